@@ -0,0 +1,152 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_ao.h"
+
+#include "vox_brick.h"
+#include "vox_collision.h"
+#include "vox_parallel.h"
+
+#include <cmath>
+#include <cstring>
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+// Voxels per thread, at least.
+constexpr size_t kMinChunk = 4096;
+
+// Occupancy lookups that treat everything outside the model as empty.
+class Occupancy {
+ public:
+  explicit Occupancy(const VoxBrickMap& bricks)
+      : bricks_(bricks),
+        size_{static_cast<int>(bricks.size().x),
+              static_cast<int>(bricks.size().y),
+              static_cast<int>(bricks.size().z)} {}
+
+  bool operator()(const int p[3]) const {
+    if (p[0] < 0 || p[1] < 0 || p[2] < 0 || p[0] >= size_[0] ||
+        p[1] >= size_[1] || p[2] >= size_[2])
+      return false;
+    return bricks_.occupied(p[0], p[1], p[2]);
+  }
+
+ private:
+  const VoxBrickMap& bricks_;
+  const int size_[3];
+};
+
+// Cosine-weighted directions over the hemisphere around +z, spread evenly
+// with a spherical Fibonacci pattern (so bakes are deterministic).
+vector<Vec3f> HemisphereDirections(int n) {
+  vector<Vec3f> directions(n);
+  const float golden_angle = 2.39996323f;
+  for (int i = 0; i < n; ++i) {
+    const float r = sqrt((i + 0.5f) / n);
+    const float phi = i * golden_angle;
+    directions[i] = {r * cos(phi), r * sin(phi), sqrt(max(0.0f, 1 - r * r))};
+  }
+  return directions;
+}
+
+}  // namespace
+
+void magicavoxel::BakeAmbientOcclusion(const VoxDenseModel& dense,
+                                       const VoxSparseModel& sparse,
+                                       std::vector<VoxelAo>& ao,
+                                       std::vector<VoxelHemisphereAo>* hemisphere,
+                                       const AoOptions& options) {
+  const vector<Voxel>& voxels = sparse.voxels();
+  ao.assign(voxels.size(), VoxelAo{});
+  const bool bake_hemisphere = hemisphere && options.hemisphere_samples > 0;
+  if (bake_hemisphere) hemisphere->assign(voxels.size(), VoxelHemisphereAo{});
+
+  const VoxCollisionModel collision(dense);
+  const Occupancy occupied(collision.bricks());
+  const vector<Vec3f> directions =
+      HemisphereDirections(bake_hemisphere ? options.hemisphere_samples : 0);
+
+  ParallelFor(voxels.size(), kMinChunk, options.threads,
+              [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Voxel& voxel = voxels[i];
+      const int p[3] = {voxel.x, voxel.y, voxel.z};
+
+      for (int face = 0; face < 6; ++face) {
+        const int axis = face / 2;
+        const int u = (axis + 1) % 3;
+        const int v = (axis + 2) % 3;
+        const int normal = (face & 1) ? 1 : -1;
+
+        // The layer the face looks into; a covered face gets nothing.
+        int q[3] = {p[0], p[1], p[2]};
+        q[axis] += normal;
+        if (occupied(q)) continue;
+
+        uint8_t corners = 0;
+        for (int c = 0; c < 4; ++c) {
+          const int du = (c & 1) ? 1 : -1;
+          const int dv = (c >> 1) ? 1 : -1;
+          int side_u[3] = {q[0], q[1], q[2]};
+          int side_v[3] = {q[0], q[1], q[2]};
+          int diagonal[3] = {q[0], q[1], q[2]};
+          side_u[u] += du;
+          side_v[v] += dv;
+          diagonal[u] += du;
+          diagonal[v] += dv;
+          const bool a = occupied(side_u), b = occupied(side_v);
+          const int occlusion = (a && b) ? 3 : a + b + occupied(diagonal);
+          corners |= static_cast<uint8_t>(occlusion << (2 * c));
+        }
+        ao[i].faces[face] = corners;
+
+        if (!bake_hemisphere) continue;
+
+        // Rays from just above the face's center, with the hemisphere's +z
+        // mapped to the face normal.
+        VoxRay ray;
+        float origin[3] = {p[0] + 0.5f, p[1] + 0.5f, p[2] + 0.5f};
+        origin[axis] += normal * 0.501f;
+        ray.origin = {origin[0], origin[1], origin[2]};
+        ray.max_distance = options.hemisphere_radius;
+        int open = 0;
+        for (const Vec3f& local : directions) {
+          float d[3];
+          d[u] = local.x;
+          d[v] = local.y;
+          d[axis] = local.z * normal;
+          ray.direction = {d[0], d[1], d[2]};
+          VoxHit hit;
+          if (!collision.Raycast(ray, hit)) ++open;
+        }
+        (*hemisphere)[i].faces[face] =
+            static_cast<uint8_t>((255 * open + static_cast<int>(directions.size()) / 2) /
+                                 static_cast<int>(directions.size()));
+      }
+    }
+  });
+}
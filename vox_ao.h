@@ -0,0 +1,76 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_AO_H
+#define VOX_AO_H
+
+#include "vox_file.h"
+#include "vox_mesh.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// Corner ambient occlusion of the six faces of one voxel, 2 bits per corner:
+// the number of the three voxels around the corner (two sides and the
+// diagonal, in the layer the face looks into) that are occupied, with both
+// sides occupied counting as 3. 0 is unoccluded, 3 fully occluded.
+//
+// Corner c of a face lies at (c & 1, c >> 1) along the face's (u, v) axes,
+// where u = (axis + 1) % 3 and v = (axis + 2) % 3, as in MeshModel.
+struct VoxelAo {
+  uint8_t faces[6];
+
+  int corner(Face face, int c) const { return (faces[face] >> (2 * c)) & 3; }
+};
+
+// Hemisphere ambient occlusion of the six faces of one voxel: how much of
+// the hemisphere above each face's center is open, 0 (none) to 255 (all).
+struct VoxelHemisphereAo {
+  uint8_t faces[6];
+};
+
+struct AoOptions {
+  // Rays per face for hemisphere AO; 0 skips it.
+  int hemisphere_samples = 0;
+  // Distance beyond which voxels no longer occlude, for hemisphere AO.
+  float hemisphere_radius = 8.0f;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Bakes ambient occlusion for every voxel of sparse, whose voxels must be
+// those of dense (e.g. the models a VoxFile loaded). ao[i] (and hemisphere[i],
+// if given and options.hemisphere_samples > 0) is for sparse.voxels()[i];
+// faces covered by another voxel are left at 0. Neighbors are tested against
+// the model's occupancy bits, and the work is split across threads.
+void BakeAmbientOcclusion(const VoxDenseModel& dense,
+                          const VoxSparseModel& sparse,
+                          std::vector<VoxelAo>& ao,
+                          std::vector<VoxelHemisphereAo>* hemisphere = nullptr,
+                          const AoOptions& options = AoOptions());
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,347 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_boxes.h"
+
+#include "vox_cache.h"
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <tuple>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+// z planes per task when packing a dense model, at least.
+constexpr size_t kMinPlanes = 8;
+
+int CountTrailingZeros64(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+uint32_t& Axis(Vec3i& v, int axis) { return (&v.x)[axis]; }
+uint32_t Axis(const Vec3i& v, int axis) { return (&v.x)[axis]; }
+
+// Occupancy bits, in rows of 64-bit words along the first axis; row (j, k)
+// covers voxels (*, j, k). Bits past the end of a row are 0.
+struct Occupancy {
+  uint32_t dims[3] = {0, 0, 0};
+  size_t words = 0;
+  vector<uint64_t> bits;
+
+  void Reset(uint32_t x, uint32_t y, uint32_t z) {
+    dims[0] = x;
+    dims[1] = y;
+    dims[2] = z;
+    words = (x + 63) / 64;
+    bits.assign(words * y * z, 0);
+  }
+  uint64_t* row(uint32_t j, uint32_t k) {
+    return bits.data() + (j + static_cast<size_t>(dims[1]) * k) * words;
+  }
+  void Set(uint32_t i, uint32_t j, uint32_t k) {
+    row(j, k)[i / 64] |= uint64_t{1} << (i % 64);
+  }
+};
+
+void PackOccupancy(const VoxDenseModel& model, unsigned threads,
+                   Occupancy& occupancy) {
+  const Size& size = model.size();
+  occupancy.Reset(size.x, size.y, size.z);
+  const uint8_t* voxels = model.data().data();
+  ParallelFor(size.z, kMinPlanes, threads, [&](size_t z0, size_t z1) {
+    for (size_t z = z0; z < z1; ++z) {
+      for (uint32_t y = 0; y < size.y; ++y) {
+        const uint8_t* src = voxels + (z * size.y + y) * size.x;
+        uint64_t* row = occupancy.row(y, static_cast<uint32_t>(z));
+        for (uint32_t x = 0; x < size.x; ++x)
+          row[x / 64] |= static_cast<uint64_t>(src[x] != 0) << (x % 64);
+      }
+    }
+  });
+}
+
+void PackOccupancy(const VoxSparseModel& model, Occupancy& occupancy) {
+  const Size& size = model.size();
+  occupancy.Reset(size.x, size.y, size.z);
+  for (const Voxel& voxel : model.voxels()) {
+    if (voxel.color && voxel.x < size.x && voxel.y < size.y && voxel.z < size.z)
+      occupancy.Set(voxel.x, voxel.y, voxel.z);
+  }
+}
+
+// Copies occupancy with its axes reordered: axis a of the result is axis
+// order[a] of the source.
+void Permute(Occupancy& source, const int order[3], Occupancy& result) {
+  result.Reset(source.dims[order[0]], source.dims[order[1]],
+               source.dims[order[2]]);
+  for (uint32_t k = 0; k < source.dims[2]; ++k) {
+    for (uint32_t j = 0; j < source.dims[1]; ++j) {
+      const uint64_t* row = source.row(j, k);
+      for (size_t w = 0; w < source.words; ++w) {
+        for (uint64_t bits = row[w]; bits; bits &= bits - 1) {
+          const uint32_t v[3] = {
+              static_cast<uint32_t>(w * 64 + CountTrailingZeros64(bits)), j, k};
+          result.Set(v[order[0]], v[order[1]], v[order[2]]);
+        }
+      }
+    }
+  }
+}
+
+// Mask of the bits of word w that fall in [begin, end).
+uint64_t RunMask(size_t w, uint32_t begin, uint32_t end) {
+  const size_t low = max<size_t>(begin, w * 64), high = min<size_t>(end, w * 64 + 64);
+  if (low >= high) return 0;
+  const uint64_t from = ~uint64_t{0} << (low - w * 64);
+  return high - w * 64 == 64 ? from : from & ((uint64_t{1} << (high - w * 64)) - 1);
+}
+
+bool HasRun(const uint64_t* row, uint32_t begin, uint32_t end) {
+  for (size_t w = begin / 64; w * 64 < end; ++w) {
+    const uint64_t mask = RunMask(w, begin, end);
+    if ((row[w] & mask) != mask) return false;
+  }
+  return true;
+}
+
+void ClearRun(uint64_t* row, uint32_t begin, uint32_t end) {
+  for (size_t w = begin / 64; w * 64 < end; ++w) row[w] &= ~RunMask(w, begin, end);
+}
+
+// Greedy merge, consuming occupancy; boxes are emitted in the source axes,
+// given the order occupancy was permuted with.
+void Greedy(Occupancy& occupancy, const int order[3], vector<VoxelBox>& boxes) {
+  const uint32_t* dims = occupancy.dims;
+  for (uint32_t k = 0; k < dims[2]; ++k) {
+    for (uint32_t j = 0; j < dims[1]; ++j) {
+      uint64_t* row = occupancy.row(j, k);
+      for (size_t w = 0; w < occupancy.words;) {
+        if (!row[w]) {
+          ++w;
+          continue;
+        }
+        // Run along the first axis, from the first set bit to the first clear
+        // one after it.
+        const uint32_t begin =
+            static_cast<uint32_t>(w * 64 + CountTrailingZeros64(row[w]));
+        size_t end_word = w;
+        uint64_t clear = ~row[w] & (~uint64_t{0} << (begin % 64));
+        while (!clear && end_word + 1 < occupancy.words) clear = ~row[++end_word];
+        const uint32_t end = clear ? min<uint32_t>(dims[0], static_cast<uint32_t>(
+                                         end_word * 64 + CountTrailingZeros64(clear)))
+                                   : dims[0];
+
+        // Grow along the second axis while rows hold the whole run, then
+        // along the third while whole slices of rows do.
+        uint32_t j_end = j + 1;
+        while (j_end < dims[1] && HasRun(occupancy.row(j_end, k), begin, end))
+          ++j_end;
+        uint32_t k_end = k + 1;
+        for (; k_end < dims[2]; ++k_end) {
+          uint32_t y = j;
+          while (y < j_end && HasRun(occupancy.row(y, k_end), begin, end)) ++y;
+          if (y < j_end) break;
+        }
+        for (uint32_t z = k; z < k_end; ++z) {
+          for (uint32_t y = j; y < j_end; ++y) ClearRun(occupancy.row(y, z), begin, end);
+        }
+
+        const uint32_t lo[3] = {begin, j, k}, hi[3] = {end, j_end, k_end};
+        VoxelBox box;
+        for (int a = 0; a < 3; ++a) {
+          Axis(box.min, order[a]) = lo[a];
+          Axis(box.max, order[a]) = hi[a];
+        }
+        boxes.push_back(box);
+      }
+    }
+  }
+}
+
+// Merges boxes that share a whole face, along each axis in turn, until none
+// do.
+void MergeFaces(vector<VoxelBox>& boxes) {
+  for (bool merged = true; merged;) {
+    merged = false;
+    for (int axis = 0; axis < 3; ++axis) {
+      const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+      auto key = [=](const VoxelBox& box) {
+        return make_tuple(Axis(box.min, u), Axis(box.max, u), Axis(box.min, v),
+                          Axis(box.max, v), Axis(box.min, axis));
+      };
+      sort(boxes.begin(), boxes.end(),
+           [&](const VoxelBox& a, const VoxelBox& b) { return key(a) < key(b); });
+      size_t kept = 0;
+      for (const VoxelBox& box : boxes) {
+        if (kept) {
+          VoxelBox& last = boxes[kept - 1];
+          if (Axis(last.max, axis) == Axis(box.min, axis) &&
+              Axis(last.min, u) == Axis(box.min, u) &&
+              Axis(last.max, u) == Axis(box.max, u) &&
+              Axis(last.min, v) == Axis(box.min, v) &&
+              Axis(last.max, v) == Axis(box.max, v)) {
+            Axis(last.max, axis) = Axis(box.max, axis);
+            merged = true;
+            continue;
+          }
+        }
+        boxes[kept++] = box;
+      }
+      boxes.resize(kept);
+    }
+  }
+}
+
+void Decompose(Occupancy& occupancy, const BoxOptions& options,
+               vector<VoxelBox>& boxes) {
+  boxes.clear();
+  static const int kOrders[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2},
+                                    {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+  if (!options.reduce) {
+    Greedy(occupancy, kOrders[0], boxes);
+    return;
+  }
+
+  // Every axis order, each on its own copy; the first order works on the
+  // source, once the others have been permuted from it.
+  vector<VoxelBox> results[6];
+  Occupancy permuted[6];
+  ParallelFor(5, 1, options.threads, [&](size_t o0, size_t o1) {
+    for (size_t o = o0 + 1; o < o1 + 1; ++o) {
+      Permute(occupancy, kOrders[o], permuted[o]);
+      Greedy(permuted[o], kOrders[o], results[o]);
+      MergeFaces(results[o]);
+    }
+  });
+  Greedy(occupancy, kOrders[0], results[0]);
+  MergeFaces(results[0]);
+  size_t best = 0;
+  for (size_t o = 1; o < 6; ++o) {
+    if (results[o].size() < results[best].size()) best = o;
+  }
+  boxes.swap(results[best]);
+}
+
+uint64_t HashOccupancy(const Occupancy& occupancy) {
+  const uint64_t seed = HashBytes(occupancy.dims, sizeof(occupancy.dims));
+  return HashBytes(occupancy.bits.data(),
+                   occupancy.bits.size() * sizeof(uint64_t), seed);
+}
+
+}  // namespace
+
+void magicavoxel::DecomposeBoxes(const VoxDenseModel& model,
+                                 vector<VoxelBox>& boxes,
+                                 const BoxOptions& options) {
+  Occupancy occupancy;
+  PackOccupancy(model, options.threads, occupancy);
+  Decompose(occupancy, options, boxes);
+}
+
+void magicavoxel::DecomposeBoxes(const VoxSparseModel& model,
+                                 vector<VoxelBox>& boxes,
+                                 const BoxOptions& options) {
+  Occupancy occupancy;
+  PackOccupancy(model, occupancy);
+  Decompose(occupancy, options, boxes);
+}
+
+namespace {
+
+// Looks a shape up in a hash-keyed multimap of VoxBoxCache entries; the
+// hash only narrows the search, the dims and bits must match too.
+template <typename Cache>
+typename Cache::const_iterator FindEntry(const Cache& cache, uint64_t hash,
+                                         const uint32_t (&dims)[3],
+                                         const vector<uint64_t>& bits) {
+  const auto range = cache.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (equal(begin(dims), end(dims), it->second.dims) &&
+        it->second.bits == bits)
+      return it;
+  }
+  return cache.end();
+}
+
+template <typename Cache>
+shared_ptr<const vector<VoxelBox>> CachedBoxes(Occupancy& occupancy,
+                                               const BoxOptions& options,
+                                               mutex& lock, Cache& cache) {
+  const uint64_t hash = HashOccupancy(occupancy);
+  {
+    lock_guard<mutex> guard(lock);
+    auto found = FindEntry(cache, hash, occupancy.dims, occupancy.bits);
+    if (found != cache.end()) return found->second.boxes;
+  }
+  // Decomposed outside the lock (Decompose clears the bits, so the entry
+  // gets a copy); if another thread got there first, its result wins.
+  typename Cache::mapped_type entry;
+  copy(begin(occupancy.dims), end(occupancy.dims), entry.dims);
+  entry.bits = occupancy.bits;
+  auto boxes = make_shared<vector<VoxelBox>>();
+  Decompose(occupancy, options, *boxes);
+  entry.boxes = move(boxes);
+
+  lock_guard<mutex> guard(lock);
+  auto found = FindEntry(cache, hash, entry.dims, entry.bits);
+  if (found != cache.end()) return found->second.boxes;
+  return cache.emplace(hash, move(entry))->second.boxes;
+}
+
+}  // namespace
+
+shared_ptr<const vector<VoxelBox>> VoxBoxCache::Get(const VoxDenseModel& model) {
+  Occupancy occupancy;
+  PackOccupancy(model, options_.threads, occupancy);
+  return CachedBoxes(occupancy, options_, mutex_, boxes_);
+}
+
+shared_ptr<const vector<VoxelBox>> VoxBoxCache::Get(const VoxSparseModel& model) {
+  Occupancy occupancy;
+  PackOccupancy(model, occupancy);
+  return CachedBoxes(occupancy, options_, mutex_, boxes_);
+}
+
+size_t VoxBoxCache::size() const {
+  lock_guard<mutex> guard(mutex_);
+  return boxes_.size();
+}
+
+void VoxBoxCache::clear() {
+  lock_guard<mutex> guard(mutex_);
+  boxes_.clear();
+}
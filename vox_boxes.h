@@ -0,0 +1,96 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_BOXES_H
+#define VOX_BOXES_H
+
+#include "vox_file.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace magicavoxel {
+
+// Box of whole voxels: [min, max) on each axis.
+struct VoxelBox {
+  Vec3i min;
+  Vec3i max;
+};
+
+struct BoxOptions {
+  // After the greedy merge, also try the other five axis orders and merge
+  // boxes that share a whole face, keeping the smallest result. About six
+  // times the work; worth most on shapes whose long runs are not along x.
+  bool reduce = false;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Covers the occupied voxels of a model exactly with non-overlapping boxes,
+// for physics colliders, replacing the contents of boxes.
+//
+// Occupancy is packed into 64-bit words along one axis; the greedy pass takes
+// the first voxel not yet covered, grows a run along the word axis with bit
+// scans, then grows it along the other two axes as far as whole rows are
+// covered by the run's mask, and clears what it took.
+void DecomposeBoxes(const VoxDenseModel& model, std::vector<VoxelBox>& boxes,
+                    const BoxOptions& options = BoxOptions());
+void DecomposeBoxes(const VoxSparseModel& model, std::vector<VoxelBox>& boxes,
+                    const BoxOptions& options = BoxOptions());
+
+// Decompositions keyed by a hash of the model's occupancy (colors do not
+// matter), so each distinct shape is decomposed once however many models or
+// instances share it. Each entry keeps the packed occupancy too, compared on
+// a hash match, so a collision never returns another shape's boxes. Safe to
+// use from many threads.
+class VoxBoxCache {
+ public:
+  explicit VoxBoxCache(const BoxOptions& options = BoxOptions())
+      : options_(options) {}
+
+  // Boxes of model, decomposed on first use. The result stays valid after
+  // clear().
+  std::shared_ptr<const std::vector<VoxelBox>> Get(const VoxDenseModel& model);
+  std::shared_ptr<const std::vector<VoxelBox>> Get(const VoxSparseModel& model);
+
+  size_t size() const;
+  void clear();
+
+ private:
+  struct Entry {
+    uint32_t dims[3];
+    std::vector<uint64_t> bits;  // Packed occupancy, one bit per voxel
+    std::shared_ptr<const std::vector<VoxelBox>> boxes;
+  };
+
+  const BoxOptions options_;
+  mutable std::mutex mutex_;
+  std::unordered_multimap<uint64_t, Entry> boxes_;
+};
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,74 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_brick.h"
+
+using namespace magicavoxel;
+using namespace std;
+
+VoxBrickMap::VoxBrickMap(const VoxDenseModel& model)
+    : size_(model.size()),
+      brick_count_{(size_.x + kBrickSize - 1) / kBrickSize,
+                   (size_.y + kBrickSize - 1) / kBrickSize,
+                   (size_.z + kBrickSize - 1) / kBrickSize} {
+  bricks_.assign(
+      static_cast<size_t>(brick_count_.x) * brick_count_.y * brick_count_.z,
+      BrickOccupancy{});
+
+  // Walk the voxels in memory order; each row of 8 voxels becomes one byte of
+  // a brick layer.
+  const uint8_t* voxel = model.data().data();
+  for (uint32_t z = 0; z < size_.z; ++z) {
+    for (uint32_t y = 0; y < size_.y; ++y) {
+      for (uint32_t x = 0; x < size_.x; ++x, ++voxel) {
+        if (!*voxel) continue;
+        BrickOccupancy& b = bricks_[BrickIndex(x / kBrickSize, y / kBrickSize,
+                                               z / kBrickSize)];
+        b.layers[z % kBrickSize] |=
+            uint64_t{1} << ((x % kBrickSize) + kBrickSize * (y % kBrickSize));
+      }
+    }
+  }
+}
+
+VoxBrickMap::VoxBrickMap(const Size& size)
+    : size_(size),
+      brick_count_{(size_.x + kBrickSize - 1) / kBrickSize,
+                   (size_.y + kBrickSize - 1) / kBrickSize,
+                   (size_.z + kBrickSize - 1) / kBrickSize} {
+  bricks_.assign(
+      static_cast<size_t>(brick_count_.x) * brick_count_.y * brick_count_.z,
+      BrickOccupancy{});
+}
+
+void VoxBrickMap::Set(uint32_t x, uint32_t y, uint32_t z, bool occupied) {
+  BrickOccupancy& b =
+      bricks_[BrickIndex(x / kBrickSize, y / kBrickSize, z / kBrickSize)];
+  const uint64_t bit = uint64_t{1}
+                       << ((x % kBrickSize) + kBrickSize * (y % kBrickSize));
+  if (occupied)
+    b.layers[z % kBrickSize] |= bit;
+  else
+    b.layers[z % kBrickSize] &= ~bit;
+}
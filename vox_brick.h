@@ -0,0 +1,97 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_BRICK_H
+#define VOX_BRICK_H
+
+#include "vox_file.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// Edge length of a brick, in voxels.
+constexpr uint32_t kBrickSize = 8;
+
+// Occupancy of one 8x8x8 brick, one bit per voxel: layers[z] holds bit
+// (x + 8 * y) for the voxel at brick-local (x, y, z).
+struct BrickOccupancy {
+  uint64_t layers[kBrickSize];
+
+  bool empty() const noexcept {
+    uint64_t any = 0;
+    for (uint64_t layer : layers) any |= layer;
+    return any == 0;
+  }
+};
+
+// Coarse view of a dense model as a grid of 8x8x8 bricks, each holding which
+// of its voxels are occupied. Lets queries skip empty space a brick at a time,
+// and test occupancy without touching the color data. Bricks on the far sides
+// of a model whose size is not a multiple of 8 are padded with empty voxels.
+class VoxBrickMap {
+ public:
+  VoxBrickMap() : size_{0, 0, 0}, brick_count_{0, 0, 0} {}
+  explicit VoxBrickMap(const VoxDenseModel& model);
+  // All-empty bricks covering a model of the given size.
+  explicit VoxBrickMap(const Size& size);
+
+  // Size of the model, in voxels.
+  const Size& size() const noexcept { return size_; }
+  // Number of bricks along each axis.
+  const Size& brickCount() const noexcept { return brick_count_; }
+
+  const BrickOccupancy& brick(uint32_t bx, uint32_t by, uint32_t bz) const {
+    return bricks_[BrickIndex(bx, by, bz)];
+  }
+  bool brickEmpty(uint32_t bx, uint32_t by, uint32_t bz) const {
+    return brick(bx, by, bz).empty();
+  }
+  bool occupied(uint32_t x, uint32_t y, uint32_t z) const {
+    const BrickOccupancy& b = brick(x / kBrickSize, y / kBrickSize,
+                                    z / kBrickSize);
+    return (b.layers[z % kBrickSize] >>
+            ((x % kBrickSize) + kBrickSize * (y % kBrickSize))) & 1;
+  }
+
+  // Updates the occupancy of one voxel, e.g. after the model was edited.
+  void Set(uint32_t x, uint32_t y, uint32_t z, bool occupied);
+
+  // All bricks, x-major then y then z, like the voxels of VoxDenseModel.
+  const std::vector<BrickOccupancy>& data() const noexcept { return bricks_; }
+  std::vector<BrickOccupancy>& data() noexcept { return bricks_; }
+
+ private:
+  size_t BrickIndex(uint32_t bx, uint32_t by, uint32_t bz) const {
+    return bx + brick_count_.x * (by + static_cast<size_t>(brick_count_.y) * bz);
+  }
+
+  Size size_;
+  Size brick_count_;
+  std::vector<BrickOccupancy> bricks_;
+};
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,538 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_cache.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+constexpr char kCacheMagic[8] = {'V', 'O', 'X', 'C', 'A', 'C', 'H', 'E'};
+constexpr uint32_t kCacheVersion = 1;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+// Every section starts on a cache line, so it can be used in place (and with
+// aligned SIMD loads) straight from the mapping.
+constexpr uint64_t kSectionAlignment = 64;
+
+// File layout: CacheHeader, then (aligned) the palette, the material table,
+// the CacheRecord of every model and LOD, and the sections they refer to.
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t source_hash;
+  uint64_t file_size;
+  uint32_t model_count;
+  uint32_t lod_levels;
+  uint64_t palette_offset;
+  uint64_t materials_offset;
+  uint64_t records_offset;
+};
+
+// Elements of one array in the file.
+struct CacheSection {
+  uint64_t offset;
+  uint64_t count;
+};
+
+// One model at one LOD. Records are stored model-major: model m at LOD l is
+// record m * (lod_levels + 1) + l.
+struct CacheRecord {
+  uint32_t model;
+  uint32_t lod;
+  Size size;
+  Size brick_count;
+  CacheSection voxels;
+  CacheSection sparse_voxels;
+  CacheSection bricks;
+  CacheSection vertices;
+  CacheSection indices;
+};
+
+// The structs above are written as-is; a layout change needs a new version.
+static_assert(sizeof(CacheHeader) == 64, "CacheHeader layout changed");
+static_assert(sizeof(CacheRecord) == 112, "CacheRecord layout changed");
+static_assert(sizeof(Voxel) == 4 && sizeof(MeshVertex) == 16 &&
+                  sizeof(BrickOccupancy) == 64 && sizeof(Palette) == 1024,
+              "Cached type layout changed");
+
+uint64_t AlignUp(uint64_t offset) {
+  return (offset + kSectionAlignment - 1) & ~(kSectionAlignment - 1);
+}
+
+// Contents of one record, gathered before writing.
+struct PendingRecord {
+  CacheRecord record;
+  const VoxDenseModel* dense;
+  const VoxSparseModel* sparse;
+  VoxBrickMap bricks;
+  VoxMesh mesh;
+};
+
+// A temporary file name next to path that no other writer uses, even another
+// process rebuilding the same cache: the process id and a per-process count.
+string TempPath(const string& path) {
+  static atomic<uint64_t> counter{0};
+#ifdef _WIN32
+  const unsigned long pid = GetCurrentProcessId();
+#else
+  const unsigned long pid = static_cast<unsigned long>(getpid());
+#endif
+  return path + "." + to_string(pid) + "." +
+         to_string(counter.fetch_add(1, memory_order_relaxed)) + ".tmp";
+}
+
+// Checks that a section lies within a file of the given size.
+bool SectionFits(const CacheSection& section, size_t element_size,
+                 size_t file_size) {
+  return section.offset <= file_size &&
+         section.count <= (file_size - section.offset) / element_size;
+}
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ull;
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t HashRound(uint64_t acc, uint64_t word) {
+  return RotateLeft(acc + word * kPrime2, 31) * kPrime1;
+}
+
+uint64_t LoadWord(const unsigned char* bytes) {
+  uint64_t word;
+  memcpy(&word, bytes, sizeof(word));
+  return word;
+}
+
+}  // namespace
+
+uint64_t magicavoxel::HashBytes(const void* data, size_t size, uint64_t seed) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  const unsigned char* end = bytes + size;
+
+  // Four independent lanes over 32-byte blocks, then the remaining words and
+  // bytes, then a final avalanche.
+  uint64_t h = seed + kPrime3 + size;
+  if (size >= 32) {
+    uint64_t lanes[4] = {seed + kPrime1 + kPrime2, seed + kPrime2, seed,
+                         seed - kPrime1};
+    for (; end - bytes >= 32; bytes += 32) {
+      for (int i = 0; i < 4; ++i)
+        lanes[i] = HashRound(lanes[i], LoadWord(bytes + 8 * i));
+    }
+    h = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) +
+        RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18) + size;
+    for (uint64_t lane : lanes) h = (h ^ HashRound(0, lane)) * kPrime1 + kPrime3;
+  }
+  for (; end - bytes >= 8; bytes += 8)
+    h = RotateLeft(h ^ HashRound(0, LoadWord(bytes)), 27) * kPrime1 + kPrime3;
+  for (; bytes < end; ++bytes)
+    h = RotateLeft(h ^ (*bytes * kPrime3), 11) * kPrime1;
+
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+VoxDenseModel magicavoxel::DownsampleModel(const VoxDenseModel& model) {
+  const Size& size = model.size();
+  const Size half{(size.x + 1) / 2, (size.y + 1) / 2, (size.z + 1) / 2};
+  VoxDenseModel result(half, model.palette());
+
+  const uint8_t* src = model.data().data();
+  uint8_t* dst = result.data().data();
+  for (uint32_t z = 0; z < half.z; ++z) {
+    for (uint32_t y = 0; y < half.y; ++y) {
+      for (uint32_t x = 0; x < half.x; ++x) {
+        // Gather the (up to) 8 voxels of the block.
+        uint8_t colors[8];
+        int n_cells = 0;
+        int n_filled = 0;
+        for (uint32_t dz = 0; dz < 2; ++dz) {
+          for (uint32_t dy = 0; dy < 2; ++dy) {
+            for (uint32_t dx = 0; dx < 2; ++dx) {
+              const uint32_t sx = 2 * x + dx, sy = 2 * y + dy, sz = 2 * z + dz;
+              if (sx >= size.x || sy >= size.y || sz >= size.z) continue;
+              ++n_cells;
+              const uint8_t color =
+                  src[sx + size.x * (sy + static_cast<size_t>(size.y) * sz)];
+              if (color) colors[n_filled++] = color;
+            }
+          }
+        }
+        if (n_filled == 0 || 2 * n_filled < n_cells) continue;
+
+        // Most common color; ties go to the first one seen.
+        uint8_t best = colors[0];
+        int best_count = 0;
+        for (int i = 0; i < n_filled; ++i) {
+          int count = 0;
+          for (int j = 0; j < n_filled; ++j) count += colors[j] == colors[i];
+          if (count > best_count) {
+            best = colors[i];
+            best_count = count;
+          }
+        }
+        dst[x + half.x * (y + static_cast<size_t>(half.y) * z)] = best;
+      }
+    }
+  }
+  return result;
+}
+
+void magicavoxel::WriteVoxCache(const std::string& path, const VoxFile& vox,
+                                uint64_t source_hash, uint32_t lod_levels) {
+  const vector<VoxDenseModel>& dense_models = vox.denseModels();
+  const vector<VoxSparseModel>& sparse_models = vox.sparseModels();
+  if (dense_models.empty() && !sparse_models.empty())
+    throw VoxException("Caching requires a VoxFile loaded with dense models");
+  if (lod_levels > kMaxCacheLodLevels)
+    throw VoxException("Too many cache LOD levels");
+
+  // Run the post-processing for every model and LOD. lods holds the
+  // downsampled models; each inner vector is reserved up front so the
+  // pointers kept in pending stay valid.
+  vector<vector<VoxDenseModel>> lods(dense_models.size());
+  vector<PendingRecord> pending;
+  pending.reserve(dense_models.size() * (lod_levels + 1));
+  for (size_t m = 0; m < dense_models.size(); ++m) {
+    lods[m].reserve(lod_levels);
+    for (uint32_t lod = 0; lod <= lod_levels; ++lod) {
+      if (lod > 0) {
+        lods[m].push_back(DownsampleModel(
+            lod == 1 ? dense_models[m] : lods[m][lod - 2]));
+      }
+      const VoxDenseModel& dense = lod == 0 ? dense_models[m] : lods[m].back();
+
+      pending.emplace_back();
+      PendingRecord& p = pending.back();
+      p.dense = &dense;
+      p.sparse = lod == 0 && m < sparse_models.size() ? &sparse_models[m]
+                                                      : nullptr;
+      p.bricks = VoxBrickMap(dense);
+      MeshModel(dense, p.mesh);
+      memset(&p.record, 0, sizeof(p.record));
+      p.record.model = static_cast<uint32_t>(m);
+      p.record.lod = lod;
+      p.record.size = dense.size();
+      p.record.brick_count = p.bricks.brickCount();
+    }
+  }
+
+  // Lay out the file.
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.byte_order = kByteOrderMark;
+  header.source_hash = source_hash;
+  header.model_count = static_cast<uint32_t>(dense_models.size());
+  header.lod_levels = lod_levels;
+  header.palette_offset = AlignUp(sizeof(CacheHeader));
+  header.materials_offset = AlignUp(header.palette_offset + sizeof(Palette));
+  header.records_offset =
+      AlignUp(header.materials_offset + sizeof(MaterialTable));
+
+  uint64_t offset = header.records_offset + pending.size() * sizeof(CacheRecord);
+  auto place = [&offset](CacheSection& section, uint64_t count,
+                         size_t element_size) {
+    offset = AlignUp(offset);
+    section.offset = offset;
+    section.count = count;
+    offset += count * element_size;
+  };
+  for (PendingRecord& p : pending) {
+    CacheRecord& r = p.record;
+    place(r.voxels, p.dense->data().size(), 1);
+    place(r.sparse_voxels, p.sparse ? p.sparse->voxels().size() : 0,
+          sizeof(Voxel));
+    place(r.bricks, p.bricks.data().size(), sizeof(BrickOccupancy));
+    place(r.vertices, p.mesh.vertices.size(), sizeof(MeshVertex));
+    place(r.indices, p.mesh.indices.size(), sizeof(uint32_t));
+  }
+  header.file_size = offset;
+
+  // Write to a temporary file and rename it over the old cache, so another
+  // process never maps a half-written file (nor, on POSIX, finds no file).
+  const string temp_path = TempPath(path);
+  {
+    ofstream file(temp_path, ios::out | ios::binary | ios::trunc);
+    if (!file) throw VoxException("Could not create '" + temp_path + "'");
+
+    uint64_t written = 0;
+    auto write_at = [&](uint64_t at, const void* data, size_t size) {
+      static const char kZeros[kSectionAlignment] = {};
+      file.write(kZeros, static_cast<streamsize>(at - written));
+      file.write(static_cast<const char*>(data), static_cast<streamsize>(size));
+      written = at + size;
+    };
+
+    write_at(0, &header, sizeof(header));
+    write_at(header.palette_offset, vox.palette().data(), sizeof(Palette));
+    write_at(header.materials_offset, vox.materials().data(),
+             sizeof(MaterialTable));
+    for (const PendingRecord& p : pending)
+      write_at(written, &p.record, sizeof(CacheRecord));
+    for (const PendingRecord& p : pending) {
+      const CacheRecord& r = p.record;
+      write_at(r.voxels.offset, p.dense->data().data(), r.voxels.count);
+      if (p.sparse)
+        write_at(r.sparse_voxels.offset, p.sparse->voxels().data(),
+                 r.sparse_voxels.count * sizeof(Voxel));
+      write_at(r.bricks.offset, p.bricks.data().data(),
+               r.bricks.count * sizeof(BrickOccupancy));
+      write_at(r.vertices.offset, p.mesh.vertices.data(),
+               r.vertices.count * sizeof(MeshVertex));
+      write_at(r.indices.offset, p.mesh.indices.data(),
+               r.indices.count * sizeof(uint32_t));
+    }
+    write_at(header.file_size, nullptr, 0);
+    file.close();
+    if (!file) {
+      remove(temp_path.c_str());
+      throw VoxException("Could not write '" + temp_path + "'");
+    }
+  }
+
+#ifdef _WIN32
+  // rename does not replace an existing file here.
+  remove(path.c_str());
+#endif
+  if (rename(temp_path.c_str(), path.c_str()) != 0) {
+    remove(temp_path.c_str());
+    throw VoxException("Could not replace '" + path + "'");
+  }
+}
+
+VoxCache::VoxCache(VoxCache&& other) noexcept { *this = std::move(other); }
+
+VoxCache& VoxCache::operator=(VoxCache&& other) noexcept {
+  if (this != &other) {
+    Close();
+    data_ = other.data_;
+    size_ = other.size_;
+    other.data_ = nullptr;
+    other.size_ = 0;
+#ifdef _WIN32
+    file_handle_ = other.file_handle_;
+    mapping_handle_ = other.mapping_handle_;
+    other.file_handle_ = nullptr;
+    other.mapping_handle_ = nullptr;
+#endif
+  }
+  return *this;
+}
+
+bool VoxCache::Open(const std::string& path, uint64_t source_hash) {
+  Close();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  void* view =
+      mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (!view) {
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  file_handle_ = file;
+  mapping_handle_ = mapping;
+  data_ = static_cast<const char*>(view);
+  size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                    MAP_SHARED, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED) return false;
+  data_ = static_cast<const char*>(view);
+  size_ = static_cast<size_t>(st.st_size);
+#endif
+
+  // Check the header, and that every section is inside the file, so a damaged
+  // or truncated cache is rebuilt rather than read out of bounds.
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(data_);
+  bool valid = size_ >= sizeof(CacheHeader) &&
+               memcmp(header->magic, kCacheMagic, sizeof(kCacheMagic)) == 0 &&
+               header->version == kCacheVersion &&
+               header->byte_order == kByteOrderMark &&
+               header->source_hash == source_hash &&
+               header->file_size == size_ &&
+               header->lod_levels <= kMaxCacheLodLevels &&
+               SectionFits({header->palette_offset, 1}, sizeof(Palette), size_) &&
+               SectionFits({header->materials_offset, 1}, sizeof(MaterialTable),
+                           size_);
+  if (valid) {
+    const uint64_t n_records = static_cast<uint64_t>(header->model_count) *
+                               (uint64_t{header->lod_levels} + 1);
+    valid = SectionFits({header->records_offset, n_records},
+                        sizeof(CacheRecord), size_);
+    const CacheRecord* records =
+        reinterpret_cast<const CacheRecord*>(data_ + header->records_offset);
+    for (uint64_t i = 0; valid && i < n_records; ++i) {
+      const CacheRecord& r = records[i];
+      valid = r.voxels.count ==
+                  static_cast<uint64_t>(r.size.x) * r.size.y * r.size.z &&
+              r.bricks.count == static_cast<uint64_t>(r.brick_count.x) *
+                                    r.brick_count.y * r.brick_count.z &&
+              SectionFits(r.voxels, 1, size_) &&
+              SectionFits(r.sparse_voxels, sizeof(Voxel), size_) &&
+              SectionFits(r.bricks, sizeof(BrickOccupancy), size_) &&
+              SectionFits(r.vertices, sizeof(MeshVertex), size_) &&
+              SectionFits(r.indices, sizeof(uint32_t), size_);
+    }
+  }
+  if (!valid) Close();
+  return valid;
+}
+
+void VoxCache::Close() noexcept {
+  if (!data_) return;
+#ifdef _WIN32
+  UnmapViewOfFile(data_);
+  CloseHandle(static_cast<HANDLE>(mapping_handle_));
+  CloseHandle(static_cast<HANDLE>(file_handle_));
+  file_handle_ = nullptr;
+  mapping_handle_ = nullptr;
+#else
+  munmap(const_cast<char*>(data_), size_);
+#endif
+  data_ = nullptr;
+  size_ = 0;
+}
+
+size_t VoxCache::modelCount() const noexcept {
+  return data_ ? reinterpret_cast<const CacheHeader*>(data_)->model_count : 0;
+}
+
+uint32_t VoxCache::lodLevels() const noexcept {
+  return data_ ? reinterpret_cast<const CacheHeader*>(data_)->lod_levels : 0;
+}
+
+VoxCacheModel VoxCache::model(size_t index, uint32_t lod) const {
+  if (index >= modelCount() || lod > lodLevels())
+    throw std::out_of_range("VoxCache::model");
+
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(data_);
+  const CacheRecord& r = reinterpret_cast<const CacheRecord*>(
+      data_ + header->records_offset)[index * (uint64_t{header->lod_levels} + 1) +
+                                      lod];
+
+  VoxCacheModel model;
+  model.model = r.model;
+  model.lod = r.lod;
+  model.size = r.size;
+  model.voxels = reinterpret_cast<const uint8_t*>(data_ + r.voxels.offset);
+  model.sparse_voxels =
+      reinterpret_cast<const Voxel*>(data_ + r.sparse_voxels.offset);
+  model.sparse_count = static_cast<size_t>(r.sparse_voxels.count);
+  model.brick_count = r.brick_count;
+  model.bricks =
+      reinterpret_cast<const BrickOccupancy*>(data_ + r.bricks.offset);
+  model.vertices =
+      reinterpret_cast<const MeshVertex*>(data_ + r.vertices.offset);
+  model.vertex_count = static_cast<size_t>(r.vertices.count);
+  model.indices = reinterpret_cast<const uint32_t*>(data_ + r.indices.offset);
+  model.index_count = static_cast<size_t>(r.indices.count);
+  return model;
+}
+
+const Palette& VoxCache::palette() const {
+  if (!data_) throw std::logic_error("VoxCache is not open");
+  return *reinterpret_cast<const Palette*>(
+      data_ + reinterpret_cast<const CacheHeader*>(data_)->palette_offset);
+}
+
+const MaterialTable& VoxCache::materials() const {
+  if (!data_) throw std::logic_error("VoxCache is not open");
+  return *reinterpret_cast<const MaterialTable*>(
+      data_ + reinterpret_cast<const CacheHeader*>(data_)->materials_offset);
+}
+
+void magicavoxel::LoadVoxCached(const std::string& vox_path,
+                                const std::string& cache_path, VoxCache& cache,
+                                uint32_t lod_levels,
+                                bool remove_hidden_voxels) {
+  ifstream file(vox_path, ios::in | ios::binary | ios::ate);
+  if (!file) throw VoxException("Could not open '" + vox_path + "'");
+  const streamoff file_size = file.tellg();
+  vector<char> data(static_cast<size_t>(file_size > 0 ? file_size : 0));
+  file.seekg(0);
+  if (!file.read(data.data(), static_cast<streamsize>(data.size())))
+    throw VoxException("Could not read '" + vox_path + "'");
+
+  // The options change the cached data, so they are part of the key.
+  const uint64_t options = lod_levels | (remove_hidden_voxels ? 1ull << 32 : 0);
+  const uint64_t source_hash = HashBytes(data.data(), data.size(), options);
+  if (cache.Open(cache_path, source_hash)) return;
+
+  VoxFile vox(true, true, remove_hidden_voxels);
+  vox.Load(data.data(), data.size());
+  WriteVoxCache(cache_path, vox, source_hash, lod_levels);
+  if (!cache.Open(cache_path, source_hash))
+    throw VoxException("Could not map '" + cache_path + "'");
+}
@@ -0,0 +1,126 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_CACHE_H
+#define VOX_CACHE_H
+
+#include "vox_brick.h"
+#include "vox_file.h"
+#include "vox_mesh.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace magicavoxel {
+
+// Fast non-cryptographic 64-bit hash of a block of memory, for detecting
+// changed contents (e.g. of a .vox file).
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+// Returns a model of half the size (rounded up) on each axis, where each
+// voxel stands for a 2x2x2 block of the original: it is filled if at least
+// half of the block is, with the most common color of the block.
+VoxDenseModel DownsampleModel(const VoxDenseModel& model);
+
+// Read-only view of one preprocessed model in a VoxCache. All pointers point
+// into the mapped cache file and stay valid until the cache is closed.
+struct VoxCacheModel {
+  uint32_t model;  // Index of the model in the .vox file
+  uint32_t lod;    // 0 for the full model, n for one downsampled n times
+  Size size;
+
+  const uint8_t* voxels;  // Dense voxels, x-major then y then z
+  const Voxel* sparse_voxels;
+  size_t sparse_count;    // 0 if the file was loaded without sparse models
+
+  Size brick_count;
+  const BrickOccupancy* bricks;
+
+  const MeshVertex* vertices;
+  size_t vertex_count;
+  const uint32_t* indices;
+  size_t index_count;
+};
+
+// Most LOD levels a cache can hold; each halves the model size, so a 32-bit
+// size is down to one voxel long before this.
+constexpr uint32_t kMaxCacheLodLevels = 32;
+
+// Writes the models of a loaded VoxFile, post-processed, to a cache file: for
+// each model its dense and sparse voxels, brick occupancy and mesh, and the
+// same (except sparse voxels) for lod_levels successively downsampled
+// versions. The file must have been loaded with dense models, and lod_levels
+// be at most kMaxCacheLodLevels; otherwise throws VoxException.
+//
+// source_hash identifies the input the cache is built from (normally the
+// HashBytes of the .vox file, mixed with any options), and is checked by
+// VoxCache::Open.
+void WriteVoxCache(const std::string& path, const VoxFile& vox,
+                   uint64_t source_hash, uint32_t lod_levels);
+
+// A cache file written by WriteVoxCache, memory-mapped. Opening one does no
+// parsing or copying: sections are aligned so that models are read in place.
+class VoxCache final {
+ public:
+  VoxCache() = default;
+  ~VoxCache() { Close(); }
+  VoxCache(const VoxCache&) = delete;
+  VoxCache& operator=(const VoxCache&) = delete;
+  VoxCache(VoxCache&& other) noexcept;
+  VoxCache& operator=(VoxCache&& other) noexcept;
+
+  // Maps the cache file at path. Returns false, leaving the cache closed, if
+  // the file does not exist, was written by another format version or on a
+  // platform with different byte order, is damaged, or was built from input
+  // other than source_hash.
+  bool Open(const std::string& path, uint64_t source_hash);
+  void Close() noexcept;
+  bool isOpen() const noexcept { return data_ != nullptr; }
+
+  size_t modelCount() const noexcept;
+  uint32_t lodLevels() const noexcept;
+  VoxCacheModel model(size_t index, uint32_t lod = 0) const;
+  const Palette& palette() const;
+  const MaterialTable& materials() const;
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void* file_handle_ = nullptr;
+  void* mapping_handle_ = nullptr;
+#endif
+};
+
+// Maps the cache for the .vox file at vox_path from cache_path. If the cache
+// is missing or was built from other contents (or options), the .vox file is
+// loaded and the cache rebuilt first. Throws VoxException if the .vox file
+// cannot be read or the cache cannot be written.
+void LoadVoxCached(const std::string& vox_path, const std::string& cache_path,
+                   VoxCache& cache, uint32_t lod_levels = 2,
+                   bool remove_hidden_voxels = true);
+
+}  // namespace magicavoxel
+#endif
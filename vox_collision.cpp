@@ -0,0 +1,379 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_collision.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+constexpr float kInfinity = numeric_limits<float>::infinity();
+constexpr int kBrick = static_cast<int>(kBrickSize);
+
+int CountTrailingZeros64(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+// Normalizes v into out; returns false if v is zero.
+bool Normalize(const Vec3f& v, float out[3]) {
+  const float length = sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+  if (!(length > 0)) return false;
+  out[0] = v.x / length;
+  out[1] = v.y / length;
+  out[2] = v.z / length;
+  return true;
+}
+
+// Face hit when moving along d and entering through the given axis (or, for
+// -1, when starting inside: the face towards the main direction of travel).
+Face EntryFace(const float d[3], int axis) {
+  if (axis < 0) {
+    axis = 0;
+    for (int a = 1; a < 3; ++a)
+      if (fabs(d[a]) > fabs(d[axis])) axis = a;
+  }
+  return static_cast<Face>(axis * 2 + (d[axis] > 0 ? 0 : 1));
+}
+
+// Bits of a brick layer covering local x in [x0, x1) and y in [y0, y1).
+uint64_t LayerMask(int x0, int x1, int y0, int y1) {
+  const uint64_t row = ((1u << x1) - 1) & ~((1u << x0) - 1);
+  uint64_t mask = 0;
+  for (int y = y0; y < y1; ++y) mask |= row << (kBrick * y);
+  return mask;
+}
+
+// Ray (origin o, unit direction d) against the box [lo, hi]. Succeeds if the
+// ray passes through the inside of the box, leaving it after 0 and entering
+// it before t_limit; t_entry (negative when o is inside) and the axis it
+// enters through are returned.
+bool SlabTest(const float o[3], const float d[3], const float lo[3],
+              const float hi[3], float t_limit, float& t_entry, int& axis) {
+  float t0 = -kInfinity;
+  float t1 = kInfinity;
+  axis = -1;
+  for (int a = 0; a < 3; ++a) {
+    if (d[a] == 0) {
+      if (!(o[a] > lo[a] && o[a] < hi[a])) return false;
+      continue;
+    }
+    float near = (lo[a] - o[a]) / d[a];
+    float far = (hi[a] - o[a]) / d[a];
+    if (near > far) swap(near, far);
+    if (near > t0) {
+      t0 = near;
+      axis = a;
+    }
+    t1 = min(t1, far);
+  }
+  if (!(t0 < t1) || t1 <= 0 || t0 >= t_limit) return false;
+  t_entry = t0;
+  return true;
+}
+
+// Voxel DDA through one (non-empty) brick, from t to t_end. axis is the axis
+// the ray last crossed, for the face of a hit.
+bool TraceBrick(const BrickOccupancy& occupancy, const int brick[3],
+                const int dims[3], const float o[3], const float d[3],
+                const int step[3], float t, float t_end, int axis,
+                VoxHit& hit) {
+  int lo[3], hi[3], v[3];
+  float t_max[3], t_delta[3];
+  for (int a = 0; a < 3; ++a) {
+    lo[a] = brick[a] * kBrick;
+    hi[a] = min(lo[a] + kBrick, dims[a]);
+    const float p = o[a] + d[a] * t;
+    v[a] = min(max(static_cast<int>(floor(p)), lo[a]), hi[a] - 1);
+    if (step[a] > 0) {
+      t_max[a] = (v[a] + 1 - o[a]) / d[a];
+      t_delta[a] = 1 / d[a];
+    } else if (step[a] < 0) {
+      t_max[a] = (v[a] - o[a]) / d[a];
+      t_delta[a] = -1 / d[a];
+    } else {
+      t_max[a] = kInfinity;
+      t_delta[a] = kInfinity;
+    }
+  }
+
+  for (;;) {
+    const int lx = v[0] - lo[0], ly = v[1] - lo[1], lz = v[2] - lo[2];
+    if ((occupancy.layers[lz] >> (lx + kBrick * ly)) & 1) {
+      hit.distance = t;
+      hit.voxel = {static_cast<uint32_t>(v[0]), static_cast<uint32_t>(v[1]),
+                   static_cast<uint32_t>(v[2])};
+      hit.face = EntryFace(d, axis);
+      return true;
+    }
+
+    int next = t_max[0] < t_max[1] ? 0 : 1;
+    if (t_max[2] < t_max[next]) next = 2;
+    if (t_max[next] > t_end) return false;
+    t = t_max[next];
+    v[next] += step[next];
+    if (v[next] < lo[next] || v[next] >= hi[next]) return false;
+    t_max[next] += t_delta[next];
+    axis = next;
+  }
+}
+
+}  // namespace
+
+bool VoxCollisionModel::Raycast(const VoxRay& ray, VoxHit& hit) const {
+  const Size& size = bricks_.size();
+  const Size& brick_count = bricks_.brickCount();
+  const int dims[3] = {static_cast<int>(size.x), static_cast<int>(size.y),
+                       static_cast<int>(size.z)};
+  const int n_bricks[3] = {static_cast<int>(brick_count.x),
+                           static_cast<int>(brick_count.y),
+                           static_cast<int>(brick_count.z)};
+  const float o[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+  float d[3];
+  if (!Normalize(ray.direction, d) || !size.x || !size.y || !size.z)
+    return false;
+
+  // Clip the ray to the model's bounds.
+  float t_enter = 0;
+  float t_exit = ray.max_distance;
+  int axis = -1;
+  for (int a = 0; a < 3; ++a) {
+    if (d[a] == 0) {
+      if (o[a] < 0 || o[a] >= dims[a]) return false;
+      continue;
+    }
+    float t0 = -o[a] / d[a];
+    float t1 = (dims[a] - o[a]) / d[a];
+    if (t0 > t1) swap(t0, t1);
+    if (t0 > t_enter) {
+      t_enter = t0;
+      axis = a;
+    }
+    t_exit = min(t_exit, t1);
+  }
+  if (t_enter > t_exit) return false;
+
+  // Brick-level DDA, descending into bricks that have any voxels.
+  int brick[3], step[3];
+  float t_max[3], t_delta[3];
+  for (int a = 0; a < 3; ++a) {
+    const float p = o[a] + d[a] * t_enter;
+    brick[a] = min(max(static_cast<int>(floor(p / kBrick)), 0), n_bricks[a] - 1);
+    if (d[a] > 0) {
+      step[a] = 1;
+      t_max[a] = ((brick[a] + 1) * kBrick - o[a]) / d[a];
+      t_delta[a] = kBrick / d[a];
+    } else if (d[a] < 0) {
+      step[a] = -1;
+      t_max[a] = (brick[a] * kBrick - o[a]) / d[a];
+      t_delta[a] = -kBrick / d[a];
+    } else {
+      step[a] = 0;
+      t_max[a] = kInfinity;
+      t_delta[a] = kInfinity;
+    }
+  }
+
+  float t = t_enter;
+  for (;;) {
+    int next = t_max[0] < t_max[1] ? 0 : 1;
+    if (t_max[2] < t_max[next]) next = 2;
+
+    const BrickOccupancy& occupancy = bricks_.brick(brick[0], brick[1], brick[2]);
+    if (!occupancy.empty() &&
+        TraceBrick(occupancy, brick, dims, o, d, step, t,
+                   min(t_max[next], t_exit), axis, hit))
+      return true;
+
+    if (t_max[next] > t_exit) return false;
+    t = t_max[next];
+    brick[next] += step[next];
+    if (brick[next] < 0 || brick[next] >= n_bricks[next]) return false;
+    t_max[next] += t_delta[next];
+    axis = next;
+  }
+}
+
+bool VoxCollisionModel::OverlapBox(const VoxBox& box) const {
+  const Size& size = bricks_.size();
+  const float box_min[3] = {box.min.x, box.min.y, box.min.z};
+  const float box_max[3] = {box.max.x, box.max.y, box.max.z};
+  const int dims[3] = {static_cast<int>(size.x), static_cast<int>(size.y),
+                       static_cast<int>(size.z)};
+
+  // Voxels v with v < max and v + 1 > min.
+  int lo[3], hi[3];
+  for (int a = 0; a < 3; ++a) {
+    if (!(box_min[a] < box_max[a])) return false;
+    lo[a] = static_cast<int>(max(floor(box_min[a]), 0.0f));
+    hi[a] = static_cast<int>(min(ceil(box_max[a]), static_cast<float>(dims[a])));
+    if (lo[a] >= hi[a]) return false;
+  }
+
+  for (int bz = lo[2] / kBrick; bz <= (hi[2] - 1) / kBrick; ++bz) {
+    for (int by = lo[1] / kBrick; by <= (hi[1] - 1) / kBrick; ++by) {
+      for (int bx = lo[0] / kBrick; bx <= (hi[0] - 1) / kBrick; ++bx) {
+        const BrickOccupancy& occupancy = bricks_.brick(bx, by, bz);
+        if (occupancy.empty()) continue;
+        const int x0 = max(lo[0] - bx * kBrick, 0);
+        const int x1 = min(hi[0] - bx * kBrick, kBrick);
+        const int y0 = max(lo[1] - by * kBrick, 0);
+        const int y1 = min(hi[1] - by * kBrick, kBrick);
+        const int z0 = max(lo[2] - bz * kBrick, 0);
+        const int z1 = min(hi[2] - bz * kBrick, kBrick);
+        const uint64_t mask = LayerMask(x0, x1, y0, y1);
+        for (int z = z0; z < z1; ++z) {
+          if (occupancy.layers[z] & mask) return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+bool VoxCollisionModel::SweepAABB(const VoxSweep& sweep, VoxHit& hit) const {
+  const Size& size = bricks_.size();
+  const int dims[3] = {static_cast<int>(size.x), static_cast<int>(size.y),
+                       static_cast<int>(size.z)};
+  float d[3];
+  if (!Normalize(sweep.direction, d)) return false;
+
+  // The box is swept as its center point against voxels grown by its half
+  // size (their Minkowski sum with the box).
+  const float box_min[3] = {sweep.box.min.x, sweep.box.min.y, sweep.box.min.z};
+  const float box_max[3] = {sweep.box.max.x, sweep.box.max.y, sweep.box.max.z};
+  float center[3], half[3];
+  int lo[3], hi[3];
+  for (int a = 0; a < 3; ++a) {
+    center[a] = (box_min[a] + box_max[a]) / 2;
+    half[a] = (box_max[a] - box_min[a]) / 2;
+    const float travel = d[a] * sweep.max_distance;
+    const float swept_min = box_min[a] + min(travel, 0.0f);
+    const float swept_max = box_max[a] + max(travel, 0.0f);
+    lo[a] = static_cast<int>(max(floor(swept_min), 0.0f));
+    hi[a] = static_cast<int>(min(ceil(swept_max), static_cast<float>(dims[a])));
+    if (lo[a] >= hi[a]) return false;
+  }
+
+  float best = sweep.max_distance;
+  bool found = false;
+  for (int bz = lo[2] / kBrick; bz <= (hi[2] - 1) / kBrick; ++bz) {
+    for (int by = lo[1] / kBrick; by <= (hi[1] - 1) / kBrick; ++by) {
+      for (int bx = lo[0] / kBrick; bx <= (hi[0] - 1) / kBrick; ++bx) {
+        const BrickOccupancy& occupancy = bricks_.brick(bx, by, bz);
+        if (occupancy.empty()) continue;
+
+        // Skip bricks the box cannot reach before the best hit so far.
+        const int origin[3] = {bx * kBrick, by * kBrick, bz * kBrick};
+        float grown_lo[3], grown_hi[3];
+        for (int a = 0; a < 3; ++a) {
+          grown_lo[a] = origin[a] - half[a];
+          grown_hi[a] = min(origin[a] + kBrick, dims[a]) + half[a];
+        }
+        float t_entry;
+        int axis;
+        if (!SlabTest(center, d, grown_lo, grown_hi, best, t_entry, axis))
+          continue;
+
+        const int x0 = max(lo[0] - origin[0], 0);
+        const int x1 = min(hi[0] - origin[0], kBrick);
+        const int y0 = max(lo[1] - origin[1], 0);
+        const int y1 = min(hi[1] - origin[1], kBrick);
+        const int z0 = max(lo[2] - origin[2], 0);
+        const int z1 = min(hi[2] - origin[2], kBrick);
+        const uint64_t mask = LayerMask(x0, x1, y0, y1);
+        for (int z = z0; z < z1; ++z) {
+          for (uint64_t bits = occupancy.layers[z] & mask; bits;
+               bits &= bits - 1) {
+            const int bit = CountTrailingZeros64(bits);
+            const int v[3] = {origin[0] + bit % kBrick,
+                              origin[1] + bit / kBrick, origin[2] + z};
+            for (int a = 0; a < 3; ++a) {
+              grown_lo[a] = v[a] - half[a];
+              grown_hi[a] = v[a] + 1 + half[a];
+            }
+            if (!SlabTest(center, d, grown_lo, grown_hi, best, t_entry, axis))
+              continue;
+            found = true;
+            best = max(t_entry, 0.0f);
+            hit.distance = best;
+            hit.voxel = {static_cast<uint32_t>(v[0]),
+                         static_cast<uint32_t>(v[1]),
+                         static_cast<uint32_t>(v[2])};
+            hit.face = EntryFace(d, t_entry < 0 ? -1 : axis);
+          }
+        }
+      }
+    }
+  }
+  return found;
+}
+
+size_t VoxCollisionModel::Raycast(const VoxRay* rays, size_t count,
+                                  VoxHit* hits) const {
+  size_t n_hits = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (Raycast(rays[i], hits[i]))
+      ++n_hits;
+    else
+      hits[i].distance = kInfinity;
+  }
+  return n_hits;
+}
+
+size_t VoxCollisionModel::OverlapBox(const VoxBox* boxes, size_t count,
+                                     bool* overlaps) const {
+  size_t n_overlaps = 0;
+  for (size_t i = 0; i < count; ++i) {
+    overlaps[i] = OverlapBox(boxes[i]);
+    n_overlaps += overlaps[i];
+  }
+  return n_overlaps;
+}
+
+size_t VoxCollisionModel::SweepAABB(const VoxSweep* sweeps, size_t count,
+                                    VoxHit* hits) const {
+  size_t n_hits = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (SweepAABB(sweeps[i], hits[i]))
+      ++n_hits;
+    else
+      hits[i].distance = kInfinity;
+  }
+  return n_hits;
+}
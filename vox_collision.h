@@ -0,0 +1,110 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_COLLISION_H
+#define VOX_COLLISION_H
+
+#include "vox_brick.h"
+#include "vox_file.h"
+#include "vox_mesh.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace magicavoxel {
+
+// Ray for VoxCollisionModel::Raycast. The direction does not need to be
+// normalized; distances are measured in voxels along it either way.
+struct VoxRay {
+  Vec3f origin;
+  Vec3f direction;
+  float max_distance;
+};
+
+// Axis-aligned box, in voxel coordinates.
+struct VoxBox {
+  Vec3f min;
+  Vec3f max;
+};
+
+// A box moved along a direction, for VoxCollisionModel::SweepAABB.
+struct VoxSweep {
+  VoxBox box;
+  Vec3f direction;
+  float max_distance;
+};
+
+// First occupied voxel found by a ray or sweep.
+struct VoxHit {
+  float distance;  // Along the (normalized) direction; 0 if starting inside
+  Vec3i voxel;
+  Face face;       // Face of voxel that was hit
+};
+
+// Collision queries against the occupancy of a model, for physics and game
+// logic. Coordinates are in voxel units, with the model's (0, 0, 0) corner at
+// the origin; voxel (x, y, z) covers [x, x + 1) etc.
+//
+// Queries walk the model's 8x8x8 bricks first and only look at voxels inside
+// bricks that are not empty, reading occupancy bits rather than colors. They
+// do not allocate, and are safe to run from many threads at once (as long as
+// nothing calls SetVoxel at the same time).
+class VoxCollisionModel {
+ public:
+  explicit VoxCollisionModel(const VoxDenseModel& model) : bricks_(model) {}
+  explicit VoxCollisionModel(VoxBrickMap bricks) : bricks_(std::move(bricks)) {}
+
+  const Size& size() const noexcept { return bricks_.size(); }
+  const VoxBrickMap& bricks() const noexcept { return bricks_; }
+
+  // Keeps the queries in sync with an edit of the model.
+  void SetVoxel(uint32_t x, uint32_t y, uint32_t z, bool occupied) {
+    bricks_.Set(x, y, z, occupied);
+  }
+
+  // Finds the first occupied voxel along the ray. Returns false if there is
+  // none within max_distance.
+  bool Raycast(const VoxRay& ray, VoxHit& hit) const;
+
+  // Returns whether any occupied voxel overlaps the box (touching does not
+  // count).
+  bool OverlapBox(const VoxBox& box) const;
+
+  // Moves the box along the sweep direction and finds the first occupied
+  // voxel it would run into. Returns false if it can move the whole
+  // max_distance. A box that already overlaps a voxel hits at distance 0.
+  bool SweepAABB(const VoxSweep& sweep, VoxHit& hit) const;
+
+  // Batched forms: run count queries, writing one result per query. Misses
+  // have a distance of infinity. Return the number of hits (overlaps).
+  size_t Raycast(const VoxRay* rays, size_t count, VoxHit* hits) const;
+  size_t OverlapBox(const VoxBox* boxes, size_t count, bool* overlaps) const;
+  size_t SweepAABB(const VoxSweep* sweeps, size_t count, VoxHit* hits) const;
+
+ private:
+  VoxBrickMap bricks_;
+};
+
+}  // namespace magicavoxel
+#endif
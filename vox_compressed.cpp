@@ -0,0 +1,318 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_compressed.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+constexpr uint32_t kBrickVoxels = kBrickSize * kBrickSize * kBrickSize;
+
+enum BrickEncoding : uint8_t {
+  kEncodingEmpty,    // All voxels 0; no bytes
+  kEncodingUniform,  // All voxels param; no bytes
+  kEncodingPacked,   // Color count, colors, then indices of param bits each
+  kEncodingRuns,     // (run length - 1, color) pairs
+  kEncodingRaw       // kBrickVoxels bytes
+};
+
+// Encodes voxels into out (which has room for kBrickVoxels bytes), returning
+// the encoding and setting size and param.
+BrickEncoding Encode(const uint8_t* voxels, uint8_t* out, uint16_t& size,
+                     uint8_t& param) {
+  size = 0;
+  param = 0;
+
+  // Distinct colors, in order of first appearance (up to 17, which is enough
+  // to know packing does not apply).
+  uint8_t colors[17];
+  int n_colors = 0;
+  uint8_t index_of[256];
+  bool seen[256] = {};
+  for (uint32_t i = 0; i < kBrickVoxels && n_colors <= 16; ++i) {
+    const uint8_t color = voxels[i];
+    if (!seen[color]) {
+      seen[color] = true;
+      index_of[color] = static_cast<uint8_t>(n_colors);
+      colors[n_colors++] = color;
+    }
+  }
+  if (n_colors == 1) {
+    param = colors[0];
+    return colors[0] ? kEncodingUniform : kEncodingEmpty;
+  }
+
+  uint32_t packed_size = kBrickVoxels + 1;
+  uint8_t bits = 0;
+  if (n_colors <= 16) {
+    bits = n_colors <= 2 ? 1 : n_colors <= 4 ? 2 : 4;
+    packed_size = 1 + n_colors + kBrickVoxels * bits / 8;
+  }
+
+  // Count the run-length size before committing to it.
+  uint32_t runs_size = 0;
+  for (uint32_t i = 0; i < kBrickVoxels && runs_size < kBrickVoxels;) {
+    uint32_t run = 1;
+    while (i + run < kBrickVoxels && run < 256 && voxels[i + run] == voxels[i])
+      ++run;
+    runs_size += 2;
+    i += run;
+  }
+
+  if (packed_size <= runs_size && packed_size < kBrickVoxels) {
+    out[0] = static_cast<uint8_t>(n_colors);
+    memcpy(out + 1, colors, n_colors);
+    uint8_t* packed = out + 1 + n_colors;
+    memset(packed, 0, kBrickVoxels * bits / 8);
+    const uint32_t per_byte = 8 / bits;
+    for (uint32_t i = 0; i < kBrickVoxels; ++i) {
+      packed[i / per_byte] |= index_of[voxels[i]] << ((i % per_byte) * bits);
+    }
+    size = static_cast<uint16_t>(packed_size);
+    param = bits;
+    return kEncodingPacked;
+  }
+
+  if (runs_size < kBrickVoxels) {
+    uint8_t* p = out;
+    for (uint32_t i = 0; i < kBrickVoxels;) {
+      uint32_t run = 1;
+      while (i + run < kBrickVoxels && run < 256 &&
+             voxels[i + run] == voxels[i])
+        ++run;
+      *p++ = static_cast<uint8_t>(run - 1);
+      *p++ = voxels[i];
+      i += run;
+    }
+    size = static_cast<uint16_t>(runs_size);
+    return kEncodingRuns;
+  }
+
+  memcpy(out, voxels, kBrickVoxels);
+  size = kBrickVoxels;
+  return kEncodingRaw;
+}
+
+}  // namespace
+
+constexpr uint32_t VoxCompressedModel::kNoBrick;
+constexpr int32_t VoxCompressedModel::kNotCached;
+
+VoxCompressedModel::VoxCompressedModel(const VoxDenseModel& model,
+                                       size_t cache_bricks)
+    : size_(model.size()),
+      brick_count_{(size_.x + kBrickSize - 1) / kBrickSize,
+                   (size_.y + kBrickSize - 1) / kBrickSize,
+                   (size_.z + kBrickSize - 1) / kBrickSize},
+      palette_(model.palette()) {
+  const size_t n_bricks =
+      static_cast<size_t>(brick_count_.x) * brick_count_.y * brick_count_.z;
+  bricks_.resize(n_bricks);
+  slot_of_brick_.assign(n_bricks, kNotCached);
+
+  // Gather each brick (padded with 0 past the model's edges) and compress it.
+  const uint8_t* voxels = model.data().data();
+  uint8_t brick[kBrickVoxels];
+  for (uint32_t bz = 0; bz < brick_count_.z; ++bz) {
+    for (uint32_t by = 0; by < brick_count_.y; ++by) {
+      for (uint32_t bx = 0; bx < brick_count_.x; ++bx) {
+        memset(brick, 0, sizeof(brick));
+        const uint32_t x0 = bx * kBrickSize, y0 = by * kBrickSize,
+                       z0 = bz * kBrickSize;
+        const uint32_t w = min(kBrickSize, size_.x - x0);
+        for (uint32_t z = z0; z < min(z0 + kBrickSize, size_.z); ++z) {
+          for (uint32_t y = y0; y < min(y0 + kBrickSize, size_.y); ++y) {
+            memcpy(brick + LocalIndex(0, y, z),
+                   voxels + x0 + size_.x * (y + static_cast<size_t>(size_.y) * z),
+                   w);
+          }
+        }
+        Compress(BrickIndex(x0, y0, z0), brick);
+      }
+    }
+  }
+
+  SetCacheSize(cache_bricks);
+}
+
+void VoxCompressedModel::SetVoxel(uint32_t x, uint32_t y, uint32_t z,
+                                  uint8_t color) {
+  const uint32_t brick = BrickIndex(x, y, z);
+  CacheSlot* slot = slot_of_brick_[brick] != kNotCached
+                        ? &cache_[slot_of_brick_[brick]]
+                        : Load(brick);
+  slot->voxels[LocalIndex(x, y, z)] = color;
+  slot->dirty = true;
+  slot->last_used = ++clock_;
+}
+
+void VoxCompressedModel::SetCacheSize(size_t cache_bricks) {
+  Flush();
+  cache_.resize(max<size_t>(cache_bricks, 1));
+  for (CacheSlot& slot : cache_) {
+    slot.brick = kNoBrick;
+    slot.last_used = 0;
+    slot.dirty = false;
+  }
+}
+
+void VoxCompressedModel::Flush() {
+  for (CacheSlot& slot : cache_) Evict(slot);
+}
+
+VoxDenseModel VoxCompressedModel::Decompress() const {
+  VoxDenseModel model(size_, palette_);
+  uint8_t* voxels = model.data().data();
+  uint8_t brick[kBrickVoxels];
+  for (uint32_t bz = 0; bz < brick_count_.z; ++bz) {
+    for (uint32_t by = 0; by < brick_count_.y; ++by) {
+      for (uint32_t bx = 0; bx < brick_count_.x; ++bx) {
+        const uint32_t x0 = bx * kBrickSize, y0 = by * kBrickSize,
+                       z0 = bz * kBrickSize;
+        const uint32_t index = BrickIndex(x0, y0, z0);
+        const int32_t slot = slot_of_brick_[index];
+        const uint8_t* src = brick;
+        if (slot != kNotCached)
+          src = cache_[slot].voxels;
+        else
+          DecompressBrick(index, brick);
+
+        const uint32_t w = min(kBrickSize, size_.x - x0);
+        for (uint32_t z = z0; z < min(z0 + kBrickSize, size_.z); ++z) {
+          for (uint32_t y = y0; y < min(y0 + kBrickSize, size_.y); ++y) {
+            memcpy(voxels + x0 + size_.x * (y + static_cast<size_t>(size_.y) * z),
+                   src + LocalIndex(0, y, z), w);
+          }
+        }
+      }
+    }
+  }
+  return model;
+}
+
+size_t VoxCompressedModel::compressedBytes() const noexcept {
+  return arena_.size() - garbage_bytes_ +
+         bricks_.size() * sizeof(BrickRecord);
+}
+
+VoxCompressedModel::CacheSlot* VoxCompressedModel::Load(uint32_t brick) const {
+  CacheSlot* victim = &cache_[0];
+  for (CacheSlot& slot : cache_) {
+    if (slot.last_used < victim->last_used) victim = &slot;
+  }
+  Evict(*victim);
+
+  DecompressBrick(brick, victim->voxels);
+  victim->brick = brick;
+  victim->last_used = ++clock_;
+  victim->dirty = false;
+  slot_of_brick_[brick] = static_cast<int32_t>(victim - cache_.data());
+  return victim;
+}
+
+void VoxCompressedModel::Evict(CacheSlot& slot) const {
+  if (slot.brick == kNoBrick) return;
+  if (slot.dirty) Compress(slot.brick, slot.voxels);
+  slot_of_brick_[slot.brick] = kNotCached;
+  slot.brick = kNoBrick;
+  slot.last_used = 0;
+  slot.dirty = false;
+}
+
+void VoxCompressedModel::Compress(uint32_t brick, const uint8_t* voxels) const {
+  uint8_t encoded[kBrickVoxels];
+  BrickRecord& record = bricks_[brick];
+  uint16_t size;
+  uint8_t param;
+  const BrickEncoding encoding = Encode(voxels, encoded, size, param);
+
+  // Reuse the brick's old space if the new encoding fits, else append.
+  if (size > record.size) {
+    garbage_bytes_ += record.size;
+    record.offset = static_cast<uint32_t>(arena_.size());
+    arena_.resize(arena_.size() + size);
+  } else {
+    garbage_bytes_ += record.size - size;
+  }
+  if (size) memcpy(arena_.data() + record.offset, encoded, size);
+  record.size = size;
+  record.encoding = encoding;
+  record.param = param;
+
+  // Compact once more than half of the arena is unused.
+  if (garbage_bytes_ > arena_.size() / 2 && garbage_bytes_ > 4096) {
+    vector<uint8_t> compacted;
+    compacted.reserve(arena_.size() - garbage_bytes_);
+    for (BrickRecord& r : bricks_) {
+      const uint32_t offset = static_cast<uint32_t>(compacted.size());
+      compacted.insert(compacted.end(), arena_.begin() + r.offset,
+                       arena_.begin() + r.offset + r.size);
+      r.offset = offset;
+    }
+    arena_.swap(compacted);
+    garbage_bytes_ = 0;
+  }
+}
+
+void VoxCompressedModel::DecompressBrick(uint32_t brick,
+                                         uint8_t* voxels) const {
+  const BrickRecord& record = bricks_[brick];
+  const uint8_t* data = arena_.data() + record.offset;
+  switch (record.encoding) {
+    case kEncodingEmpty:
+      memset(voxels, 0, kBrickVoxels);
+      break;
+    case kEncodingUniform:
+      memset(voxels, record.param, kBrickVoxels);
+      break;
+    case kEncodingPacked: {
+      const uint8_t* colors = data + 1;
+      const uint8_t* packed = colors + data[0];
+      const uint32_t bits = record.param;
+      const uint32_t per_byte = 8 / bits;
+      const uint8_t mask = static_cast<uint8_t>((1u << bits) - 1);
+      for (uint32_t i = 0; i < kBrickVoxels; ++i) {
+        voxels[i] =
+            colors[(packed[i / per_byte] >> ((i % per_byte) * bits)) & mask];
+      }
+      break;
+    }
+    case kEncodingRuns: {
+      uint8_t* out = voxels;
+      for (const uint8_t* p = data; p < data + record.size; p += 2) {
+        memset(out, p[1], p[0] + 1u);
+        out += p[0] + 1u;
+      }
+      break;
+    }
+    default:
+      memcpy(voxels, data, kBrickVoxels);
+      break;
+  }
+}
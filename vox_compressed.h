@@ -0,0 +1,139 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_COMPRESSED_H
+#define VOX_COMPRESSED_H
+
+#include "vox_brick.h"
+#include "vox_file.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// A dense model kept compressed in memory, one 8x8x8 brick at a time, for
+// holding many idle models. Each brick is stored in whichever of these is
+// smallest: nothing (empty), a single color, indices into a small per-brick
+// palette packed to 1, 2 or 4 bits, run-lengths, or raw bytes. Typical models
+// shrink 5-20x.
+//
+// Bricks are decompressed on access into a small LRU cache. A brick that is
+// cached is read with one table lookup, so models that are being worked on
+// read at close to VoxDenseModel speed; with a cache as large as the brick
+// count, the whole model stays decompressed.
+//
+// Reads update the cache, so a VoxCompressedModel must not be used from more
+// than one thread at a time, even through const methods.
+class VoxCompressedModel {
+ public:
+  explicit VoxCompressedModel(const VoxDenseModel& model,
+                              size_t cache_bricks = 64);
+
+  const Size& size() const noexcept { return size_; }
+  const Palette& palette() const noexcept { return palette_; }
+  Palette& palette() noexcept { return palette_; }
+
+  uint8_t voxel(uint32_t x, uint32_t y, uint32_t z) const {
+    const uint8_t* brick = Brick(x, y, z);
+    return brick[LocalIndex(x, y, z)];
+  }
+  void SetVoxel(uint32_t x, uint32_t y, uint32_t z, uint8_t color);
+
+  // Changes the number of bricks kept decompressed.
+  void SetCacheSize(size_t cache_bricks);
+
+  // Compresses any bricks modified through SetVoxel, and drops the cache.
+  void Flush();
+
+  // Decompresses the whole model.
+  VoxDenseModel Decompress() const;
+
+  // Memory held by the compressed bricks, excluding the cache.
+  size_t compressedBytes() const noexcept;
+
+ private:
+  // Where a brick's compressed bytes are, and how they are encoded.
+  struct BrickRecord {
+    uint32_t offset;
+    uint16_t size;
+    uint8_t encoding;
+    uint8_t param;  // Color for uniform bricks, bits per index for packed
+  };
+
+  // A decompressed brick.
+  struct CacheSlot {
+    uint8_t voxels[kBrickSize * kBrickSize * kBrickSize];
+    uint32_t brick;      // Brick index, or kNoBrick
+    uint64_t last_used;  // For LRU eviction
+    bool dirty;
+  };
+
+  static constexpr uint32_t kNoBrick = 0xffffffff;
+  static constexpr int32_t kNotCached = -1;
+
+  static uint32_t LocalIndex(uint32_t x, uint32_t y, uint32_t z) {
+    return (x % kBrickSize) + kBrickSize * ((y % kBrickSize) +
+                                            kBrickSize * (z % kBrickSize));
+  }
+  uint32_t BrickIndex(uint32_t x, uint32_t y, uint32_t z) const {
+    return x / kBrickSize +
+           brick_count_.x * (y / kBrickSize + brick_count_.y * (z / kBrickSize));
+  }
+
+  // Decompressed voxels of the brick containing (x, y, z).
+  const uint8_t* Brick(uint32_t x, uint32_t y, uint32_t z) const {
+    const uint32_t brick = BrickIndex(x, y, z);
+    const int32_t slot = slot_of_brick_[brick];
+    if (slot != kNotCached) {
+      cache_[slot].last_used = ++clock_;
+      return cache_[slot].voxels;
+    }
+    return Load(brick)->voxels;
+  }
+
+  // Brings a brick into the cache, evicting the least recently used one.
+  CacheSlot* Load(uint32_t brick) const;
+  void Evict(CacheSlot& slot) const;
+
+  void Compress(uint32_t brick, const uint8_t* voxels) const;
+  void DecompressBrick(uint32_t brick, uint8_t* voxels) const;
+
+  Size size_;
+  Size brick_count_;
+  Palette palette_;
+
+  // Compressed bricks live in one arena. A brick that grows when recompressed
+  // is appended; the space it left is reclaimed by compacting the arena.
+  mutable std::vector<uint8_t> arena_;
+  mutable size_t garbage_bytes_ = 0;
+  mutable std::vector<BrickRecord> bricks_;
+
+  mutable std::vector<CacheSlot> cache_;
+  mutable std::vector<int32_t> slot_of_brick_;
+  mutable uint64_t clock_ = 0;
+};
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,547 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_convex.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+// z planes per task when packing the model, at least.
+constexpr size_t kMinPlanes = 8;
+
+int CountTrailingZeros64(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+int HighestBit64(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return static_cast<int>(index);
+#else
+  return 63 - __builtin_clzll(value);
+#endif
+}
+
+int PopCount64(uint64_t value) {
+#ifdef _MSC_VER
+  return static_cast<int>(__popcnt64(value));
+#else
+  return __builtin_popcountll(value);
+#endif
+}
+
+uint32_t& Axis(Vec3i& v, int axis) { return (&v.x)[axis]; }
+
+// Occupancy bits of the model, in rows of 64-bit words along x.
+struct Occupancy {
+  Size size;
+  size_t words = 0;
+  vector<uint64_t> bits;
+
+  const uint64_t* row(uint32_t y, uint32_t z) const {
+    return bits.data() + (y + static_cast<size_t>(size.y) * z) * words;
+  }
+};
+
+void PackOccupancy(const VoxDenseModel& model, unsigned threads,
+                   Occupancy& occupancy) {
+  const Size& size = model.size();
+  occupancy.size = size;
+  occupancy.words = (size.x + 63) / 64;
+  occupancy.bits.assign(occupancy.words * size.y * size.z, 0);
+  const uint8_t* voxels = model.data().data();
+  ParallelFor(size.z, kMinPlanes, threads, [&](size_t z0, size_t z1) {
+    for (size_t z = z0; z < z1; ++z) {
+      for (uint32_t y = 0; y < size.y; ++y) {
+        const uint8_t* src = voxels + (z * size.y + y) * size.x;
+        uint64_t* row = occupancy.bits.data() + (y + size.y * z) * occupancy.words;
+        for (uint32_t x = 0; x < size.x; ++x)
+          row[x / 64] |= static_cast<uint64_t>(src[x] != 0) << (x % 64);
+      }
+    }
+  });
+}
+
+// Mask of the bits of word w that fall in [begin, end).
+uint64_t RunMask(size_t w, uint32_t begin, uint32_t end) {
+  const size_t low = max<size_t>(begin, w * 64), high = min<size_t>(end, w * 64 + 64);
+  if (low >= high) return 0;
+  const uint64_t from = ~uint64_t{0} << (low - w * 64);
+  return high - w * 64 == 64 ? from : from & ((uint64_t{1} << (high - w * 64)) - 1);
+}
+
+// Integer points and vectors, so hull predicates are exact: coordinates
+// below 2^20 keep every product within 64 bits.
+struct Point {
+  int64_t x, y, z;
+};
+
+Point Sub(const Point& a, const Point& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+Point Cross(const Point& a, const Point& b) {
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+int64_t Dot(const Point& a, const Point& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+bool Less(const Point& a, const Point& b) {
+  return a.x != b.x ? a.x < b.x : a.y != b.y ? a.y < b.y : a.z < b.z;
+}
+
+// 3D quickhull over integer points.
+class QuickHull {
+ public:
+  // Returns false if the points span no volume.
+  bool Build(const vector<Point>& points);
+
+  // Six times the volume.
+  int64_t volume6() const;
+
+  void Output(ConvexHull& hull) const;
+
+  // Planes of the hull's faces, as unit outward normals and offsets.
+  struct Plane {
+    double nx, ny, nz, offset;
+  };
+  void Planes(vector<Plane>& planes) const;
+
+ private:
+  struct Face {
+    uint32_t v[3];
+    uint32_t neighbor[3];  // Across edge v[i] -> v[(i + 1) % 3]
+    Point normal;          // Outward, not normalized
+    int64_t offset;
+    vector<uint32_t> outside;
+    bool alive;
+  };
+
+  int64_t Distance(const Face& face, uint32_t point) const {
+    return Dot(face.normal, (*points_)[point]) - face.offset;
+  }
+  uint32_t AddFace(uint32_t a, uint32_t b, uint32_t c);
+  void AddPoint(uint32_t face, uint32_t point);
+
+  const vector<Point>* points_ = nullptr;
+  vector<Face> faces_;
+  vector<uint32_t> visible_, horizon_, created_;
+  vector<uint32_t> starting_, ending_;  // New face by horizon vertex
+  vector<uint8_t> seen_;
+};
+
+uint32_t QuickHull::AddFace(uint32_t a, uint32_t b, uint32_t c) {
+  const vector<Point>& points = *points_;
+  Face face{};  // neighbor[] is set by the caller
+  face.v[0] = a;
+  face.v[1] = b;
+  face.v[2] = c;
+  face.normal = Cross(Sub(points[b], points[a]), Sub(points[c], points[a]));
+  face.offset = Dot(face.normal, points[a]);
+  face.alive = true;
+  faces_.push_back(move(face));
+  seen_.push_back(0);
+  return static_cast<uint32_t>(faces_.size() - 1);
+}
+
+bool QuickHull::Build(const vector<Point>& points) {
+  points_ = &points;
+  faces_.clear();
+  seen_.clear();
+  const uint32_t n = static_cast<uint32_t>(points.size());
+  if (n < 4) return false;
+
+  // A first tetrahedron from extreme points.
+  uint32_t a = 0, b = 0;
+  for (uint32_t i = 1; i < n; ++i) {
+    if (Less(points[i], points[a])) a = i;
+    if (Less(points[b], points[i])) b = i;
+  }
+  const Point ab = Sub(points[b], points[a]);
+  uint32_t c = a;
+  int64_t best = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    const Point cross = Cross(ab, Sub(points[i], points[a]));
+    const int64_t length = Dot(cross, cross);
+    if (length > best) {
+      best = length;
+      c = i;
+    }
+  }
+  if (!best) return false;
+  const Point normal = Cross(ab, Sub(points[c], points[a]));
+  uint32_t d = a;
+  best = 0;
+  for (uint32_t i = 0; i < n; ++i) {
+    const int64_t distance = llabs(Dot(normal, Sub(points[i], points[a])));
+    if (distance > best) {
+      best = distance;
+      d = i;
+    }
+  }
+  if (!best) return false;
+  if (Dot(normal, Sub(points[d], points[a])) > 0) swap(b, c);
+
+  // Base facing away from d, then the sides, each edge shared in opposite
+  // directions.
+  AddFace(a, b, c);
+  AddFace(b, a, d);
+  AddFace(c, b, d);
+  AddFace(a, c, d);
+  for (uint32_t f = 0; f < 4; ++f) {
+    for (int e = 0; e < 3; ++e) {
+      const uint32_t from = faces_[f].v[e], to = faces_[f].v[(e + 1) % 3];
+      for (uint32_t g = 0; g < 4; ++g) {
+        for (int k = 0; k < 3; ++k) {
+          if (faces_[g].v[k] == to && faces_[g].v[(k + 1) % 3] == from)
+            faces_[f].neighbor[e] = g;
+        }
+      }
+    }
+  }
+  for (uint32_t i = 0; i < n; ++i) {
+    if (i == a || i == b || i == c || i == d) continue;
+    for (uint32_t f = 0; f < 4; ++f) {
+      if (Distance(faces_[f], i) > 0) {
+        faces_[f].outside.push_back(i);
+        break;
+      }
+    }
+  }
+
+  starting_.resize(n);
+  ending_.resize(n);
+  // New faces go to the end, so one pass sees every face that gets points.
+  for (uint32_t f = 0; f < faces_.size(); ++f) {
+    if (!faces_[f].alive || faces_[f].outside.empty()) continue;
+    uint32_t apex = faces_[f].outside[0];
+    int64_t farthest = 0;
+    for (uint32_t point : faces_[f].outside) {
+      const int64_t distance = Distance(faces_[f], point);
+      if (distance > farthest) {
+        farthest = distance;
+        apex = point;
+      }
+    }
+
+    // Faces that see the apex, and the edges where they meet the others.
+    visible_.assign(1, f);
+    horizon_.clear();
+    seen_[f] = 1;
+    for (size_t i = 0; i < visible_.size(); ++i) {
+      const uint32_t g = visible_[i];
+      for (int e = 0; e < 3; ++e) {
+        const uint32_t h = faces_[g].neighbor[e];
+        if (seen_[h]) continue;
+        if (Distance(faces_[h], apex) > 0) {
+          seen_[h] = 1;
+          visible_.push_back(h);
+        } else {
+          horizon_.push_back(g * 3 + e);
+        }
+      }
+    }
+
+    // A cone of faces from the horizon to the apex.
+    created_.clear();
+    for (uint32_t edge : horizon_) {
+      const uint32_t g = edge / 3;
+      const int e = edge % 3;
+      const uint32_t from = faces_[g].v[e], to = faces_[g].v[(e + 1) % 3];
+      const uint32_t outer = faces_[g].neighbor[e];
+      const uint32_t face = AddFace(from, to, apex);
+      faces_[face].neighbor[0] = outer;
+      for (int k = 0; k < 3; ++k) {
+        if (faces_[outer].neighbor[k] == g && faces_[outer].v[k] == to)
+          faces_[outer].neighbor[k] = face;
+      }
+      starting_[from] = ending_[to] = face;
+      created_.push_back(face);
+    }
+    for (uint32_t face : created_) {
+      faces_[face].neighbor[1] = starting_[faces_[face].v[1]];
+      faces_[face].neighbor[2] = ending_[faces_[face].v[0]];
+    }
+
+    for (uint32_t g : visible_) {
+      for (uint32_t point : faces_[g].outside) {
+        if (point == apex) continue;
+        for (uint32_t face : created_) {
+          if (Distance(faces_[face], point) > 0) {
+            faces_[face].outside.push_back(point);
+            break;
+          }
+        }
+      }
+      faces_[g].alive = false;
+      vector<uint32_t>().swap(faces_[g].outside);
+    }
+  }
+  return true;
+}
+
+int64_t QuickHull::volume6() const {
+  int64_t volume = 0;
+  for (const Face& face : faces_) {
+    if (!face.alive) continue;
+    const vector<Point>& points = *points_;
+    volume += Dot(points[face.v[0]], Cross(points[face.v[1]], points[face.v[2]]));
+  }
+  return volume;
+}
+
+void QuickHull::Planes(vector<Plane>& planes) const {
+  planes.clear();
+  for (const Face& face : faces_) {
+    if (!face.alive) continue;
+    const double length = sqrt(static_cast<double>(Dot(face.normal, face.normal)));
+    planes.push_back({face.normal.x / length, face.normal.y / length,
+                      face.normal.z / length, face.offset / length});
+  }
+}
+
+void QuickHull::Output(ConvexHull& hull) const {
+  hull.vertices.clear();
+  hull.indices.clear();
+  vector<uint32_t> ids(points_->size(), numeric_limits<uint32_t>::max());
+  for (const Face& face : faces_) {
+    if (!face.alive) continue;
+    for (uint32_t v : face.v) {
+      if (ids[v] == numeric_limits<uint32_t>::max()) {
+        const Point& p = (*points_)[v];
+        ids[v] = static_cast<uint32_t>(hull.vertices.size());
+        hull.vertices.push_back({static_cast<float>(p.x), static_cast<float>(p.y),
+                                 static_cast<float>(p.z)});
+      }
+      hull.indices.push_back(ids[v]);
+    }
+  }
+}
+
+// A part: the model's voxels inside bounds, with its hull's measures.
+struct Part {
+  VoxelBox bounds;
+  uint32_t voxels = 0;
+  int64_t volume6 = 0;
+  uint32_t deep_voxels = 0;  // Empty, deeper than max_concavity in the hull
+  bool final = false;        // No plane splits it
+
+  double empty() const { return volume6 / 6.0 - voxels; }
+};
+
+// Counts the voxels inside box, shrinks it to them, and gathers the corners
+// of the first and last voxel of each row.
+void ScanPart(const Occupancy& occupancy, const VoxelBox& box, Part& part,
+              vector<Point>& corners) {
+  corners.clear();
+  part.voxels = 0;
+  VoxelBox tight{{box.max.x, box.max.y, box.max.z}, {0, 0, 0}};
+  const size_t first_word = box.min.x / 64;
+  for (uint32_t z = box.min.z; z < box.max.z; ++z) {
+    for (uint32_t y = box.min.y; y < box.max.y; ++y) {
+      const uint64_t* row = occupancy.row(y, z);
+      int64_t first = -1, last = -1;
+      for (size_t w = first_word; w * 64 < box.max.x; ++w) {
+        const uint64_t bits = row[w] & RunMask(w, box.min.x, box.max.x);
+        if (!bits) continue;
+        if (first < 0) first = static_cast<int64_t>(w * 64) + CountTrailingZeros64(bits);
+        last = static_cast<int64_t>(w * 64) + HighestBit64(bits);
+        part.voxels += PopCount64(bits);
+      }
+      if (first < 0) continue;
+      tight.min = {min<uint32_t>(tight.min.x, static_cast<uint32_t>(first)),
+                   min(tight.min.y, y), min(tight.min.z, z)};
+      tight.max = {max<uint32_t>(tight.max.x, static_cast<uint32_t>(last + 1)),
+                   max(tight.max.y, y + 1), max(tight.max.z, z + 1)};
+      for (int64_t x : {first, last + 1}) {
+        for (int corner = 0; corner < 4; ++corner)
+          corners.push_back({x, y + (corner & 1), z + (corner >> 1)});
+      }
+    }
+  }
+  part.bounds = tight;
+}
+
+// Counts the empty voxels of part whose centers lie more than depth inside
+// its hull, clipping each row of voxel centers against the hull's planes
+// moved inwards by depth.
+uint32_t DeepVoxels(const Occupancy& occupancy, const Part& part,
+                    const QuickHull& hull, float depth,
+                    vector<QuickHull::Plane>& planes) {
+  hull.Planes(planes);
+  const VoxelBox& bounds = part.bounds;
+  uint32_t count = 0;
+  for (uint32_t z = bounds.min.z; z < bounds.max.z; ++z) {
+    for (uint32_t y = bounds.min.y; y < bounds.max.y; ++y) {
+      double low = bounds.min.x, high = bounds.max.x;
+      for (const QuickHull::Plane& plane : planes) {
+        const double rest = plane.offset - depth - plane.ny * (y + 0.5) -
+                            plane.nz * (z + 0.5);
+        if (plane.nx > 0.0) {
+          high = min(high, rest / plane.nx);
+        } else if (plane.nx < 0.0) {
+          low = max(low, rest / plane.nx);
+        } else if (rest < 0.0) {
+          high = low;
+        }
+        if (low >= high) break;
+      }
+      // Voxels whose centers are in [low, high].
+      const double first = ceil(low - 0.5), last = floor(high - 0.5);
+      if (first > last) continue;
+      const uint32_t begin = static_cast<uint32_t>(first);
+      const uint32_t end = static_cast<uint32_t>(last) + 1;
+      const uint64_t* row = occupancy.row(y, z);
+      count += end - begin;
+      for (size_t w = begin / 64; w * 64 < end; ++w)
+        count -= PopCount64(row[w] & RunMask(w, begin, end));
+    }
+  }
+  return count;
+}
+
+// Scans a part and measures its hull; with depth > 0, also counts its deep
+// empty voxels.
+void EvaluatePart(const Occupancy& occupancy, const VoxelBox& box, float depth,
+                  Part& part, vector<Point>& corners, QuickHull& hull,
+                  vector<QuickHull::Plane>& planes) {
+  ScanPart(occupancy, box, part, corners);
+  part.volume6 = 0;
+  part.deep_voxels = 0;
+  if (part.voxels && hull.Build(corners)) {
+    part.volume6 = hull.volume6();
+    if (depth > 0.0f)
+      part.deep_voxels = DeepVoxels(occupancy, part, hull, depth, planes);
+  }
+}
+
+}  // namespace
+
+void magicavoxel::DecomposeConvex(const VoxDenseModel& model,
+                                  vector<ConvexHull>& hulls,
+                                  const ConvexOptions& options) {
+  hulls.clear();
+  Occupancy occupancy;
+  PackOccupancy(model, options.threads, occupancy);
+
+  const float depth = max(options.max_concavity, 0.0f);
+  vector<Point> corners;
+  QuickHull hull;
+  vector<QuickHull::Plane> planes;
+  vector<Part> parts(1);
+  EvaluatePart(occupancy, VoxelBox{{0, 0, 0}, model.size()}, depth, parts[0],
+               corners, hull, planes);
+  if (!parts[0].voxels) return;
+
+  struct Split {
+    int axis;
+    uint32_t position;
+  };
+  vector<Split> splits;
+  vector<Part> halves;
+  while (parts.size() < max<uint32_t>(options.max_hulls, 1)) {
+    // The part with the most deep empty voxels.
+    size_t worst = parts.size();
+    for (size_t i = 0; i < parts.size(); ++i) {
+      if (parts[i].final || !parts[i].deep_voxels) continue;
+      if (worst == parts.size() || parts[i].deep_voxels > parts[worst].deep_voxels)
+        worst = i;
+    }
+    if (worst == parts.size()) break;
+
+    // Candidate planes spread over the part on each axis, scored in parallel.
+    const VoxelBox bounds = parts[worst].bounds;
+    splits.clear();
+    for (int axis = 0; axis < 3; ++axis) {
+      const uint32_t low = (&bounds.min.x)[axis], span = (&bounds.max.x)[axis] - low;
+      const uint32_t count =
+          min<uint32_t>(span - 1, static_cast<uint32_t>(max(options.split_candidates, 1)));
+      for (uint32_t i = 0; i < count; ++i)
+        splits.push_back({axis, low + span * (i + 1) / (count + 1)});
+    }
+    halves.assign(splits.size() * 2, Part());
+    ParallelFor(splits.size(), 1, options.threads, [&](size_t s0, size_t s1) {
+      vector<Point> corners;
+      QuickHull hull;
+      vector<QuickHull::Plane> planes;
+      for (size_t s = s0; s < s1; ++s) {
+        VoxelBox below = bounds, above = bounds;
+        Axis(below.max, splits[s].axis) = splits[s].position;
+        Axis(above.min, splits[s].axis) = splits[s].position;
+        EvaluatePart(occupancy, below, 0.0f, halves[2 * s], corners, hull, planes);
+        EvaluatePart(occupancy, above, 0.0f, halves[2 * s + 1], corners, hull,
+                     planes);
+      }
+    });
+
+    size_t best = splits.size();
+    double best_empty = 0.0;
+    for (size_t s = 0; s < splits.size(); ++s) {
+      if (!halves[2 * s].voxels || !halves[2 * s + 1].voxels) continue;
+      const double empty = halves[2 * s].empty() + halves[2 * s + 1].empty();
+      if (best == splits.size() || empty < best_empty) {
+        best = s;
+        best_empty = empty;
+      }
+    }
+    if (best == splits.size()) {
+      parts[worst].final = true;
+      continue;
+    }
+    EvaluatePart(occupancy, halves[2 * best].bounds, depth, parts[worst],
+                 corners, hull, planes);
+    parts.emplace_back();
+    EvaluatePart(occupancy, halves[2 * best + 1].bounds, depth, parts.back(),
+                 corners, hull, planes);
+  }
+
+  hulls.resize(parts.size());
+  ParallelFor(parts.size(), 1, options.threads, [&](size_t p0, size_t p1) {
+    vector<Point> part_corners;
+    QuickHull part_hull;
+    for (size_t p = p0; p < p1; ++p) {
+      Part part;
+      ScanPart(occupancy, parts[p].bounds, part, part_corners);
+      part_hull.Build(part_corners);
+      part_hull.Output(hulls[p]);
+      hulls[p].bounds = part.bounds;
+      hulls[p].voxel_count = part.voxels;
+      hulls[p].volume = static_cast<float>(parts[p].volume6 / 6.0);
+    }
+  });
+}
@@ -0,0 +1,75 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_CONVEX_H
+#define VOX_CONVEX_H
+
+#include "vox_boxes.h"
+#include "vox_file.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// Convex hull of one part of a model, in voxel units with the model's
+// (0, 0, 0) corner at the origin. Triangles wind counter-clockwise when seen
+// from outside.
+struct ConvexHull {
+  std::vector<Vec3f> vertices;
+  std::vector<uint32_t> indices;
+  VoxelBox bounds;       // Tight bounds of the part's voxels
+  uint32_t voxel_count;  // Voxels of the part
+  float volume;          // Of the hull, in voxels
+};
+
+struct ConvexOptions {
+  // Most hulls to produce.
+  uint32_t max_hulls = 16;
+  // Parts are split while their hull holds an empty voxel whose center is
+  // more than this many voxels inside it. Staircases along slopes stay
+  // within about 0.7 voxels of the hull.
+  float max_concavity = 2.0f;
+  // Split planes tried per axis when splitting a part.
+  int split_candidates = 8;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Approximate convex decomposition of the occupancy of model, replacing the
+// contents of hulls; every occupied voxel lies inside one hull.
+//
+// Parts are the voxels of the model inside a box. Starting from the whole
+// model, the part with the most empty voxels deeper than max_concavity inside
+// its hull is split by the axis-aligned plane that leaves the least empty
+// space in the hulls of the two halves, until no part has such voxels or
+// there are max_hulls parts. Hulls are exact, over the corners of the first and last voxel of
+// each row (which span the same hull as all the voxels), with integer
+// predicates. Split candidates, and the final hulls of the parts, are
+// computed in parallel.
+void DecomposeConvex(const VoxDenseModel& model, std::vector<ConvexHull>& hulls,
+                     const ConvexOptions& options = ConvexOptions());
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,315 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_diff.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VOX_DIFF_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+// Runs closer than this are merged: a run costs 8 bytes, so resending a few
+// unchanged voxels is cheaper than starting a new one.
+constexpr uint32_t kMaxRunGap = 8;
+
+// Bytes in the serialized header: size, format, entry count, color count.
+constexpr size_t kSerializedHeaderSize = 12 + 1 + 4 + 4;
+
+int CountTrailingZeros(uint32_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, value);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(value);
+#endif
+}
+
+// Bit i is set if a[i] != b[i], for the 32 bytes at a and b.
+uint32_t DifferenceMask(const uint8_t* a, const uint8_t* b) {
+#if defined(__AVX2__)
+  const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+  const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+  return ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+#elif defined(VOX_DIFF_SSE2)
+  const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+  const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+  const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 16));
+  const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 16));
+  const uint32_t equal =
+      static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(a0, b0))) |
+      (static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(a1, b1))) << 16);
+  return ~equal;
+#else
+  uint64_t wa[4], wb[4];
+  memcpy(wa, a, 32);
+  memcpy(wb, b, 32);
+  if (((wa[0] ^ wb[0]) | (wa[1] ^ wb[1]) | (wa[2] ^ wb[2]) |
+       (wa[3] ^ wb[3])) == 0)
+    return 0;
+  uint32_t mask = 0;
+  for (int i = 0; i < 32; ++i) mask |= static_cast<uint32_t>(a[i] != b[i]) << i;
+  return mask;
+#endif
+}
+
+// Appends the index of every voxel in [begin, end) that differs.
+void FindChanges(const uint8_t* from, const uint8_t* to, uint32_t begin,
+                 uint32_t end, vector<uint32_t>& changed) {
+  uint32_t i = begin;
+  for (; i + 32 <= end; i += 32) {
+    uint32_t mask = DifferenceMask(from + i, to + i);
+    while (mask) {
+      changed.push_back(i + CountTrailingZeros(mask));
+      mask &= mask - 1;
+    }
+  }
+  for (; i < end; ++i) {
+    if (from[i] != to[i]) changed.push_back(i);
+  }
+}
+
+void PutU32(uint8_t* out, uint32_t value) {
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+  out[2] = static_cast<uint8_t>(value >> 16);
+  out[3] = static_cast<uint8_t>(value >> 24);
+}
+
+uint32_t GetU32(const uint8_t* in) {
+  return in[0] | (in[1] << 8) | (in[2] << 16) |
+         (static_cast<uint32_t>(in[3]) << 24);
+}
+
+[[noreturn]] void InvalidPatch(const char* message) {
+  throw VoxException(string("Invalid patch: ") + message);
+}
+
+}  // namespace
+
+void magicavoxel::DiffModels(const VoxDenseModel& from, const VoxDenseModel& to,
+                             VoxPatch& patch, PatchFormat format,
+                             const VoxRegion* region) {
+  const Size& size = from.size();
+  if (size.x != to.size().x || size.y != to.size().y || size.z != to.size().z)
+    throw VoxException("Cannot diff models of different sizes");
+
+  patch.size = size;
+  patch.runs.clear();
+  patch.indices.clear();
+  patch.colors.clear();
+
+  const uint8_t* a = from.data().data();
+  const uint8_t* b = to.data().data();
+  const uint32_t n_voxels = static_cast<uint32_t>(from.data().size());
+
+  // Changed voxel indices, in increasing order.
+  vector<uint32_t>& changed = patch.indices;
+  if (!region) {
+    FindChanges(a, b, 0, n_voxels, changed);
+  } else {
+    const Vec3i lo{min(region->min.x, size.x), min(region->min.y, size.y),
+                   min(region->min.z, size.z)};
+    const Vec3i hi{min(region->max.x, size.x), min(region->max.y, size.y),
+                   min(region->max.z, size.z)};
+    for (uint32_t z = lo.z; z < hi.z; ++z) {
+      for (uint32_t y = lo.y; y < hi.y; ++y) {
+        const uint32_t row = size.x * (y + size.y * z);
+        if (lo.x < hi.x) FindChanges(a, b, row + lo.x, row + hi.x, changed);
+      }
+    }
+  }
+
+  // Group the changes into runs, merging nearby ones.
+  uint32_t run_colors = 0;
+  for (uint32_t index : changed) {
+    if (!patch.runs.empty()) {
+      VoxPatchRun& last = patch.runs.back();
+      if (index - (last.start + last.length) <= kMaxRunGap) {
+        run_colors += index + 1 - (last.start + last.length);
+        last.length = index + 1 - last.start;
+        continue;
+      }
+    }
+    patch.runs.push_back({index, 1});
+    ++run_colors;
+  }
+
+  if (format == PatchFormat::kAuto) {
+    const size_t runs_bytes = patch.runs.size() * 8 + run_colors;
+    const size_t sparse_bytes = changed.size() * 5;
+    format = runs_bytes <= sparse_bytes ? PatchFormat::kRuns
+                                        : PatchFormat::kSparse;
+  }
+  patch.format = format;
+
+  if (format == PatchFormat::kRuns) {
+    patch.colors.reserve(run_colors);
+    for (const VoxPatchRun& run : patch.runs)
+      patch.colors.insert(patch.colors.end(), b + run.start,
+                          b + run.start + run.length);
+    patch.indices.clear();
+  } else {
+    patch.colors.reserve(changed.size());
+    for (uint32_t index : changed) patch.colors.push_back(b[index]);
+    patch.runs.clear();
+  }
+}
+
+void magicavoxel::ApplyPatch(const VoxPatch& patch, VoxDenseModel& model) {
+  const Size& size = model.size();
+  if (size.x != patch.size.x || size.y != patch.size.y ||
+      size.z != patch.size.z)
+    throw VoxException("Patch is for a model of a different size");
+
+  uint8_t* voxels = model.data().data();
+  const uint64_t n_voxels = model.data().size();
+  const uint8_t* color = patch.colors.data();
+  if (patch.format == PatchFormat::kSparse) {
+    if (patch.indices.size() != patch.colors.size())
+      InvalidPatch("color count does not match");
+    for (uint32_t index : patch.indices) {
+      if (index >= n_voxels) InvalidPatch("voxel outside of the model");
+    }
+    for (uint32_t index : patch.indices) voxels[index] = *color++;
+  } else {
+    uint64_t n_colors = 0;
+    for (const VoxPatchRun& run : patch.runs) {
+      if (static_cast<uint64_t>(run.start) + run.length > n_voxels)
+        InvalidPatch("run outside of the model");
+      n_colors += run.length;
+    }
+    if (n_colors != patch.colors.size())
+      InvalidPatch("color count does not match");
+    for (const VoxPatchRun& run : patch.runs) {
+      memcpy(voxels + run.start, color, run.length);
+      color += run.length;
+    }
+  }
+}
+
+size_t magicavoxel::SerializedPatchSize(const VoxPatch& patch) {
+  const size_t entries = patch.format == PatchFormat::kSparse
+                             ? patch.indices.size() * 4
+                             : patch.runs.size() * 8;
+  return kSerializedHeaderSize + entries + patch.colors.size();
+}
+
+void magicavoxel::SerializePatch(const VoxPatch& patch,
+                                 std::vector<uint8_t>& out) {
+  const bool sparse = patch.format == PatchFormat::kSparse;
+  const size_t start = out.size();
+  out.resize(start + SerializedPatchSize(patch));
+  uint8_t* p = out.data() + start;
+
+  PutU32(p, patch.size.x);
+  PutU32(p + 4, patch.size.y);
+  PutU32(p + 8, patch.size.z);
+  p[12] = static_cast<uint8_t>(sparse ? PatchFormat::kSparse : PatchFormat::kRuns);
+  PutU32(p + 13, static_cast<uint32_t>(sparse ? patch.indices.size()
+                                              : patch.runs.size()));
+  PutU32(p + 17, static_cast<uint32_t>(patch.colors.size()));
+  p += kSerializedHeaderSize;
+
+  if (sparse) {
+    for (uint32_t index : patch.indices) {
+      PutU32(p, index);
+      p += 4;
+    }
+  } else {
+    for (const VoxPatchRun& run : patch.runs) {
+      PutU32(p, run.start);
+      PutU32(p + 4, run.length);
+      p += 8;
+    }
+  }
+  if (!patch.colors.empty())
+    memcpy(p, patch.colors.data(), patch.colors.size());
+}
+
+VoxPatch magicavoxel::DeserializePatch(const uint8_t* data, size_t size) {
+  if (size < kSerializedHeaderSize) InvalidPatch("truncated header");
+
+  VoxPatch patch;
+  patch.size = {GetU32(data), GetU32(data + 4), GetU32(data + 8)};
+  const uint8_t format = data[12];
+  const uint32_t n_entries = GetU32(data + 13);
+  const uint32_t n_colors = GetU32(data + 17);
+  if (format != static_cast<uint8_t>(PatchFormat::kRuns) &&
+      format != static_cast<uint8_t>(PatchFormat::kSparse))
+    InvalidPatch("unknown format");
+  patch.format = static_cast<PatchFormat>(format);
+
+  const bool sparse = patch.format == PatchFormat::kSparse;
+  const uint64_t entry_bytes = static_cast<uint64_t>(n_entries) * (sparse ? 4 : 8);
+  if (entry_bytes + n_colors != size - kSerializedHeaderSize)
+    InvalidPatch("size does not match contents");
+
+  // Entries must be in increasing order and inside the model, as DiffModels
+  // writes them, and must account for exactly n_colors colors.
+  const uint64_t n_voxels =
+      static_cast<uint64_t>(patch.size.x) * patch.size.y * patch.size.z;
+  const uint8_t* p = data + kSerializedHeaderSize;
+  uint64_t next = 0;
+  uint64_t covered = 0;
+  if (sparse) {
+    patch.indices.resize(n_entries);
+    for (uint32_t i = 0; i < n_entries; ++i, p += 4) {
+      const uint32_t index = GetU32(p);
+      if (index < next || index >= n_voxels) InvalidPatch("bad voxel index");
+      patch.indices[i] = index;
+      next = index + 1ull;
+    }
+    covered = n_entries;
+  } else {
+    patch.runs.resize(n_entries);
+    for (uint32_t i = 0; i < n_entries; ++i, p += 8) {
+      const VoxPatchRun run{GetU32(p), GetU32(p + 4)};
+      if (run.start < next || run.length == 0 ||
+          run.start + static_cast<uint64_t>(run.length) > n_voxels)
+        InvalidPatch("bad run");
+      patch.runs[i] = run;
+      next = run.start + static_cast<uint64_t>(run.length);
+      covered += run.length;
+    }
+  }
+  if (covered != n_colors) InvalidPatch("color count does not match");
+
+  patch.colors.assign(p, p + n_colors);
+  return patch;
+}
@@ -0,0 +1,97 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_DIFF_H
+#define VOX_DIFF_H
+
+#include "vox_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// How a VoxPatch stores its changes.
+enum class PatchFormat : uint8_t {
+  kAuto,    // Whichever of the two below is smaller
+  kRuns,    // Runs of consecutive voxels: 8 bytes per run + 1 per voxel
+  kSparse   // Individual voxels: 5 bytes per voxel
+};
+
+// Span of consecutive voxels (in the memory order of VoxDenseModel) replaced
+// by a patch. Its new colors are the next length bytes of VoxPatch::colors.
+struct VoxPatchRun {
+  uint32_t start;
+  uint32_t length;
+};
+
+// The changes that turn one model into another of the same size. Exactly one
+// of runs and indices is used, depending on format; colors holds the new
+// color of each voxel they cover, in order.
+struct VoxPatch {
+  Size size{0, 0, 0};
+  PatchFormat format = PatchFormat::kRuns;
+  std::vector<VoxPatchRun> runs;
+  std::vector<uint32_t> indices;
+  std::vector<uint8_t> colors;
+
+  bool empty() const noexcept { return colors.empty(); }
+};
+
+// Inclusive-exclusive box of voxels, [min, max) on each axis.
+struct VoxRegion {
+  Vec3i min;
+  Vec3i max;
+};
+
+// Computes the patch that turns from into to, which must have the same size
+// (throws VoxException otherwise), replacing the contents of patch. Both
+// models are compared 32 bytes at a time with SIMD; unchanged stretches cost
+// one compare per block.
+//
+// Scanning all of a 256^3 model reads 32 MB, which takes a few milliseconds.
+// Editors that know where edits happened should pass that region, so only it
+// is scanned; everything outside of it must be unchanged.
+void DiffModels(const VoxDenseModel& from, const VoxDenseModel& to,
+                VoxPatch& patch, PatchFormat format = PatchFormat::kAuto,
+                const VoxRegion* region = nullptr);
+
+// Applies a patch to a model of the size it was made for. Throws VoxException
+// if the sizes differ or the patch refers to voxels outside of the model.
+void ApplyPatch(const VoxPatch& patch, VoxDenseModel& model);
+
+// Size of the patch in its serialized form.
+size_t SerializedPatchSize(const VoxPatch& patch);
+
+// Appends the patch to out in a compact little-endian form, for sending it
+// elsewhere.
+void SerializePatch(const VoxPatch& patch, std::vector<uint8_t>& out);
+
+// Reads a patch written by SerializePatch, checking that it is well-formed
+// (it may come from an untrusted peer). Throws VoxException if it is not.
+VoxPatch DeserializePatch(const uint8_t* data, size_t size);
+
+}  // namespace magicavoxel
+#endif
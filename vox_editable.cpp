@@ -0,0 +1,167 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_editable.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace magicavoxel;
+using namespace std;
+
+constexpr uint32_t VoxEditableModel::kPageBricks;
+
+VoxEditableModel::VoxEditableModel(const VoxDenseModel& model)
+    : size_(model.size()),
+      brick_count_{(size_.x + kBrickSize - 1) / kBrickSize,
+                   (size_.y + kBrickSize - 1) / kBrickSize,
+                   (size_.z + kBrickSize - 1) / kBrickSize},
+      palette_(model.palette()) {
+  const uint32_t n_bricks = brick_count_.x * brick_count_.y * brick_count_.z;
+  Version initial;
+  initial.pages.resize((n_bricks + kPageBricks - 1) / kPageBricks);
+
+  // Copy the model in, brick by brick, leaving empty bricks (and pages) null.
+  const uint8_t* voxels = model.data().data();
+  Brick brick;
+  for (uint32_t bz = 0; bz < brick_count_.z; ++bz) {
+    for (uint32_t by = 0; by < brick_count_.y; ++by) {
+      for (uint32_t bx = 0; bx < brick_count_.x; ++bx) {
+        brick.fill(0);
+        bool empty = true;
+        const uint32_t x0 = bx * kBrickSize, y0 = by * kBrickSize,
+                       z0 = bz * kBrickSize;
+        const uint32_t w = min(kBrickSize, size_.x - x0);
+        for (uint32_t z = z0; z < min(z0 + kBrickSize, size_.z); ++z) {
+          for (uint32_t y = y0; y < min(y0 + kBrickSize, size_.y); ++y) {
+            const uint8_t* row =
+                voxels + x0 + size_.x * (y + static_cast<size_t>(size_.y) * z);
+            memcpy(&brick[LocalIndex(0, y, z)], row, w);
+            for (uint32_t i = 0; i < w; ++i) empty &= row[i] == 0;
+          }
+        }
+        if (empty) continue;
+
+        const uint32_t index = BrickIndex(x0, y0, z0);
+        shared_ptr<Page>& page = initial.pages[index / kPageBricks];
+        if (!page) page = make_shared<Page>();
+        page->bricks[index % kPageBricks] = make_shared<Brick>(brick);
+      }
+    }
+  }
+  versions_.push_back(std::move(initial));
+}
+
+void VoxEditableModel::SetVoxel(uint32_t x, uint32_t y, uint32_t z,
+                                uint8_t color) {
+  if (voxel(x, y, z) == color) return;
+  if (!dirty_) {
+    working_ = versions_[current_];
+    dirty_ = true;
+  }
+
+  const uint32_t index = BrickIndex(x, y, z);
+  shared_ptr<Page>& page = working_.pages[index / kPageBricks];
+  if (!page) {
+    page = make_shared<Page>();
+  } else if (page.use_count() > 1) {
+    page = make_shared<Page>(*page);
+  }
+
+  shared_ptr<Brick>& brick = page->bricks[index % kPageBricks];
+  if (!brick) {
+    brick = make_shared<Brick>();
+    brick->fill(0);
+  } else if (brick.use_count() > 1) {
+    brick = make_shared<Brick>(*brick);
+  }
+  (*brick)[LocalIndex(x, y, z)] = color;
+}
+
+void VoxEditableModel::Commit() {
+  if (!dirty_) return;
+  versions_.erase(versions_.begin() + current_ + 1, versions_.end());
+  versions_.push_back(std::move(working_));
+  working_ = Version();
+  dirty_ = false;
+  current_ = versions_.size() - 1;
+
+  if (history_limit_ && versions_.size() > history_limit_) {
+    const size_t n_dropped = versions_.size() - history_limit_;
+    versions_.erase(versions_.begin(), versions_.begin() + n_dropped);
+    current_ -= n_dropped;
+  }
+}
+
+bool VoxEditableModel::Undo() {
+  Commit();
+  if (current_ == 0) return false;
+  --current_;
+  return true;
+}
+
+bool VoxEditableModel::Redo() {
+  if (!canRedo()) return false;
+  ++current_;
+  return true;
+}
+
+void VoxEditableModel::SetHistoryLimit(size_t max_versions) {
+  history_limit_ = max_versions;
+  if (!history_limit_ || versions_.size() <= history_limit_) return;
+
+  // Drop the oldest versions, but never the current one.
+  const size_t n_dropped =
+      min(versions_.size() - history_limit_, current_);
+  versions_.erase(versions_.begin(), versions_.begin() + n_dropped);
+  current_ -= n_dropped;
+}
+
+VoxDenseModel VoxEditableModel::ToDense() const {
+  VoxDenseModel model(size_, palette_);
+  uint8_t* voxels = model.data().data();
+  const Version& version = state();
+  for (uint32_t bz = 0; bz < brick_count_.z; ++bz) {
+    for (uint32_t by = 0; by < brick_count_.y; ++by) {
+      for (uint32_t bx = 0; bx < brick_count_.x; ++bx) {
+        const uint32_t x0 = bx * kBrickSize, y0 = by * kBrickSize,
+                       z0 = bz * kBrickSize;
+        const uint32_t index = BrickIndex(x0, y0, z0);
+        const Page* page = version.pages[index / kPageBricks].get();
+        const Brick* brick =
+            page ? page->bricks[index % kPageBricks].get() : nullptr;
+        if (!brick) continue;
+
+        const uint32_t w = min(kBrickSize, size_.x - x0);
+        for (uint32_t z = z0; z < min(z0 + kBrickSize, size_.z); ++z) {
+          for (uint32_t y = y0; y < min(y0 + kBrickSize, size_.y); ++y) {
+            memcpy(voxels + x0 + size_.x * (y + static_cast<size_t>(size_.y) * z),
+                   &(*brick)[LocalIndex(0, y, z)], w);
+          }
+        }
+      }
+    }
+  }
+  return model;
+}
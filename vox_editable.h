@@ -0,0 +1,131 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_EDITABLE_H
+#define VOX_EDITABLE_H
+
+#include "vox_brick.h"
+#include "vox_file.h"
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace magicavoxel {
+
+// A dense model with an undo/redo history. Edits are grouped into batches
+// with Commit(); each batch makes a new version of the model.
+//
+// Versions share their unchanged data: the model is stored as 8x8x8 bricks,
+// grouped into pages of 64 bricks, all reference-counted. Editing a voxel
+// copies its brick (and page) the first time they change in a batch, so a
+// version costs the bricks it changed plus a small table of pages (8 KB for
+// a 256^3 model) rather than a full copy. Undo and Redo just switch versions.
+//
+// Not thread-safe.
+class VoxEditableModel {
+ public:
+  explicit VoxEditableModel(const VoxDenseModel& model);
+
+  const Size& size() const noexcept { return size_; }
+  const Palette& palette() const noexcept { return palette_; }
+  Palette& palette() noexcept { return palette_; }
+
+  uint8_t voxel(uint32_t x, uint32_t y, uint32_t z) const {
+    const uint32_t brick = BrickIndex(x, y, z);
+    const Page* page = state().pages[brick / kPageBricks].get();
+    const Brick* b = page ? page->bricks[brick % kPageBricks].get() : nullptr;
+    return b ? (*b)[LocalIndex(x, y, z)] : 0;
+  }
+
+  // Changes a voxel, as part of the current (uncommitted) batch.
+  void SetVoxel(uint32_t x, uint32_t y, uint32_t z, uint8_t color);
+
+  // Ends the current batch of edits, making it a new version that Undo()
+  // returns from. Versions that were undone can no longer be redone. Does
+  // nothing if there were no edits.
+  void Commit();
+
+  // Goes back one version, committing any pending edits first (so they can
+  // be redone). Returns false if there is nothing to undo.
+  bool Undo();
+  // Goes forward one undone version. Returns false if there is none (or
+  // there are pending edits).
+  bool Redo();
+
+  bool canUndo() const noexcept { return dirty_ || current_ > 0; }
+  bool canRedo() const noexcept { return !dirty_ && current_ + 1 < versions_.size(); }
+
+  // Limits how many versions are kept; the oldest are dropped beyond it.
+  void SetHistoryLimit(size_t max_versions);
+
+  // Copies the current state into a dense model.
+  VoxDenseModel ToDense() const;
+
+ private:
+  using Brick = std::array<uint8_t, kBrickSize * kBrickSize * kBrickSize>;
+  static constexpr uint32_t kPageBricks = 64;
+
+  // A page or brick pointer that is null stands for all-empty voxels.
+  struct Page {
+    std::array<std::shared_ptr<Brick>, kPageBricks> bricks;
+  };
+  struct Version {
+    std::vector<std::shared_ptr<Page>> pages;
+  };
+
+  static uint32_t LocalIndex(uint32_t x, uint32_t y, uint32_t z) {
+    return (x % kBrickSize) + kBrickSize * ((y % kBrickSize) +
+                                            kBrickSize * (z % kBrickSize));
+  }
+  uint32_t BrickIndex(uint32_t x, uint32_t y, uint32_t z) const {
+    return x / kBrickSize +
+           brick_count_.x * (y / kBrickSize + brick_count_.y * (z / kBrickSize));
+  }
+
+  // The state reads see: the pending batch if there is one, else the current
+  // version.
+  const Version& state() const noexcept {
+    return dirty_ ? working_ : versions_[current_];
+  }
+
+  Size size_;
+  Size brick_count_;
+  Palette palette_;
+
+  std::deque<Version> versions_;
+  size_t current_ = 0;
+  size_t history_limit_ = 0;  // 0 = unlimited
+
+  // Pending edits: a copy of the current version's page table, whose pages
+  // and bricks are copied on their first write. Data is private to working_
+  // (and so safe to write) when working_ holds the only reference.
+  Version working_;
+  bool dirty_ = false;
+};
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,624 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_export.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+// Size of the write buffer, and of the blocks vertices are converted in.
+constexpr size_t kWriteBufferSize = 1 << 20;
+constexpr size_t kVertexBlock = 4096;
+
+// Unit normal of each Face.
+constexpr float kFaceNormals[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0},
+                                      {0, 1, 0},  {0, 0, -1}, {0, 0, 1}};
+
+// One model's mesh within an export, and where it is placed.
+struct ExportPart {
+  const VoxMesh* mesh;
+  float offset_x;  // In voxels
+};
+
+// Buffered binary/text output to a file.
+class FileWriter {
+ public:
+  explicit FileWriter(const string& path) : path_(path), buffer_(kWriteBufferSize) {
+    file_ = fopen(path.c_str(), "wb");
+    if (!file_) throw VoxException("Could not create '" + path + "'");
+  }
+  ~FileWriter() {
+    if (file_) fclose(file_);
+  }
+  FileWriter(const FileWriter&) = delete;
+  FileWriter& operator=(const FileWriter&) = delete;
+
+  void Write(const void* data, size_t size) {
+    if (!size) return;
+    if (used_ + size > buffer_.size()) {
+      Flush();
+      if (size > buffer_.size()) {
+        Put(data, size);
+        return;
+      }
+    }
+    memcpy(buffer_.data() + used_, data, size);
+    used_ += size;
+  }
+  void Print(const char* text) { Write(text, strlen(text)); }
+  void Print(const string& text) { Write(text.data(), text.size()); }
+
+  // Writes a float as text, as an integer when it is one (the common case
+  // for voxel positions), which is much faster than printf.
+  void PrintFloat(float value) {
+    char text[32];
+    int length;
+    if (value == floor(value) && fabs(value) < 1e9f) {
+      long long integer = static_cast<long long>(value);
+      char* end = text + sizeof(text);
+      char* p = end;
+      const bool negative = integer < 0;
+      if (negative) integer = -integer;
+      do {
+        *--p = static_cast<char>('0' + integer % 10);
+        integer /= 10;
+      } while (integer);
+      if (negative) *--p = '-';
+      Write(p, end - p);
+      return;
+    }
+    length = snprintf(text, sizeof(text), "%.6g", value);
+    Write(text, length);
+  }
+
+  void PutU32(uint32_t value) {
+    const uint8_t bytes[4] = {
+        static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8),
+        static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24)};
+    Write(bytes, 4);
+  }
+
+  void Close() {
+    Flush();
+    const bool failed = fclose(file_) != 0;
+    file_ = nullptr;
+    if (failed) throw VoxException("Could not write '" + path_ + "'");
+  }
+
+ private:
+  void Flush() {
+    Put(buffer_.data(), used_);
+    used_ = 0;
+  }
+  void Put(const void* data, size_t size) {
+    if (size && fwrite(data, 1, size, file_) != size)
+      throw VoxException("Could not write '" + path_ + "'");
+  }
+
+  string path_;
+  FILE* file_;
+  vector<char> buffer_;
+  size_t used_ = 0;
+};
+
+// Appends a little-endian value to a byte block.
+void AppendF32(vector<uint8_t>& out, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, 4);
+  for (int i = 0; i < 4; ++i) out.push_back(static_cast<uint8_t>(bits >> (8 * i)));
+}
+void AppendU32(vector<uint8_t>& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+void AppendU16(vector<uint8_t>& out, uint16_t value) {
+  out.push_back(static_cast<uint8_t>(value));
+  out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+// PNG of the palette as a 256x1 RGBA image. Uses an uncompressed (stored)
+// deflate block, which needs no compressor and is only ~1 KB.
+vector<uint8_t> PalettePng(const Palette& palette) {
+  uint32_t crc_table[256];
+  for (uint32_t n = 0; n < 256; ++n) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    crc_table[n] = c;
+  }
+
+  vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  auto chunk = [&](const char* type, const vector<uint8_t>& data) {
+    for (int i = 3; i >= 0; --i)
+      png.push_back(static_cast<uint8_t>(data.size() >> (8 * i)));
+    const size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = start; i < png.size(); ++i)
+      crc = crc_table[(crc ^ png[i]) & 0xff] ^ (crc >> 8);
+    crc ^= 0xffffffffu;
+    for (int i = 3; i >= 0; --i) png.push_back(static_cast<uint8_t>(crc >> (8 * i)));
+  };
+
+  // 256 x 1, 8 bits per channel, RGBA.
+  chunk("IHDR", {0, 0, 1, 0, 0, 0, 0, 1, 8, 6, 0, 0, 0});
+
+  vector<uint8_t> scanline = {0};  // Filter type: none
+  for (const Color& color : palette) {
+    scanline.insert(scanline.end(), {color.r, color.g, color.b, color.a});
+  }
+  uint32_t a = 1, b = 0;
+  for (uint8_t byte : scanline) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  const uint16_t length = static_cast<uint16_t>(scanline.size());
+  vector<uint8_t> zlib = {0x78, 0x01, 0x01};  // Header, final stored block
+  AppendU16(zlib, length);
+  AppendU16(zlib, static_cast<uint16_t>(~length));
+  zlib.insert(zlib.end(), scanline.begin(), scanline.end());
+  const uint32_t adler = (b << 16) | a;
+  for (int i = 3; i >= 0; --i) zlib.push_back(static_cast<uint8_t>(adler >> (8 * i)));
+  chunk("IDAT", zlib);
+  chunk("IEND", {});
+  return png;
+}
+
+// Texture coordinate of the middle of a palette entry's texel.
+float PaletteU(uint8_t color) { return (color + 0.5f) / 256.0f; }
+
+string PathWithoutExtension(const string& path) {
+  const size_t slash = path.find_last_of("/\\");
+  const size_t dot = path.find_last_of('.');
+  if (dot == string::npos || (slash != string::npos && dot < slash)) return path;
+  return path.substr(0, dot);
+}
+
+string FileName(const string& path) {
+  const size_t slash = path.find_last_of("/\\");
+  return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+void WritePly(const string& path, const vector<ExportPart>& parts,
+              const Palette& palette, const ExportOptions& options) {
+  size_t n_vertices = 0, n_triangles = 0;
+  for (const ExportPart& part : parts) {
+    n_vertices += part.mesh->vertices.size();
+    n_triangles += part.mesh->indices.size() / 3;
+  }
+
+  FileWriter out(path);
+  ostringstream header;
+  header << "ply\nformat binary_little_endian 1.0\n"
+         << "element vertex " << n_vertices << "\n"
+         << "property float x\nproperty float y\nproperty float z\n"
+         << "property float nx\nproperty float ny\nproperty float nz\n"
+         << "property uchar red\nproperty uchar green\nproperty uchar blue\n"
+         << "property uchar alpha\n"
+         << "element face " << n_triangles << "\n"
+         << "property list uchar uint vertex_indices\nend_header\n";
+  out.Print(header.str());
+
+  vector<uint8_t> block;
+  block.reserve(kVertexBlock * 28);
+  for (const ExportPart& part : parts) {
+    const vector<MeshVertex>& vertices = part.mesh->vertices;
+    for (size_t start = 0; start < vertices.size(); start += kVertexBlock) {
+      block.clear();
+      const size_t end = min(vertices.size(), start + kVertexBlock);
+      for (size_t i = start; i < end; ++i) {
+        const MeshVertex& v = vertices[i];
+        const float* normal = kFaceNormals[v.face];
+        const Color& color = palette[v.color];
+        AppendF32(block, (v.x + part.offset_x) * options.scale);
+        AppendF32(block, v.y * options.scale);
+        AppendF32(block, v.z * options.scale);
+        AppendF32(block, normal[0]);
+        AppendF32(block, normal[1]);
+        AppendF32(block, normal[2]);
+        block.insert(block.end(), {color.r, color.g, color.b, color.a});
+      }
+      out.Write(block.data(), block.size());
+    }
+  }
+
+  uint32_t base = 0;
+  for (const ExportPart& part : parts) {
+    const vector<uint32_t>& indices = part.mesh->indices;
+    for (size_t start = 0; start < indices.size(); start += 3 * kVertexBlock) {
+      block.clear();
+      const size_t end = min(indices.size(), start + 3 * kVertexBlock);
+      for (size_t i = start; i + 2 < end; i += 3) {
+        block.push_back(3);
+        AppendU32(block, base + indices[i]);
+        AppendU32(block, base + indices[i + 1]);
+        AppendU32(block, base + indices[i + 2]);
+      }
+      out.Write(block.data(), block.size());
+    }
+    base += static_cast<uint32_t>(part.mesh->vertices.size());
+  }
+  out.Close();
+}
+
+void WriteObj(const string& path, const vector<ExportPart>& parts,
+              const Palette& palette, const ExportOptions& options) {
+  const string base_path = PathWithoutExtension(path);
+  FileWriter out(path);
+  out.Print("# Exported from MagicaVoxel .vox\n");
+
+  if (options.palette_texture) {
+    const string name = FileName(base_path);
+    out.Print("mtllib " + name + ".mtl\n");
+
+    FileWriter mtl(base_path + ".mtl");
+    mtl.Print("newmtl palette\nKa 1 1 1\nKd 1 1 1\nKs 0 0 0\nd 1\nillum 1\n");
+    mtl.Print("map_Kd " + name + ".png\n");
+    mtl.Close();
+
+    const vector<uint8_t> png = PalettePng(palette);
+    FileWriter texture(base_path + ".png");
+    texture.Write(png.data(), png.size());
+    texture.Close();
+
+    for (int i = 0; i < 256; ++i) {
+      out.Print("vt ");
+      out.PrintFloat(PaletteU(static_cast<uint8_t>(i)));
+      out.Print(" 0.5\n");
+    }
+  }
+  for (const auto& normal : kFaceNormals) {
+    out.Print("vn ");
+    out.PrintFloat(normal[0]);
+    out.Print(" ");
+    out.PrintFloat(normal[1]);
+    out.Print(" ");
+    out.PrintFloat(normal[2]);
+    out.Print("\n");
+  }
+
+  // Vertex colors as 0..1 fractions, formatted once per palette entry.
+  char color_text[256][40];
+  for (int i = 0; i < 256; ++i) {
+    snprintf(color_text[i], sizeof(color_text[i]), " %.4g %.4g %.4g",
+             palette[i].r / 255.0, palette[i].g / 255.0, palette[i].b / 255.0);
+  }
+
+  char face_text[96];
+  uint32_t base = 1;  // OBJ indices start at 1
+  for (size_t p = 0; p < parts.size(); ++p) {
+    const ExportPart& part = parts[p];
+    out.Print("o model_" + to_string(p) + "\n");
+    if (options.palette_texture) out.Print("usemtl palette\n");
+
+    const vector<MeshVertex>& vertices = part.mesh->vertices;
+    for (const MeshVertex& v : vertices) {
+      out.Print("v ");
+      out.PrintFloat((v.x + part.offset_x) * options.scale);
+      out.Print(" ");
+      out.PrintFloat(v.y * options.scale);
+      out.Print(" ");
+      out.PrintFloat(v.z * options.scale);
+      if (!options.palette_texture) out.Print(color_text[v.color]);
+      out.Print("\n");
+    }
+
+    const vector<uint32_t>& indices = part.mesh->indices;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      uint32_t corner[3];
+      for (int c = 0; c < 3; ++c) corner[c] = indices[i + c];
+      const MeshVertex& first = vertices[corner[0]];
+      const unsigned normal = first.face + 1u;
+      int length;
+      if (options.palette_texture) {
+        const unsigned uv = first.color + 1u;
+        length = snprintf(face_text, sizeof(face_text),
+                          "f %u/%u/%u %u/%u/%u %u/%u/%u\n", base + corner[0],
+                          uv, normal, base + corner[1], uv, normal,
+                          base + corner[2], uv, normal);
+      } else {
+        length = snprintf(face_text, sizeof(face_text), "f %u//%u %u//%u %u//%u\n",
+                          base + corner[0], normal, base + corner[1], normal,
+                          base + corner[2], normal);
+      }
+      out.Write(face_text, length);
+    }
+    base += static_cast<uint32_t>(vertices.size());
+  }
+  out.Close();
+}
+
+// Binary glTF: a JSON chunk describing one node and mesh per part, and a
+// binary chunk with, per part, positions, normals, colors (or texture
+// coordinates) and indices, then the palette PNG if textured.
+//
+// glTF forbids empty accessors, buffer views and top-level arrays, so parts
+// without triangles are left out (keeping the model_i names of the others),
+// and arrays and the binary chunk are only written when they have entries.
+void WriteGlb(const string& path, const vector<ExportPart>& all_parts,
+              const Palette& palette, const ExportOptions& options) {
+  vector<ExportPart> parts;
+  vector<size_t> names;
+  for (size_t p = 0; p < all_parts.size(); ++p) {
+    if (all_parts[p].mesh->indices.empty()) continue;
+    parts.push_back(all_parts[p]);
+    names.push_back(p);
+  }
+  const bool textured = options.palette_texture;
+  const size_t color_size = 8;  // float2 UV, or normalized ushort4 color
+  const vector<uint8_t> png = textured ? PalettePng(palette) : vector<uint8_t>();
+
+  // Buffer layout (every view 4-byte aligned; all element sizes are
+  // multiples of 4).
+  struct PartLayout {
+    size_t positions, normals, colors, indices;
+    float min[3], max[3];
+  };
+  vector<PartLayout> layouts(parts.size());
+  size_t offset = 0;
+  for (size_t p = 0; p < parts.size(); ++p) {
+    const VoxMesh& mesh = *parts[p].mesh;
+    const size_t n = mesh.vertices.size();
+    PartLayout& layout = layouts[p];
+    layout.positions = offset;
+    offset += n * 12;
+    layout.normals = offset;
+    offset += n * 12;
+    layout.colors = offset;
+    offset += n * color_size;
+    layout.indices = offset;
+    offset += mesh.indices.size() * 4;
+
+    for (int a = 0; a < 3; ++a) {
+      layout.min[a] = n ? 1e30f : 0;
+      layout.max[a] = n ? -1e30f : 0;
+    }
+    for (const MeshVertex& v : mesh.vertices) {
+      const float position[3] = {(v.x + parts[p].offset_x) * options.scale,
+                                 v.z * options.scale, -v.y * options.scale};
+      for (int a = 0; a < 3; ++a) {
+        layout.min[a] = min(layout.min[a], position[a]);
+        layout.max[a] = max(layout.max[a], position[a]);
+      }
+    }
+  }
+  const size_t png_offset = offset;
+  offset += png.size();
+  const size_t bin_size = (offset + 3) & ~size_t{3};
+
+  ostringstream json;
+  json.precision(9);
+  json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"vox_export\"},"
+       << "\"scene\":0,\"scenes\":[{";
+  if (!parts.empty()) {
+    json << "\"nodes\":[";
+    for (size_t p = 0; p < parts.size(); ++p) json << (p ? "," : "") << p;
+    json << "]";
+  }
+  json << "}],";
+  if (!parts.empty()) json << "\"nodes\":[";
+  for (size_t p = 0; p < parts.size(); ++p)
+    json << (p ? "," : "") << "{\"mesh\":" << p << ",\"name\":\"model_"
+         << names[p] << "\"}";
+  if (!parts.empty()) json << "],\"meshes\":[";
+  for (size_t p = 0; p < parts.size(); ++p) {
+    const size_t a = 4 * p;
+    json << (p ? "," : "") << "{\"primitives\":[{\"attributes\":{"
+         << "\"POSITION\":" << a << ",\"NORMAL\":" << a + 1
+         << (textured ? ",\"TEXCOORD_0\":" : ",\"COLOR_0\":") << a + 2
+         << "},\"indices\":" << a + 3 << ",\"material\":0}]}";
+  }
+  if (!parts.empty()) json << "],\"accessors\":[";
+  for (size_t p = 0; p < parts.size(); ++p) {
+    const PartLayout& layout = layouts[p];
+    const size_t n = parts[p].mesh->vertices.size();
+    const size_t v = 4 * p;
+    json << (p ? "," : "")
+         << "{\"bufferView\":" << v << ",\"componentType\":5126,\"count\":" << n
+         << ",\"type\":\"VEC3\",\"min\":[" << layout.min[0] << ","
+         << layout.min[1] << "," << layout.min[2] << "],\"max\":["
+         << layout.max[0] << "," << layout.max[1] << "," << layout.max[2]
+         << "]},"
+         << "{\"bufferView\":" << v + 1
+         << ",\"componentType\":5126,\"count\":" << n << ",\"type\":\"VEC3\"},";
+    if (textured)
+      json << "{\"bufferView\":" << v + 2
+           << ",\"componentType\":5126,\"count\":" << n
+           << ",\"type\":\"VEC2\"},";
+    else
+      json << "{\"bufferView\":" << v + 2
+           << ",\"componentType\":5123,\"normalized\":true,\"count\":" << n
+           << ",\"type\":\"VEC4\"},";
+    json << "{\"bufferView\":" << v + 3
+         << ",\"componentType\":5125,\"count\":"
+         << parts[p].mesh->indices.size() << ",\"type\":\"SCALAR\"}";
+  }
+  if (!parts.empty()) json << "],";
+  if (!parts.empty() || textured) json << "\"bufferViews\":[";
+  for (size_t p = 0; p < parts.size(); ++p) {
+    const PartLayout& layout = layouts[p];
+    const size_t n = parts[p].mesh->vertices.size();
+    json << (p ? "," : "")
+         << "{\"buffer\":0,\"byteOffset\":" << layout.positions
+         << ",\"byteLength\":" << n * 12 << ",\"target\":34962},"
+         << "{\"buffer\":0,\"byteOffset\":" << layout.normals
+         << ",\"byteLength\":" << n * 12 << ",\"target\":34962},"
+         << "{\"buffer\":0,\"byteOffset\":" << layout.colors
+         << ",\"byteLength\":" << n * color_size << ",\"target\":34962},"
+         << "{\"buffer\":0,\"byteOffset\":" << layout.indices
+         << ",\"byteLength\":" << parts[p].mesh->indices.size() * 4
+         << ",\"target\":34963}";
+  }
+  if (textured) {
+    json << (parts.empty() ? "" : ",") << "{\"buffer\":0,\"byteOffset\":"
+         << png_offset << ",\"byteLength\":" << png.size() << "}";
+  }
+  if (!parts.empty() || textured)
+    json << "],\"buffers\":[{\"byteLength\":" << bin_size << "}],";
+  if (textured) {
+    json << "\"images\":[{\"bufferView\":" << 4 * parts.size()
+         << ",\"mimeType\":\"image/png\"}],"
+         << "\"samplers\":[{\"magFilter\":9728,\"minFilter\":9728,"
+         << "\"wrapS\":33071,\"wrapT\":33071}],"
+         << "\"textures\":[{\"sampler\":0,\"source\":0}],"
+         << "\"materials\":[{\"pbrMetallicRoughness\":{\"baseColorTexture\":"
+         << "{\"index\":0},\"metallicFactor\":0}}]}";
+  } else {
+    json << "\"materials\":[{\"pbrMetallicRoughness\":{\"metallicFactor\":0}}]}";
+  }
+  string json_text = json.str();
+  json_text.resize((json_text.size() + 3) & ~size_t{3}, ' ');
+
+  FileWriter out(path);
+  out.Print("glTF");
+  out.PutU32(2);
+  const size_t bin_chunk = bin_size ? 8 + bin_size : 0;
+  out.PutU32(static_cast<uint32_t>(12 + 8 + json_text.size() + bin_chunk));
+  out.PutU32(static_cast<uint32_t>(json_text.size()));
+  out.Print("JSON");
+  out.Print(json_text);
+  if (!bin_size) {
+    out.Close();
+    return;
+  }
+  out.PutU32(static_cast<uint32_t>(bin_size));
+  out.Write("BIN\0", 4);
+
+  // glTF vertex colors are linear.
+  uint16_t linear[256][4];
+  if (!textured) {
+    PaletteViews views;
+    ComputePaletteViews(palette, views);
+    for (int i = 0; i < 256; ++i) {
+      const ColorF& color = views.linear[i];
+      const float channels[4] = {color.r, color.g, color.b, color.a};
+      for (int c = 0; c < 4; ++c)
+        linear[i][c] = static_cast<uint16_t>(channels[c] * 65535.0f + 0.5f);
+    }
+  }
+
+  vector<uint8_t> block;
+  block.reserve(kVertexBlock * 12);
+  for (const ExportPart& part : parts) {
+    const vector<MeshVertex>& vertices = part.mesh->vertices;
+    for (int attribute = 0; attribute < 3; ++attribute) {
+      for (size_t start = 0; start < vertices.size(); start += kVertexBlock) {
+        block.clear();
+        const size_t end = min(vertices.size(), start + kVertexBlock);
+        for (size_t i = start; i < end; ++i) {
+          const MeshVertex& v = vertices[i];
+          if (attribute == 0) {
+            AppendF32(block, (v.x + part.offset_x) * options.scale);
+            AppendF32(block, v.z * options.scale);
+            AppendF32(block, -v.y * options.scale);
+          } else if (attribute == 1) {
+            const float* normal = kFaceNormals[v.face];
+            AppendF32(block, normal[0]);
+            AppendF32(block, normal[2]);
+            AppendF32(block, -normal[1]);
+          } else if (textured) {
+            AppendF32(block, PaletteU(v.color));
+            AppendF32(block, 0.5f);
+          } else {
+            for (int c = 0; c < 4; ++c) AppendU16(block, linear[v.color][c]);
+          }
+        }
+        out.Write(block.data(), block.size());
+      }
+    }
+    const vector<uint32_t>& indices = part.mesh->indices;
+    for (size_t start = 0; start < indices.size(); start += kVertexBlock) {
+      block.clear();
+      const size_t end = min(indices.size(), start + kVertexBlock);
+      for (size_t i = start; i < end; ++i) AppendU32(block, indices[i]);
+      out.Write(block.data(), block.size());
+    }
+  }
+  out.Write(png.data(), png.size());
+  static const char kZeros[4] = {};
+  out.Write(kZeros, bin_size - offset);
+  out.Close();
+}
+
+void WriteParts(const string& path, ExportFormat format,
+                const vector<ExportPart>& parts, const Palette& palette,
+                const ExportOptions& options) {
+  switch (format) {
+    case ExportFormat::kGlb:
+      WriteGlb(path, parts, palette, options);
+      break;
+    case ExportFormat::kPly:
+      WritePly(path, parts, palette, options);
+      break;
+    case ExportFormat::kObj:
+      WriteObj(path, parts, palette, options);
+      break;
+  }
+}
+
+}  // namespace
+
+void magicavoxel::ExportMesh(const std::string& path, ExportFormat format,
+                             const VoxMesh& mesh, const Palette& palette,
+                             const ExportOptions& options) {
+  WriteParts(path, format, {ExportPart{&mesh, 0}}, palette, options);
+}
+
+void magicavoxel::ExportVoxFile(const std::string& path, ExportFormat format,
+                                const VoxFile& file, bool merge,
+                                const ExportOptions& options) {
+  const vector<VoxDenseModel>& models = file.denseModels();
+  if (models.empty())
+    throw VoxException("Exporting requires a VoxFile loaded with dense models");
+  if (merge) {
+    vector<VoxMesh> meshes(models.size());
+    vector<ExportPart> parts;
+    float offset_x = 0;
+    for (size_t i = 0; i < models.size(); ++i) {
+      MeshModel(models[i], meshes[i]);
+      parts.push_back({&meshes[i], offset_x});
+      offset_x += models[i].size().x + 1;  // One voxel of space between
+    }
+    WriteParts(path, format, parts, file.palette(), options);
+    return;
+  }
+
+  // One mesh buffer, reused for every model.
+  const string base = PathWithoutExtension(path);
+  const string extension = path.substr(base.size());
+  VoxMesh mesh;
+  for (size_t i = 0; i < models.size(); ++i) {
+    MeshModel(models[i], mesh);
+    ExportMesh(base + "_" + to_string(i) + extension, format, mesh,
+               file.palette(), options);
+  }
+}
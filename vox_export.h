@@ -0,0 +1,73 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_EXPORT_H
+#define VOX_EXPORT_H
+
+#include "vox_file.h"
+#include "vox_mesh.h"
+
+#include <string>
+
+namespace magicavoxel {
+
+enum class ExportFormat {
+  kGlb,  // Binary glTF 2.0
+  kPly,  // Binary little-endian PLY
+  kObj   // Wavefront OBJ (text)
+};
+
+struct ExportOptions {
+  // Color the mesh through texture coordinates into a 256x1 palette texture
+  // (written into the .glb, or next to the .obj as <name>.png with a .mtl)
+  // rather than with per-vertex colors. PLY always uses vertex colors.
+  bool palette_texture = false;
+
+  // Size of one voxel in the exported units.
+  float scale = 1.0f;
+};
+
+// Writes a mesh made by MeshModel to a file. Vertices are converted from the
+// mesher's buffers in blocks and written with large buffered writes.
+//
+// OBJ and PLY keep MagicaVoxel's axes (z up); glTF is y-up, so positions are
+// rotated to (x, z, -y) there. Throws VoxException if the file cannot be
+// written.
+void ExportMesh(const std::string& path, ExportFormat format,
+                const VoxMesh& mesh, const Palette& palette,
+                const ExportOptions& options = ExportOptions());
+
+// Meshes every dense model of a loaded VoxFile and exports it.
+//
+// With merge, all models go into the one file at path, as separate objects
+// (glTF nodes, OBJ groups) placed side by side along x, since VoxFile does
+// not read the scene graph. Otherwise model i is written to path with "_i"
+// inserted before the extension. Throws VoxException if the file has no
+// dense models (it was loaded without them, or is empty).
+void ExportVoxFile(const std::string& path, ExportFormat format,
+                   const VoxFile& file, bool merge,
+                   const ExportOptions& options = ExportOptions());
+
+}  // namespace magicavoxel
+#endif
@@ -23,137 +23,360 @@
  ******************************************************************************/
 
 #include "vox_file.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VOX_FILE_SSE2
+#endif
+
 using namespace magicavoxel;
 using namespace std;
 
-// Reads a little-endian uint32 from a (binary) file
-uint32_t le_u32read(ifstream& file) {
-  char data[4];
-  file.read(data, 4);
+// Decodes a little-endian uint32 from 4 bytes.
+uint32_t le_u32(const char* data) {
   return (static_cast<uint8_t>(data[0])) |
          (static_cast<uint8_t>(data[1]) << 8) |
          (static_cast<uint8_t>(data[2]) << 16) |
-         (static_cast<uint8_t>(data[3]) << 24);
+         (static_cast<uint32_t>(static_cast<uint8_t>(data[3])) << 24);
+}
+
+// Decodes a little-endian IEEE float from 4 bytes.
+float le_f32(const char* data) {
+  const uint32_t bits = le_u32(data);
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
 }
 
-// Reads a little-endian int32 from a (binary) file.
-int32_t le_i32read(ifstream& file) {
-  return static_cast<int32_t>(le_u32read(file));
+// Reads a STRING (int32 length, then that many bytes, no terminator) and
+// advances data past it.
+string read_string(const char*& data) {
+  const uint32_t length = le_u32(data);
+  string str(data + 4, length);
+  data += 4 + length;
+  return str;
 }
 
-int read_byte(ifstream& file) {
-  char byte;
-  file.read(&byte, 1);
-  return static_cast<int>(byte);
+// Sets the field of the material named by a MATL dictionary key. Unknown keys
+// are ignored.
+void set_material_property(Material& material, const string& key,
+                           const string& value) {
+  if (key == "_type") {
+    if (value == "_diffuse") material.type = MaterialType::kDiffuse;
+    else if (value == "_metal") material.type = MaterialType::kMetal;
+    else if (value == "_glass") material.type = MaterialType::kGlass;
+    else if (value == "_emit") material.type = MaterialType::kEmit;
+    else if (value == "_blend") material.type = MaterialType::kBlend;
+    else if (value == "_media") material.type = MaterialType::kMedia;
+    else if (value == "_cloud") material.type = MaterialType::kCloud;
+    return;
+  }
+
+  float* field = nullptr;
+  if (key == "_weight") field = &material.weight;
+  else if (key == "_rough") field = &material.roughness;
+  else if (key == "_spec") field = &material.specular;
+  else if (key == "_ior") field = &material.ior;
+  else if (key == "_att") field = &material.attenuation;
+  else if (key == "_flux") field = &material.flux;
+  else if (key == "_emit") field = &material.emission;
+  else if (key == "_ldr") field = &material.ldr;
+  else if (key == "_metal") field = &material.metalness;
+  else if (key == "_trans") field = &material.transparency;
+  else if (key == "_plastic") field = &material.plastic;
+  if (field) *field = strtof(value.c_str(), nullptr);
+}
+
+namespace {
+
+// Linear value of each 8-bit sRGB channel value.
+struct SrgbToLinearTable {
+  SrgbToLinearTable() {
+    for (int i = 0; i < 256; ++i) {
+      const float c = i / 255.0f;
+      values[i] = c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+  }
+  float values[256];
+};
+
+// Size of a chunk header: ID, contents size, children size.
+constexpr size_t kChunkHeaderSize = 12;
+
+// Deepest nesting of MAIN chunks we accept. Real files have exactly one.
+constexpr int kMaxChunkDepth = 8;
+
+// Largest model dimension. Voxel coordinates are stored as single bytes.
+constexpr uint32_t kMaxModelSize = 256;
+
+[[noreturn]] void Invalid(const string& message) {
+  throw VoxException("Invalid .vox file: " + message);
 }
 
-uint8_t read_uint8(ifstream& file) {
-  return static_cast<uint8_t>(read_byte(file));
+// Checks that a DICT of n_pairs key/value STRINGs fits in [data, end).
+void ValidateDict(const char* data, const char* end, uint32_t n_pairs) {
+  for (uint64_t i = 0; i < 2 * static_cast<uint64_t>(n_pairs); ++i) {
+    if (end - data < 4) Invalid("truncated DICT");
+    const uint32_t length = le_u32(data);
+    data += 4;
+    if (static_cast<size_t>(end - data) < length) Invalid("truncated STRING");
+    data += length;
+  }
 }
 
+// Checks the chunks in [data, end): every header, contents and children must
+// fit inside their parent, and the contents of the chunk types we decode must
+// be consistent (voxel coordinates inside the model size, etc.). cur_size
+// tracks the last SIZE chunk, as in decoding; each model's volume is taken
+// from dense_budget, the voxels left for dense grids.
+void ValidateChunks(const char* data, const char* end, Size& cur_size,
+                    uint64_t& dense_budget, int depth) {
+  if (depth > kMaxChunkDepth) Invalid("chunks nested too deeply");
+
+  while (data < end) {
+    if (static_cast<size_t>(end - data) < kChunkHeaderSize)
+      Invalid("truncated chunk header");
+    const uint32_t id = le_u32(data);
+    const uint32_t contents_size = le_u32(data + 4);
+    const uint32_t children_size = le_u32(data + 8);
+    const char* contents = data + kChunkHeaderSize;
+    if (static_cast<uint64_t>(contents_size) + children_size >
+        static_cast<uint64_t>(end - contents))
+      Invalid("chunk extends past the end of its parent");
+
+    if (id == FourCC("MAIN")) {
+      ValidateChunks(contents + contents_size,
+                     contents + contents_size + children_size, cur_size,
+                     dense_budget, depth + 1);
+    } else if (id == FourCC("SIZE")) {
+      if (contents_size < 12) Invalid("truncated SIZE chunk");
+      cur_size = {le_u32(contents), le_u32(contents + 4), le_u32(contents + 8)};
+      if (cur_size.x > kMaxModelSize || cur_size.y > kMaxModelSize ||
+          cur_size.z > kMaxModelSize)
+        Invalid("model larger than 256x256x256");
+    } else if (id == FourCC("XYZI")) {
+      if (contents_size < 4) Invalid("truncated XYZI chunk");
+      const uint32_t n_voxels = le_u32(contents);
+      if (static_cast<uint64_t>(n_voxels) * 4 > contents_size - 4)
+        Invalid("truncated XYZI chunk");
+      const uint8_t* voxel = reinterpret_cast<const uint8_t*>(contents + 4);
+      for (uint32_t i = 0; i < n_voxels; ++i, voxel += 4) {
+        if (voxel[0] >= cur_size.x || voxel[1] >= cur_size.y ||
+            voxel[2] >= cur_size.z)
+          Invalid("voxel outside of the model size");
+      }
+      const uint64_t volume =
+          static_cast<uint64_t>(cur_size.x) * cur_size.y * cur_size.z;
+      if (volume > dense_budget) Invalid("models too large in total");
+      dense_budget -= volume;
+    } else if (id == FourCC("RGBA")) {
+      if (contents_size < 255 * 4) Invalid("truncated RGBA chunk");
+    } else if (id == FourCC("MATT")) {
+      if (contents_size < 16) Invalid("truncated MATT chunk");
+      uint32_t n_values = 0;
+      for (int bit = 0; bit < 7; ++bit)
+        if (le_u32(contents + 12) & (1u << bit)) ++n_values;
+      if (contents_size < 16 + 4 * n_values) Invalid("truncated MATT chunk");
+    } else if (id == FourCC("MATL")) {
+      if (contents_size < 8) Invalid("truncated MATL chunk");
+      ValidateDict(contents + 8, contents + contents_size,
+                   le_u32(contents + 4));
+    }
+
+    data = contents + contents_size + children_size;
+  }
+}
+
+}  // namespace
+
+void magicavoxel::ComputePaletteViews(const Palette& palette,
+                                      PaletteViews& views) {
+  static const SrgbToLinearTable srgb_to_linear;
+  const float* lut = srgb_to_linear.values;
+
+  for (int i = 0; i < 256; ++i) {
+    const Color& color = palette[i];
+    views.texture[4 * i] = color.r;
+    views.texture[4 * i + 1] = color.g;
+    views.texture[4 * i + 2] = color.b;
+    views.texture[4 * i + 3] = color.a;
+  }
+
+#ifdef VOX_FILE_SSE2
+  // One color per vector: RGB decoded through the table, alpha scaled to 0..1,
+  // then premultiplied by (alpha, alpha, alpha, 1).
+  for (int i = 0; i < 256; ++i) {
+    const Color& color = palette[i];
+    const float alpha = color.a * (1.0f / 255.0f);
+    const __m128 linear =
+        _mm_set_ps(alpha, lut[color.b], lut[color.g], lut[color.r]);
+    const __m128 scale = _mm_set_ps(1.0f, alpha, alpha, alpha);
+    _mm_storeu_ps(&views.linear[i].r, linear);
+    _mm_storeu_ps(&views.premultiplied[i].r, _mm_mul_ps(linear, scale));
+  }
+#else
+  for (int i = 0; i < 256; ++i) {
+    const Color& color = palette[i];
+    const float alpha = color.a / 255.0f;
+    views.linear[i] = {lut[color.r], lut[color.g], lut[color.b], alpha};
+    views.premultiplied[i] = {lut[color.r] * alpha, lut[color.g] * alpha,
+                              lut[color.b] * alpha, alpha};
+  }
+#endif
+}
+
+
+const VoxFile::ChunkReader VoxFile::kChunkReaders[6] = {
+    {FourCC("MAIN"), &VoxFile::ReadMainChunk},
+    {FourCC("SIZE"), &VoxFile::ReadSizeChunk},
+    {FourCC("XYZI"), &VoxFile::ReadXyziChunk},
+    {FourCC("RGBA"), &VoxFile::ReadRgbaChunk},
+    {FourCC("MATT"), &VoxFile::ReadMattChunk},
+    {FourCC("MATL"), &VoxFile::ReadMatlChunk},
+};
 
 VoxFile::VoxFile(bool load_dense, bool load_sparse, bool remove_hidden_voxels)
     : load_dense_(load_dense),
       load_sparse_(load_sparse),
       remove_hidden_voxels_(remove_hidden_voxels),
       cur_size_{0, 0, 0},
-      palette_(kDefaultPalette) {}
+      palette_(kDefaultPalette),
+      materials_() {
+  ComputePaletteViews(palette_, palette_views_);
+}
 
 void VoxFile::Load(const std::string& path) {
-  ifstream file(path, ios::in | ios::binary);
+  ifstream file(path, ios::in | ios::binary | ios::ate);
+  if (!file) throw VoxException("Could not open '" + path + "'");
+
+  // Read the whole file at once; it is validated and decoded in memory.
+  const streamoff file_size = file.tellg();
+  if (file_size < 0) throw VoxException("Could not read '" + path + "'");
+  vector<char> data(static_cast<size_t>(file_size));
+  file.seekg(0);
+  if (!file.read(data.data(), file_size))
+    throw VoxException("Could not read '" + path + "'");
+
+  Load(data.data(), data.size());
+}
+
+void VoxFile::Load(const char* data, size_t size) {
   dense_models_.clear();
-  ReadId(file, "VOX ");
-  auto version = le_i32read(file);
+  sparse_models_.clear();
+  materials_ = MaterialTable();
+  cur_size_ = {0, 0, 0};
+
+  // File header: "VOX ", then the version number (which we do not need).
+  if (size < 8 || memcmp(data, "VOX ", 4) != 0)
+    throw VoxException("Not a .vox file");
+  data += 8;
+  size -= 8;
+
+  // Check the whole chunk tree before decoding anything, so the readers below
+  // can index the data (and the models) without checks of their own.
+  Size size_check{0, 0, 0};
+  uint64_t dense_budget =
+      load_dense_ || (load_sparse_ && remove_hidden_voxels_)
+          ? kMaxFileDenseVoxels
+          : ~uint64_t{0};
+  ValidateChunks(data, data + size, size_check, dense_budget, 0);
 
   // Read MAIN chunk. If the file has other chunks beyond MAIN, we are ignoring
   // them currently. (Current 3.x format appears to only have MAIN though, with
   // its child chunks.)
-  ReadChunk(file);  
+  if (size > 0) ReadChunk(data);
 
   for (auto& model : dense_models_) {
     model.palette() = palette_;
   }
+  for (auto& model : sparse_models_) {
+    model.palette() = palette_;
+  }
+  ComputePaletteViews(palette_, palette_views_);
 }
 
-void VoxFile::ReadId(ifstream& file, const string& id) const {
-  if (id.length() != 4) throw std::logic_error("ID must be 4 characters");
-
-  char fid[4];
-  file.read(fid, 4);
-
-  if (fid[0] != id[0] || fid[1] != id[1] || fid[2] != id[2] ||
-      fid[3] != id[3]) {
-    stringstream ss;
-    ss << "Chunk ID Mismatch. Expected '" << id << "' but found '" << fid[0]
-       << fid[1] << fid[2] << fid[3] << "'";
-    throw VoxException(ss.str());
+void VoxFile::SetChunkHandler(uint32_t chunk_id, ChunkHandler handler) {
+  for (auto& entry : chunk_handlers_) {
+    if (entry.first == chunk_id) {
+      entry.second = std::move(handler);
+      return;
+    }
   }
+  chunk_handlers_.emplace_back(chunk_id, std::move(handler));
 }
 
-void VoxFile::ReadChunk(ifstream& file) {
-  char chunk_id_chars[5];
-  file.read(chunk_id_chars, 4);
-  chunk_id_chars[4] = '\0';
-  string chunk_id(chunk_id_chars);
-
-  const uint32_t contents_size = le_u32read(file);
-  const uint32_t children_size = le_u32read(file);
-  const uint32_t contents_start = static_cast<uint32_t>(file.tellg());
+uint32_t VoxFile::ReadChunk(const char* data) {
+  // Chunk header: 4-byte ID, contents size, children size.
+  const uint32_t chunk_id = le_u32(data);
+  const uint32_t contents_size = le_u32(data + 4);
+  const uint32_t children_size = le_u32(data + 8);
+  const char* contents = data + kChunkHeaderSize;
 
-  if (chunk_id == "MAIN")
-    ReadMainChunk(file, contents_size, children_size);
-  else if (chunk_id == "SIZE")
-    ReadSizeChunk(file, contents_size, children_size);
-  else if (chunk_id == "XYZI")
-    ReadXyziChunk(file, contents_size, children_size);
-  else if (chunk_id == "RGBA")
-    ReadRgbaChunk(file, contents_size, children_size);
-  //else if (chunk_id == "MATT")
+  bool handled = false;
+  for (const auto& reader : kChunkReaders) {
+    if (reader.id == chunk_id) {
+      (this->*reader.read)(contents, contents_size, children_size);
+      handled = true;
+      break;
+    }
+  }
+  if (!handled) {
+    for (const auto& entry : chunk_handlers_) {
+      if (entry.first == chunk_id) {
+        entry.second(contents, contents_size, children_size);
+        break;
+      }
+    }
+  }
 
   // RIFF format enforces even byte boundaries between chunks.
   // if (contents_size & 1) ++contents_size;
 
-  const uint32_t next_chunk_pos =
-      contents_start + contents_size + children_size;
-  file.seekg(next_chunk_pos);
+  return static_cast<uint32_t>(kChunkHeaderSize) + contents_size +
+         children_size;
 }
 
-void VoxFile::ReadMainChunk(std::ifstream& file, uint32_t contents_size,
+void VoxFile::ReadMainChunk(const char* contents, uint32_t contents_size,
                             uint32_t children_size) {
   // skip contents, to get to the beginning of the children
-  file.seekg(contents_size, ios_base::cur);
-
-  uint32_t end_pos = static_cast<uint32_t>(file.tellg()) + children_size;
-  while (file.tellg() < end_pos) {
-    ReadChunk(file);
+  const char* child = contents + contents_size;
+  const char* end = child + children_size;
+  while (child < end) {
+    child += ReadChunk(child);
   }
 }
 
-void VoxFile::ReadSizeChunk(std::ifstream& file, uint32_t contents_size,
+void VoxFile::ReadSizeChunk(const char* contents, uint32_t contents_size,
                             uint32_t children_size) {
-  cur_size_ = {le_u32read(file), le_u32read(file), le_u32read(file)};
+  cur_size_ = {le_u32(contents), le_u32(contents + 4), le_u32(contents + 8)};
 }
 
-void VoxFile::RemoveHiddenVoxels(VoxDenseModel& dense, VoxSparseModel& sparse, const vector<Voxel>& voxels)
+void VoxFile::RemoveHiddenVoxels(const VoxDenseModel& dense, VoxSparseModel& sparse, const vector<Voxel>& voxels)
 {
+  // Voxel coordinates have been validated, so the grid is indexed directly.
+  const uint8_t* grid = dense.data().data();
+  const Size& size = dense.size();
+  const size_t stride_y = size.x;
+  const size_t stride_z = static_cast<size_t>(size.x) * size.y;
+
   int n_removed = 0;
   for (const auto& voxel : voxels) {
+    const size_t i = voxel.x + voxel.y * stride_y + voxel.z * stride_z;
     // If voxel is surrounded by non-empty cells on all 6 sides, and it is not
     // along one of the sides of the model (e.g. x == 0), we can remove it.
-    if (voxel.x > 0 && dense.voxel(voxel.x - 1, voxel.y, voxel.z) &&
-        voxel.x < dense.size().x - 1 &&
-        dense.voxel(voxel.x + 1, voxel.y, voxel.z) && voxel.y > 0 &&
-        dense.voxel(voxel.x, voxel.y - 1, voxel.z) &&
-        voxel.y < dense.size().y - 1 &&
-        dense.voxel(voxel.x, voxel.y + 1, voxel.z) && voxel.z > 0 &&
-        dense.voxel(voxel.x, voxel.y, voxel.z - 1) &&
-        voxel.z < dense.size().z - 1 &&
-        dense.voxel(voxel.x, voxel.y, voxel.z + 1)) {
-      dense.voxel(voxel.x, voxel.y, voxel.z) = 0;
+    if (voxel.x > 0 && grid[i - 1] &&
+        voxel.x < size.x - 1 && grid[i + 1] &&
+        voxel.y > 0 && grid[i - stride_y] &&
+        voxel.y < size.y - 1 && grid[i + stride_y] &&
+        voxel.z > 0 && grid[i - stride_z] &&
+        voxel.z < size.z - 1 && grid[i + stride_z]) {
       ++n_removed;
     } else {
       sparse.voxels().push_back(voxel);
@@ -161,37 +384,111 @@ void VoxFile::RemoveHiddenVoxels(VoxDenseModel& dense, VoxSparseModel& sparse, c
   }
 }
 
-void VoxFile::ReadXyziChunk(std::ifstream& file, uint32_t contents_size,
+void VoxFile::ReadXyziChunk(const char* contents, uint32_t contents_size,
                             uint32_t children_size) {
-  VoxDenseModel dense(cur_size_);
+  const uint32_t n_voxels = le_u32(contents);
+
+  // Voxels are 4 bytes each (x, y, z, color), exactly the layout of Voxel.
+  static_assert(sizeof(Voxel) == 4, "Voxel must match the XYZI layout");
+  vector<Voxel> voxels(n_voxels);
+  if (n_voxels) memcpy(voxels.data(), contents + 4, n_voxels * sizeof(Voxel));
+  if (model_handler_) model_handler_(cur_size_, voxels);
+  if (!load_dense_ && !load_sparse_) return;
+
+  // The dense grid is only made when it is kept or hidden voxels are removed.
   VoxSparseModel sparse(cur_size_);
-  vector<Voxel> voxels;
-  uint32_t n_voxels = le_u32read(file);
+  if (!load_dense_ && !remove_hidden_voxels_) {
+    sparse.voxels() = std::move(voxels);
+    sparse_models_.push_back(std::move(sparse));
+    return;
+  }
 
-  for (uint32_t i = 0; i < n_voxels; ++i) {
-    Voxel voxel{read_uint8(file), read_uint8(file), read_uint8(file),
-                read_uint8(file)};
-    //sparse.voxels().push_back(voxel);
-    voxels.push_back(voxel);
-    dense.voxel(voxel.x, voxel.y, voxel.z) = voxel.color;
+  VoxDenseModel dense(cur_size_);
+  uint8_t* grid = dense.data().data();
+  const size_t stride_y = cur_size_.x;
+  const size_t stride_z = static_cast<size_t>(cur_size_.x) * cur_size_.y;
+  for (const auto& voxel : voxels) {
+    grid[voxel.x + voxel.y * stride_y + voxel.z * stride_z] = voxel.color;
   }
 
-  if (remove_hidden_voxels_) {
-    RemoveHiddenVoxels(dense, sparse, voxels);
-  } else {
-    sparse.voxels().assign(voxels.begin(), voxels.end());
+  if (load_sparse_) {
+    if (remove_hidden_voxels_) {
+      RemoveHiddenVoxels(dense, sparse, voxels);
+    } else {
+      sparse.voxels() = std::move(voxels);
+    }
+    sparse_models_.push_back(std::move(sparse));
   }
+  if (load_dense_) dense_models_.push_back(std::move(dense));
+}
 
-  if (load_dense_) dense_models_.push_back(dense);
-  if (load_sparse_) sparse_models_.push_back(sparse);
+void VoxFile::ReadRgbaChunk(const char* contents, uint32_t contents_size,
+                            uint32_t children_size) {
+  const uint8_t* rgba = reinterpret_cast<const uint8_t*>(contents);
+  for (int i = 1; i < 256; ++i, rgba += 4) {
+    palette_[i].r = rgba[0];
+    palette_[i].g = rgba[1];
+    palette_[i].b = rgba[2];
+    palette_[i].a = rgba[3];
+  }
 }
 
-void VoxFile::ReadRgbaChunk(std::ifstream& file, uint32_t contents_size,
+void VoxFile::ReadMattChunk(const char* contents, uint32_t contents_size,
                             uint32_t children_size) {
-  for (int i = 1; i < 256; ++i) {
-    palette_[i].r = read_byte(file);
-    palette_[i].g = read_byte(file);
-    palette_[i].b = read_byte(file);
-    palette_[i].a = read_byte(file);
+  const uint32_t id = le_u32(contents);
+  const uint32_t type = le_u32(contents + 4);
+  const float weight = le_f32(contents + 8);
+  const uint32_t property_bits = le_u32(contents + 12);
+  if (id == 0 || id > 255) return;
+
+  // Type 0 is diffuse, 1 metal, 2 glass, 3 emissive. The weight is the
+  // strength of the type (metalness, transparency or emission).
+  Material& material = materials_[id];
+  switch (type) {
+    case 1:
+      material.type = MaterialType::kMetal;
+      material.metalness = weight;
+      break;
+    case 2:
+      material.type = MaterialType::kGlass;
+      material.transparency = weight;
+      break;
+    case 3:
+      material.type = MaterialType::kEmit;
+      material.emission = weight;
+      break;
+    default:
+      material.type = MaterialType::kDiffuse;
+      break;
+  }
+  material.weight = weight;
+
+  // One normalized float follows for each set property bit, in bit order.
+  // Bit 7 (total power) is a flag and has no value.
+  float* const fields[] = {&material.plastic,     &material.roughness,
+                           &material.specular,    &material.ior,
+                           &material.attenuation, &material.flux,
+                           &material.ldr};
+  const char* value = contents + 16;
+  for (int bit = 0; bit < 7; ++bit) {
+    if (property_bits & (1u << bit)) {
+      *fields[bit] = le_f32(value);
+      value += 4;
+    }
+  }
+}
+
+void VoxFile::ReadMatlChunk(const char* contents, uint32_t contents_size,
+                            uint32_t children_size) {
+  const uint32_t id = le_u32(contents);
+  const uint32_t n_pairs = le_u32(contents + 4);
+  if (id > 255) return;
+
+  Material& material = materials_[id];
+  const char* pair = contents + 8;
+  for (uint32_t i = 0; i < n_pairs; ++i) {
+    const string key = read_string(pair);
+    const string value = read_string(pair);
+    set_material_property(material, key, value);
   }
 }
@@ -26,6 +26,7 @@
 #define VOX_FILE_H
 
 #include <array>
+#include <cstdint>
 #include <fstream>
 #include <functional>
 #include <string>
@@ -40,7 +41,10 @@ class VoxSparseModel;
 class VoxException;
 struct Voxel;
 struct Color;
+struct ColorF;
+struct Material;
 struct Vec3i;
+struct Vec3f;
 
 // 3D size. x, y, z is the width, height, depth...or width, depth, height...
 // it's just more straightforward to use the axis names.
@@ -52,7 +56,7 @@ class VoxException : public std::exception {
  public:
   explicit VoxException(const std::string& message) : message_(message) {}
 
-  char const* what() const override { return message_.c_str(); }
+  char const* what() const noexcept override { return message_.c_str(); }
 
  private:
   // const char* const message_;
@@ -63,6 +67,20 @@ struct Vec3i {
   uint32_t x, y, z;
 };
 
+// 3D point or direction, in voxel units.
+struct Vec3f {
+  float x, y, z;
+};
+
+// Packs a 4-character chunk ID into the little-endian uint32 it is stored as in
+// a .vox file, so chunk IDs can be compared as integers: FourCC("MAIN").
+constexpr uint32_t FourCC(const char (&id)[5]) {
+  return static_cast<uint32_t>(static_cast<uint8_t>(id[0])) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(id[1])) << 8) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(id[2])) << 16) |
+         (static_cast<uint32_t>(static_cast<uint8_t>(id[3])) << 24);
+}
+
 
 // RGBA color, as four bytes ranging from 0 to 255.
 struct Color {
@@ -128,6 +146,60 @@ constexpr Palette kDefaultPalette{
      0xffdddddd, 0xffbbbbbb, 0xffaaaaaa, 0xff888888, 0xff777777, 0xff555555,
      0xff444444, 0xff222222, 0xff111111, 0xff000000}};
 
+// Float RGBA color, with channels ranging from 0 to 1.
+struct ColorF {
+  float r, g, b, a;
+};
+
+// Forms of a Palette that renderers use directly, so they do not have to
+// convert colors per hit. Computed once per palette by ComputePaletteViews.
+struct PaletteViews {
+  // Linear-light colors (sRGB decoded), straight alpha.
+  std::array<ColorF, 256> linear;
+  // Linear-light colors multiplied by alpha.
+  std::array<ColorF, 256> premultiplied;
+  // The palette as a 256x1 RGBA8 texture, ready to upload: texel i is the
+  // bytes r, g, b, a of color i.
+  std::array<uint8_t, 256 * 4> texture;
+};
+
+// Fills views from palette (using SSE2 where available).
+void ComputePaletteViews(const Palette& palette, PaletteViews& views);
+
+// Surface type of a material, from the "_type" field of a MATL chunk (or the
+// type field of a legacy MATT chunk).
+enum class MaterialType : uint8_t {
+  kDiffuse,
+  kMetal,
+  kGlass,
+  kEmit,
+  kBlend,
+  kMedia,
+  kCloud
+};
+
+// Rendering properties of one palette index, read from the MATL (or legacy
+// MATT) chunks. Values are kept as they are stored in the file (mostly
+// normalized to 0..1); properties the file does not mention keep the defaults
+// below.
+struct Material {
+  MaterialType type = MaterialType::kDiffuse;
+  float weight = 1.0f;
+  float roughness = 0.1f;
+  float specular = 0.5f;
+  float ior = 0.3f;
+  float attenuation = 0.0f;
+  float flux = 0.0f;
+  float emission = 0.0f;
+  float ldr = 0.0f;
+  float metalness = 0.0f;
+  float transparency = 0.0f;
+  float plastic = 0.0f;
+};
+
+// Materials for each color of a Palette, indexed the same way.
+using MaterialTable = std::array<Material, 256>;
+
 // Dense representation of a voxel model. That is, a three-dimensional array of
 // color values, where each color value is a (byte) index into a Palette (array
 // of RGBA color values).
@@ -139,7 +211,7 @@ class VoxDenseModel {
 
   explicit VoxDenseModel(const Size& size,
                         const Palette& palette = kDefaultPalette)
-      : size_(size) {
+      : size_(size), palette_(palette) {
     voxels_.resize(size.x * size.y * size.z);
   }
 
@@ -153,6 +225,7 @@ class VoxDenseModel {
     return voxels_.at(x + (y * size_.x) + (z * size_.x * size_.y));
   }
   std::vector<uint8_t>& data() noexcept { return voxels_; }
+  const std::vector<uint8_t>& data() const noexcept { return voxels_; }
 
  private:
   const Size size_;
@@ -189,6 +262,7 @@ public:
   const Size& size() const noexcept { return size_; }
   const std::vector<Voxel>& voxels() const noexcept { return voxels_; }
   std::vector<Voxel>& voxels() noexcept { return voxels_; }
+  Palette& palette() noexcept { return palette_; }
   const Palette& palette() const noexcept { return palette_; }
 
  private:
@@ -197,6 +271,13 @@ public:
   Palette palette_;
 };
 
+// Most voxels VoxFile::Load makes dense grids for, summed over the models of
+// a file at their full SIZE: one byte each, so 1 GiB. Counted only when the
+// grids are needed (dense models, or sparse ones with hidden voxels removed),
+// so a small file of many large, nearly empty models cannot demand unbounded
+// memory.
+constexpr uint64_t kMaxFileDenseVoxels = uint64_t{1} << 30;
+
 // Used to load a .vox file of the MagicaVoxel format, into memory, as either
 // dense models, sparse models, or both.
 //
@@ -204,10 +285,23 @@ public:
 // https://github.com/ephtracy/voxel-model/blob/master/MagicaVoxel-file-format-vox.txt
 class VoxFile final {
  public:
+  // Reads a chunk type that VoxFile does not handle itself. Called with a
+  // pointer to the chunk's contents, which are followed by its children; the
+  // file has been validated so that both lie within the loaded data, and the
+  // handler must not read beyond contents + contents_size + children_size.
+  using ChunkHandler = std::function<void(
+      const char* contents, uint32_t contents_size, uint32_t children_size)>;
+  // Sees every model as its XYZI chunk is read: its size and all of its
+  // voxels (hidden ones included), whose coordinates have been validated.
+  using ModelHandler =
+      std::function<void(const Size& size, const std::vector<Voxel>& voxels)>;
+
   // load_dense: if true, loads the models as dense models, accessible via denseModels()
   // load_sparse: if true, loads the models as sparse models, accessible via sparseModels()
   // remove_hidden_voxels: if true, removes voxels that can never be visible (its 6 sides
-  //   are covered by other (non-empty) voxels.
+  //   are covered by other (non-empty) voxels) from the sparse models. Dense
+  //   models always keep every voxel, so they stay solid for meshing and
+  //   spatial queries.
   explicit VoxFile(bool load_dense = true, bool load_sparse = true,
                    bool remove_hidden_voxels = true);
 
@@ -219,26 +313,68 @@ class VoxFile final {
 
   // Clears any previously-loaded data and loads the models and (optional)
   // palette from the file at the given path.
+  //
+  // The whole chunk tree is validated against the file size before anything
+  // is decoded, so malformed or truncated files throw a VoxException up front
+  // rather than failing part-way through. So do files whose dense grids would
+  // exceed kMaxFileDenseVoxels.
   void Load(const std::string& path);
 
+  // Same as Load(path), for a .vox file that is already in memory.
+  void Load(const char* data, size_t size);
+
   std::vector<VoxDenseModel>& denseModels() noexcept { return dense_models_; }
   std::vector<VoxSparseModel>& sparseModels() noexcept { return sparse_models_; }
+  const std::vector<VoxDenseModel>& denseModels() const noexcept { return dense_models_; }
+  const std::vector<VoxSparseModel>& sparseModels() const noexcept { return sparse_models_; }
 
- private:
-  // Reads a 4-character ID from the file, and asserts that it matches the given one.
-  void ReadId(std::ifstream& file, const std::string& id) const;
+  // Palette shared by all models of the file.
+  const Palette& palette() const noexcept { return palette_; }
+
+  // Precomputed float and texture forms of palette(), computed when loading.
+  const PaletteViews& paletteViews() const noexcept { return palette_views_; }
+
+  // Registers (or replaces) the handler for chunks with the given ID, e.g.
+  // FourCC("nTRN"). IDs that VoxFile reads itself (MAIN, SIZE, XYZI, RGBA,
+  // MATT, MATL) always use the built-in readers.
+  void SetChunkHandler(uint32_t chunk_id, ChunkHandler handler);
+
+  // Registers (or, with an empty handler, removes) a reader that is shown
+  // each model while it is loaded, e.g. to compute statistics without a
+  // second pass over the voxels.
+  void SetModelHandler(ModelHandler handler) {
+    model_handler_ = std::move(handler);
+  }
+
+  // Material of each palette index. Indices without a MATL/MATT chunk hold a
+  // default (diffuse) Material.
+  const MaterialTable& materials() const noexcept { return materials_; }
 
-  // Reads the next chunk (RIFF-like structure)
-  void ReadChunk(std::ifstream& file);
-  void ReadMainChunk(std::ifstream& file, uint32_t contents_size,
+ private:
+  // Built-in chunk reader, for the compile-time dispatch table.
+  struct ChunkReader {
+    uint32_t id;
+    void (VoxFile::*read)(const char* contents, uint32_t contents_size,
+                          uint32_t children_size);
+  };
+  static const ChunkReader kChunkReaders[6];
+
+  // Reads the next chunk (RIFF-like structure), which has been validated.
+  // Returns the total size of the chunk, header included.
+  uint32_t ReadChunk(const char* data);
+  void ReadMainChunk(const char* contents, uint32_t contents_size,
+                     uint32_t children_size);
+  void ReadSizeChunk(const char* contents, uint32_t contents_size,
                      uint32_t children_size);
-  void ReadSizeChunk(std::ifstream& file, uint32_t contents_size,
+  void ReadXyziChunk(const char* contents, uint32_t contents_size,
                      uint32_t children_size);
-  void ReadXyziChunk(std::ifstream& file, uint32_t contents_size,
+  void ReadRgbaChunk(const char* contents, uint32_t contents_size,
                      uint32_t children_size);
-  void ReadRgbaChunk(std::ifstream& file, uint32_t contents_size,
+  void ReadMattChunk(const char* contents, uint32_t contents_size,
                      uint32_t children_size);
-  void RemoveHiddenVoxels(VoxDenseModel& dense, VoxSparseModel& sparse,
+  void ReadMatlChunk(const char* contents, uint32_t contents_size,
+                     uint32_t children_size);
+  void RemoveHiddenVoxels(const VoxDenseModel& dense, VoxSparseModel& sparse,
                           const std::vector<Voxel>& voxels);
  private:
   bool load_dense_;
@@ -255,6 +391,14 @@ class VoxFile final {
   // in a .vox file, we do not support it currently; but I don't believe it is
   // possible.)
   Palette palette_;
+  PaletteViews palette_views_;
+
+  // Materials, indexed like palette_.
+  MaterialTable materials_;
+
+  // Caller-registered readers for other chunk types, by chunk ID.
+  std::vector<std::pair<uint32_t, ChunkHandler>> chunk_handlers_;
+  ModelHandler model_handler_;
 };
 
 }  // namespace magicavoxel
@@ -0,0 +1,299 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_flow.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace magicavoxel;
+using namespace std;
+
+constexpr uint32_t VoxFlowField::kUnreachable;
+
+namespace {
+
+// Rows of columns per task, at least.
+constexpr size_t kMinRows = 16;
+
+// Costs of straight and diagonal moves (even and odd directions), and the
+// number of queue buckets needed to hold every cost within one move of the
+// current one.
+constexpr uint32_t kMoveCost[2] = {2, 3};
+constexpr uint32_t kBuckets = 4;
+
+}  // namespace
+
+VoxFlowField::VoxFlowField(const VoxDenseModel& model,
+                           const FlowFieldOptions& options)
+    : model_(model),
+      options_(options),
+      width_(model.size().x),
+      depth_(model.size().y) {
+  Rebuild();
+}
+
+void VoxFlowField::SetGoals(const vector<FlowCell>& goals) {
+  goals_ = goals;
+  Refresh();
+}
+
+int VoxFlowField::ColumnHeight(uint32_t x, uint32_t y) const {
+  const Size& size = model_.size();
+  const uint8_t* column = model_.data().data() + Index(x, y);
+  const size_t layer = static_cast<size_t>(size.x) * size.y;
+  for (uint32_t z = size.z; z-- > 0;) {
+    if (column[z * layer]) return static_cast<int>(z) + 1;
+  }
+  return -1;
+}
+
+uint8_t VoxFlowField::ComputeMoves(uint32_t cell) const {
+  const long x = cell % width_, y = cell / width_;
+  auto step = [&](size_t a, size_t b) {
+    return heights_[a] >= 0 && heights_[b] >= 0 &&
+           abs(heights_[a] - heights_[b]) <= options_.step_height;
+  };
+  uint8_t moves = 0;
+  for (int d = 0; d < 8; ++d) {
+    const int dx = kFlowOffsets[d][0], dy = kFlowOffsets[d][1];
+    if (x + dx < 0 || y + dy < 0 || x + dx >= static_cast<long>(width_) ||
+        y + dy >= static_cast<long>(depth_))
+      continue;
+    const size_t to = cell + dx + static_cast<long>(width_) * dy;
+    bool ok = step(cell, to);
+    if (ok && (d & 1)) {
+      // Diagonals need both straight ways around the corner.
+      const size_t side_x = cell + dx;
+      const size_t side_y = cell + static_cast<long>(width_) * dy;
+      ok = step(cell, side_x) && step(side_x, to) && step(cell, side_y) &&
+           step(side_y, to);
+    }
+    if (ok) moves |= static_cast<uint8_t>(1 << d);
+  }
+  return moves;
+}
+
+void VoxFlowField::UpdateDirection(uint32_t cell) {
+  int8_t best = -1;
+  if (costs_[cell] != kUnreachable && !is_goal_[cell]) {
+    uint32_t best_cost = kUnreachable;
+    for (int d = 0; d < 8; ++d) {
+      uint32_t to;
+      if (!CanMove(cell, d, to) || costs_[to] == kUnreachable) continue;
+      const uint32_t cost = costs_[to] + kMoveCost[d & 1];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best = static_cast<int8_t>(d);
+      }
+    }
+  }
+  directions_[cell] = best;
+}
+
+void VoxFlowField::Propagate(vector<uint32_t>& seeds, vector<uint32_t>& changed) {
+  // Seeds enter the queue when the wavefront reaches their cost; between
+  // them, buckets cost % kBuckets hold the cells still to expand.
+  sort(seeds.begin(), seeds.end(),
+       [this](uint32_t a, uint32_t b) { return costs_[a] < costs_[b]; });
+  vector<uint32_t> buckets[kBuckets];
+  size_t queued = 0, next_seed = 0;
+  uint32_t current = 0;
+  while (queued || next_seed < seeds.size()) {
+    if (!queued) current = max(current, costs_[seeds[next_seed]]);
+    for (; next_seed < seeds.size() && costs_[seeds[next_seed]] <= current;
+         ++next_seed) {
+      buckets[current % kBuckets].push_back(seeds[next_seed]);
+      ++queued;
+    }
+    vector<uint32_t>& bucket = buckets[current % kBuckets];
+    for (size_t i = 0; i < bucket.size(); ++i) {
+      const uint32_t cell = bucket[i];
+      if (costs_[cell] != current) continue;  // Improved since queued
+      for (int d = 0; d < 8; ++d) {
+        uint32_t to;
+        if (!CanMove(cell, d, to)) continue;
+        const uint32_t cost = current + kMoveCost[d & 1];
+        if (cost >= costs_[to]) continue;
+        costs_[to] = cost;
+        buckets[cost % kBuckets].push_back(to);
+        ++queued;
+        changed.push_back(to);
+      }
+    }
+    queued -= bucket.size();
+    bucket.clear();
+    ++current;
+  }
+}
+
+void VoxFlowField::Rebuild() {
+  const Size& size = model_.size();
+  const size_t n = static_cast<size_t>(width_) * depth_;
+  heights_.assign(n, -1);
+  moves_.resize(n);
+
+  // Heights, bottom-up through each row so reads stay sequential.
+  ParallelFor(depth_, kMinRows, options_.threads, [&](size_t y0, size_t y1) {
+    for (uint32_t z = 0; z < size.z; ++z) {
+      for (size_t y = y0; y < y1; ++y) {
+        const uint8_t* row = model_.data().data() + (z * depth_ + y) * width_;
+        int16_t* heights = heights_.data() + y * width_;
+        for (uint32_t x = 0; x < width_; ++x) {
+          if (row[x]) heights[x] = static_cast<int16_t>(z + 1);
+        }
+      }
+    }
+  });
+
+  // Moves use the same rules as Update, so incremental and full builds
+  // agree.
+  ParallelFor(depth_, kMinRows, options_.threads, [&](size_t y0, size_t y1) {
+    for (size_t cell = y0 * width_; cell < y1 * width_; ++cell)
+      moves_[cell] = ComputeMoves(static_cast<uint32_t>(cell));
+  });
+  Refresh();
+}
+
+void VoxFlowField::Refresh() {
+  const size_t n = static_cast<size_t>(width_) * depth_;
+  costs_.assign(n, kUnreachable);
+  directions_.resize(n);
+  is_goal_.assign(n, 0);
+  vector<uint32_t> seeds, changed;
+  for (const FlowCell& goal : goals_) {
+    if (goal.x >= width_ || goal.y >= depth_) continue;
+    const uint32_t cell = static_cast<uint32_t>(Index(goal.x, goal.y));
+    is_goal_[cell] = 1;
+    if (heights_[cell] < 0) continue;
+    costs_[cell] = 0;
+    seeds.push_back(cell);
+  }
+  Propagate(seeds, changed);
+
+  ParallelFor(depth_, kMinRows, options_.threads, [&](size_t y0, size_t y1) {
+    for (size_t cell = y0 * width_; cell < y1 * width_; ++cell)
+      UpdateDirection(static_cast<uint32_t>(cell));
+  });
+}
+
+void VoxFlowField::Update(uint32_t x, uint32_t y, uint32_t) {
+  const uint32_t center = static_cast<uint32_t>(Index(x, y));
+  const int height = ColumnHeight(x, y);
+  if (height == heights_[center]) return;
+  heights_[center] = static_cast<int16_t>(height);
+  // Moves of the 3x3 columns around the edit depend on its height.
+  for (int dy = -1; dy <= 1; ++dy) {
+    for (int dx = -1; dx <= 1; ++dx) {
+      const long nx = static_cast<long>(x) + dx, ny = static_cast<long>(y) + dy;
+      if (nx < 0 || ny < 0 || nx >= static_cast<long>(width_) ||
+          ny >= static_cast<long>(depth_))
+        continue;
+      const uint32_t cell = static_cast<uint32_t>(Index(nx, ny));
+      moves_[cell] = ComputeMoves(cell);
+    }
+  }
+
+  // Costs that may have gone up: the column's, any neighbor whose way out
+  // went through it or around its corner, and everything downstream of
+  // those (columns whose direction leads into an invalidated one).
+  vector<uint32_t> invalid = {center};
+  auto invalidate = [&](uint32_t cell) {
+    if (costs_[cell] == kUnreachable) return;
+    costs_[cell] = kUnreachable;
+    invalid.push_back(cell);
+  };
+  costs_[center] = kUnreachable;
+  for (int d = 0; d < 8; ++d) {
+    const long nx = static_cast<long>(x) + kFlowOffsets[d][0];
+    const long ny = static_cast<long>(y) + kFlowOffsets[d][1];
+    if (nx < 0 || ny < 0 || nx >= static_cast<long>(width_) ||
+        ny >= static_cast<long>(depth_))
+      continue;
+    const uint32_t neighbor = static_cast<uint32_t>(Index(nx, ny));
+    const int out = directions_[neighbor];
+    if (out < 0) continue;
+    const long tx = nx + kFlowOffsets[out][0], ty = ny + kFlowOffsets[out][1];
+    const bool through = tx == x && ty == y;
+    const bool around = (out & 1) && ((tx == x && ny == y) || (nx == x && ty == y));
+    if (through || around) invalidate(neighbor);
+  }
+  for (size_t i = 0; i < invalid.size(); ++i) {
+    const uint32_t cell = invalid[i];
+    const long cx = cell % width_, cy = cell / width_;
+    for (int d = 0; d < 8; ++d) {
+      const long nx = cx - kFlowOffsets[d][0], ny = cy - kFlowOffsets[d][1];
+      if (nx < 0 || ny < 0 || nx >= static_cast<long>(width_) ||
+          ny >= static_cast<long>(depth_))
+        continue;
+      const uint32_t upstream = static_cast<uint32_t>(Index(nx, ny));
+      if (directions_[upstream] == d) invalidate(upstream);
+    }
+  }
+
+  // Seed the wavefront with the best cost each invalidated column can get
+  // from the rest, and with the columns around the edit, whose new moves may
+  // lower costs.
+  vector<uint32_t> seeds, changed;
+  for (uint32_t cell : invalid) {
+    uint32_t best = kUnreachable;
+    if (is_goal_[cell] && heights_[cell] >= 0) {
+      best = 0;
+    } else {
+      for (int d = 0; d < 8; ++d) {
+        uint32_t to;
+        if (CanMove(cell, d, to) && costs_[to] != kUnreachable)
+          best = min(best, costs_[to] + kMoveCost[d & 1]);
+      }
+    }
+    costs_[cell] = best;
+    if (best != kUnreachable) seeds.push_back(cell);
+  }
+  for (int d = 0; d < 8; ++d) {
+    const long nx = static_cast<long>(x) + kFlowOffsets[d][0];
+    const long ny = static_cast<long>(y) + kFlowOffsets[d][1];
+    if (nx < 0 || ny < 0 || nx >= static_cast<long>(width_) ||
+        ny >= static_cast<long>(depth_))
+      continue;
+    const uint32_t neighbor = static_cast<uint32_t>(Index(nx, ny));
+    if (costs_[neighbor] != kUnreachable) seeds.push_back(neighbor);
+  }
+  Propagate(seeds, changed);
+
+  // Directions follow the costs around everything that changed.
+  changed.insert(changed.end(), invalid.begin(), invalid.end());
+  changed.push_back(center);
+  for (uint32_t cell : changed) {
+    UpdateDirection(cell);
+    const long cx = cell % width_, cy = cell / width_;
+    for (int d = 0; d < 8; ++d) {
+      const long nx = cx + kFlowOffsets[d][0], ny = cy + kFlowOffsets[d][1];
+      if (nx >= 0 && ny >= 0 && nx < static_cast<long>(width_) &&
+          ny < static_cast<long>(depth_))
+        UpdateDirection(static_cast<uint32_t>(Index(nx, ny)));
+    }
+  }
+}
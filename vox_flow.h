@@ -0,0 +1,118 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_FLOW_H
+#define VOX_FLOW_H
+
+#include "vox_file.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// A column of a model, by its x and y.
+struct FlowCell {
+  uint32_t x, y;
+};
+
+// Offsets of the eight flow directions, as (dx, dy).
+constexpr int kFlowOffsets[8][2] = {{1, 0},  {1, 1},   {0, 1},  {-1, 1},
+                                    {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+
+struct FlowFieldOptions {
+  // Highest step (up or down) between neighboring columns.
+  int step_height = 1;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Integration and flow field over the top surface of a model (the top of
+// the highest voxel of every (x, y) column), for crowds heading to shared
+// goals. Agents move to any of the eight neighboring columns within
+// step_height, without cutting corners; straight moves cost 2 and diagonal
+// ones 3.
+//
+// The integration field is a Dijkstra wavefront from the goals over bucketed
+// queues (Dial's algorithm, as step costs are small integers); column heights
+// and flow directions are computed in parallel. After changing a voxel
+// through VoxDenseModel::voxel(), call Update: if the column's top moved, it
+// re-runs the wavefront only over the columns whose cost can change.
+//
+// The model must outlive the field.
+class VoxFlowField {
+ public:
+  static constexpr uint32_t kUnreachable = 0xffffffff;
+
+  explicit VoxFlowField(const VoxDenseModel& model,
+                        const FlowFieldOptions& options = FlowFieldOptions());
+
+  // Replaces the goals and recomputes costs and directions.
+  void SetGoals(const std::vector<FlowCell>& goals);
+
+  // Height of the top surface of column (x, y), -1 if the column is empty.
+  int height(uint32_t x, uint32_t y) const { return heights_[Index(x, y)]; }
+
+  // Cost of the cheapest way from column (x, y) to a goal, or kUnreachable.
+  uint32_t cost(uint32_t x, uint32_t y) const { return costs_[Index(x, y)]; }
+
+  // Direction to move from column (x, y), as an index into kFlowOffsets, or
+  // -1 at goals and columns that cannot reach one.
+  int direction(uint32_t x, uint32_t y) const { return directions_[Index(x, y)]; }
+
+  // Fixes the field after the voxel at (x, y, z) was changed in the model.
+  void Update(uint32_t x, uint32_t y, uint32_t z);
+
+  // Recomputes everything from the model.
+  void Rebuild();
+
+ private:
+  size_t Index(uint32_t x, uint32_t y) const {
+    return x + static_cast<size_t>(width_) * y;
+  }
+  int ColumnHeight(uint32_t x, uint32_t y) const;
+  void Refresh();
+  uint8_t ComputeMoves(uint32_t cell) const;
+  bool CanMove(uint32_t cell, int direction, uint32_t& to) const {
+    if (!((moves_[cell] >> direction) & 1)) return false;
+    to = cell + kFlowOffsets[direction][0] +
+         static_cast<int32_t>(width_) * kFlowOffsets[direction][1];
+    return true;
+  }
+  void Propagate(std::vector<uint32_t>& seeds, std::vector<uint32_t>& changed);
+  void UpdateDirection(uint32_t cell);
+
+  const VoxDenseModel& model_;
+  const FlowFieldOptions options_;
+  const uint32_t width_, depth_;
+  std::vector<FlowCell> goals_;
+  std::vector<int16_t> heights_;
+  std::vector<uint8_t> is_goal_;
+  std::vector<uint8_t> moves_;  // bit d: can move towards kFlowOffsets[d]
+  std::vector<uint32_t> costs_;
+  std::vector<int8_t> directions_;
+};
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,302 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_light.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+constexpr uint8_t kMaxLight = 15;
+
+// Bricks are 8x8x8 voxels, as in VoxBrickMap.
+constexpr uint32_t kBrickShift = 3;
+
+// Direction index of -z, the way sky light falls.
+constexpr int kDown = 4;
+
+// Bricks (of voxels) per propagation task, at least.
+constexpr size_t kMinBricks = 4;
+
+// Neighbor lookups and level updates on one light channel.
+class Grid {
+ public:
+  Grid(const VoxDenseModel& model, atomic<uint8_t>* levels)
+      : voxels_(model.data().data()),
+        levels_(levels),
+        sx_(model.size().x),
+        sy_(model.size().y),
+        sz_(model.size().z) {}
+
+  uint8_t level(uint32_t i) const {
+    return levels_[i].load(memory_order_relaxed);
+  }
+  void set(uint32_t i, uint8_t level) {
+    levels_[i].store(level, memory_order_relaxed);
+  }
+  bool empty(uint32_t i) const { return !voxels_[i]; }
+
+  // Index of the neighbor of i in direction dir (ordered as Face: -x, +x,
+  // -y, +y, -z, +z); false if that is outside the model.
+  bool Neighbor(uint32_t i, int dir, uint32_t& n) const {
+    const uint32_t x = i % sx_;
+    const uint32_t y = (i / sx_) % sy_;
+    const uint32_t z = i / (sx_ * sy_);
+    switch (dir) {
+      case 0: if (x == 0) return false; n = i - 1; return true;
+      case 1: if (x + 1 == sx_) return false; n = i + 1; return true;
+      case 2: if (y == 0) return false; n = i - sx_; return true;
+      case 3: if (y + 1 == sy_) return false; n = i + sx_; return true;
+      case 4: if (z == 0) return false; n = i - sx_ * sy_; return true;
+      default: if (z + 1 == sz_) return false; n = i + sx_ * sy_; return true;
+    }
+  }
+
+  uint32_t Brick(uint32_t i) const {
+    const uint32_t bx = (i % sx_) >> kBrickShift;
+    const uint32_t by = ((i / sx_) % sy_) >> kBrickShift;
+    const uint32_t bz = (i / (sx_ * sy_)) >> kBrickShift;
+    return bx + bricks_x() * (by + bricks_y() * bz);
+  }
+  uint32_t bricks_x() const { return (sx_ + 7) >> kBrickShift; }
+  uint32_t bricks_y() const { return (sy_ + 7) >> kBrickShift; }
+  uint32_t bricks_z() const { return (sz_ + 7) >> kBrickShift; }
+
+  // Spreads the light of voxel i one step, calling push(n) for every
+  // neighbor whose level went up.
+  template <typename Push>
+  void Spread(bool sky, uint32_t i, Push push) {
+    const uint8_t light = level(i);
+    if (light <= 1 && !(sky && light == kMaxLight)) return;
+    for (int dir = 0; dir < 6; ++dir) {
+      uint32_t n;
+      if (!Neighbor(i, dir, n) || !empty(n)) continue;
+      const uint8_t target =
+          (sky && dir == kDown && light == kMaxLight) ? kMaxLight : light - 1;
+      uint8_t current = level(n);
+      while (current < target &&
+             !levels_[n].compare_exchange_weak(current, target,
+                                               memory_order_relaxed)) {
+      }
+      if (current < target) push(n);
+    }
+  }
+
+ private:
+  const uint8_t* voxels_;
+  atomic<uint8_t>* levels_;
+  const uint32_t sx_, sy_, sz_;
+};
+
+}  // namespace
+
+EmissionLevels magicavoxel::EmissionFromMaterials(
+    const MaterialTable& materials) {
+  EmissionLevels levels{};
+  for (int i = 1; i < 256; ++i) {
+    const float emission = materials[i].emission;
+    if (emission > 0) {
+      levels[i] = static_cast<uint8_t>(
+          min<long>(kMaxLight, max<long>(1, lround(emission * kMaxLight))));
+    }
+  }
+  return levels;
+}
+
+VoxLightVolume::VoxLightVolume(const VoxDenseModel& model,
+                               const EmissionLevels& emission,
+                               const LightOptions& options)
+    : model_(model),
+      emission_(emission),
+      options_(options),
+      block_(new atomic<uint8_t>[model.data().size()]),
+      sky_(new atomic<uint8_t>[model.data().size()]) {
+  Relight();
+}
+
+void VoxLightVolume::SetEmission(const EmissionLevels& emission) {
+  emission_ = emission;
+  Relight();
+}
+
+uint8_t VoxLightVolume::Source(bool sky, size_t index) const {
+  const uint8_t color = model_.data()[index];
+  if (!sky) return color ? min(emission_[color], kMaxLight) : 0;
+  const Size& size = model_.size();
+  const size_t top = static_cast<size_t>(size.x) * size.y * (size.z - 1);
+  return (!color && index >= top) ? kMaxLight : 0;
+}
+
+void VoxLightVolume::Relight() {
+  const Size& size = model_.size();
+  const size_t count = model_.data().size();
+  const size_t layer = static_cast<size_t>(size.x) * size.y;
+  mutex seeds_mutex;
+
+  for (int channel = 0; channel < 2; ++channel) {
+    const bool sky = channel == 1;
+    atomic<uint8_t>* levels = sky ? sky_.get() : block_.get();
+    if (sky && !options_.sky) {
+      for (size_t i = 0; i < count; ++i)
+        levels[i].store(0, memory_order_relaxed);
+      continue;
+    }
+
+    // Seeds: emitters, or every empty voxel the sky sees straight down.
+    vector<uint32_t> seeds;
+    ParallelFor(size.z, 1, options_.threads, [&](size_t z0, size_t z1) {
+      vector<uint32_t> local;
+      for (size_t i = z0 * layer; i < z1 * layer; ++i) {
+        const uint8_t source = sky ? 0 : Source(false, i);
+        levels[i].store(source, memory_order_relaxed);
+        if (source) local.push_back(static_cast<uint32_t>(i));
+      }
+      lock_guard<mutex> lock(seeds_mutex);
+      seeds.insert(seeds.end(), local.begin(), local.end());
+    });
+    if (sky && count) {
+      const vector<uint8_t>& voxels = model_.data();
+      for (size_t column = 0; column < layer; ++column) {
+        for (size_t i = column + layer * (size.z - 1); !voxels[i]; i -= layer) {
+          levels[i].store(kMaxLight, memory_order_relaxed);
+          seeds.push_back(static_cast<uint32_t>(i));
+          if (i < layer) break;
+        }
+      }
+    }
+    Propagate(sky, seeds);
+  }
+}
+
+void VoxLightVolume::Propagate(bool sky, vector<uint32_t>& seeds) {
+  Grid grid(model_, sky ? sky_.get() : block_.get());
+  const size_t n_bricks = static_cast<size_t>(grid.bricks_x()) *
+                          grid.bricks_y() * grid.bricks_z();
+  vector<vector<uint32_t>> queues(n_bricks);
+  vector<uint32_t> active;
+  vector<uint8_t> queued(n_bricks, 0);
+  auto enqueue = [&](const vector<uint32_t>& cells) {
+    for (uint32_t cell : cells) {
+      const uint32_t brick = grid.Brick(cell);
+      queues[brick].push_back(cell);
+      if (!queued[brick]) {
+        queued[brick] = 1;
+        active.push_back(brick);
+      }
+    }
+  };
+  enqueue(seeds);
+
+  // Each round drains the queues of the active bricks in parallel; light
+  // that crosses into another brick is queued there for the next round.
+  mutex spill_mutex;
+  vector<uint32_t> spilled;
+  while (!active.empty()) {
+    ParallelFor(active.size(), kMinBricks, options_.threads,
+                [&](size_t begin, size_t end) {
+      vector<uint32_t> spill;
+      for (size_t k = begin; k < end; ++k) {
+        const uint32_t brick = active[k];
+        vector<uint32_t>& queue = queues[brick];
+        for (size_t head = 0; head < queue.size(); ++head) {
+          grid.Spread(sky, queue[head], [&](uint32_t n) {
+            if (grid.Brick(n) == brick) queue.push_back(n);
+            else spill.push_back(n);
+          });
+        }
+        queue.clear();
+      }
+      lock_guard<mutex> lock(spill_mutex);
+      spilled.insert(spilled.end(), spill.begin(), spill.end());
+    });
+    for (uint32_t brick : active) queued[brick] = 0;
+    active.clear();
+    enqueue(spilled);
+    spilled.clear();
+  }
+}
+
+void VoxLightVolume::Update(uint32_t x, uint32_t y, uint32_t z) {
+  const uint32_t index = static_cast<uint32_t>(Index(x, y, z));
+  UpdateChannel(false, index);
+  if (options_.sky) UpdateChannel(true, index);
+}
+
+void VoxLightVolume::UpdateChannel(bool sky, uint32_t index) {
+  Grid grid(model_, sky ? sky_.get() : block_.get());
+  vector<pair<uint32_t, uint8_t>> removal;
+  vector<uint32_t> refill;
+
+  // Take away all light that could have come through (or from) the voxel:
+  // neighbors that are darker than the light being removed got it from here.
+  // Anything at least as bright has another source and refills the hole.
+  const uint8_t old_level = grid.level(index);
+  if (old_level) {
+    grid.set(index, 0);
+    removal.emplace_back(index, old_level);
+  }
+  for (size_t head = 0; head < removal.size(); ++head) {
+    const uint32_t cell = removal[head].first;
+    const uint8_t light = removal[head].second;
+    for (int dir = 0; dir < 6; ++dir) {
+      uint32_t n;
+      if (!grid.Neighbor(cell, dir, n)) continue;
+      const uint8_t level = grid.level(n);
+      if (!level) continue;
+      const bool falling = sky && dir == kDown && light == kMaxLight;
+      if (level < light || (falling && level == kMaxLight)) {
+        const uint8_t source = Source(sky, n);
+        grid.set(n, source);
+        removal.emplace_back(n, level);
+        if (source) refill.push_back(n);
+      } else {
+        refill.push_back(n);
+      }
+    }
+  }
+
+  // Light the voxel itself if it is a source, and let the light around it
+  // back in if it is empty.
+  const uint8_t source = Source(sky, index);
+  if (source) {
+    grid.set(index, source);
+    refill.push_back(index);
+  }
+  if (grid.empty(index)) {
+    for (int dir = 0; dir < 6; ++dir) {
+      uint32_t n;
+      if (grid.Neighbor(index, dir, n) && grid.level(n)) refill.push_back(n);
+    }
+  }
+
+  for (size_t head = 0; head < refill.size(); ++head)
+    grid.Spread(sky, refill[head], [&](uint32_t n) { refill.push_back(n); });
+}
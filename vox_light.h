@@ -0,0 +1,106 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_LIGHT_H
+#define VOX_LIGHT_H
+
+#include "vox_file.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace magicavoxel {
+
+// Light level (0 to 15) emitted by each palette index, 0 for none.
+using EmissionLevels = std::array<uint8_t, 256>;
+
+// Emission levels from the MATL emission of each color (emission 1 = 15).
+EmissionLevels EmissionFromMaterials(const MaterialTable& materials);
+
+struct LightOptions {
+  // Whether to compute sky light (light from above the model).
+  bool sky = true;
+  // Threads to use for full relights; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Block-game style light levels for every voxel of a model: block light
+// spreading from emissive colors, and sky light falling from above the top of
+// the model (+z). Light drops by one level per voxel it travels through empty
+// space; sky light at full level (15) falls straight down without dropping.
+// Occupied voxels block light, except that emitters hold their own level.
+//
+// The constructor lights the whole model, propagating breadth-first from
+// per-brick queues on several threads (levels are raised with atomic
+// compare-exchange, so bricks can spill into their neighbors freely). After
+// changing a voxel through VoxDenseModel::voxel(), call Update to fix the
+// light around it, which only visits the voxels whose light changes.
+//
+// The model must outlive the volume.
+class VoxLightVolume {
+ public:
+  VoxLightVolume(const VoxDenseModel& model, const EmissionLevels& emission,
+                 const LightOptions& options = LightOptions());
+
+  const Size& size() const noexcept { return model_.size(); }
+
+  uint8_t blockLight(uint32_t x, uint32_t y, uint32_t z) const {
+    return block_[Index(x, y, z)].load(std::memory_order_relaxed);
+  }
+  uint8_t skyLight(uint32_t x, uint32_t y, uint32_t z) const {
+    return sky_[Index(x, y, z)].load(std::memory_order_relaxed);
+  }
+
+  // Recomputes all light from scratch.
+  void Relight();
+
+  // Fixes the light after the voxel at (x, y, z) was changed in the model.
+  void Update(uint32_t x, uint32_t y, uint32_t z);
+
+  // Changes what each color emits, and relights.
+  void SetEmission(const EmissionLevels& emission);
+
+ private:
+  using Levels = std::unique_ptr<std::atomic<uint8_t>[]>;
+
+  size_t Index(uint32_t x, uint32_t y, uint32_t z) const {
+    const Size& size = model_.size();
+    return x + size.x * (y + static_cast<size_t>(size.y) * z);
+  }
+  uint8_t Source(bool sky, size_t index) const;
+  void Propagate(bool sky, std::vector<uint32_t>& seeds);
+  void UpdateChannel(bool sky, uint32_t index);
+
+  const VoxDenseModel& model_;
+  EmissionLevels emission_;
+  const LightOptions options_;
+  Levels block_;
+  Levels sky_;
+};
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,208 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_lightmap.h"
+
+#include "vox_parallel.h"
+
+#include <cmath>
+#include <limits>
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+// Voxels per scheduler tile.
+constexpr size_t kTileVoxels = 64;
+
+// How far ray origins are lifted off the face they start on.
+constexpr float kSurfaceOffset = 1e-3f;
+
+// Small, fast generator (PCG32) so every tile can have its own.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(Mix(seed)) {}
+
+  uint32_t Next() {
+    const uint64_t old = state_;
+    state_ = old * 6364136223846793005ull + 1442695040888963407ull;
+    const uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+    const uint32_t rotation = static_cast<uint32_t>(old >> 59);
+    return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+  }
+
+  // Uniform in [0, 1).
+  float Uniform() { return (Next() >> 8) * (1.0f / 16777216.0f); }
+
+ private:
+  // SplitMix64 finalizer, so nearby seeds give unrelated streams.
+  static uint64_t Mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+  uint64_t state_;
+};
+
+// Cosine-weighted direction around the normal of face.
+void SampleDirection(Face face, Random& random, float d[3]) {
+  const int axis = face / 2;
+  const float r = sqrt(random.Uniform());
+  const float phi = 6.28318531f * random.Uniform();
+  d[(axis + 1) % 3] = r * cos(phi);
+  d[(axis + 2) % 3] = r * sin(phi);
+  d[axis] = sqrt(max(0.0f, 1 - r * r)) * ((face & 1) ? 1 : -1);
+}
+
+}  // namespace
+
+VoxLightmapBaker::VoxLightmapBaker(const VoxDenseModel& dense,
+                                   const VoxSparseModel& sparse,
+                                   const PaletteViews& palette,
+                                   const MaterialTable& materials,
+                                   const LightmapOptions& options)
+    : dense_(dense), sparse_(sparse), options_(options), collision_(dense) {
+  for (int i = 0; i < 256; ++i) {
+    const ColorF& color = palette.linear[i];
+    albedo_[i] = {color.r, color.g, color.b};
+    const Material& material = materials[i];
+    const float strength =
+        material.emission * (1 + material.flux) * options_.emission_scale;
+    emission_[i] = {color.r * strength, color.g * strength,
+                    color.b * strength};
+  }
+  Reset();
+}
+
+void VoxLightmapBaker::Reset() {
+  sums_.assign(sparse_.voxels().size(), VoxelIrradiance{});
+  passes_ = 0;
+}
+
+void VoxLightmapBaker::Bake(int passes) {
+  const size_t tiles = (sums_.size() + kTileVoxels - 1) / kTileVoxels;
+  for (int pass = 0; pass < passes; ++pass) {
+    ParallelForTiles(tiles, options_.threads,
+                     [this](size_t tile, unsigned) { BakeTile(tile); });
+    ++passes_;
+  }
+}
+
+void VoxLightmapBaker::BakeTile(size_t tile) {
+  const vector<Voxel>& voxels = sparse_.voxels();
+  const size_t begin = tile * kTileVoxels;
+  const size_t end = min(voxels.size(), begin + kTileVoxels);
+  const Size& size = dense_.size();
+  const int samples = max(options_.samples_per_pass, 1);
+  const float weight = 1.0f / samples;
+  Random random((static_cast<uint64_t>(options_.seed) << 32 ^
+                 static_cast<uint64_t>(passes_)) * 0x100000001b3ull ^ tile);
+
+  for (size_t i = begin; i < end; ++i) {
+    const Voxel& voxel = voxels[i];
+    const int p[3] = {voxel.x, voxel.y, voxel.z};
+    for (int f = 0; f < 6; ++f) {
+      const Face face = static_cast<Face>(f);
+      const int axis = f / 2;
+      const int normal = (f & 1) ? 1 : -1;
+      int q[3] = {p[0], p[1], p[2]};
+      q[axis] += normal;
+      if (q[axis] >= 0 && q[0] < static_cast<int>(size.x) &&
+          q[1] < static_cast<int>(size.y) && q[2] < static_cast<int>(size.z) &&
+          collision_.bricks().occupied(q[0], q[1], q[2]))
+        continue;
+
+      Irradiance sum = {0, 0, 0};
+      for (int s = 0; s < samples; ++s) {
+        // Start from a random point on the face.
+        float o[3] = {p[0] + random.Uniform(), p[1] + random.Uniform(),
+                      p[2] + random.Uniform()};
+        o[axis] = p[axis] + ((f & 1) ? 1 + kSurfaceOffset : -kSurfaceOffset);
+        float d[3];
+        SampleDirection(face, random, d);
+
+        Irradiance radiance = {0, 0, 0};
+        Irradiance throughput = {1, 1, 1};
+        for (int bounce = 0;; ++bounce) {
+          VoxRay ray = {{o[0], o[1], o[2]},
+                        {d[0], d[1], d[2]},
+                        numeric_limits<float>::infinity()};
+          VoxHit hit;
+          if (!collision_.Raycast(ray, hit)) {
+            radiance.r += throughput.r * options_.sky.r;
+            radiance.g += throughput.g * options_.sky.g;
+            radiance.b += throughput.b * options_.sky.b;
+            break;
+          }
+          const uint8_t color =
+              dense_.voxel(hit.voxel.x, hit.voxel.y, hit.voxel.z);
+          const Irradiance& emission = emission_[color];
+          radiance.r += throughput.r * emission.r;
+          radiance.g += throughput.g * emission.g;
+          radiance.b += throughput.b * emission.b;
+          if (bounce == options_.bounces) break;
+
+          // Continue diffusely from the face that was hit.
+          const Irradiance& albedo = albedo_[color];
+          throughput.r *= albedo.r;
+          throughput.g *= albedo.g;
+          throughput.b *= albedo.b;
+          if (throughput.r + throughput.g + throughput.b <= 0) break;
+          const int hit_axis = hit.face / 2;
+          const float hit_p[3] = {static_cast<float>(hit.voxel.x),
+                                  static_cast<float>(hit.voxel.y),
+                                  static_cast<float>(hit.voxel.z)};
+          for (int a = 0; a < 3; ++a) o[a] += d[a] * hit.distance;
+          o[hit_axis] = hit_p[hit_axis] +
+                        ((hit.face & 1) ? 1 + kSurfaceOffset : -kSurfaceOffset);
+          SampleDirection(hit.face, random, d);
+        }
+        sum.r += radiance.r;
+        sum.g += radiance.g;
+        sum.b += radiance.b;
+      }
+
+      // Tiles own disjoint voxels, so no other thread writes here.
+      Irradiance& out = sums_[i].faces[f];
+      out.r += sum.r * weight;
+      out.g += sum.g * weight;
+      out.b += sum.b * weight;
+    }
+  }
+}
+
+void VoxLightmapBaker::Irradiances(std::vector<VoxelIrradiance>& out) const {
+  out.assign(sums_.size(), VoxelIrradiance{});
+  if (!passes_) return;
+  const float scale = 1.0f / passes_;
+  for (size_t i = 0; i < sums_.size(); ++i) {
+    for (int f = 0; f < 6; ++f) {
+      const Irradiance& sum = sums_[i].faces[f];
+      out[i].faces[f] = {sum.r * scale, sum.g * scale, sum.b * scale};
+    }
+  }
+}
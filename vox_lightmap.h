@@ -0,0 +1,110 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_LIGHTMAP_H
+#define VOX_LIGHTMAP_H
+
+#include "vox_collision.h"
+#include "vox_file.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// Linear-light RGB.
+struct Irradiance {
+  float r, g, b;
+};
+
+// Light arriving at the six faces of one voxel, indexed by Face. Faces
+// covered by another voxel stay black.
+struct VoxelIrradiance {
+  Irradiance faces[6];
+};
+
+struct LightmapOptions {
+  // Rays per face per pass.
+  int samples_per_pass = 4;
+  // Bounces after the first hit; 0 gives direct light only.
+  int bounces = 2;
+  // Radiance of rays that leave the model.
+  Irradiance sky = {1.0f, 1.0f, 1.0f};
+  // Scale of MATL emission. A material emits its (linear) palette color times
+  // emission * (1 + flux) * emission_scale.
+  float emission_scale = 1.0f;
+  // Base seed; the same seed, options and model always bake the same result,
+  // whatever the number of threads.
+  uint32_t seed = 0;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Progressive path tracer that bakes the irradiance of every voxel face of a
+// model, using the palette colors as (diffuse) albedo and the MATL emission of
+// each color as a light source.
+//
+// Every call to Bake adds passes to the running average, so a level can be
+// previewed after one pass and refined later. Work is split into tiles of
+// voxels that threads steal from each other; each tile draws its random
+// numbers from a generator seeded by (seed, pass, tile), so results do not
+// depend on scheduling. Rays walk the model's bricks with VoxCollisionModel,
+// skipping empty bricks.
+//
+// The models must outlive the baker; sparse must hold the voxels of dense
+// (e.g. the models a VoxFile loaded), and the results are indexed parallel to
+// sparse.voxels().
+class VoxLightmapBaker {
+ public:
+  VoxLightmapBaker(const VoxDenseModel& dense, const VoxSparseModel& sparse,
+                   const PaletteViews& palette, const MaterialTable& materials,
+                   const LightmapOptions& options = LightmapOptions());
+
+  // Traces `passes` more passes.
+  void Bake(int passes = 1);
+
+  // Drops everything baked so far.
+  void Reset();
+
+  int passes() const noexcept { return passes_; }
+
+  // Average of the passes baked so far (black before the first).
+  void Irradiances(std::vector<VoxelIrradiance>& out) const;
+
+ private:
+  void BakeTile(size_t tile);
+
+  const VoxDenseModel& dense_;
+  const VoxSparseModel& sparse_;
+  const LightmapOptions options_;
+  const VoxCollisionModel collision_;
+  std::array<Irradiance, 256> albedo_;
+  std::array<Irradiance, 256> emission_;
+  std::vector<VoxelIrradiance> sums_;
+  int passes_ = 0;
+};
+
+}  // namespace magicavoxel
+#endif
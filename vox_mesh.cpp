@@ -0,0 +1,135 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_mesh.h"
+
+#include <cstring>
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+// Appends a quad with corner origin spanning w voxels along axis u and h
+// voxels along axis v, on the given face.
+void AddQuad(VoxMesh& mesh, const uint32_t origin[3], int u, int v, uint32_t w,
+             uint32_t h, Face face, uint8_t color) {
+  float corners[4][3];
+  for (int c = 0; c < 4; ++c) {
+    for (int axis = 0; axis < 3; ++axis)
+      corners[c][axis] = static_cast<float>(origin[axis]);
+  }
+  corners[1][u] += w;
+  corners[2][u] += w;
+  corners[2][v] += h;
+  corners[3][v] += h;
+
+  // (u, v) is a right-handed pair around the face axis, so corners 0-1-2-3
+  // wind counter-clockwise around the positive direction.
+  static const int kPositiveOrder[4] = {0, 1, 2, 3};
+  static const int kNegativeOrder[4] = {0, 3, 2, 1};
+  const int* order = (face & 1) ? kPositiveOrder : kNegativeOrder;
+
+  const uint32_t base = static_cast<uint32_t>(mesh.vertices.size());
+  for (int c = 0; c < 4; ++c) {
+    const float* p = corners[order[c]];
+    MeshVertex vertex{p[0], p[1], p[2], face, color, {0, 0}};
+    mesh.vertices.push_back(vertex);
+  }
+  const uint32_t quad_indices[6] = {base,     base + 1, base + 2,
+                                    base + 2, base + 3, base};
+  mesh.indices.insert(mesh.indices.end(), quad_indices, quad_indices + 6);
+}
+
+}  // namespace
+
+void magicavoxel::MeshModel(const VoxDenseModel& model, VoxMesh& mesh) {
+  mesh.clear();
+
+  const Size& size = model.size();
+  const uint32_t dims[3] = {size.x, size.y, size.z};
+  const size_t strides[3] = {1, size.x, static_cast<size_t>(size.x) * size.y};
+  const uint8_t* voxels = model.data().data();
+
+  vector<uint8_t> mask;
+  for (int face_index = 0; face_index < 6; ++face_index) {
+    const Face face = static_cast<Face>(face_index);
+    const int axis = face_index / 2;
+    const int u = (axis + 1) % 3;
+    const int v = (axis + 2) % 3;
+    const bool positive = face_index & 1;
+    mask.resize(static_cast<size_t>(dims[u]) * dims[v]);
+
+    for (uint32_t slice = 0; slice < dims[axis]; ++slice) {
+      // Color of each visible face in this slice, or 0.
+      const bool at_edge = positive ? slice + 1 == dims[axis] : slice == 0;
+      for (uint32_t j = 0; j < dims[v]; ++j) {
+        for (uint32_t i = 0; i < dims[u]; ++i) {
+          const size_t index =
+              slice * strides[axis] + i * strides[u] + j * strides[v];
+          uint8_t color = voxels[index];
+          if (color && !at_edge) {
+            const size_t neighbor = positive ? index + strides[axis]
+                                             : index - strides[axis];
+            if (voxels[neighbor]) color = 0;
+          }
+          mask[i + static_cast<size_t>(j) * dims[u]] = color;
+        }
+      }
+
+      // Greedily cover the mask with rectangles of a single color.
+      for (uint32_t j = 0; j < dims[v]; ++j) {
+        for (uint32_t i = 0; i < dims[u];) {
+          uint8_t* row = &mask[static_cast<size_t>(j) * dims[u]];
+          const uint8_t color = row[i];
+          if (!color) {
+            ++i;
+            continue;
+          }
+
+          uint32_t w = 1;
+          while (i + w < dims[u] && row[i + w] == color) ++w;
+
+          uint32_t h = 1;
+          for (; j + h < dims[v]; ++h) {
+            const uint8_t* next = row + static_cast<size_t>(h) * dims[u];
+            uint32_t k = 0;
+            while (k < w && next[i + k] == color) ++k;
+            if (k < w) break;
+          }
+
+          for (uint32_t dj = 0; dj < h; ++dj)
+            memset(row + static_cast<size_t>(dj) * dims[u] + i, 0, w);
+
+          uint32_t origin[3];
+          origin[axis] = slice + (positive ? 1 : 0);
+          origin[u] = i;
+          origin[v] = j;
+          AddQuad(mesh, origin, u, v, w, h, face, color);
+          i += w;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,76 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_MESH_H
+#define VOX_MESH_H
+
+#include "vox_file.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// Direction a voxel face points in. Even values face towards negative
+// coordinates, odd values towards positive; value / 2 is the axis (0 = x,
+// 1 = y, 2 = z).
+enum Face : uint8_t {
+  kFaceNegX,
+  kFacePosX,
+  kFaceNegY,
+  kFacePosY,
+  kFaceNegZ,
+  kFacePosZ
+};
+
+// Vertex of a voxel mesh. Positions are in voxel units, with the model's
+// (0, 0, 0) corner at the origin.
+struct MeshVertex {
+  float x, y, z;
+  uint8_t face;   // Face the vertex belongs to (its normal)
+  uint8_t color;  // Palette index
+  uint8_t reserved[2];
+};
+
+// Triangle mesh of the visible faces of a model. Every quad is four vertices
+// and six indices (two triangles), counter-clockwise when seen from outside.
+struct VoxMesh {
+  std::vector<MeshVertex> vertices;
+  std::vector<uint32_t> indices;
+
+  void clear() noexcept {
+    vertices.clear();
+    indices.clear();
+  }
+};
+
+// Meshes the faces of model that are not covered by another voxel, replacing
+// the contents of mesh. Adjacent faces of the same color and direction are
+// greedily merged into larger rectangles, so flat areas cost two triangles
+// rather than two per voxel. The buffers of mesh are reused, so meshing many
+// models through the same VoxMesh does not allocate once it has grown.
+void MeshModel(const VoxDenseModel& model, VoxMesh& mesh);
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,445 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_nav.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <unordered_map>
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+constexpr int32_t kNone = -1;
+
+// Directions between columns: -x, +x, -y, +y. d ^ 1 is the opposite of d.
+constexpr int kDx[4] = {-1, 1, 0, 0};
+constexpr int kDy[4] = {0, 0, -1, 1};
+
+// Ceiling of a column with nothing above.
+constexpr int32_t kOpen = INT32_MAX / 2;
+
+// A walkable rectangle while the mesh is being built.
+struct Rect {
+  uint16_t x0, y0, x1, y1, top;
+};
+
+// The candidate floors of every column, with their links to neighbors.
+struct Cells {
+  uint32_t sx, sy;
+  vector<uint32_t> column_start;  // cells of column c: [start[c], start[c+1])
+  vector<uint16_t> top;           // z of the top of the floor voxel
+  vector<int32_t> ceiling;        // z of the next occupied voxel above
+  vector<array<int32_t, 4>> links;
+  vector<uint8_t> walkable;
+  vector<int32_t> polygon;
+
+  size_t Column(uint32_t x, uint32_t y) const { return x + size_t{sx} * y; }
+
+  int32_t Find(uint32_t x, uint32_t y, uint16_t z) const {
+    const size_t column = Column(x, y);
+    for (uint32_t i = column_start[column]; i < column_start[column + 1]; ++i) {
+      if (top[i] == z) return static_cast<int32_t>(i);
+    }
+    return kNone;
+  }
+
+  // Neighbor of cell i in direction d, if both are walkable.
+  int32_t Walk(int32_t i, int d) const {
+    const int32_t n = links[i][d];
+    return (n != kNone && walkable[n]) ? n : kNone;
+  }
+};
+
+// Calls emit(top, ceiling) for every top of an occupied voxel in column
+// (x, y) with at least height empty voxels above it.
+template <typename Emit>
+void ScanColumn(const VoxBrickMap& occupancy, uint32_t x, uint32_t y,
+                int height, Emit emit) {
+  const uint32_t sz = occupancy.size().z;
+  bool below = false;
+  int32_t floor_top = -1;  // top of the last occupied run, if any
+  for (uint32_t z = 0; z < sz; ++z) {
+    const bool occupied = occupancy.occupied(x, y, z);
+    if (occupied && floor_top >= 0) {
+      if (static_cast<int32_t>(z) - floor_top >= height)
+        emit(static_cast<uint16_t>(floor_top), static_cast<int32_t>(z));
+      floor_top = -1;
+    } else if (!occupied && below) {
+      floor_top = static_cast<int32_t>(z);
+    }
+    below = occupied;
+  }
+  if (below) floor_top = static_cast<int32_t>(sz);
+  if (floor_top >= 0) emit(static_cast<uint16_t>(floor_top), kOpen);
+}
+
+}  // namespace
+
+int VoxNavMesh::FindPolygon(const Vec3f& position, float max_drop) const {
+  int best = -1;
+  for (size_t i = 0; i < polygons_.size(); ++i) {
+    const NavPolygon& p = polygons_[i];
+    if (position.x < p.min_x || position.x >= p.max_x ||
+        position.y < p.min_y || position.y >= p.max_y)
+      continue;
+    if (p.z > position.z + 0.5f || p.z < position.z - max_drop) continue;
+    if (best < 0 || p.z > polygons_[best].z) best = static_cast<int>(i);
+  }
+  return best;
+}
+
+void magicavoxel::BuildNavMesh(const VoxDenseModel& model,
+                               const NavOptions& options, VoxNavMesh& mesh) {
+  BuildNavMesh(VoxBrickMap(model), options, mesh);
+}
+
+void magicavoxel::BuildNavMesh(const VoxBrickMap& occupancy,
+                               const NavOptions& options, VoxNavMesh& mesh) {
+  mesh.clear();
+  const Size& size = occupancy.size();
+  if (!size.x || !size.y || !size.z) return;
+  const int height = max(options.agent_height, 1);
+  const uint32_t tiles_x = (size.x + kBrickSize - 1) / kBrickSize;
+  const uint32_t tiles_y = (size.y + kBrickSize - 1) / kBrickSize;
+
+  // Floors of every column: count, then fill, one row of bricks per task.
+  Cells cells;
+  cells.sx = size.x;
+  cells.sy = size.y;
+  cells.column_start.assign(size_t{size.x} * size.y + 1, 0);
+  ParallelFor(tiles_y, 1, options.threads, [&](size_t ty0, size_t ty1) {
+    const uint32_t y1 = min<uint32_t>(size.y, ty1 * kBrickSize);
+    for (uint32_t y = ty0 * kBrickSize; y < y1; ++y) {
+      for (uint32_t x = 0; x < size.x; ++x) {
+        uint32_t& count = cells.column_start[cells.Column(x, y) + 1];
+        ScanColumn(occupancy, x, y, height, [&](uint16_t, int32_t) { ++count; });
+      }
+    }
+  });
+  for (size_t c = 1; c < cells.column_start.size(); ++c)
+    cells.column_start[c] += cells.column_start[c - 1];
+  const size_t n_cells = cells.column_start.back();
+  cells.top.resize(n_cells);
+  cells.ceiling.resize(n_cells);
+  cells.links.resize(n_cells);
+  cells.walkable.assign(n_cells, 1);
+  cells.polygon.assign(n_cells, kNone);
+  ParallelFor(tiles_y, 1, options.threads, [&](size_t ty0, size_t ty1) {
+    const uint32_t y1 = min<uint32_t>(size.y, ty1 * kBrickSize);
+    for (uint32_t y = ty0 * kBrickSize; y < y1; ++y) {
+      for (uint32_t x = 0; x < size.x; ++x) {
+        uint32_t i = cells.column_start[cells.Column(x, y)];
+        ScanColumn(occupancy, x, y, height, [&](uint16_t top, int32_t ceiling) {
+          cells.top[i] = top;
+          cells.ceiling[i++] = ceiling;
+        });
+      }
+    }
+  });
+
+  // Links: the neighboring floor closest in height that the agent can step
+  // to without hitting its head on either side.
+  ParallelFor(tiles_y, 1, options.threads, [&](size_t ty0, size_t ty1) {
+    const uint32_t y1 = min<uint32_t>(size.y, ty1 * kBrickSize);
+    for (uint32_t y = ty0 * kBrickSize; y < y1; ++y) {
+      for (uint32_t x = 0; x < size.x; ++x) {
+        const size_t column = cells.Column(x, y);
+        for (uint32_t i = cells.column_start[column];
+             i < cells.column_start[column + 1]; ++i) {
+          for (int d = 0; d < 4; ++d) {
+            int32_t best = kNone;
+            int best_step = INT_MAX;
+            const long nx = static_cast<long>(x) + kDx[d];
+            const long ny = static_cast<long>(y) + kDy[d];
+            if (nx >= 0 && ny >= 0 && nx < static_cast<long>(size.x) &&
+                ny < static_cast<long>(size.y)) {
+              const size_t other = cells.Column(static_cast<uint32_t>(nx),
+                                                static_cast<uint32_t>(ny));
+              for (uint32_t j = cells.column_start[other];
+                   j < cells.column_start[other + 1]; ++j) {
+                const int step = abs(cells.top[i] - cells.top[j]);
+                const int32_t room = min(cells.ceiling[i], cells.ceiling[j]) -
+                                     max(cells.top[i], cells.top[j]);
+                if (step <= options.step_height && room >= height &&
+                    step < best_step) {
+                  best = static_cast<int32_t>(j);
+                  best_step = step;
+                }
+              }
+            }
+            cells.links[i][d] = best;
+          }
+        }
+      }
+    }
+  });
+
+  // Erosion: distance (in steps) from each floor to the nearest edge of the
+  // walkable area, where an edge floor, missing a link, is 1 step away.
+  if (options.agent_radius > 0) {
+    vector<uint32_t> distance(n_cells, 0);
+    vector<uint32_t> queue;
+    for (size_t i = 0; i < n_cells; ++i) {
+      const array<int32_t, 4>& l = cells.links[i];
+      if (l[0] == kNone || l[1] == kNone || l[2] == kNone || l[3] == kNone) {
+        distance[i] = 1;
+        queue.push_back(static_cast<uint32_t>(i));
+      }
+    }
+    for (size_t head = 0; head < queue.size(); ++head) {
+      const uint32_t i = queue[head];
+      for (int d = 0; d < 4; ++d) {
+        const int32_t n = cells.links[i][d];
+        if (n != kNone && !distance[n]) {
+          distance[n] = distance[i] + 1;
+          queue.push_back(static_cast<uint32_t>(n));
+        }
+      }
+    }
+    for (size_t i = 0; i < n_cells; ++i) {
+      // Unreached floors are enclosed by links on all sides: keep them.
+      cells.walkable[i] =
+          !distance[i] || distance[i] - 0.5f >= options.agent_radius;
+    }
+  }
+
+  // Rectangles, greedily grown along +x then +y inside each column of
+  // bricks, with cells.polygon holding the index within the tile.
+  vector<vector<Rect>> tile_rects(size_t{tiles_x} * tiles_y);
+  ParallelFor(tile_rects.size(), 1, options.threads, [&](size_t t0, size_t t1) {
+    vector<int32_t> members;
+    for (size_t t = t0; t < t1; ++t) {
+      const uint32_t bx = static_cast<uint32_t>(t % tiles_x) * kBrickSize;
+      const uint32_t by = static_cast<uint32_t>(t / tiles_x) * kBrickSize;
+      const uint32_t ex = min(size.x, bx + kBrickSize);
+      const uint32_t ey = min(size.y, by + kBrickSize);
+      vector<Rect>& rects = tile_rects[t];
+      for (uint32_t y = by; y < ey; ++y) {
+        for (uint32_t x = bx; x < ex; ++x) {
+          const size_t column = cells.Column(x, y);
+          for (uint32_t c = cells.column_start[column];
+               c < cells.column_start[column + 1]; ++c) {
+            if (!cells.walkable[c] || cells.polygon[c] != kNone) continue;
+            const uint16_t top = cells.top[c];
+            auto free = [&](int32_t n) {
+              return n != kNone && cells.polygon[n] == kNone &&
+                     cells.top[n] == top;
+            };
+            members.assign(1, static_cast<int32_t>(c));
+            uint32_t width = 1;
+            while (x + width < ex) {
+              const int32_t n = cells.Walk(members.back(), 1);
+              if (!free(n)) break;
+              members.push_back(n);
+              ++width;
+            }
+            uint32_t rows = 1;
+            while (y + rows < ey) {
+              const size_t row = members.size() - width;
+              bool ok = true;
+              for (uint32_t k = 0; k < width && ok; ++k) {
+                const int32_t n = cells.Walk(members[row + k], 3);
+                ok = free(n) &&
+                     (k == 0 || cells.Walk(members[row + width + k - 1], 1) == n);
+                if (ok) members.push_back(n);
+              }
+              if (!ok) {
+                members.resize(row + width);
+                break;
+              }
+              ++rows;
+            }
+            const int32_t id = static_cast<int32_t>(rects.size());
+            for (int32_t m : members) cells.polygon[m] = id;
+            rects.push_back({static_cast<uint16_t>(x), static_cast<uint16_t>(y),
+                             static_cast<uint16_t>(x + width),
+                             static_cast<uint16_t>(y + rows), top});
+          }
+        }
+      }
+    }
+  });
+
+  vector<Rect> rects;
+  vector<uint32_t> tile_offset(tile_rects.size());
+  for (size_t t = 0; t < tile_rects.size(); ++t) {
+    tile_offset[t] = static_cast<uint32_t>(rects.size());
+    rects.insert(rects.end(), tile_rects[t].begin(), tile_rects[t].end());
+  }
+  ParallelFor(tile_rects.size(), 1, options.threads, [&](size_t t0, size_t t1) {
+    for (size_t t = t0; t < t1; ++t) {
+      const uint32_t bx = static_cast<uint32_t>(t % tiles_x) * kBrickSize;
+      const uint32_t by = static_cast<uint32_t>(t / tiles_x) * kBrickSize;
+      for (uint32_t y = by; y < min(size.y, by + kBrickSize); ++y) {
+        for (uint32_t x = bx; x < min(size.x, bx + kBrickSize); ++x) {
+          const size_t column = cells.Column(x, y);
+          for (uint32_t c = cells.column_start[column];
+               c < cells.column_start[column + 1]; ++c) {
+            if (cells.polygon[c] != kNone) cells.polygon[c] += tile_offset[t];
+          }
+        }
+      }
+    }
+  });
+
+  // Merge rectangles that continue each other across brick borders: first
+  // along x (same rows), then along y (same columns).
+  vector<int32_t> parent(rects.size());
+  for (size_t r = 0; r < rects.size(); ++r) parent[r] = static_cast<int32_t>(r);
+  auto find = [&](int32_t r) {
+    while (parent[r] != r) r = parent[r] = parent[parent[r]];
+    return r;
+  };
+  for (int axis = 0; axis < 2; ++axis) {
+    auto key = [axis](const Rect& r, uint16_t start) {
+      const uint64_t across0 = axis ? r.x0 : r.y0;
+      const uint64_t across1 = axis ? r.x1 : r.y1;
+      return uint64_t{r.top} | across0 << 16 | across1 << 32 |
+             uint64_t{start} << 48;
+    };
+    unordered_map<uint64_t, int32_t> starts;
+    vector<int32_t> order;
+    for (size_t r = 0; r < rects.size(); ++r) {
+      if (parent[r] != static_cast<int32_t>(r)) continue;
+      starts[key(rects[r], axis ? rects[r].y0 : rects[r].x0)] =
+          static_cast<int32_t>(r);
+      order.push_back(static_cast<int32_t>(r));
+    }
+    sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+      return axis ? rects[a].y0 < rects[b].y0 : rects[a].x0 < rects[b].x0;
+    });
+    for (int32_t r : order) {
+      if (parent[r] != r) continue;
+      for (;;) {
+        Rect& rect = rects[r];
+        const uint16_t end = axis ? rect.y1 : rect.x1;
+        auto it = starts.find(key(rect, end));
+        if (it == starts.end()) break;
+        const int32_t s = it->second;
+        // Every floor along the border must link to the other rectangle.
+        bool linked = true;
+        const uint16_t lo = axis ? rect.x0 : rect.y0;
+        const uint16_t hi = axis ? rect.x1 : rect.y1;
+        for (uint16_t k = lo; k < hi && linked; ++k) {
+          const int32_t c = axis ? cells.Find(k, end - 1, rect.top)
+                                 : cells.Find(end - 1, k, rect.top);
+          const int32_t n = c == kNone ? kNone : cells.Walk(c, axis ? 3 : 1);
+          linked = n != kNone && find(cells.polygon[n]) == s;
+        }
+        if (!linked) break;
+        if (axis) rect.y1 = rects[s].y1;
+        else rect.x1 = rects[s].x1;
+        parent[s] = r;
+        starts.erase(it);
+      }
+    }
+  }
+
+  // Final polygons, with shared corner vertices.
+  vector<int32_t> final_id(rects.size(), kNone);
+  unordered_map<uint64_t, uint32_t> vertex_ids;
+  auto vertex = [&](uint16_t x, uint16_t y, uint16_t z) {
+    const uint64_t k = uint64_t{x} | uint64_t{y} << 16 | uint64_t{z} << 32;
+    auto inserted = vertex_ids.emplace(k, static_cast<uint32_t>(mesh.vertices_.size()));
+    if (inserted.second) {
+      mesh.vertices_.push_back({static_cast<float>(x), static_cast<float>(y),
+                                static_cast<float>(z)});
+    }
+    return inserted.first->second;
+  };
+  for (size_t r = 0; r < rects.size(); ++r) {
+    if (parent[r] != static_cast<int32_t>(r)) continue;
+    const Rect& rect = rects[r];
+    final_id[r] = static_cast<int32_t>(mesh.polygons_.size());
+    NavPolygon polygon;
+    polygon.vertices[0] = vertex(rect.x0, rect.y0, rect.top);
+    polygon.vertices[1] = vertex(rect.x1, rect.y0, rect.top);
+    polygon.vertices[2] = vertex(rect.x1, rect.y1, rect.top);
+    polygon.vertices[3] = vertex(rect.x0, rect.y1, rect.top);
+    polygon.min_x = rect.x0;
+    polygon.min_y = rect.y0;
+    polygon.max_x = rect.x1;
+    polygon.max_y = rect.y1;
+    polygon.z = rect.top;
+    polygon.first_link = polygon.link_count = 0;
+    mesh.polygons_.push_back(polygon);
+  }
+  for (size_t r = 0; r < rects.size(); ++r)
+    final_id[r] = final_id[find(static_cast<int32_t>(r))];
+  for (int32_t& p : cells.polygon) {
+    if (p != kNone) p = final_id[p];
+  }
+
+  // Portals: runs of edge floors that link into the same neighbor polygon.
+  vector<vector<NavLink>> links(mesh.polygons_.size());
+  ParallelFor(links.size(), 64, options.threads, [&](size_t p0, size_t p1) {
+    for (size_t p = p0; p < p1; ++p) {
+      const NavPolygon& polygon = mesh.polygons_[p];
+      const float z = polygon.z;
+      for (int d = 0; d < 4; ++d) {
+        const bool along_y = d < 2;
+        const uint16_t lo = along_y ? polygon.min_y : polygon.min_x;
+        const uint16_t hi = along_y ? polygon.max_y : polygon.max_x;
+        const uint16_t edge = (d & 1) ? (along_y ? polygon.max_x : polygon.max_y) - 1
+                                      : (along_y ? polygon.min_x : polygon.min_y);
+        const float line = (d & 1) ? edge + 1.0f : edge;
+        int32_t run_polygon = kNone;
+        uint16_t run_start = lo;
+        for (uint16_t k = lo; k <= hi; ++k) {
+          int32_t q = kNone;
+          if (k < hi) {
+            const int32_t c = along_y ? cells.Find(edge, k, polygon.z)
+                                      : cells.Find(k, edge, polygon.z);
+            const int32_t n = c == kNone ? kNone : cells.Walk(c, d);
+            if (n != kNone) q = cells.polygon[n];
+          }
+          if (q == run_polygon) continue;
+          if (run_polygon != kNone && run_polygon != static_cast<int32_t>(p)) {
+            NavLink link;
+            link.polygon = static_cast<uint32_t>(run_polygon);
+            link.a = along_y ? Vec3f{line, static_cast<float>(run_start), z}
+                             : Vec3f{static_cast<float>(run_start), line, z};
+            link.b = along_y ? Vec3f{line, static_cast<float>(k), z}
+                             : Vec3f{static_cast<float>(k), line, z};
+            links[p].push_back(link);
+          }
+          run_polygon = q;
+          run_start = k;
+        }
+      }
+    }
+  });
+  for (size_t p = 0; p < links.size(); ++p) {
+    mesh.polygons_[p].first_link = static_cast<uint32_t>(mesh.links_.size());
+    mesh.polygons_[p].link_count = static_cast<uint32_t>(links[p].size());
+    mesh.links_.insert(mesh.links_.end(), links[p].begin(), links[p].end());
+  }
+}
@@ -0,0 +1,105 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_NAV_H
+#define VOX_NAV_H
+
+#include "vox_brick.h"
+#include "vox_file.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// Size and abilities of the agents a navmesh is built for, in voxels.
+struct NavOptions {
+  // Empty voxels the agent needs above the floor it stands on.
+  int agent_height = 2;
+  // Walkable area closer than this to a ledge or wall is dropped.
+  float agent_radius = 0.5f;
+  // Highest step (up or down) the agent can take between neighboring voxels.
+  int step_height = 1;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Walkable region: an axis-aligned rectangle of voxel tops, all at height z
+// (the top of the floor voxels), covering [min_x, max_x) x [min_y, max_y).
+struct NavPolygon {
+  // Corners in counter-clockwise order seen from above (+z), as indices into
+  // VoxNavMesh::vertices().
+  uint32_t vertices[4];
+  uint16_t min_x, min_y, max_x, max_y, z;
+  // This polygon's links are links()[first_link, first_link + link_count).
+  uint32_t first_link;
+  uint32_t link_count;
+};
+
+// Connection from one polygon to a neighbor. The agent can cross anywhere
+// along the portal, a segment of the polygon's edge from a to b.
+struct NavLink {
+  uint32_t polygon;
+  Vec3f a, b;
+};
+
+// Polygon navmesh of the walkable surfaces of a model.
+class VoxNavMesh {
+ public:
+  const std::vector<Vec3f>& vertices() const noexcept { return vertices_; }
+  const std::vector<NavPolygon>& polygons() const noexcept { return polygons_; }
+  const std::vector<NavLink>& links() const noexcept { return links_; }
+
+  // Polygon the agent is standing on at position: the highest one under
+  // (x, y) whose height is at most position.z + 0.5, and no more than
+  // max_drop below. -1 if there is none.
+  int FindPolygon(const Vec3f& position, float max_drop = 2.0f) const;
+
+  void clear() {
+    vertices_.clear();
+    polygons_.clear();
+    links_.clear();
+  }
+
+ private:
+  friend void BuildNavMesh(const VoxBrickMap&, const NavOptions&, VoxNavMesh&);
+
+  std::vector<Vec3f> vertices_;
+  std::vector<NavPolygon> polygons_;
+  std::vector<NavLink> links_;
+};
+
+// Builds the navmesh of a model: finds the tops of occupied voxels with room
+// for the agent above them, links neighboring tops the agent can step
+// between, erodes the walkable area by the agent's radius, and merges it into
+// rectangles. Columns, links and rectangles are processed in parallel, one
+// 8x8 column of bricks at a time, and rectangles are then merged across brick
+// borders.
+void BuildNavMesh(const VoxBrickMap& occupancy, const NavOptions& options,
+                  VoxNavMesh& mesh);
+void BuildNavMesh(const VoxDenseModel& model, const NavOptions& options,
+                  VoxNavMesh& mesh);
+
+}  // namespace magicavoxel
+#endif
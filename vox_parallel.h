@@ -0,0 +1,165 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_PARALLEL_H
+#define VOX_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace magicavoxel {
+
+// Number of threads to use when the caller asks for 0 (= automatic).
+inline unsigned ThreadCount(unsigned requested = 0) {
+  if (requested) return requested;
+  const unsigned hardware = std::thread::hardware_concurrency();
+  return hardware ? hardware : 1;
+}
+
+// Keeps the first exception thrown by the threads of a parallel loop, to be
+// rethrown on the calling thread once they have all been joined (an exception
+// escaping a std::thread would call std::terminate).
+class ParallelErrors {
+ public:
+  // Runs fn, storing what it throws.
+  template <typename Fn>
+  void Run(Fn&& fn) noexcept {
+    try {
+      fn();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) error_ = std::current_exception();
+      failed_.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  // Whether anything has thrown yet, so loops can stop taking work.
+  bool failed() const noexcept {
+    return failed_.load(std::memory_order_relaxed);
+  }
+
+  // Rethrows the stored exception, if any. Call after joining the threads.
+  void Rethrow() const {
+    if (error_) std::rethrow_exception(error_);
+  }
+
+ private:
+  std::mutex mutex_;
+  std::exception_ptr error_;
+  std::atomic<bool> failed_{false};
+};
+
+// Calls fn(begin, end) for contiguous ranges covering [0, count), one range
+// per thread, on up to `threads` threads (0 = one per core). Ranges are never
+// smaller than min_chunk, so small jobs stay on the calling thread. If fn
+// throws, the other ranges still finish and the first exception is rethrown.
+template <typename Fn>
+void ParallelFor(size_t count, size_t min_chunk, unsigned threads, Fn fn) {
+  const size_t max_threads = std::max<size_t>(count / std::max<size_t>(min_chunk, 1), 1);
+  const size_t n_threads = std::min<size_t>(ThreadCount(threads), max_threads);
+  if (n_threads <= 1) {
+    if (count) fn(size_t{0}, count);
+    return;
+  }
+
+  ParallelErrors errors;
+  std::vector<std::thread> workers;
+  workers.reserve(n_threads - 1);
+  const size_t chunk = (count + n_threads - 1) / n_threads;
+  errors.Run([&] {
+    for (size_t t = 1; t < n_threads; ++t) {
+      const size_t begin = std::min(count, t * chunk);
+      const size_t end = std::min(count, begin + chunk);
+      if (begin < end) {
+        workers.emplace_back(
+            [=, &fn, &errors] { errors.Run([&] { fn(begin, end); }); });
+      }
+    }
+    fn(size_t{0}, std::min(count, chunk));
+  });
+  for (std::thread& worker : workers) worker.join();
+  errors.Rethrow();
+}
+
+// Calls fn(tile, thread) once for every tile in [0, tiles), on up to
+// `threads` threads (0 = one per core); thread is in [0, ThreadCount(threads))
+// and no two calls with the same thread overlap, so it can index per-thread
+// scratch space. Each thread starts on its own contiguous share
+// of the tiles and, once that runs out, steals tiles from the other shares,
+// so threads stay busy even when tiles take very different times. Which
+// thread runs a tile is not deterministic; anything that must be (like
+// random numbers) should be derived from the tile index. If fn throws, no
+// further tiles are started and the first exception is rethrown.
+template <typename Fn>
+void ParallelForTiles(size_t tiles, unsigned threads, Fn fn) {
+  const size_t n_threads =
+      std::min<size_t>(ThreadCount(threads), std::max<size_t>(tiles, 1));
+  if (n_threads <= 1) {
+    for (size_t tile = 0; tile < tiles; ++tile) fn(tile, 0u);
+    return;
+  }
+
+  // One cache line per share, so threads taking tiles do not contend.
+  struct Share {
+    std::atomic<size_t> next;
+    size_t end;
+    char padding[64 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+  };
+  std::unique_ptr<Share[]> shares(new Share[n_threads]);
+  for (size_t t = 0; t < n_threads; ++t) {
+    shares[t].next.store(tiles * t / n_threads, std::memory_order_relaxed);
+    shares[t].end = tiles * (t + 1) / n_threads;
+  }
+
+  ParallelErrors errors;
+  auto work = [&](size_t self) {
+    errors.Run([&] {
+      for (size_t k = 0; k < n_threads; ++k) {
+        Share& share = shares[(self + k) % n_threads];
+        while (!errors.failed()) {
+          const size_t tile = share.next.fetch_add(1, std::memory_order_relaxed);
+          if (tile >= share.end) break;
+          fn(tile, static_cast<unsigned>(self));
+        }
+      }
+    });
+  };
+  std::vector<std::thread> workers;
+  workers.reserve(n_threads - 1);
+  errors.Run([&] {
+    for (size_t t = 1; t < n_threads; ++t) workers.emplace_back(work, t);
+  });
+  work(0);
+  for (std::thread& worker : workers) worker.join();
+  errors.Rethrow();
+}
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,709 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_path.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+constexpr float kInfinity = numeric_limits<float>::infinity();
+
+// Longest straight jump; longer ones stop and become jump points, which
+// keeps the cost of scanning open space for forced neighbors bounded.
+constexpr int kMaxJump = 2 * kBrickSize;
+
+// Queries whose ends are at most this many bricks apart (along every axis)
+// skip the brick graph.
+constexpr int kNearBricks = 1;
+
+constexpr uint32_t kNoNode = 0xffffffff;
+
+// Cost of one move along a direction with n non-zero components.
+constexpr float kMoveCost[4] = {0.0f, 1.0f, 1.41421356f, 1.73205081f};
+
+constexpr uint32_t kBrickVoxels = kBrickSize * kBrickSize * kBrickSize;
+
+// The 26 moves (dx, dy, dz, non-zero components), and how far each moves
+// the index of a voxel within a brick.
+constexpr int kMoves[26][4] = {
+    {-1, -1, -1, 3}, {0, -1, -1, 2}, {1, -1, -1, 3}, {-1, 0, -1, 2},
+    {0, 0, -1, 1},   {1, 0, -1, 2},  {-1, 1, -1, 3}, {0, 1, -1, 2},
+    {1, 1, -1, 3},   {-1, -1, 0, 2}, {0, -1, 0, 1},  {1, -1, 0, 2},
+    {-1, 0, 0, 1},   {1, 0, 0, 1},   {-1, 1, 0, 2},  {0, 1, 0, 1},
+    {1, 1, 0, 2},    {-1, -1, 1, 3}, {0, -1, 1, 2},  {1, -1, 1, 3},
+    {-1, 0, 1, 2},   {0, 0, 1, 1},   {1, 0, 1, 2},   {-1, 1, 1, 3},
+    {0, 1, 1, 2},    {1, 1, 1, 3}};
+constexpr int kMoveOffset[26] = {
+    -73, -72, -71, -65, -64, -63, -57, -56, -55, -9, -8, -7, -1,
+    1,   7,   8,   9,   55,  56,  57,  63,  64,  65,  71,  72, 73};
+
+int LowestBit(uint32_t bits) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(bits);
+#endif
+}
+
+int Sign(int v) { return (v > 0) - (v < 0); }
+
+// 3D octile distance: the length of the shortest path in open space.
+float Octile(const Vec3i& a, const Vec3i& b) {
+  int d[3] = {abs(static_cast<int>(a.x) - static_cast<int>(b.x)),
+              abs(static_cast<int>(a.y) - static_cast<int>(b.y)),
+              abs(static_cast<int>(a.z) - static_cast<int>(b.z))};
+  sort(d, d + 3);
+  return kMoveCost[3] * d[0] + kMoveCost[2] * (d[1] - d[0]) +
+         kMoveCost[1] * (d[2] - d[1]);
+}
+
+bool operator==(const Vec3i& a, const Vec3i& b) {
+  return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// Calls fn(dx, dy, dz) for every non-zero direction whose components are a
+// subset of d's (same signs), d itself included unless proper.
+template <typename Fn>
+void ForSubDirections(int dx, int dy, int dz, bool proper, Fn fn) {
+  for (int mask = 1; mask < 8; ++mask) {
+    const int sx = (mask & 1) ? dx : 0;
+    const int sy = (mask & 2) ? dy : 0;
+    const int sz = (mask & 4) ? dz : 0;
+    if (!sx && (mask & 1)) continue;
+    if (!sy && (mask & 2)) continue;
+    if (!sz && (mask & 4)) continue;
+    if (proper && sx == dx && sy == dy && sz == dz) continue;
+    fn(sx, sy, sz);
+  }
+}
+
+// Calls fn(ex, ey, ez) for every non-zero offset that only moves along the
+// axes d does not.
+template <typename Fn>
+void ForPerpendicular(int dx, int dy, int dz, Fn fn) {
+  for (int ez = dz ? 0 : -1; ez <= (dz ? 0 : 1); ++ez)
+    for (int ey = dy ? 0 : -1; ey <= (dy ? 0 : 1); ++ey)
+      for (int ex = dx ? 0 : -1; ex <= (dx ? 0 : 1); ++ex)
+        if (ex || ey || ez) fn(ex, ey, ez);
+}
+
+using HeapEntry = pair<float, uint32_t>;
+using MinHeap = greater<HeapEntry>;
+
+}  // namespace
+
+struct VoxPathContext::Scratch {
+  // Jump Point Search nodes, in an open-addressed table keyed by cell.
+  // Entries whose stamp is not the current search's are free.
+  struct Node {
+    uint32_t cell;
+    uint32_t stamp;
+    float g;
+    uint32_t parent;
+    bool closed;
+  };
+  vector<Node> table = vector<Node>(1024, Node{0, 0, 0, 0, false});
+  size_t used = 0;
+  uint32_t stamp = 0;
+  vector<HeapEntry> open;
+
+  // Dijkstra inside one brick. moves holds the moves of brick moves_brick of
+  // the pathfinder whose id_ is moves_owner (0 = none).
+  uint64_t moves_owner = 0;
+  size_t moves_brick = 0;
+  uint32_t moves[kBrickSize * kBrickSize * kBrickSize];
+  float distance[kBrickSize * kBrickSize * kBrickSize];
+  vector<HeapEntry> brick_open;
+
+  // Search over the brick entrance graph.
+  vector<float> g;
+  vector<uint32_t> parent;
+  vector<uint32_t> seen;
+  vector<float> goal_cost;
+  vector<uint32_t> goal_seen;
+  uint32_t graph_stamp = 0;
+  vector<HeapEntry> graph_open;
+  vector<Vec3i> route;
+
+  void BeginSearch() {
+    if (++stamp == 0) {
+      for (Node& node : table) node.stamp = 0;
+      stamp = 1;
+    }
+    used = 0;
+    open.clear();
+  }
+
+  // The node for cell, added (with g = infinity) if new to this search.
+  Node& Get(uint32_t cell) {
+    if (2 * (used + 1) > table.size()) Grow();
+    const size_t mask = table.size() - 1;
+    for (size_t i = Hash(cell) & mask;; i = (i + 1) & mask) {
+      Node& node = table[i];
+      if (node.stamp != stamp) {
+        node = Node{cell, stamp, kInfinity, cell, false};
+        ++used;
+        return node;
+      }
+      if (node.cell == cell) return node;
+    }
+  }
+
+ private:
+  static size_t Hash(uint32_t cell) { return cell * 2654435761u; }
+
+  void Grow() {
+    vector<Node> old(table.size() * 2, Node{0, 0, 0, 0, false});
+    old.swap(table);
+    const size_t mask = table.size() - 1;
+    for (const Node& node : old) {
+      if (node.stamp != stamp) continue;
+      size_t i = Hash(node.cell) & mask;
+      while (table[i].stamp == stamp) i = (i + 1) & mask;
+      table[i] = node;
+    }
+  }
+};
+
+VoxPathContext::VoxPathContext() : scratch_(new Scratch) {}
+VoxPathContext::~VoxPathContext() = default;
+VoxPathContext::VoxPathContext(VoxPathContext&&) noexcept = default;
+VoxPathContext& VoxPathContext::operator=(VoxPathContext&&) noexcept = default;
+
+VoxPathfinder::VoxPathfinder(VoxBrickMap occupancy, unsigned threads)
+    : occupancy_(std::move(occupancy)) {
+  static atomic<uint64_t> next_id{1};
+  id_ = next_id.fetch_add(1, memory_order_relaxed);
+  BuildEntrances(threads);
+}
+
+bool VoxPathfinder::Free(int x, int y, int z) const {
+  const Size& s = occupancy_.size();
+  return x >= 0 && y >= 0 && z >= 0 && x < static_cast<int>(s.x) &&
+         y < static_cast<int>(s.y) && z < static_cast<int>(s.z) &&
+         !occupancy_.occupied(x, y, z);
+}
+
+bool VoxPathfinder::CanMove(int x, int y, int z, int dx, int dy, int dz) const {
+  bool ok = true;
+  ForSubDirections(dx, dy, dz, false, [&](int sx, int sy, int sz) {
+    ok = ok && Free(x + sx, y + sy, z + sz);
+  });
+  return ok;
+}
+
+bool VoxPathfinder::Jump(int x, int y, int z, int dx, int dy, int dz,
+                         const Vec3i& goal, bool probe, int out[3]) const {
+  const int axes = (dx != 0) + (dy != 0) + (dz != 0);
+  for (int steps = 0; steps < kMaxJump; ++steps) {
+    if (!CanMove(x, y, z, dx, dy, dz)) return false;
+    x += dx;
+    y += dy;
+    z += dz;
+    bool stop = static_cast<uint32_t>(x) == goal.x &&
+                static_cast<uint32_t>(y) == goal.y &&
+                static_cast<uint32_t>(z) == goal.z;
+    if (!stop && axes < 3) {
+      // Forced neighbor: a voxel beside this one (across the direction of
+      // travel) that was blocked beside a voxel this one is entered from,
+      // so it could not have been reached more directly. Without corner
+      // cutting, a diagonal also passes the voxels of its components, and
+      // one of those being blocked forces a turn just the same.
+      ForPerpendicular(dx, dy, dz, [&](int ex, int ey, int ez) {
+        if (stop || !Free(x + ex, y + ey, z + ez)) return;
+        ForSubDirections(dx, dy, dz, false, [&](int sx, int sy, int sz) {
+          stop = stop || !Free(x - sx + ex, y - sy + ey, z - sz + ez);
+        });
+      });
+    }
+    if (!stop && axes > 1) {
+      // A diagonal stops where one of its component directions finds a jump
+      // point.
+      int unused[3];
+      ForSubDirections(dx, dy, dz, true, [&](int sx, int sy, int sz) {
+        stop = stop || Jump(x, y, z, sx, sy, sz, goal, true, unused);
+      });
+    }
+    if (stop) {
+      out[0] = x;
+      out[1] = y;
+      out[2] = z;
+      return true;
+    }
+  }
+  // Too far: the end of the scan is a jump point of its own, except when
+  // only probing a diagonal's components for one.
+  out[0] = x;
+  out[1] = y;
+  out[2] = z;
+  return !probe;
+}
+
+bool VoxPathfinder::FindPathJps(const Vec3i& start, const Vec3i& goal,
+                                VoxPathContext& context,
+                                VoxPath& path) const {
+  path.waypoints.clear();
+  path.length = 0;
+  if (!Free(start.x, start.y, start.z) || !Free(goal.x, goal.y, goal.z))
+    return false;
+  if (start == goal) {
+    path.waypoints.push_back(start);
+    return true;
+  }
+
+  const Size& s = occupancy_.size();
+  auto cell_of = [&](int x, int y, int z) {
+    return static_cast<uint32_t>(x + s.x * (y + s.y * static_cast<size_t>(z)));
+  };
+  auto point_of = [&](uint32_t cell) {
+    return Vec3i{cell % s.x, (cell / s.x) % s.y, cell / (s.x * s.y)};
+  };
+
+  VoxPathContext::Scratch& scratch = *context.scratch_;
+  scratch.BeginSearch();
+  const uint32_t start_cell = cell_of(start.x, start.y, start.z);
+  const uint32_t goal_cell = cell_of(goal.x, goal.y, goal.z);
+  scratch.Get(start_cell).g = 0;
+  scratch.open.push_back({Octile(start, goal), start_cell});
+
+  while (!scratch.open.empty()) {
+    pop_heap(scratch.open.begin(), scratch.open.end(), MinHeap());
+    const uint32_t cell = scratch.open.back().second;
+    scratch.open.pop_back();
+    VoxPathContext::Scratch::Node& node = scratch.Get(cell);
+    if (node.closed) continue;
+    node.closed = true;
+    const float g = node.g;
+
+    if (cell == goal_cell) {
+      for (uint32_t c = cell;; c = scratch.Get(c).parent) {
+        path.waypoints.push_back(point_of(c));
+        if (c == start_cell) break;
+      }
+      reverse(path.waypoints.begin(), path.waypoints.end());
+      path.length = g;
+      return true;
+    }
+
+    const Vec3i p = point_of(cell);
+    const Vec3i from = point_of(node.parent);
+    const int x = p.x, y = p.y, z = p.z;
+    const int dx = Sign(x - static_cast<int>(from.x));
+    const int dy = Sign(y - static_cast<int>(from.y));
+    const int dz = Sign(z - static_cast<int>(from.z));
+    const int axes = (dx != 0) + (dy != 0) + (dz != 0);
+
+    auto expand = [&](int sx, int sy, int sz) {
+      int j[3];
+      if (!Jump(x, y, z, sx, sy, sz, goal, false, j)) return;
+      const int steps = max(abs(j[0] - x), max(abs(j[1] - y), abs(j[2] - z)));
+      const float cost =
+          g + steps * kMoveCost[(sx != 0) + (sy != 0) + (sz != 0)];
+      const uint32_t next = cell_of(j[0], j[1], j[2]);
+      VoxPathContext::Scratch::Node& target = scratch.Get(next);
+      if (target.closed || cost >= target.g) return;
+      target.g = cost;
+      target.parent = cell;
+      const Vec3i jp = {static_cast<uint32_t>(j[0]), static_cast<uint32_t>(j[1]),
+                        static_cast<uint32_t>(j[2])};
+      scratch.open.push_back({cost + Octile(jp, goal), next});
+      push_heap(scratch.open.begin(), scratch.open.end(), MinHeap());
+    };
+
+    if (axes == 0) {
+      // The start: every direction.
+      for (int sz = -1; sz <= 1; ++sz)
+        for (int sy = -1; sy <= 1; ++sy)
+          for (int sx = -1; sx <= 1; ++sx)
+            if (sx || sy || sz) expand(sx, sy, sz);
+    } else {
+      // Canonical moves keep to the components of the arrival direction;
+      // jump points also turn across it, and beyond.
+      ForSubDirections(dx, dy, dz, false, expand);
+      if (axes < 3) {
+        ForPerpendicular(dx, dy, dz, [&](int ex, int ey, int ez) {
+          ForSubDirections(dx, dy, dz, false, [&](int sx, int sy, int sz) {
+            expand(sx + ex, sy + ey, sz + ez);
+          });
+          expand(ex, ey, ez);
+        });
+      }
+    }
+  }
+  return false;
+}
+
+void VoxPathfinder::InBrickDistances(const Vec3i& from,
+                                     VoxPathContext::Scratch& scratch,
+                                     vector<Edge>& out) const {
+  out.clear();
+  const Size& count = occupancy_.brickCount();
+  const uint32_t bx = from.x / kBrickSize, by = from.y / kBrickSize,
+                 bz = from.z / kBrickSize;
+  const size_t brick = bx + count.x * (by + count.y * static_cast<size_t>(bz));
+  auto local = [](uint32_t x, uint32_t y, uint32_t z) {
+    return x % kBrickSize + kBrickSize * (y % kBrickSize + kBrickSize * (z % kBrickSize));
+  };
+
+  // The moves possible from every voxel of the brick (bit k for kMoves[k]),
+  // kept for the next search in the same brick.
+  if (scratch.moves_owner != id_ || scratch.moves_brick != brick) {
+    scratch.moves_owner = id_;
+    scratch.moves_brick = brick;
+    // Empty voxels, one bit each as in BrickOccupancy, with the padding past
+    // the model's far sides counted as occupied.
+    const Size& size = occupancy_.size();
+    const BrickOccupancy& occupied = occupancy_.brick(bx, by, bz);
+    uint64_t area = 0;
+    for (uint32_t y = 0; y < min(kBrickSize, size.y - by * kBrickSize); ++y) {
+      for (uint32_t x = 0; x < min(kBrickSize, size.x - bx * kBrickSize); ++x)
+        area |= uint64_t{1} << (x + kBrickSize * y);
+    }
+    uint64_t empty[kBrickSize];
+    for (uint32_t z = 0; z < kBrickSize; ++z) {
+      empty[z] = bz * kBrickSize + z < size.z ? ~occupied.layers[z] & area : 0;
+    }
+    auto free = [&](int x, int y, int z) {
+      return x >= 0 && y >= 0 && z >= 0 && x < static_cast<int>(kBrickSize) &&
+             y < static_cast<int>(kBrickSize) &&
+             z < static_cast<int>(kBrickSize) &&
+             ((empty[z] >> (x + kBrickSize * y)) & 1);
+    };
+    for (uint32_t i = 0; i < kBrickVoxels; ++i) {
+      const int x = i % kBrickSize, y = i / kBrickSize % kBrickSize,
+                z = i / (kBrickSize * kBrickSize);
+      uint32_t moves = 0;
+      if (free(x, y, z)) {
+        for (int k = 0; k < 26; ++k) {
+          const int* d = kMoves[k];
+          bool ok = true;
+          ForSubDirections(d[0], d[1], d[2], false, [&](int sx, int sy, int sz) {
+            ok = ok && free(x + sx, y + sy, z + sz);
+          });
+          if (ok) moves |= uint32_t{1} << k;
+        }
+      }
+      scratch.moves[i] = moves;
+    }
+  }
+
+  // Stop as soon as every entrance of the brick is settled.
+  uint64_t targets[kBrickSize] = {};
+  uint32_t remaining = 0;
+  for (uint32_t i = first_brick_node_[brick]; i < first_brick_node_[brick + 1];
+       ++i) {
+    const Vec3i& p = nodes_[brick_nodes_[i]];
+    const uint32_t t = local(p.x, p.y, p.z);
+    targets[t / 64] |= uint64_t{1} << (t % 64);
+    ++remaining;
+  }
+
+  fill(begin(scratch.distance), end(scratch.distance), kInfinity);
+  const uint32_t source = local(from.x, from.y, from.z);
+  scratch.distance[source] = 0;
+  scratch.brick_open.assign(1, {0.0f, source});
+  while (!scratch.brick_open.empty()) {
+    pop_heap(scratch.brick_open.begin(), scratch.brick_open.end(), MinHeap());
+    const HeapEntry top = scratch.brick_open.back();
+    scratch.brick_open.pop_back();
+    if (top.first > scratch.distance[top.second]) continue;
+    if (((targets[top.second / 64] >> (top.second % 64)) & 1) && !--remaining)
+      break;
+    for (uint32_t moves = scratch.moves[top.second]; moves; moves &= moves - 1) {
+      const int k = LowestBit(moves);
+      const uint32_t n = top.second + kMoveOffset[k];
+      const float d = top.first + kMoveCost[kMoves[k][3]];
+      if (d < scratch.distance[n]) {
+        scratch.distance[n] = d;
+        scratch.brick_open.push_back({d, n});
+        push_heap(scratch.brick_open.begin(), scratch.brick_open.end(),
+                  MinHeap());
+      }
+    }
+  }
+
+  for (uint32_t i = first_brick_node_[brick]; i < first_brick_node_[brick + 1];
+       ++i) {
+    const uint32_t node = brick_nodes_[i];
+    const Vec3i& p = nodes_[node];
+    const float d = scratch.distance[local(p.x, p.y, p.z)];
+    if (d < kInfinity) out.push_back({node, d});
+  }
+}
+
+void VoxPathfinder::BuildEntrances(unsigned threads) {
+  const Size& size = occupancy_.size();
+  const Size& count = occupancy_.brickCount();
+  const size_t n_bricks = static_cast<size_t>(count.x) * count.y * count.z;
+  first_brick_node_.assign(n_bricks + 1, 0);
+  if (!n_bricks) return;
+
+  // Entrances: for every face between two bricks, one pair of voxels (the
+  // most central) per 4-connected group of voxel pairs that are both empty.
+  vector<vector<pair<Vec3i, Vec3i>>> pairs(n_bricks);
+  ParallelFor(n_bricks, 1, threads, [&](size_t b0, size_t b1) {
+    for (size_t b = b0; b < b1; ++b) {
+      const uint32_t base[3] = {
+          static_cast<uint32_t>(b % count.x) * kBrickSize,
+          static_cast<uint32_t>(b / count.x % count.y) * kBrickSize,
+          static_cast<uint32_t>(b / (size_t{count.x} * count.y)) * kBrickSize};
+      const uint32_t dims[3] = {size.x, size.y, size.z};
+      for (int axis = 0; axis < 3; ++axis) {
+        const uint32_t layer = base[axis] + kBrickSize - 1;
+        if (layer + 1 >= dims[axis]) continue;
+        const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        const uint32_t nu = min(kBrickSize, dims[u] - base[u]);
+        const uint32_t nv = min(kBrickSize, dims[v] - base[v]);
+        auto voxel = [&](uint32_t i, uint32_t j, uint32_t offset) {
+          uint32_t p[3];
+          p[axis] = layer + offset;
+          p[u] = base[u] + i;
+          p[v] = base[v] + j;
+          return Vec3i{p[0], p[1], p[2]};
+        };
+        int group[kBrickSize][kBrickSize];
+        for (uint32_t i = 0; i < nu; ++i) {
+          for (uint32_t j = 0; j < nv; ++j) {
+            const Vec3i a = voxel(i, j, 0), c = voxel(i, j, 1);
+            group[i][j] = (Free(a.x, a.y, a.z) && Free(c.x, c.y, c.z)) ? -1 : -2;
+          }
+        }
+        int groups = 0;
+        for (uint32_t i = 0; i < nu; ++i) {
+          for (uint32_t j = 0; j < nv; ++j) {
+            if (group[i][j] != -1) continue;
+            // Flood the group, then pick the member closest to its center.
+            vector<pair<uint32_t, uint32_t>> members = {{i, j}};
+            group[i][j] = groups;
+            float cu = 0, cv = 0;
+            for (size_t head = 0; head < members.size(); ++head) {
+              const uint32_t mi = members[head].first, mj = members[head].second;
+              cu += mi;
+              cv += mj;
+              const int next[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+              for (const auto& n : next) {
+                const int ni = static_cast<int>(mi) + n[0];
+                const int nj = static_cast<int>(mj) + n[1];
+                if (ni < 0 || nj < 0 || ni >= static_cast<int>(nu) ||
+                    nj >= static_cast<int>(nv) || group[ni][nj] != -1)
+                  continue;
+                group[ni][nj] = groups;
+                members.push_back({static_cast<uint32_t>(ni),
+                                   static_cast<uint32_t>(nj)});
+              }
+            }
+            cu /= members.size();
+            cv /= members.size();
+            auto best = min_element(
+                members.begin(), members.end(), [&](const pair<uint32_t, uint32_t>& a,
+                                                    const pair<uint32_t, uint32_t>& c) {
+                  return (a.first - cu) * (a.first - cu) + (a.second - cv) * (a.second - cv) <
+                         (c.first - cu) * (c.first - cu) + (c.second - cv) * (c.second - cv);
+                });
+            pairs[b].push_back({voxel(best->first, best->second, 0),
+                                voxel(best->first, best->second, 1)});
+            ++groups;
+          }
+        }
+      }
+    }
+  });
+
+  // Nodes (a voxel can be an entrance of several faces) and the edges
+  // between the two voxels of each entrance.
+  unordered_map<uint64_t, uint32_t> node_ids;
+  vector<vector<Edge>> adjacency;
+  auto node = [&](const Vec3i& p) {
+    const uint64_t key = p.x + size.x * (p.y + size.y * uint64_t{p.z});
+    auto inserted = node_ids.emplace(key, static_cast<uint32_t>(nodes_.size()));
+    if (inserted.second) {
+      nodes_.push_back(p);
+      adjacency.emplace_back();
+    }
+    return inserted.first->second;
+  };
+  for (const auto& brick_pairs : pairs) {
+    for (const auto& entrance : brick_pairs) {
+      const uint32_t a = node(entrance.first);
+      const uint32_t b = node(entrance.second);
+      adjacency[a].push_back({b, 1.0f});
+      adjacency[b].push_back({a, 1.0f});
+    }
+  }
+  auto brick_of = [&](const Vec3i& p) {
+    return p.x / kBrickSize +
+           count.x * (p.y / kBrickSize +
+                      count.y * static_cast<size_t>(p.z / kBrickSize));
+  };
+  for (const Vec3i& p : nodes_) ++first_brick_node_[brick_of(p) + 1];
+  for (size_t b = 1; b <= n_bricks; ++b)
+    first_brick_node_[b] += first_brick_node_[b - 1];
+  brick_nodes_.resize(nodes_.size());
+  {
+    vector<uint32_t> next(first_brick_node_.begin(), first_brick_node_.end() - 1);
+    for (uint32_t n = 0; n < nodes_.size(); ++n)
+      brick_nodes_[next[brick_of(nodes_[n])]++] = n;
+  }
+
+  // Edges between the entrances of each brick, by Dijkstra inside it.
+  ParallelFor(n_bricks, 1, threads, [&](size_t b0, size_t b1) {
+    VoxPathContext context;
+    vector<Edge> reached;
+    for (size_t b = b0; b < b1; ++b) {
+      for (uint32_t i = first_brick_node_[b]; i < first_brick_node_[b + 1]; ++i) {
+        const uint32_t n = brick_nodes_[i];
+        InBrickDistances(nodes_[n], *context.scratch_, reached);
+        for (const Edge& edge : reached) {
+          if (edge.node != n) adjacency[n].push_back(edge);
+        }
+      }
+    }
+  });
+
+  first_edge_.assign(nodes_.size() + 1, 0);
+  for (size_t n = 0; n < nodes_.size(); ++n)
+    first_edge_[n + 1] = first_edge_[n] + static_cast<uint32_t>(adjacency[n].size());
+  edges_.reserve(first_edge_.back());
+  for (const vector<Edge>& edges : adjacency)
+    edges_.insert(edges_.end(), edges.begin(), edges.end());
+}
+
+bool VoxPathfinder::FindPath(const Vec3i& start, const Vec3i& goal,
+                             VoxPathContext& context, VoxPath& path) const {
+  const int brick_distance = max(
+      abs(static_cast<int>(start.x / kBrickSize) - static_cast<int>(goal.x / kBrickSize)),
+      max(abs(static_cast<int>(start.y / kBrickSize) - static_cast<int>(goal.y / kBrickSize)),
+          abs(static_cast<int>(start.z / kBrickSize) - static_cast<int>(goal.z / kBrickSize))));
+  if (brick_distance <= kNearBricks || !Free(start.x, start.y, start.z) ||
+      !Free(goal.x, goal.y, goal.z))
+    return FindPathJps(start, goal, context, path);
+
+  // Route through the brick graph, with the two ends as extra nodes joined
+  // to the entrances of their bricks.
+  VoxPathContext::Scratch& scratch = *context.scratch_;
+  vector<Edge> start_edges, goal_edges;
+  InBrickDistances(start, scratch, start_edges);
+  InBrickDistances(goal, scratch, goal_edges);
+
+  const uint32_t n_nodes = static_cast<uint32_t>(nodes_.size());
+  const uint32_t source = n_nodes, target = n_nodes + 1;
+  if (scratch.seen.size() < n_nodes + 2) {
+    scratch.g.resize(n_nodes + 2);
+    scratch.parent.resize(n_nodes + 2);
+    scratch.seen.assign(n_nodes + 2, 0);
+    scratch.goal_cost.resize(n_nodes + 2);
+    scratch.goal_seen.assign(n_nodes + 2, 0);
+    scratch.graph_stamp = 0;
+  }
+  if (++scratch.graph_stamp == 0) {
+    fill(scratch.seen.begin(), scratch.seen.end(), 0);
+    fill(scratch.goal_seen.begin(), scratch.goal_seen.end(), 0);
+    scratch.graph_stamp = 1;
+  }
+  const uint32_t stamp = scratch.graph_stamp;
+  for (const Edge& edge : goal_edges) {
+    scratch.goal_cost[edge.node] = edge.cost;
+    scratch.goal_seen[edge.node] = stamp;
+  }
+  auto point = [&](uint32_t n) {
+    return n == source ? start : (n == target ? goal : nodes_[n]);
+  };
+  auto relax = [&](uint32_t from, uint32_t to, float cost) {
+    if (scratch.seen[to] == stamp && cost >= scratch.g[to]) return;
+    scratch.seen[to] = stamp;
+    scratch.g[to] = cost;
+    scratch.parent[to] = from;
+    scratch.graph_open.push_back({cost + Octile(point(to), goal), to});
+    push_heap(scratch.graph_open.begin(), scratch.graph_open.end(), MinHeap());
+  };
+
+  scratch.graph_open.clear();
+  scratch.seen[source] = stamp;
+  scratch.g[source] = 0;
+  scratch.parent[source] = kNoNode;
+  for (const Edge& edge : start_edges) relax(source, edge.node, edge.cost);
+  bool found = false;
+  while (!scratch.graph_open.empty()) {
+    pop_heap(scratch.graph_open.begin(), scratch.graph_open.end(), MinHeap());
+    const HeapEntry top = scratch.graph_open.back();
+    scratch.graph_open.pop_back();
+    const uint32_t n = top.second;
+    const float g = scratch.g[n];
+    if (top.first > g + Octile(point(n), goal) + 1e-4f) continue;
+    if (n == target) {
+      found = true;
+      break;
+    }
+    for (uint32_t e = first_edge_[n]; e < first_edge_[n + 1]; ++e)
+      relax(n, edges_[e].node, g + edges_[e].cost);
+    if (scratch.goal_seen[n] == stamp) relax(n, target, g + scratch.goal_cost[n]);
+  }
+  if (!found) return FindPathJps(start, goal, context, path);
+
+  // Refine each step of the route with Jump Point Search.
+  scratch.route.clear();
+  for (uint32_t n = target; n != kNoNode; n = scratch.parent[n])
+    scratch.route.push_back(point(n));
+  reverse(scratch.route.begin(), scratch.route.end());
+  const vector<Vec3i>& route = scratch.route;
+  path.waypoints.assign(1, start);
+  path.length = 0;
+  VoxPath step;
+  for (size_t i = 1; i < route.size(); ++i) {
+    if (!FindPathJps(route[i - 1], route[i], context, step))
+      return FindPathJps(start, goal, context, path);
+    path.waypoints.insert(path.waypoints.end(), step.waypoints.begin() + 1,
+                          step.waypoints.end());
+    path.length += step.length;
+  }
+  return true;
+}
+
+void VoxPathfinder::FindPaths(const vector<PathQuery>& queries,
+                              vector<VoxPath>& paths, unsigned threads) const {
+  paths.assign(queries.size(), VoxPath());
+  vector<VoxPathContext> contexts(ThreadCount(threads));
+  ParallelForTiles(queries.size(), threads, [&](size_t i, unsigned thread) {
+    if (!FindPath(queries[i].start, queries[i].goal, contexts[thread], paths[i]))
+      paths[i] = VoxPath();
+  });
+}
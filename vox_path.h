@@ -0,0 +1,132 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_PATH_H
+#define VOX_PATH_H
+
+#include "vox_brick.h"
+#include "vox_file.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace magicavoxel {
+
+// A path through the empty voxels of a model. Consecutive waypoints are
+// joined by straight moves along one of the 26 grid directions.
+struct VoxPath {
+  std::vector<Vec3i> waypoints;
+  float length = 0;  // In voxels; diagonal moves cost sqrt(2) or sqrt(3)
+};
+
+struct PathQuery {
+  Vec3i start;
+  Vec3i goal;
+};
+
+// Scratch space for path queries. Each thread needs its own; reusing one
+// across queries avoids allocating every time.
+class VoxPathContext {
+ public:
+  VoxPathContext();
+  ~VoxPathContext();
+  VoxPathContext(VoxPathContext&&) noexcept;
+  VoxPathContext& operator=(VoxPathContext&&) noexcept;
+
+ private:
+  friend class VoxPathfinder;
+  struct Scratch;
+  std::unique_ptr<Scratch> scratch_;
+};
+
+// Pathfinding for flying agents through the empty voxels of a model, moving
+// between any of the 26 neighbors of a voxel without cutting corners (a
+// diagonal move needs the voxels it passes by to be empty too). Everything
+// outside the model counts as occupied.
+//
+// Short paths use 3D Jump Point Search over the occupancy bits. Long ones
+// first search a graph of entrances between neighboring 8x8x8 bricks (built
+// once, in parallel, by the constructor; the HPA* abstraction) and then
+// refine each step of that route with Jump Point Search. Hierarchical paths
+// can be slightly longer than optimal.
+//
+// The pathfinder does not change after construction, so any number of
+// threads can query it at once, each with its own VoxPathContext.
+class VoxPathfinder {
+ public:
+  explicit VoxPathfinder(VoxBrickMap occupancy, unsigned threads = 0);
+  explicit VoxPathfinder(const VoxDenseModel& model, unsigned threads = 0)
+      : VoxPathfinder(VoxBrickMap(model), threads) {}
+
+  const Size& size() const noexcept { return occupancy_.size(); }
+
+  // Number of nodes in the brick entrance graph.
+  size_t entranceCount() const noexcept { return nodes_.size(); }
+
+  // Finds a path from start to goal (both empty voxels), choosing the
+  // hierarchical search for long distances. Returns false if there is none.
+  bool FindPath(const Vec3i& start, const Vec3i& goal, VoxPathContext& context,
+                VoxPath& path) const;
+
+  // Finds a shortest path with Jump Point Search alone.
+  bool FindPathJps(const Vec3i& start, const Vec3i& goal,
+                   VoxPathContext& context, VoxPath& path) const;
+
+  // Runs FindPath for every query on up to `threads` threads (0 = one per
+  // core). paths[i] is left empty for a query without a path.
+  void FindPaths(const std::vector<PathQuery>& queries,
+                 std::vector<VoxPath>& paths, unsigned threads = 0) const;
+
+ private:
+  struct Edge {
+    uint32_t node;
+    float cost;
+  };
+
+  bool Free(int x, int y, int z) const;
+  bool CanMove(int x, int y, int z, int dx, int dy, int dz) const;
+  bool Jump(int x, int y, int z, int dx, int dy, int dz, const Vec3i& goal,
+            bool probe, int out[3]) const;
+  void InBrickDistances(const Vec3i& from, VoxPathContext::Scratch& scratch,
+                        std::vector<Edge>& out) const;
+  void BuildEntrances(unsigned threads);
+
+  VoxBrickMap occupancy_;
+  // Unique per constructed pathfinder (copies share it, as they share the
+  // occupancy), so a VoxPathContext never reuses per-brick data across
+  // pathfinders, even one assigned over another at the same address.
+  uint64_t id_;
+  // Brick entrance graph: node cells, and each node's edges as
+  // edges_[first_edge_[n], first_edge_[n + 1]).
+  std::vector<Vec3i> nodes_;
+  std::vector<uint32_t> first_edge_;
+  std::vector<Edge> edges_;
+  // Nodes inside each brick, as brick_nodes_[first_brick_node_[b], ...[b + 1]).
+  std::vector<uint32_t> first_brick_node_;
+  std::vector<uint32_t> brick_nodes_;
+};
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,555 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_points.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+// Cells are kept as 18-bit coordinates per axis, offset so the origin's
+// cell is in the middle; Morton codes of the three fit in 54 bits, leaving
+// the low 8 bits of a key for a palette index.
+constexpr int kCellBits = 18;
+constexpr uint32_t kCellBias = 1u << (kCellBits - 1);
+constexpr float kCellLimit = static_cast<float>(1u << kCellBits);
+
+// Points per task when quantizing and sorting, at least.
+constexpr size_t kMinTaskPoints = 1 << 15;
+
+uint64_t SpreadBits(uint32_t value) {
+  uint64_t x = value & 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffULL;
+  x = (x | x << 16) & 0x1f0000ff0000ffULL;
+  x = (x | x << 8) & 0x100f00f00f00f00fULL;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+  x = (x | x << 2) & 0x1249249249249249ULL;
+  return x;
+}
+
+uint32_t CompactBits(uint64_t x) {
+  x &= 0x1249249249249249ULL;
+  x = (x ^ (x >> 2)) & 0x10c30c30c30c30c3ULL;
+  x = (x ^ (x >> 4)) & 0x100f00f00f00f00fULL;
+  x = (x ^ (x >> 8)) & 0x1f0000ff0000ffULL;
+  x = (x ^ (x >> 16)) & 0x1f00000000ffffULL;
+  x = (x ^ (x >> 32)) & 0x1fffffULL;
+  return static_cast<uint32_t>(x);
+}
+
+Vec3i CellOf(uint64_t key) {
+  const uint64_t morton = key >> 8;
+  return {CompactBits(morton), CompactBits(morton >> 1), CompactBits(morton >> 2)};
+}
+
+size_t ColorIndex(uint32_t r, uint32_t g, uint32_t b) {
+  return (r >> 2) << 12 | (g >> 2) << 6 | (b >> 2);
+}
+
+bool HostIsBigEndian() {
+  const uint16_t probe = 1;
+  uint8_t first;
+  memcpy(&first, &probe, 1);
+  return first == 0;
+}
+
+// Reads a scalar stored with the given byte order.
+template <typename T>
+T Load(const char* bytes, bool swap) {
+  char copy[sizeof(T)];
+  memcpy(copy, bytes, sizeof(T));
+  if (swap) reverse(copy, copy + sizeof(T));
+  T value;
+  memcpy(&value, copy, sizeof(T));
+  return value;
+}
+
+enum class PlyType { kInt8, kUint8, kInt16, kUint16, kInt32, kUint32, kFloat32, kFloat64 };
+
+bool ParsePlyType(const string& name, PlyType& type) {
+  static const pair<const char*, PlyType> kNames[] = {
+      {"char", PlyType::kInt8},      {"int8", PlyType::kInt8},
+      {"uchar", PlyType::kUint8},    {"uint8", PlyType::kUint8},
+      {"short", PlyType::kInt16},    {"int16", PlyType::kInt16},
+      {"ushort", PlyType::kUint16},  {"uint16", PlyType::kUint16},
+      {"int", PlyType::kInt32},      {"int32", PlyType::kInt32},
+      {"uint", PlyType::kUint32},    {"uint32", PlyType::kUint32},
+      {"float", PlyType::kFloat32},  {"float32", PlyType::kFloat32},
+      {"double", PlyType::kFloat64}, {"float64", PlyType::kFloat64}};
+  for (const auto& entry : kNames) {
+    if (name == entry.first) {
+      type = entry.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t PlyTypeSize(PlyType type) {
+  static const size_t kSizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+  return kSizes[static_cast<int>(type)];
+}
+
+double LoadPly(const char* bytes, PlyType type, bool swap) {
+  switch (type) {
+    case PlyType::kInt8: return static_cast<int8_t>(*bytes);
+    case PlyType::kUint8: return static_cast<uint8_t>(*bytes);
+    case PlyType::kInt16: return Load<int16_t>(bytes, swap);
+    case PlyType::kUint16: return Load<uint16_t>(bytes, swap);
+    case PlyType::kInt32: return Load<int32_t>(bytes, swap);
+    case PlyType::kUint32: return Load<uint32_t>(bytes, swap);
+    case PlyType::kFloat32: return Load<float>(bytes, swap);
+    default: return Load<double>(bytes, swap);
+  }
+}
+
+// A color channel as a byte: integers are scaled from their range, floats
+// from [0, 1].
+uint8_t PlyChannel(const char* bytes, PlyType type, bool swap) {
+  double value = LoadPly(bytes, type, swap);
+  if (type == PlyType::kUint16) {
+    value /= 257.0;
+  } else if (type == PlyType::kFloat32 || type == PlyType::kFloat64) {
+    value *= 255.0;
+  }
+  return static_cast<uint8_t>(min(max(value + 0.5, 0.0), 255.0));
+}
+
+uint8_t FloatChannel(float value) {
+  return static_cast<uint8_t>(min(max(value * 255.0f + 0.5f, 0.0f), 255.0f));
+}
+
+// Sorts samples by key with an LSD radix sort, 8 bits per pass, skipping
+// passes where every key has the same digit. Each task counts and scatters
+// its own contiguous range.
+template <typename Sample>
+void RadixSort(vector<Sample>& samples, vector<Sample>& scratch, unsigned threads) {
+  const size_t n = samples.size();
+  scratch.resize(n);
+  const size_t tasks =
+      min<size_t>(ThreadCount(threads), max<size_t>(n / kMinTaskPoints, 1));
+  vector<array<size_t, 256>> counts(tasks);
+  for (int shift = 0; shift < 64; shift += 8) {
+    ParallelFor(tasks, 1, threads, [&](size_t t0, size_t t1) {
+      for (size_t t = t0; t < t1; ++t) {
+        counts[t].fill(0);
+        for (size_t i = n * t / tasks; i < n * (t + 1) / tasks; ++i)
+          ++counts[t][(samples[i].key >> shift) & 0xff];
+      }
+    });
+    size_t sum = 0;
+    bool single = false;
+    for (int digit = 0; digit < 256; ++digit) {
+      size_t total = 0;
+      for (size_t t = 0; t < tasks; ++t) {
+        const size_t count = counts[t][digit];
+        counts[t][digit] = sum;
+        sum += count;
+        total += count;
+      }
+      single |= total == n;
+    }
+    if (single) continue;
+    ParallelFor(tasks, 1, threads, [&](size_t t0, size_t t1) {
+      for (size_t t = t0; t < t1; ++t) {
+        for (size_t i = n * t / tasks; i < n * (t + 1) / tasks; ++i)
+          scratch[counts[t][(samples[i].key >> shift) & 0xff]++] = samples[i];
+      }
+    });
+    samples.swap(scratch);
+  }
+}
+
+}  // namespace
+
+VoxPointCloudImporter::VoxPointCloudImporter(const Palette& palette,
+                                             const PointCloudOptions& options)
+    : palette_(palette), options_(options), nearest_(1 << 18) {
+  // Nearest palette entry (1-255; 0 is empty) to the middle of each 6-bit
+  // color cube.
+  ParallelFor(nearest_.size(), 4096, options_.threads, [&](size_t i0, size_t i1) {
+    for (size_t i = i0; i < i1; ++i) {
+      const int r = static_cast<int>((i >> 12) << 2 | 2);
+      const int g = static_cast<int>(((i >> 6) & 63) << 2 | 2);
+      const int b = static_cast<int>((i & 63) << 2 | 2);
+      int best = 1, best_distance = 1 << 30;
+      for (int index = 1; index < 256; ++index) {
+        const Color& color = palette_[index];
+        const int dr = color.r - r, dg = color.g - g, db = color.b - b;
+        const int distance = dr * dr + dg * dg + db * db;
+        if (distance < best_distance) {
+          best_distance = distance;
+          best = index;
+        }
+      }
+      nearest_[i] = static_cast<uint8_t>(best);
+    }
+  });
+}
+
+void VoxPointCloudImporter::AddPoints(const float* xyz, const uint8_t* rgb,
+                                      size_t count) {
+  const size_t block = max<size_t>(options_.block_points, 1);
+  for (size_t first = 0; first < count; first += block) {
+    AddBlock(xyz + 3 * first, rgb ? rgb + 3 * first : nullptr,
+             min(block, count - first));
+  }
+}
+
+void VoxPointCloudImporter::AddXyzRgb(const float* xyzrgb, size_t count) {
+  const size_t block = max<size_t>(options_.block_points, 1);
+  for (size_t first = 0; first < count; first += block) {
+    const size_t n = min(block, count - first);
+    xyz_.resize(3 * n);
+    rgb_.resize(3 * n);
+    const float* src = xyzrgb + 6 * first;
+    ParallelFor(n, kMinTaskPoints, options_.threads, [&](size_t i0, size_t i1) {
+      for (size_t i = i0; i < i1; ++i) {
+        for (int c = 0; c < 3; ++c) {
+          xyz_[3 * i + c] = src[6 * i + c];
+          rgb_[3 * i + c] = FloatChannel(src[6 * i + 3 + c]);
+        }
+      }
+    });
+    AddBlock(xyz_.data(), rgb_.data(), n);
+  }
+}
+
+void VoxPointCloudImporter::AddBlock(const float* xyz, const uint8_t* rgb,
+                                     size_t count) {
+  points_ += count;
+  const bool vote = options_.color_mode == CloudColorMode::kVote;
+  const float scale = 1.0f / options_.voxel_size;
+  const float origin[3] = {options_.origin.x, options_.origin.y, options_.origin.z};
+
+  // Quantize, each task packing its valid samples at the start of its range.
+  const size_t tasks =
+      min<size_t>(ThreadCount(options_.threads), max<size_t>(count / kMinTaskPoints, 1));
+  vector<size_t> valid(tasks);
+  samples_.resize(count);
+  ParallelFor(tasks, 1, options_.threads, [&](size_t t0, size_t t1) {
+    for (size_t t = t0; t < t1; ++t) {
+      const size_t begin = count * t / tasks, end = count * (t + 1) / tasks;
+      size_t out = begin;
+      for (size_t i = begin; i < end; ++i) {
+        uint32_t cell[3];
+        bool inside = true;
+        for (int a = 0; a < 3; ++a) {
+          const float v = floor((xyz[3 * i + a] - origin[a]) * scale) + kCellBias;
+          inside &= v >= 0.0f && v < kCellLimit;  // False for NaN too
+          cell[a] = inside ? static_cast<uint32_t>(v) : 0;
+        }
+        if (!inside) continue;
+        const uint32_t color =
+            rgb ? rgb[3 * i] | rgb[3 * i + 1] << 8 | rgb[3 * i + 2] << 16 : 0xffffff;
+        uint64_t key = (SpreadBits(cell[0]) | SpreadBits(cell[1]) << 1 |
+                        SpreadBits(cell[2]) << 2) << 8;
+        if (vote)
+          key |= nearest_[ColorIndex(color & 0xff, (color >> 8) & 0xff, color >> 16)];
+        samples_[out++] = {key, color};
+      }
+      valid[t] = out - begin;
+    }
+  });
+  size_t kept = 0;
+  for (size_t t = 0; t < tasks; ++t) {
+    const size_t begin = count * t / tasks;
+    if (kept != begin)
+      memmove(&samples_[kept], &samples_[begin], valid[t] * sizeof(Sample));
+    kept += valid[t];
+  }
+  dropped_ += count - kept;
+  samples_.resize(kept);
+
+  RadixSort(samples_, sorted_, options_.threads);
+
+  // One cell per key, merged into the cells of earlier blocks.
+  block_cells_.clear();
+  for (const Sample& sample : samples_) {
+    if (block_cells_.empty() || block_cells_.back().key != sample.key)
+      block_cells_.push_back({sample.key, 0, 0, 0, 0});
+    Cell& cell = block_cells_.back();
+    cell.r += sample.color & 0xff;
+    cell.g += (sample.color >> 8) & 0xff;
+    cell.b += sample.color >> 16;
+    ++cell.count;
+  }
+  merged_.clear();
+  merged_.reserve(cells_.size() + block_cells_.size());
+  auto a = cells_.begin(), b = block_cells_.begin();
+  while (a != cells_.end() || b != block_cells_.end()) {
+    if (b == block_cells_.end() || (a != cells_.end() && a->key < b->key)) {
+      merged_.push_back(*a++);
+    } else if (a == cells_.end() || b->key < a->key) {
+      merged_.push_back(*b++);
+    } else {
+      Cell cell = *a++;
+      cell.r += b->r;
+      cell.g += b->g;
+      cell.b += b->b;
+      cell.count += b->count;
+      ++b;
+      merged_.push_back(cell);
+    }
+  }
+  cells_.swap(merged_);
+}
+
+void VoxPointCloudImporter::ReadPly(const string& path) {
+  ifstream file(path, ios::in | ios::binary);
+  if (!file) throw VoxException("Could not open '" + path + "'");
+
+  struct Property {
+    string name;
+    PlyType type;
+    size_t offset;
+  };
+  struct Element {
+    string name;
+    size_t count;
+    size_t stride;
+    bool has_list;
+    vector<Property> properties;
+  };
+  vector<Element> elements;
+  bool big_endian = false;
+  string line;
+  for (bool first = true;; first = false) {
+    if (!getline(file, line)) throw VoxException("'" + path + "' is not a PLY file");
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (first) {
+      if (line != "ply") throw VoxException("'" + path + "' is not a PLY file");
+      continue;
+    }
+    istringstream words(line);
+    string keyword;
+    words >> keyword;
+    if (keyword == "end_header") break;
+    if (keyword == "format") {
+      string format;
+      words >> format;
+      if (format == "binary_big_endian") {
+        big_endian = true;
+      } else if (format != "binary_little_endian") {
+        throw VoxException("'" + path + "' is not a binary PLY file");
+      }
+    } else if (keyword == "element") {
+      Element element{"", 0, 0, false, {}};
+      words >> element.name >> element.count;
+      elements.push_back(element);
+    } else if (keyword == "property" && !elements.empty()) {
+      Element& element = elements.back();
+      string type_name, name;
+      words >> type_name >> name;
+      PlyType type;
+      if (type_name == "list") {
+        element.has_list = true;
+      } else if (ParsePlyType(type_name, type)) {
+        element.properties.push_back({name, type, element.stride});
+        element.stride += PlyTypeSize(type);
+      } else {
+        throw VoxException("'" + path + "' has an unknown property type");
+      }
+    }
+  }
+
+  // Skip the elements before the vertices (which must have fixed sizes).
+  size_t skip = 0;
+  const Element* vertices = nullptr;
+  for (const Element& element : elements) {
+    if (element.name == "vertex") {
+      vertices = &element;
+      break;
+    }
+    if (element.has_list)
+      throw VoxException("'" + path + "' has variable-size data before its vertices");
+    skip += element.count * element.stride;
+  }
+  if (!vertices || vertices->has_list)
+    throw VoxException("'" + path + "' has no readable vertices");
+  const Property* fields[6] = {};
+  static const char* const kFieldNames[6][2] = {
+      {"x", "x"}, {"y", "y"}, {"z", "z"},
+      {"red", "diffuse_red"}, {"green", "diffuse_green"}, {"blue", "diffuse_blue"}};
+  for (const Property& property : vertices->properties) {
+    for (int f = 0; f < 6; ++f) {
+      if (property.name == kFieldNames[f][0] || property.name == kFieldNames[f][1])
+        fields[f] = &property;
+    }
+  }
+  if (!fields[0] || !fields[1] || !fields[2])
+    throw VoxException("'" + path + "' has no vertex positions");
+  const bool colors = fields[3] && fields[4] && fields[5];
+  const bool swap = big_endian != HostIsBigEndian();
+  file.seekg(static_cast<streamoff>(skip), ios::cur);
+
+  // Blocks of vertices, decoded in parallel.
+  const size_t stride = vertices->stride;
+  const size_t block = max<size_t>(options_.block_points, 1);
+  vector<char> buffer;
+  for (size_t first = 0; first < vertices->count; first += block) {
+    const size_t n = min(block, vertices->count - first);
+    buffer.resize(n * stride);
+    if (!file.read(buffer.data(), static_cast<streamsize>(buffer.size())))
+      throw VoxException("'" + path + "' is truncated");
+    xyz_.resize(3 * n);
+    rgb_.resize(3 * n);
+    ParallelFor(n, kMinTaskPoints, options_.threads, [&](size_t i0, size_t i1) {
+      for (size_t i = i0; i < i1; ++i) {
+        const char* vertex = buffer.data() + i * stride;
+        for (int c = 0; c < 3; ++c) {
+          xyz_[3 * i + c] = static_cast<float>(
+              LoadPly(vertex + fields[c]->offset, fields[c]->type, swap));
+          rgb_[3 * i + c] =
+              colors ? PlyChannel(vertex + fields[3 + c]->offset, fields[3 + c]->type, swap)
+                     : 255;
+        }
+      }
+    });
+    AddBlock(xyz_.data(), rgb_.data(), n);
+  }
+}
+
+void VoxPointCloudImporter::ReadXyzRgb(const string& path) {
+  ifstream file(path, ios::in | ios::binary | ios::ate);
+  if (!file) throw VoxException("Could not open '" + path + "'");
+  const streamoff file_size = file.tellg();
+  if (file_size < 0) throw VoxException("Could not read '" + path + "'");
+  file.seekg(0);
+
+  const size_t count = static_cast<size_t>(file_size) / (6 * sizeof(float));
+  const size_t block = max<size_t>(options_.block_points, 1);
+  const bool swap = HostIsBigEndian();
+  vector<float> buffer;
+  for (size_t first = 0; first < count; first += block) {
+    const size_t n = min(block, count - first);
+    buffer.resize(6 * n);
+    if (!file.read(reinterpret_cast<char*>(buffer.data()),
+                   static_cast<streamsize>(buffer.size() * sizeof(float))))
+      throw VoxException("Could not read '" + path + "'");
+    if (swap) {
+      for (float& value : buffer)
+        value = Load<float>(reinterpret_cast<const char*>(&value), true);
+    }
+    AddXyzRgb(buffer.data(), n);
+  }
+}
+
+size_t VoxPointCloudImporter::voxelCount() const {
+  if (options_.color_mode == CloudColorMode::kAverage) return cells_.size();
+  size_t count = 0;
+  for (size_t i = 0; i < cells_.size(); ++i)
+    count += i == 0 || cells_[i].key >> 8 != cells_[i - 1].key >> 8;
+  return count;
+}
+
+void VoxPointCloudImporter::Voxels(vector<pair<Vec3i, uint8_t>>& voxels,
+                                   Vec3i& low, Vec3i& high) const {
+  voxels.clear();
+  low = {kCellBias * 2, kCellBias * 2, kCellBias * 2};
+  high = {0, 0, 0};
+  for (size_t i = 0; i < cells_.size();) {
+    // In vote mode, the cells of one voxel are adjacent, one per palette
+    // entry; the entry with most points wins.
+    size_t end = i + 1, best = i;
+    while (end < cells_.size() && cells_[end].key >> 8 == cells_[i].key >> 8) {
+      if (cells_[end].count > cells_[best].count) best = end;
+      ++end;
+    }
+    const Cell& cell = cells_[best];
+    uint8_t index;
+    if (options_.color_mode == CloudColorMode::kVote) {
+      index = static_cast<uint8_t>(cell.key & 0xff);
+    } else {
+      index = nearest_[ColorIndex(static_cast<uint32_t>(cell.r / cell.count),
+                                  static_cast<uint32_t>(cell.g / cell.count),
+                                  static_cast<uint32_t>(cell.b / cell.count))];
+    }
+    const Vec3i position = CellOf(cell.key);
+    low = {min(low.x, position.x), min(low.y, position.y), min(low.z, position.z)};
+    high = {max(high.x, position.x + 1), max(high.y, position.y + 1),
+            max(high.z, position.z + 1)};
+    voxels.push_back({position, index});
+    i = end;
+  }
+}
+
+Vec3f VoxPointCloudImporter::modelOrigin() const {
+  vector<pair<Vec3i, uint8_t>> voxels;
+  Vec3i low, high;
+  Voxels(voxels, low, high);
+  if (voxels.empty()) return options_.origin;
+  const float size = options_.voxel_size;
+  return {options_.origin.x + (static_cast<float>(low.x) - kCellBias) * size,
+          options_.origin.y + (static_cast<float>(low.y) - kCellBias) * size,
+          options_.origin.z + (static_cast<float>(low.z) - kCellBias) * size};
+}
+
+VoxSparseModel VoxPointCloudImporter::BuildSparse() const {
+  vector<pair<Vec3i, uint8_t>> voxels;
+  Vec3i low, high;
+  Voxels(voxels, low, high);
+  if (voxels.empty()) return VoxSparseModel(Size{0, 0, 0}, palette_);
+  const Size size{high.x - low.x, high.y - low.y, high.z - low.z};
+  if (size.x > 256 || size.y > 256 || size.z > 256)
+    throw VoxException("Point cloud spans more than 256 voxels on an axis");
+  vector<Voxel> sparse;
+  sparse.reserve(voxels.size());
+  for (const auto& voxel : voxels) {
+    sparse.push_back({static_cast<uint8_t>(voxel.first.x - low.x),
+                      static_cast<uint8_t>(voxel.first.y - low.y),
+                      static_cast<uint8_t>(voxel.first.z - low.z), voxel.second});
+  }
+  return VoxSparseModel(size, move(sparse), palette_);
+}
+
+VoxDenseModel VoxPointCloudImporter::BuildDense() const {
+  vector<pair<Vec3i, uint8_t>> voxels;
+  Vec3i low, high;
+  Voxels(voxels, low, high);
+  if (voxels.empty()) return VoxDenseModel(Size{0, 0, 0}, palette_);
+  const Size size{high.x - low.x, high.y - low.y, high.z - low.z};
+  if (uint64_t{size.x} * size.y * size.z > kMaxPointCloudDenseVoxels)
+    throw VoxException("Point cloud extent is too large for a dense model");
+  VoxDenseModel model(size, palette_);
+  for (const auto& voxel : voxels)
+    model.voxel(voxel.first.x - low.x, voxel.first.y - low.y, voxel.first.z - low.z) =
+        voxel.second;
+  return model;
+}
+
+void VoxPointCloudImporter::clear() {
+  cells_.clear();
+  points_ = dropped_ = 0;
+}
@@ -0,0 +1,142 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_POINTS_H
+#define VOX_POINTS_H
+
+#include "vox_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace magicavoxel {
+
+// How the points falling into one voxel decide its color.
+enum class CloudColorMode {
+  kAverage,  // Average color of the points, then the nearest palette entry
+  kVote      // Palette entry nearest to the most points
+};
+
+struct PointCloudOptions {
+  // Edge length of a voxel, in the cloud's units.
+  float voxel_size = 1.0f;
+  // Point of the cloud at the (0, 0, 0) corner of the voxel grid. Points
+  // must lie within 131072 voxels of it; others are dropped.
+  Vec3f origin = {0.0f, 0.0f, 0.0f};
+  CloudColorMode color_mode = CloudColorMode::kAverage;
+  // Points processed at a time, which bounds memory use besides the
+  // occupied voxels themselves.
+  size_t block_points = size_t{1} << 22;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Most voxels (product of the occupied extent on the three axes) that
+// VoxPointCloudImporter::BuildDense makes a model of: one byte each, so 1 GiB.
+constexpr uint64_t kMaxPointCloudDenseVoxels = uint64_t{1} << 30;
+
+// Converts point clouds (LiDAR scans, photogrammetry) to voxel models,
+// streaming: points are fed in any number of calls or read from files block
+// by block, and only the occupied voxels are kept between blocks.
+//
+// Each block is quantized to voxel cells in parallel, keyed by the cells'
+// Morton codes (with the palette entry appended in kVote mode), sorted with a
+// parallel LSD radix sort, reduced to one record per key, and merged into the
+// sorted records of earlier blocks. Colors are matched to the palette through
+// a table of all colors at 6 bits per channel, built once.
+class VoxPointCloudImporter {
+ public:
+  explicit VoxPointCloudImporter(
+      const Palette& palette = kDefaultPalette,
+      const PointCloudOptions& options = PointCloudOptions());
+
+  // Adds count points: xyz holds 3 floats per point and rgb, if not null, 3
+  // sRGB bytes per point (points without colors are white).
+  void AddPoints(const float* xyz, const uint8_t* rgb, size_t count);
+
+  // Adds count points of 6 floats each: x, y, z, then r, g, b in [0, 1].
+  void AddXyzRgb(const float* xyzrgb, size_t count);
+
+  // Reads the vertices of a binary (little- or big-endian) PLY file: x, y, z
+  // of any numeric type and, if present, red, green, blue (8-bit, 16-bit or
+  // floating point). Throws VoxException if the file cannot be read or is not
+  // such a PLY file.
+  void ReadPly(const std::string& path);
+
+  // Reads a raw file of 6 little-endian floats per point, as AddXyzRgb.
+  // Throws VoxException if the file cannot be read.
+  void ReadXyzRgb(const std::string& path);
+
+  size_t pointCount() const noexcept { return points_; }
+  size_t droppedCount() const noexcept { return dropped_; }
+  size_t voxelCount() const;
+
+  // Position, in the cloud's units, of the (0, 0, 0) corner of the models
+  // that BuildSparse and BuildDense make, which are trimmed to the occupied
+  // voxels.
+  Vec3f modelOrigin() const;
+
+  // Builds the model of the points so far, with the importer's palette.
+  // BuildSparse throws VoxException if the voxels span more than 256 on an
+  // axis (the most a sparse model can address), BuildDense if their extent
+  // holds more than kMaxPointCloudDenseVoxels.
+  VoxSparseModel BuildSparse() const;
+  VoxDenseModel BuildDense() const;
+
+  void clear();
+
+ private:
+  // Sum of the points with one key.
+  struct Cell {
+    uint64_t key;
+    uint64_t r, g, b;
+    uint32_t count;
+  };
+
+  void AddBlock(const float* xyz, const uint8_t* rgb, size_t count);
+  // Final voxels as (cell, palette index), and the lowest cell.
+  void Voxels(std::vector<std::pair<Vec3i, uint8_t>>& voxels, Vec3i& low,
+              Vec3i& high) const;
+
+  const Palette palette_;
+  const PointCloudOptions options_;
+  std::vector<uint8_t> nearest_;  // Palette index by 6-bit r, g, b
+  std::vector<Cell> cells_, merged_;
+  size_t points_ = 0, dropped_ = 0;
+
+  // Block scratch.
+  struct Sample {
+    uint64_t key;
+    uint32_t color;
+  };
+  std::vector<Sample> samples_, sorted_;
+  std::vector<Cell> block_cells_;
+  std::vector<float> xyz_;
+  std::vector<uint8_t> rgb_;
+};
+
+}  // namespace magicavoxel
+#endif
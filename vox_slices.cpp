@@ -0,0 +1,357 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_slices.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+// Layers per task when building a heightmap model, at least.
+constexpr size_t kMinLayers = 4;
+
+// Closes a FILE* when leaving scope.
+struct FileCloser {
+  void operator()(FILE* file) const {
+    if (file) fclose(file);
+  }
+};
+using File = unique_ptr<FILE, FileCloser>;
+
+// Header of a binary PNM image (P5 or P6).
+struct PnmHeader {
+  int channels;
+  uint32_t width, height, max_value;
+};
+
+// Reads the next header number, skipping whitespace and comments.
+bool ReadPnmNumber(FILE* file, uint32_t& value) {
+  int c = fgetc(file);
+  for (;;) {
+    if (c == '#') {
+      while (c != EOF && c != '\n') c = fgetc(file);
+    } else if (c != EOF && isspace(c)) {
+      c = fgetc(file);
+    } else {
+      break;
+    }
+  }
+  if (c == EOF || !isdigit(c)) return false;
+  uint64_t number = 0;
+  for (; c != EOF && isdigit(c); c = fgetc(file)) {
+    number = number * 10 + (c - '0');
+    if (number > 0xffffffffu) return false;
+  }
+  // A single whitespace character ends the number (and, after the maximum
+  // value, the header).
+  if (c != EOF && !isspace(c)) return false;
+  value = static_cast<uint32_t>(number);
+  return true;
+}
+
+bool ReadPnmHeader(FILE* file, PnmHeader& header) {
+  char magic[2];
+  if (fread(magic, 1, 2, file) != 2 || magic[0] != 'P') return false;
+  if (magic[1] == '5') {
+    header.channels = 1;
+  } else if (magic[1] == '6') {
+    header.channels = 3;
+  } else {
+    return false;
+  }
+  return ReadPnmNumber(file, header.width) && ReadPnmNumber(file, header.height) &&
+         ReadPnmNumber(file, header.max_value) && header.max_value > 0 &&
+         header.max_value < 65536;
+}
+
+// Throws unless a model of size x * y * z fits kMaxSliceModelVoxels; checked
+// before allocating, as VoxDenseModel computes its volume in 32 bits.
+void CheckModelSize(uint64_t x, uint64_t y, uint64_t z) {
+  if (x * y > kMaxSliceModelVoxels || x * y * z > kMaxSliceModelVoxels)
+    throw VoxException("Model would exceed kMaxSliceModelVoxels");
+}
+
+// Throws unless the rest of file holds at least `bytes`, so a forged image
+// header cannot make the reader allocate more than the file could fill.
+void CheckRemaining(FILE* file, uint64_t bytes, const string& path) {
+  const long position = ftell(file);
+  if (position < 0 || fseek(file, 0, SEEK_END) != 0) return;
+  const long end = ftell(file);
+  fseek(file, position, SEEK_SET);
+  if (end >= position && static_cast<uint64_t>(end - position) < bytes)
+    throw VoxException("'" + path + "' is truncated");
+}
+
+// Writes one z layer of model, rows flipped so y grows upwards.
+void WriteSlice(const VoxDenseModel& model, uint32_t z, const string& path,
+                SliceFormat format, vector<uint8_t>& pixels) {
+  const Size& size = model.size();
+  const int channels = format == SliceFormat::kPpm ? 3 : 1;
+  const size_t row = static_cast<size_t>(size.x) * channels;
+  pixels.resize(row * size.y);
+  const uint8_t* layer = model.data().data() + static_cast<size_t>(size.x) * size.y * z;
+  for (uint32_t y = 0; y < size.y; ++y) {
+    const uint8_t* src = layer + static_cast<size_t>(size.x) * y;
+    uint8_t* dst = pixels.data() + row * (format == SliceFormat::kRaw ? y : size.y - 1 - y);
+    if (channels == 1) {
+      memcpy(dst, src, size.x);
+      continue;
+    }
+    for (uint32_t x = 0; x < size.x; ++x) {
+      const Color& color = model.palette()[src[x]];
+      const bool empty = !src[x];
+      dst[3 * x] = empty ? 0 : color.r;
+      dst[3 * x + 1] = empty ? 0 : color.g;
+      dst[3 * x + 2] = empty ? 0 : color.b;
+    }
+  }
+
+  File file(fopen(path.c_str(), "wb"));
+  if (!file) throw VoxException("Could not create '" + path + "'");
+  if (format != SliceFormat::kRaw &&
+      fprintf(file.get(), "P%c\n%u %u\n255\n", channels == 1 ? '5' : '6', size.x,
+              size.y) < 0)
+    throw VoxException("Could not write '" + path + "'");
+  if (fwrite(pixels.data(), 1, pixels.size(), file.get()) != pixels.size() ||
+      fclose(file.release()) != 0)
+    throw VoxException("Could not write '" + path + "'");
+}
+
+// Palette index of a color: exact matches from a table, others by nearest
+// distance (black is empty).
+class ColorMatcher {
+ public:
+  explicit ColorMatcher(const Palette& palette) : palette_(palette) {
+    for (int index = 255; index >= 1; --index) {
+      const Color& color = palette[index];
+      exact_[color.r | color.g << 8 | color.b << 16] = static_cast<uint8_t>(index);
+    }
+  }
+
+  uint8_t Match(uint8_t r, uint8_t g, uint8_t b) const {
+    if (!(r | g | b)) return 0;
+    const auto found = exact_.find(r | g << 8 | b << 16);
+    if (found != exact_.end()) return found->second;
+    int best = 1, best_distance = 1 << 30;
+    for (int index = 1; index < 256; ++index) {
+      const Color& color = palette_[index];
+      const int dr = color.r - r, dg = color.g - g, db = color.b - b;
+      const int distance = dr * dr + dg * dg + db * db;
+      if (distance < best_distance) {
+        best_distance = distance;
+        best = index;
+      }
+    }
+    return static_cast<uint8_t>(best);
+  }
+
+ private:
+  const Palette& palette_;
+  unordered_map<uint32_t, uint8_t> exact_;
+};
+
+// Reads slice z into its layer of voxels (sized width x height).
+void ReadSlice(const string& path, const SliceOptions& options, uint32_t width,
+               uint32_t height, const ColorMatcher& colors, uint8_t* layer,
+               vector<uint8_t>& pixels) {
+  File file(fopen(path.c_str(), "rb"));
+  if (!file) throw VoxException("Could not open '" + path + "'");
+  PnmHeader header{1, width, height, 255};
+  if (options.format != SliceFormat::kRaw) {
+    if (!ReadPnmHeader(file.get(), header) ||
+        header.channels != (options.format == SliceFormat::kPpm ? 3 : 1))
+      throw VoxException("'" + path + "' is not a binary PGM/PPM image");
+    if (header.width != width || header.height != height)
+      throw VoxException("'" + path + "' differs in size from the first slice");
+  }
+  const int bytes = header.max_value > 255 ? 2 : 1;
+  const size_t row = static_cast<size_t>(width) * header.channels * bytes;
+  CheckRemaining(file.get(), uint64_t{row} * height, path);
+  pixels.resize(row * height);
+  if (fread(pixels.data(), 1, pixels.size(), file.get()) != pixels.size())
+    throw VoxException("'" + path + "' is truncated");
+
+  for (uint32_t y = 0; y < height; ++y) {
+    const uint8_t* src =
+        pixels.data() + row * (options.format == SliceFormat::kRaw ? y : height - 1 - y);
+    uint8_t* dst = layer + static_cast<size_t>(width) * y;
+    if (header.channels == 3) {
+      // 16-bit channels keep their high (first) byte.
+      for (uint32_t x = 0; x < width; ++x) {
+        const uint8_t* pixel = src + 3 * bytes * x;
+        dst[x] = colors.Match(pixel[0], pixel[bytes], pixel[2 * bytes]);
+      }
+    } else if (bytes == 1) {
+      for (uint32_t x = 0; x < width; ++x)
+        dst[x] = src[x] >= options.threshold ? src[x] : 0;
+    } else {
+      for (uint32_t x = 0; x < width; ++x) {
+        const uint32_t value = src[2 * x] << 8 | src[2 * x + 1];
+        dst[x] = value >= options.threshold
+                     ? static_cast<uint8_t>(max<uint32_t>(value * 255 / header.max_value, 1))
+                     : 0;
+      }
+    }
+  }
+}
+
+// Runs fn(z, thread) for every slice in parallel; ParallelForTiles rethrows
+// the first VoxException on the calling thread.
+template <typename Fn>
+void ForEachSlice(uint32_t count, unsigned threads, Fn fn) {
+  ParallelForTiles(count, threads, [&](size_t z, unsigned thread) {
+    fn(static_cast<uint32_t>(z), thread);
+  });
+}
+
+}  // namespace
+
+string magicavoxel::SlicePath(const string& prefix, uint32_t z, SliceFormat format) {
+  static const char* const kExtensions[] = {".raw", ".pgm", ".ppm"};
+  char number[16];
+  snprintf(number, sizeof(number), "%04u", z);
+  return prefix + number + kExtensions[static_cast<int>(format)];
+}
+
+void magicavoxel::ExportSlices(const VoxDenseModel& model, const string& prefix,
+                               const SliceOptions& options) {
+  vector<vector<uint8_t>> pixels(ThreadCount(options.threads));
+  ForEachSlice(model.size().z, options.threads, [&](uint32_t z, unsigned thread) {
+    WriteSlice(model, z, SlicePath(prefix, z, options.format), options.format,
+               pixels[thread]);
+  });
+}
+
+VoxDenseModel magicavoxel::ImportSlices(const string& prefix, uint32_t count,
+                                        const Palette& palette,
+                                        const SliceOptions& options) {
+  // The first slice gives the size of all.
+  uint32_t width = options.width, height = options.height;
+  if (options.format != SliceFormat::kRaw && count) {
+    const string path = SlicePath(prefix, 0, options.format);
+    File file(fopen(path.c_str(), "rb"));
+    if (!file) throw VoxException("Could not open '" + path + "'");
+    PnmHeader header;
+    if (!ReadPnmHeader(file.get(), header))
+      throw VoxException("'" + path + "' is not a binary PGM/PPM image");
+    width = header.width;
+    height = header.height;
+    CheckRemaining(file.get(),
+                   uint64_t{width} * height * header.channels *
+                       (header.max_value > 255 ? 2 : 1),
+                   path);
+  }
+
+  CheckModelSize(width, height, count);
+  VoxDenseModel model(Size{width, height, count}, palette);
+  const ColorMatcher colors(palette);
+  vector<vector<uint8_t>> pixels(ThreadCount(options.threads));
+  uint8_t* voxels = model.data().data();
+  ForEachSlice(count, options.threads, [&](uint32_t z, unsigned thread) {
+    ReadSlice(SlicePath(prefix, z, options.format), options, width, height, colors,
+              voxels + static_cast<size_t>(width) * height * z, pixels[thread]);
+  });
+  return model;
+}
+
+VoxDenseModel magicavoxel::HeightmapToModel(const uint16_t* heights, uint32_t width,
+                                            uint32_t depth,
+                                            const HeightmapOptions& options,
+                                            const Palette& palette) {
+  // Column heights in voxels, and the lowest and highest of each row.
+  const size_t columns = static_cast<size_t>(width) * depth;
+  vector<uint32_t> tops(columns);
+  vector<uint32_t> row_low(depth, ~0u), row_high(depth, 0);
+  uint32_t top = 0;
+  for (uint32_t y = 0; y < depth; ++y) {
+    for (uint32_t x = 0; x < width; ++x) {
+      const size_t column = x + static_cast<size_t>(width) * y;
+      const uint32_t height =
+          static_cast<uint32_t>(lround(heights[column] * options.height_scale));
+      tops[column] = height;
+      row_low[y] = min(row_low[y], height);
+      row_high[y] = max(row_high[y], height);
+    }
+    top = max(top, row_high[y]);
+  }
+  CheckModelSize(width, depth, top);
+
+  VoxDenseModel model(Size{width, depth, top}, palette);
+  uint8_t* voxels = model.data().data();
+  const uint8_t color = options.color;
+  ParallelFor(top, kMinLayers, options.threads, [&](size_t z0, size_t z1) {
+    for (size_t z = z0; z < z1; ++z) {
+      uint8_t* layer = voxels + columns * z;
+      for (uint32_t y = 0; y < depth; ++y) {
+        uint8_t* row = layer + static_cast<size_t>(width) * y;
+        if (z < row_low[y]) {
+          memset(row, color, width);
+        } else if (z < row_high[y]) {
+          const uint32_t* row_tops = tops.data() + static_cast<size_t>(width) * y;
+          for (uint32_t x = 0; x < width; ++x)
+            row[x] = row_tops[x] > z ? color : 0;
+        }
+      }
+    }
+  });
+  return model;
+}
+
+void magicavoxel::ReadHeightmapPgm(const string& path, vector<uint16_t>& heights,
+                                   uint32_t& width, uint32_t& depth) {
+  File file(fopen(path.c_str(), "rb"));
+  if (!file) throw VoxException("Could not open '" + path + "'");
+  PnmHeader header;
+  if (!ReadPnmHeader(file.get(), header) || header.channels != 1)
+    throw VoxException("'" + path + "' is not a binary PGM image");
+  CheckModelSize(header.width, header.height, 1);
+  width = header.width;
+  depth = header.height;
+  const int bytes = header.max_value > 255 ? 2 : 1;
+  const size_t row = static_cast<size_t>(width) * bytes;
+  CheckRemaining(file.get(), uint64_t{row} * depth, path);
+  vector<uint8_t> pixels(row * depth);
+  if (fread(pixels.data(), 1, pixels.size(), file.get()) != pixels.size())
+    throw VoxException("'" + path + "' is truncated");
+
+  heights.resize(static_cast<size_t>(width) * depth);
+  for (uint32_t y = 0; y < depth; ++y) {
+    const uint8_t* src = pixels.data() + row * (depth - 1 - y);
+    uint16_t* dst = heights.data() + static_cast<size_t>(width) * y;
+    for (uint32_t x = 0; x < width; ++x) {
+      dst[x] = bytes == 2 ? static_cast<uint16_t>(src[2 * x] << 8 | src[2 * x + 1])
+                          : static_cast<uint16_t>(src[x] * 257);
+    }
+  }
+}
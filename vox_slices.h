@@ -0,0 +1,105 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_SLICES_H
+#define VOX_SLICES_H
+
+#include "vox_file.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace magicavoxel {
+
+// Most voxels of a model that ImportSlices or HeightmapToModel builds (and
+// most pixels of an image they read): one byte each, so 1 GiB.
+constexpr uint64_t kMaxSliceModelVoxels = uint64_t{1} << 30;
+
+enum class SliceFormat {
+  kRaw,  // Palette indices, one byte per voxel, no header
+  kPgm,  // Binary (P5) graymap of palette indices
+  kPpm   // Binary (P6) pixmap of palette colors; empty voxels are black
+};
+
+struct SliceOptions {
+  SliceFormat format = SliceFormat::kPgm;
+  // Slice size, for reading kRaw slices (images carry their own).
+  uint32_t width = 0, height = 0;
+  // Lowest pixel value read as a voxel, for kPgm: 8-bit values are palette
+  // indices as they are, 16-bit ones (medical scans) are scaled down to
+  // 1-255.
+  uint16_t threshold = 1;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Path of slice z: prefix, the index as 4 or more digits, and the format's
+// extension (".raw", ".pgm", ".ppm"); e.g. "scan/slice_0042.pgm".
+std::string SlicePath(const std::string& prefix, uint32_t z, SliceFormat format);
+
+// Writes every z layer of model as one slice file, in parallel. Image rows
+// run from the highest y down, so they look like a top view; raw slices
+// keep the model's order. Throws VoxException if a file cannot be written.
+void ExportSlices(const VoxDenseModel& model, const std::string& prefix,
+                  const SliceOptions& options = SliceOptions());
+
+// Reads count slices written as by ExportSlices (or by any tool naming them
+// alike) into a model, in parallel. kPpm colors are matched to the nearest
+// entry of palette, with black as empty. Throws VoxException if a slice is
+// missing, malformed, or of another size than the first, or if the model
+// would hold more than kMaxSliceModelVoxels.
+VoxDenseModel ImportSlices(const std::string& prefix, uint32_t count,
+                           const Palette& palette = kDefaultPalette,
+                           const SliceOptions& options = SliceOptions());
+
+struct HeightmapOptions {
+  // Voxels per heightmap unit; the default maps 0-65535 onto 0-256 voxels.
+  float height_scale = 1.0f / 256.0f;
+  // Palette index of the filled voxels.
+  uint8_t color = 1;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Fills a column from z = 0 up to each height of a width x depth heightmap
+// (row-major, first row at y = 0), as tall as the highest column. Layers
+// are built row by row: rows entirely below the layer are memset at once,
+// rows entirely above it stay empty, and only the rest compare heights.
+// Throws VoxException if the model would hold more than
+// kMaxSliceModelVoxels.
+VoxDenseModel HeightmapToModel(const uint16_t* heights, uint32_t width,
+                               uint32_t depth,
+                               const HeightmapOptions& options = HeightmapOptions(),
+                               const Palette& palette = kDefaultPalette);
+
+// Reads a 16-bit (or 8-bit, scaled up) binary PGM heightmap. The first image
+// row becomes the last heightmap row, matching ExportSlices. Throws
+// VoxException if the file cannot be read, is not a binary PGM, or has more
+// than kMaxSliceModelVoxels pixels.
+void ReadHeightmapPgm(const std::string& path, std::vector<uint16_t>& heights,
+                      uint32_t& width, uint32_t& depth);
+
+}  // namespace magicavoxel
+#endif
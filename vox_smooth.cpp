@@ -0,0 +1,601 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_smooth.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+constexpr uint32_t kNone = 0xffffffff;
+
+// Grid planes per task when filling the field, and cell layers per slab, at
+// least.
+constexpr size_t kMinPlanes = 4;
+constexpr int kMinSlabLayers = 4;
+
+// Corner c of a cell is at (c & 1, (c >> 1) & 1, c >> 2). Edge e runs along
+// axis e / 4, from the corner whose two other coordinates are the bits of
+// e % 4 (lower axis in bit 0), to the corner one step further along the axis.
+int EdgeStart(int e) {
+  const int axis = e / 4, low = e & 1, high = (e >> 1) & 1;
+  if (axis == 0) return low << 1 | high << 2;
+  if (axis == 1) return low | high << 2;
+  return low | high << 1;
+}
+
+int EdgeBetween(int a, int b) {
+  const int axis = (a ^ b) == 1 ? 0 : (a ^ b) == 2 ? 1 : 2;
+  const int c = min(a, b);
+  if (axis == 0) return (c >> 1 & 1) | (c >> 2 & 1) << 1;
+  if (axis == 1) return 4 + ((c & 1) | (c >> 2 & 1) << 1);
+  return 8 + (c & 3);
+}
+
+// Whether two edges lie on a common face of the cell.
+bool EdgesShareFace(int a, int b) {
+  const int ca = EdgeStart(a), cb = EdgeStart(b);
+  for (int axis = 0; axis < 3; ++axis) {
+    if (axis != a / 4 && axis != b / 4 && ((ca ^ cb) >> axis & 1) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Triangles (as edge triples) of one marching cubes case.
+constexpr int kMaxCaseTriangles = 12;
+struct CubeCase {
+  int8_t triangles;
+  int8_t edges[kMaxCaseTriangles * 3];
+};
+
+// Splits loop[first..last] into triangles, as the fan of loop[first] where
+// possible. A loop that crosses an ambiguous face twice must not be split
+// along that face: the cell next to it may have a triangle edge there too,
+// which would give an edge of four triangles. So triangle sides between
+// edges that share a face are only allowed where they are sides of the loop
+// itself, which keeps the mesh manifold as well as closed. Returns false if
+// there is no such split, leaving result as it was.
+bool TriangulateLoop(const int* loop, int first, int last, CubeCase& result) {
+  if (last - first < 2) return true;
+  const int8_t start = result.triangles;
+  for (int apex = first + 1; apex < last; ++apex) {
+    if ((apex > first + 1 && EdgesShareFace(loop[first], loop[apex])) ||
+        (apex < last - 1 && EdgesShareFace(loop[apex], loop[last])))
+      continue;
+    int8_t* triangle = result.edges + 3 * result.triangles++;
+    triangle[0] = static_cast<int8_t>(loop[first]);
+    triangle[1] = static_cast<int8_t>(loop[apex]);
+    triangle[2] = static_cast<int8_t>(loop[last]);
+    if (TriangulateLoop(loop, first, apex, result) &&
+        TriangulateLoop(loop, apex, last, result))
+      return true;
+    result.triangles = start;
+  }
+  return false;
+}
+
+// Builds the marching cubes table instead of spelling out 256 cases. On each
+// face of the cube, every run of inside corners (walking the face
+// counter-clockwise from outside) is cut off by one segment from the edge
+// where the walk enters the run to the edge where it leaves; chaining the
+// segments of all six faces gives closed loops, which TriangulateLoop splits
+// into triangles. As a face's segments only depend on that face's corners,
+// the two cells sharing it always agree, so surfaces are closed even in the
+// ambiguous cases (which always separate inside corners).
+array<CubeCase, 256> BuildCubeCases() {
+  array<CubeCase, 256> cases;
+  static const int kSquare[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+  for (int mask = 0; mask < 256; ++mask) {
+    auto inside = [mask](int corner) { return (mask >> corner) & 1; };
+    int next[12];
+    fill(begin(next), end(next), -1);
+    for (int face = 0; face < 6; ++face) {
+      const int axis = face / 2, side = face & 1;
+      const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+      int cycle[4];
+      for (int i = 0; i < 4; ++i) {
+        // (u, v) is right-handed around the axis; walk the negative face
+        // the other way round, so both are counter-clockwise from outside.
+        const int* square = kSquare[side ? i : (4 - i) % 4];
+        cycle[i] = side << axis | square[0] << u | square[1] << v;
+      }
+      for (int i = 0; i < 4; ++i) {
+        if (inside(cycle[i]) || !inside(cycle[(i + 1) % 4])) continue;
+        int j = (i + 1) % 4;
+        while (inside(cycle[(j + 1) % 4])) j = (j + 1) % 4;
+        next[EdgeBetween(cycle[i], cycle[(i + 1) % 4])] =
+            EdgeBetween(cycle[j], cycle[(j + 1) % 4]);
+      }
+    }
+
+    CubeCase& result = cases[mask];
+    result.triangles = 0;
+    bool visited[12] = {};
+    for (int e = 0; e < 12; ++e) {
+      if (next[e] < 0 || visited[e]) continue;
+      int loop[12], length = 0;
+      for (int f = e; !visited[f]; f = next[f]) {
+        visited[f] = true;
+        loop[length++] = f;
+      }
+      TriangulateLoop(loop, 0, length - 1, result);
+    }
+  }
+  return cases;
+}
+
+const array<CubeCase, 256>& CubeCases() {
+  static const array<CubeCase, 256> cases = BuildCubeCases();
+  return cases;
+}
+
+// One pass of a box blur of the given radius along one axis of the field:
+// lines of `length` samples, `step` apart, starting at o * outer_stride + l
+// for o < outer and l < lanes (lanes are adjacent in memory, so passes along
+// y and z sweep whole rows at once). Colors spread along with it: a sample
+// with density but no color takes the nearest color within the radius.
+void BlurPass(const float* src, float* dst, const uint8_t* src_colors,
+              uint8_t* dst_colors, size_t outer, size_t outer_stride,
+              int length, size_t step, size_t lanes, int radius,
+              unsigned threads) {
+  const float scale = 1.0f / (2 * radius + 1);
+  ParallelFor(outer, lanes == 1 ? 64 : 1, threads, [&](size_t o0, size_t o1) {
+    vector<float> sums(lanes);
+    for (size_t o = o0; o < o1; ++o) {
+      const size_t base = o * outer_stride;
+      fill(sums.begin(), sums.end(), 0.0f);
+      for (int t = 0; t <= radius && t < length; ++t) {
+        for (size_t l = 0; l < lanes; ++l) sums[l] += src[base + t * step + l];
+      }
+      for (int s = 0; s < length; ++s) {
+        const size_t row = base + s * step;
+        for (size_t l = 0; l < lanes; ++l) {
+          const float density = sums[l] * scale;
+          dst[row + l] = density;
+          uint8_t color = src_colors[row + l];
+          for (int d = 1; !color && density > 0.0f && d <= radius; ++d) {
+            if (s >= d) color = src_colors[row - d * step + l];
+            if (!color && s + d < length) color = src_colors[row + d * step + l];
+          }
+          dst_colors[row + l] = color;
+        }
+        if (s + radius + 1 < length) {
+          const float* add = src + base + (s + radius + 1) * step;
+          for (size_t l = 0; l < lanes; ++l) sums[l] += add[l];
+        }
+        if (s >= radius) {
+          const float* remove = src + base + (s - radius) * step;
+          for (size_t l = 0; l < lanes; ++l) sums[l] -= remove[l];
+        }
+      }
+    }
+  });
+}
+
+// Spreads the 4 bits of a column of corners ((y, z) = (0, 0), (1, 0),
+// (0, 1), (1, 1)) to their places in a cell's corner mask, for x = 0.
+constexpr uint8_t kColumnCorners[16] = {0x00, 0x01, 0x04, 0x05, 0x10, 0x11,
+                                        0x14, 0x15, 0x40, 0x41, 0x44, 0x45,
+                                        0x50, 0x51, 0x54, 0x55};
+
+void SetNormal(SmoothVertex& vertex, const float gradient[3]) {
+  // Density falls going out of the surface.
+  const float length = sqrt(gradient[0] * gradient[0] +
+                            gradient[1] * gradient[1] +
+                            gradient[2] * gradient[2]);
+  if (length > 0.0f) {
+    vertex.nx = -gradient[0] / length;
+    vertex.ny = -gradient[1] / length;
+    vertex.nz = -gradient[2] / length;
+  } else {
+    vertex.nx = vertex.ny = 0.0f;
+    vertex.nz = 1.0f;
+  }
+}
+
+}  // namespace
+
+struct VoxSmoothMesher::Slab {
+  // Cell layers [z0, z1) of the grid.
+  int z0 = 0, z1 = 0;
+  std::vector<SmoothVertex> vertices;
+  std::vector<uint32_t> indices;
+  // Vertex ids, by cache slot, of the layer (surface nets) or plane (marching
+  // cubes) shared with the previous and next slab. The shared vertices are
+  // created first, so they are the ids below `shared`.
+  std::vector<uint32_t> first, last;
+  uint32_t shared = 0;
+  // Per-slab caches: cell vertices of the previous and current layer
+  // (surface nets), or vertices on the x and y edges of the bottom and top
+  // planes and on the z edges between them (marching cubes).
+  std::vector<uint32_t> caches[3];
+  // Inside bits of the corner columns along one row of cells.
+  std::vector<uint8_t> columns;
+  // Output ids of the shared vertices, and where the others and the indices
+  // go, set when merging.
+  std::vector<uint32_t> shared_ids;
+  size_t vertex_base = 0, index_base = 0;
+
+  uint32_t OutputId(uint32_t id) const {
+    return id < shared ? shared_ids[id]
+                       : static_cast<uint32_t>(vertex_base + id - shared);
+  }
+};
+
+VoxSmoothMesher::VoxSmoothMesher(const SmoothOptions& options)
+    : options_(options) {}
+
+VoxSmoothMesher::~VoxSmoothMesher() = default;
+
+void VoxSmoothMesher::Mesh(const VoxDenseModel& model, SmoothMesh& mesh) {
+  mesh.clear();
+  const Size& size = model.size();
+  if (!size.x || !size.y || !size.z) return;
+  BuildField(model);
+
+  const int layers = grid_[2] - 1;
+  const size_t count = max<size_t>(
+      1, min<size_t>(ThreadCount(options_.threads) * 4, layers / kMinSlabLayers));
+  while (slabs_.size() < count) slabs_.emplace_back(new Slab);
+  for (size_t s = 0; s < count; ++s) {
+    slabs_[s]->z0 = static_cast<int>(layers * s / count);
+    slabs_[s]->z1 = static_cast<int>(layers * (s + 1) / count);
+  }
+  ParallelForTiles(count, options_.threads, [&](size_t s, unsigned) {
+    if (options_.method == SmoothMethod::kSurfaceNets)
+      SurfaceNetsSlab(*slabs_[s]);
+    else
+      MarchingCubesSlab(*slabs_[s]);
+  });
+  Merge(count, mesh);
+}
+
+void VoxSmoothMesher::BuildField(const VoxDenseModel& model) {
+  const Size& size = model.size();
+  const int radius = max(options_.blur_radius, 0);
+  // Blurring spreads density `radius` samples out; one more empty sample
+  // all around closes the surface.
+  pad_ = radius + 1;
+  grid_[0] = static_cast<int>(size.x) + 2 * pad_;
+  grid_[1] = static_cast<int>(size.y) + 2 * pad_;
+  grid_[2] = static_cast<int>(size.z) + 2 * pad_;
+  const size_t row = grid_[0], plane = row * grid_[1];
+  const size_t samples = plane * grid_[2];
+  field_.resize(samples);
+  colors_.resize(samples);
+
+  const uint8_t* voxels = model.data().data();
+  ParallelFor(grid_[2], kMinPlanes, options_.threads, [&](size_t k0, size_t k1) {
+    for (size_t k = k0; k < k1; ++k) {
+      float* densities = field_.data() + k * plane;
+      uint8_t* colors = colors_.data() + k * plane;
+      fill(densities, densities + plane, 0.0f);
+      fill(colors, colors + plane, 0);
+      const long z = static_cast<long>(k) - pad_;
+      if (z < 0 || z >= static_cast<long>(size.z)) continue;
+      for (uint32_t y = 0; y < size.y; ++y) {
+        const uint8_t* src = voxels + (z * size.y + y) * size.x;
+        const size_t dst = (y + pad_) * row + pad_;
+        for (uint32_t x = 0; x < size.x; ++x) {
+          densities[dst + x] = src[x] ? 1.0f : 0.0f;
+          colors[dst + x] = src[x];
+        }
+      }
+    }
+  });
+  if (!radius) return;
+
+  blurred_.resize(samples);
+  spread_.resize(samples);
+  BlurPass(field_.data(), blurred_.data(), colors_.data(), spread_.data(),
+           static_cast<size_t>(grid_[1]) * grid_[2], row, grid_[0], 1, 1,
+           radius, options_.threads);
+  BlurPass(blurred_.data(), field_.data(), spread_.data(), colors_.data(),
+           grid_[2], plane, grid_[1], row, row, radius, options_.threads);
+  BlurPass(field_.data(), blurred_.data(), colors_.data(), spread_.data(),
+           grid_[1], row, grid_[2], plane, row, radius, options_.threads);
+  field_.swap(blurred_);
+  colors_.swap(spread_);
+}
+
+void VoxSmoothMesher::Gradient(int i, int j, int k, float gradient[3]) const {
+  gradient[0] = Density(min(i + 1, grid_[0] - 1), j, k) - Density(max(i - 1, 0), j, k);
+  gradient[1] = Density(i, min(j + 1, grid_[1] - 1), k) - Density(i, max(j - 1, 0), k);
+  gradient[2] = Density(i, j, min(k + 1, grid_[2] - 1)) - Density(i, j, max(k - 1, 0));
+}
+
+uint32_t VoxSmoothMesher::EdgeVertex(Slab& slab, int i, int j, int k, int axis,
+                                     float v0, float v1) const {
+  const float t = (options_.iso_level - v0) / (v1 - v0);
+  int far[3] = {i, j, k};
+  ++far[axis];
+  float g0[3], g1[3], gradient[3];
+  Gradient(i, j, k, g0);
+  Gradient(far[0], far[1], far[2], g1);
+  for (int a = 0; a < 3; ++a) gradient[a] = g0[a] + t * (g1[a] - g0[a]);
+
+  SmoothVertex vertex;
+  vertex.x = i - pad_ + 0.5f;
+  vertex.y = j - pad_ + 0.5f;
+  vertex.z = k - pad_ + 0.5f;
+  (&vertex.x)[axis] += t;
+  SetNormal(vertex, gradient);
+  const size_t sample =
+      v0 > options_.iso_level
+          ? i + grid_[0] * (j + static_cast<size_t>(grid_[1]) * k)
+          : far[0] + grid_[0] * (far[1] + static_cast<size_t>(grid_[1]) * far[2]);
+  vertex.color = colors_[sample];
+  vertex.reserved[0] = vertex.reserved[1] = vertex.reserved[2] = 0;
+  slab.vertices.push_back(vertex);
+  return static_cast<uint32_t>(slab.vertices.size() - 1);
+}
+
+void VoxSmoothMesher::RowColumns(int cy, int cz, Slab& slab) const {
+  const float iso = options_.iso_level;
+  slab.columns.resize(grid_[0]);
+  for (int i = 0; i < grid_[0]; ++i) {
+    slab.columns[i] = static_cast<uint8_t>(
+        (Density(i, cy, cz) > iso) | (Density(i, cy + 1, cz) > iso) << 1 |
+        (Density(i, cy, cz + 1) > iso) << 2 |
+        (Density(i, cy + 1, cz + 1) > iso) << 3);
+  }
+}
+
+void VoxSmoothMesher::SurfaceNetsSlab(Slab& slab) const {
+  const float iso = options_.iso_level;
+  const int gx = grid_[0], gy = grid_[1];
+  const int cells_x = gx - 1;
+  const size_t layer_cells = static_cast<size_t>(cells_x) * (gy - 1);
+  slab.vertices.clear();
+  slab.indices.clear();
+  slab.first.clear();
+  slab.shared = 0;
+  vector<uint32_t>* previous = &slab.caches[0];
+  vector<uint32_t>* current = &slab.caches[1];
+  previous->assign(layer_cells, kNone);
+  current->resize(layer_cells);
+
+  // Both triangles of the quad around an edge with a sign change, facing
+  // along the edge's axis if its start is inside.
+  auto quad = [&](uint32_t a, uint32_t b, uint32_t c, uint32_t d, bool facing) {
+    const uint32_t positive[6] = {a, b, c, c, d, a};
+    const uint32_t negative[6] = {a, d, c, c, b, a};
+    const uint32_t* corners = facing ? positive : negative;
+    slab.indices.insert(slab.indices.end(), corners, corners + 6);
+  };
+
+  // The layer below the slab is meshed again, for its vertices only, so
+  // quads crossing into it can be built here; they are stitched to the
+  // previous slab's vertices when merging.
+  for (int cz = slab.z0 > 0 ? slab.z0 - 1 : slab.z0; cz < slab.z1; ++cz) {
+    vector<uint32_t>& ids = *current;
+    for (int cy = 0; cy < gy - 1; ++cy) {
+      RowColumns(cy, cz, slab);
+      for (int cx = 0; cx < cells_x; ++cx) {
+        const size_t cell = cx + static_cast<size_t>(cells_x) * cy;
+        const int mask = kColumnCorners[slab.columns[cx]] |
+                         kColumnCorners[slab.columns[cx + 1]] << 1;
+        if (mask == 0 || mask == 255) {
+          ids[cell] = kNone;
+          continue;
+        }
+        float v[8];
+        for (int c = 0; c < 8; ++c)
+          v[c] = Density(cx + (c & 1), cy + (c >> 1 & 1), cz + (c >> 2));
+
+        // The vertex sits at the mean of the edges' crossings.
+        float sum[3] = {0.0f, 0.0f, 0.0f};
+        int crossings = 0;
+        for (int e = 0; e < 12; ++e) {
+          const int a = EdgeStart(e), axis = e / 4, b = a | 1 << axis;
+          if (!((mask >> a ^ mask >> b) & 1)) continue;
+          const float t = (iso - v[a]) / (v[b] - v[a]);
+          for (int k = 0; k < 3; ++k) sum[k] += a >> k & 1;
+          sum[axis] += t;
+          ++crossings;
+        }
+        const float gradient[3] = {
+            v[1] - v[0] + v[3] - v[2] + v[5] - v[4] + v[7] - v[6],
+            v[2] - v[0] + v[3] - v[1] + v[6] - v[4] + v[7] - v[5],
+            v[4] - v[0] + v[5] - v[1] + v[6] - v[2] + v[7] - v[3]};
+
+        // Color of the densest inside corner that has one.
+        uint8_t color = 0;
+        float densest = 0.0f;
+        for (int c = 0; c < 8; ++c) {
+          const size_t sample =
+              cx + (c & 1) +
+              gx * (cy + (c >> 1 & 1) + static_cast<size_t>(gy) * (cz + (c >> 2)));
+          if (v[c] > iso && colors_[sample] && v[c] > densest) {
+            densest = v[c];
+            color = colors_[sample];
+          }
+        }
+
+        SmoothVertex vertex;
+        vertex.x = cx - pad_ + 0.5f + sum[0] / crossings;
+        vertex.y = cy - pad_ + 0.5f + sum[1] / crossings;
+        vertex.z = cz - pad_ + 0.5f + sum[2] / crossings;
+        SetNormal(vertex, gradient);
+        vertex.color = color;
+        vertex.reserved[0] = vertex.reserved[1] = vertex.reserved[2] = 0;
+        ids[cell] = static_cast<uint32_t>(slab.vertices.size());
+        slab.vertices.push_back(vertex);
+      }
+    }
+    if (cz < slab.z0) {
+      slab.first = ids;
+      slab.shared = static_cast<uint32_t>(slab.vertices.size());
+      swap(previous, current);
+      continue;
+    }
+
+    // Quads around the z edges inside this layer, and around the x and y
+    // edges on its bottom plane (between the previous layer and this one).
+    const vector<uint32_t>& below = *previous;
+    auto at = [cells_x](int x, int y) { return x + static_cast<size_t>(cells_x) * y; };
+    for (int j = 1; j < gy - 1; ++j) {
+      for (int i = 1; i < gx - 1; ++i) {
+        const bool start = Density(i, j, cz) > iso;
+        if (start == (Density(i, j, cz + 1) > iso)) continue;
+        quad(ids[at(i - 1, j - 1)], ids[at(i, j - 1)], ids[at(i, j)],
+             ids[at(i - 1, j)], start);
+      }
+    }
+    for (int j = 0; j < gy - 1 && cz > 0; ++j) {
+      for (int i = 0; i < gx - 1; ++i) {
+        const bool start = Density(i, j, cz) > iso;
+        if (j > 0 && start != (Density(i + 1, j, cz) > iso)) {
+          quad(below[at(i, j - 1)], below[at(i, j)], ids[at(i, j)],
+               ids[at(i, j - 1)], start);
+        }
+        if (i > 0 && start != (Density(i, j + 1, cz) > iso)) {
+          quad(below[at(i - 1, j)], ids[at(i - 1, j)], ids[at(i, j)],
+               below[at(i, j)], start);
+        }
+      }
+    }
+    if (cz == slab.z1 - 1) slab.last = ids;
+    swap(previous, current);
+  }
+}
+
+void VoxSmoothMesher::MarchingCubesSlab(Slab& slab) const {
+  const float iso = options_.iso_level;
+  const int gx = grid_[0], gy = grid_[1];
+  const size_t plane = static_cast<size_t>(gx) * gy;
+  const array<CubeCase, 256>& cases = CubeCases();
+  slab.vertices.clear();
+  slab.indices.clear();
+  vector<uint32_t>* bottom = &slab.caches[0];
+  vector<uint32_t>* top = &slab.caches[1];
+  vector<uint32_t>& verticals = slab.caches[2];
+
+  // Vertices on the x edges (slots [0, plane)) and y edges (slots
+  // [plane, 2 * plane)) of grid plane k.
+  auto plane_vertices = [&](int k, vector<uint32_t>& ids) {
+    ids.resize(2 * plane);
+    for (int j = 0; j < gy; ++j) {
+      for (int i = 0; i < gx; ++i) {
+        const size_t slot = i + static_cast<size_t>(gx) * j;
+        const float v = Density(i, j, k);
+        ids[slot] = ids[plane + slot] = kNone;
+        if (i + 1 < gx) {
+          const float next = Density(i + 1, j, k);
+          if ((v > iso) != (next > iso))
+            ids[slot] = EdgeVertex(slab, i, j, k, 0, v, next);
+        }
+        if (j + 1 < gy) {
+          const float next = Density(i, j + 1, k);
+          if ((v > iso) != (next > iso))
+            ids[plane + slot] = EdgeVertex(slab, i, j, k, 1, v, next);
+        }
+      }
+    }
+  };
+
+  // The bottom plane is shared with the previous slab, which made the same
+  // vertices as its top plane; they are stitched when merging.
+  plane_vertices(slab.z0, *bottom);
+  slab.first = *bottom;
+  slab.shared = slab.z0 > 0 ? static_cast<uint32_t>(slab.vertices.size()) : 0;
+
+  for (int cz = slab.z0; cz < slab.z1; ++cz) {
+    verticals.resize(plane);
+    for (int j = 0; j < gy; ++j) {
+      for (int i = 0; i < gx; ++i) {
+        const float v = Density(i, j, cz), next = Density(i, j, cz + 1);
+        verticals[i + static_cast<size_t>(gx) * j] =
+            (v > iso) != (next > iso) ? EdgeVertex(slab, i, j, cz, 2, v, next)
+                                      : kNone;
+      }
+    }
+    plane_vertices(cz + 1, *top);
+
+    const vector<uint32_t>* planes[2] = {bottom, top};
+    for (int cy = 0; cy < gy - 1; ++cy) {
+      RowColumns(cy, cz, slab);
+      for (int cx = 0; cx < gx - 1; ++cx) {
+        const int mask = kColumnCorners[slab.columns[cx]] |
+                         kColumnCorners[slab.columns[cx + 1]] << 1;
+        if (mask == 0 || mask == 255) continue;
+        const CubeCase& cube = cases[mask];
+        for (int n = 0; n < cube.triangles * 3; ++n) {
+          const int e = cube.edges[n], low = e & 1, high = e >> 1 & 1;
+          const size_t origin = cx + static_cast<size_t>(gx) * cy;
+          uint32_t id;
+          switch (e / 4) {
+            case 0: id = (*planes[high])[origin + gx * low]; break;
+            case 1: id = (*planes[high])[plane + origin + low]; break;
+            default: id = verticals[origin + low + gx * high]; break;
+          }
+          slab.indices.push_back(id);
+        }
+      }
+    }
+    swap(bottom, top);
+  }
+  slab.last = *bottom;
+}
+
+void VoxSmoothMesher::Merge(size_t count, SmoothMesh& mesh) {
+  // Output ids, slab by slab; vertices on a boundary come from the earlier
+  // slab.
+  size_t vertices = 0, indices = 0;
+  for (size_t s = 0; s < count; ++s) {
+    Slab& slab = *slabs_[s];
+    slab.vertex_base = vertices;
+    slab.index_base = indices;
+    slab.shared_ids.resize(slab.shared);
+    if (slab.shared) {
+      const Slab& previous = *slabs_[s - 1];
+      for (size_t slot = 0; slot < slab.first.size(); ++slot) {
+        if (slab.first[slot] != kNone)
+          slab.shared_ids[slab.first[slot]] = previous.OutputId(previous.last[slot]);
+      }
+    }
+    vertices += slab.vertices.size() - slab.shared;
+    indices += slab.indices.size();
+  }
+
+  mesh.vertices.resize(vertices);
+  mesh.indices.resize(indices);
+  ParallelFor(count, 1, options_.threads, [&](size_t s0, size_t s1) {
+    for (size_t s = s0; s < s1; ++s) {
+      const Slab& slab = *slabs_[s];
+      copy(slab.vertices.begin() + slab.shared, slab.vertices.end(),
+           mesh.vertices.begin() + slab.vertex_base);
+      uint32_t* out = mesh.indices.data() + slab.index_base;
+      for (uint32_t id : slab.indices) *out++ = slab.OutputId(id);
+    }
+  });
+}
@@ -0,0 +1,119 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_SMOOTH_H
+#define VOX_SMOOTH_H
+
+#include "vox_file.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace magicavoxel {
+
+enum class SmoothMethod {
+  kSurfaceNets,   // One vertex per surface cell, quads across crossing edges
+  kMarchingCubes  // One vertex per crossing edge, triangles per cell case
+};
+
+// Vertex of a smooth mesh. Positions are in voxel units, with the model's
+// (0, 0, 0) corner at the origin, as in MeshVertex; the normal is unit length
+// and points out of the surface.
+struct SmoothVertex {
+  float x, y, z;
+  float nx, ny, nz;
+  uint8_t color;  // Palette index of the voxel the vertex came from
+  uint8_t reserved[3];
+};
+
+// Indexed triangle mesh, counter-clockwise when seen from outside.
+struct SmoothMesh {
+  std::vector<SmoothVertex> vertices;
+  std::vector<uint32_t> indices;
+
+  void clear() noexcept {
+    vertices.clear();
+    indices.clear();
+  }
+};
+
+struct SmoothOptions {
+  SmoothMethod method = SmoothMethod::kSurfaceNets;
+  // Radius in voxels of the box blur applied to the occupancy before
+  // extraction; 0 keeps the raw occupancy (chamfered blocks).
+  int blur_radius = 0;
+  // Density (0 = empty, 1 = solid) at which the surface is placed.
+  float iso_level = 0.5f;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Extracts smooth triangle meshes from the occupancy of dense models.
+//
+// The occupancy is sampled at voxel centers into a padded density field,
+// so the surface always closes around the model, and optionally blurred
+// with a separable box filter. Palette colors are spread along with the blur
+// so every vertex gets the color of a voxel next to it. Extraction runs in
+// parallel over slabs of cell layers; vertices are shared between cells
+// through per-slab caches of the current and previous layer, and between
+// slabs by stitching the layers on their common boundary, so the output is
+// a single connected indexed mesh.
+//
+// Field, caches and slab buffers are kept between calls, so meshing many
+// models through the same mesher does not allocate once it has grown. Use
+// one mesher per thread.
+class VoxSmoothMesher {
+ public:
+  explicit VoxSmoothMesher(const SmoothOptions& options = SmoothOptions());
+  ~VoxSmoothMesher();
+
+  // Meshes model, replacing the contents of mesh.
+  void Mesh(const VoxDenseModel& model, SmoothMesh& mesh);
+
+ private:
+  struct Slab;
+
+  void BuildField(const VoxDenseModel& model);
+  float Density(int i, int j, int k) const {
+    return field_[i + grid_[0] * (j + static_cast<size_t>(grid_[1]) * k)];
+  }
+  void Gradient(int i, int j, int k, float gradient[3]) const;
+  uint32_t EdgeVertex(Slab& slab, int i, int j, int k, int axis, float v0,
+                      float v1) const;
+  void RowColumns(int cy, int cz, Slab& slab) const;
+  void SurfaceNetsSlab(Slab& slab) const;
+  void MarchingCubesSlab(Slab& slab) const;
+  void Merge(size_t count, SmoothMesh& mesh);
+
+  const SmoothOptions options_;
+  int pad_ = 0;
+  int grid_[3] = {0, 0, 0};
+  std::vector<float> field_, blurred_;
+  std::vector<uint8_t> colors_, spread_;
+  std::vector<std::unique_ptr<Slab>> slabs_;
+};
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,448 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_stats.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VOX_STATS_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+constexpr size_t kMinLayers = 4;
+constexpr size_t kMinVoxels = 1 << 16;
+// SIMD batches of four voxels summed in 32-bit lanes before they are added to
+// the 64-bit totals; a batch adds at most 4 * 255 * 255 to a lane.
+constexpr size_t kFlushBatches = 16384;
+
+int PopCount64(uint64_t value) {
+#ifdef _MSC_VER
+  return static_cast<int>(__popcnt64(value));
+#else
+  return __builtin_popcountll(value);
+#endif
+}
+
+int CountTrailingZeros64(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+int HighestBit64(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return static_cast<int>(index);
+#else
+  return 63 - __builtin_clzll(value);
+#endif
+}
+
+// Raw sums over voxels at integer coordinates, from which everything else
+// follows; they add up across threads.
+struct Sums {
+  uint64_t count = 0;
+  uint64_t sum[3] = {};     // x, y, z
+  uint64_t square[3] = {};  // xx, yy, zz
+  uint64_t cross[3] = {};   // xy, yz, zx
+  uint32_t low[3] = {~0u, ~0u, ~0u};
+  uint32_t high[3] = {};
+  array<uint64_t, 256> histogram{};
+  // Distinct voxels, and pairs of them sharing a face.
+  uint64_t occupied = 0;
+  uint64_t pairs = 0;
+  // Listed voxels outside the model size, which are not marked.
+  uint64_t outside = 0;
+
+  void Add(const Sums& other) {
+    count += other.count;
+    for (int axis = 0; axis < 3; ++axis) {
+      sum[axis] += other.sum[axis];
+      square[axis] += other.square[axis];
+      cross[axis] += other.cross[axis];
+      low[axis] = min(low[axis], other.low[axis]);
+      high[axis] = max(high[axis], other.high[axis]);
+    }
+    for (int i = 0; i < 256; ++i) histogram[i] += other.histogram[i];
+    occupied += other.occupied;
+    pairs += other.pairs;
+    outside += other.outside;
+  }
+
+  // Voxel (x, y, z) of the given color, for the scalar paths.
+  void AddVoxel(uint32_t x, uint32_t y, uint32_t z, uint8_t color) {
+    ++count;
+    sum[0] += x;
+    sum[1] += y;
+    sum[2] += z;
+    square[0] += uint64_t{x} * x;
+    square[1] += uint64_t{y} * y;
+    square[2] += uint64_t{z} * z;
+    cross[0] += uint64_t{x} * y;
+    cross[1] += uint64_t{y} * z;
+    cross[2] += uint64_t{z} * x;
+    const uint32_t c[3] = {x, y, z};
+    for (int axis = 0; axis < 3; ++axis) {
+      low[axis] = min(low[axis], c[axis]);
+      high[axis] = max(high[axis], c[axis]);
+    }
+    ++histogram[color];
+  }
+};
+
+ModelStats Finish(const Sums& sums, const StatsOptions& options) {
+  ModelStats stats;
+  stats.count = sums.count;
+  stats.histogram = sums.histogram;
+  if (!sums.count) return stats;
+
+  stats.bounds = {{sums.low[0], sums.low[1], sums.low[2]},
+                  {sums.high[0] + 1, sums.high[1] + 1, sums.high[2] + 1}};
+  const double size = options.voxel_size;
+  const double n = static_cast<double>(sums.count);
+  stats.surface_area =
+      (6.0 * static_cast<double>(sums.occupied) - 2.0 * static_cast<double>(sums.pairs)) *
+      size * size;
+  stats.volume = n * size * size * size;
+
+  // Voxel centers lie half a voxel past their coordinates; the second
+  // moments about the mean do not depend on that offset.
+  double mean[3];
+  for (int axis = 0; axis < 3; ++axis) mean[axis] = static_cast<double>(sums.sum[axis]) / n;
+  stats.center_of_mass = {static_cast<float>((mean[0] + 0.5) * size),
+                          static_cast<float>((mean[1] + 0.5) * size),
+                          static_cast<float>((mean[2] + 0.5) * size)};
+  double square[3], cross[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    const int next = (axis + 1) % 3;
+    square[axis] = static_cast<double>(sums.square[axis]) -
+                   static_cast<double>(sums.sum[axis]) * mean[axis];
+    cross[axis] = static_cast<double>(sums.cross[axis]) -
+                  static_cast<double>(sums.sum[axis]) * mean[next];
+  }
+  // Each unit cube adds 1/6 about its own center on every axis.
+  const double own = n / 6.0;
+  const double scale = size * size * size * size * size;
+  stats.inertia = {(square[1] + square[2] + own) * scale, -cross[0] * scale,
+                   -cross[2] * scale, -cross[0] * scale,
+                   (square[0] + square[2] + own) * scale, -cross[1] * scale,
+                   -cross[2] * scale, -cross[1] * scale,
+                   (square[0] + square[1] + own) * scale};
+  return stats;
+}
+
+// Occupancy bits of a row of voxels, in words of 64 along x.
+void RowBits(const uint8_t* row, uint32_t width, uint64_t* bits) {
+  memset(bits, 0, (width + 63) / 64 * sizeof(uint64_t));
+  uint32_t x = 0;
+#ifdef VOX_STATS_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  for (; x + 16 <= width; x += 16) {
+    const __m128i voxels =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+    const uint64_t filled = static_cast<uint16_t>(
+        ~_mm_movemask_epi8(_mm_cmpeq_epi8(voxels, zero)));
+    bits[x / 64] |= filled << (x % 64);
+  }
+#endif
+  for (; x < width; ++x)
+    if (row[x]) bits[x / 64] |= uint64_t{1} << (x % 64);
+}
+
+// Pairs of set bits next to each other along a row.
+uint64_t RowPairs(const uint64_t* row, size_t words) {
+  uint64_t pairs = 0;
+  for (size_t w = 0; w < words; ++w) {
+    const uint64_t next = w + 1 < words ? row[w + 1] : 0;
+    pairs += PopCount64(row[w] & ((row[w] >> 1) | (next << 63)));
+  }
+  return pairs;
+}
+
+// Bits set in both rows: pairs across the rows.
+uint64_t CommonBits(const uint64_t* a, const uint64_t* b, size_t words) {
+  uint64_t common = 0;
+  for (size_t w = 0; w < words; ++w) common += PopCount64(a[w] & b[w]);
+  return common;
+}
+
+// Sums of a voxel list, setting each voxel's bit in the model's occupancy.
+// Other threads may be setting bits too, unless alone, which saves the
+// (several times slower) atomic OR. Voxels outside size are only counted in
+// sums.outside.
+void SumVoxels(const Voxel* voxels, size_t count, const Size& size,
+               atomic<uint64_t>* bits, bool alone, Sums& sums) {
+  const size_t words = (size.x + 63) / 64;
+  auto mark = [&](const Voxel& v) {
+    if (v.x >= size.x || v.y >= size.y || v.z >= size.z) {
+      ++sums.outside;
+      return;
+    }
+    atomic<uint64_t>& word =
+        bits[(v.y + static_cast<size_t>(size.y) * v.z) * words + v.x / 64];
+    const uint64_t bit = uint64_t{1} << (v.x % 64);
+    if (alone)
+      word.store(word.load(memory_order_relaxed) | bit, memory_order_relaxed);
+    else
+      word.fetch_or(bit, memory_order_relaxed);
+  };
+  size_t i = 0;
+#ifdef VOX_STATS_SSE2
+  // Four voxels (x, y, z, color bytes) per register; lanes of the 32-bit
+  // sums hold x, y, z and an unused color total.
+  const __m128i zero = _mm_setzero_si128();
+  __m128i low = _mm_set1_epi8(-1), high = zero;
+  uint32_t lanes[4];
+  while (i + 4 <= count) {
+    const size_t batch_end = min(count & ~size_t{3}, i + 4 * kFlushBatches);
+    __m128i sum = zero, square = zero, cross = zero;
+    for (; i < batch_end; i += 4) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(voxels + i));
+      low = _mm_min_epu8(low, v);
+      high = _mm_max_epu8(high, v);
+      // Widened to 16 bits: x0 y0 z0 c0 x1 y1 z1 c1, and the same turned
+      // to y z x c, so products give squares and cross terms at once.
+      const __m128i v01 = _mm_unpacklo_epi8(v, zero);
+      const __m128i v23 = _mm_unpackhi_epi8(v, zero);
+      const __m128i t01 = _mm_shufflehi_epi16(
+          _mm_shufflelo_epi16(v01, _MM_SHUFFLE(3, 0, 2, 1)), _MM_SHUFFLE(3, 0, 2, 1));
+      const __m128i t23 = _mm_shufflehi_epi16(
+          _mm_shufflelo_epi16(v23, _MM_SHUFFLE(3, 0, 2, 1)), _MM_SHUFFLE(3, 0, 2, 1));
+      const __m128i s = _mm_add_epi16(v01, v23);
+      sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_unpacklo_epi16(s, zero),
+                                             _mm_unpackhi_epi16(s, zero)));
+      // Products of bytes fit 16 bits unsigned; they are widened before
+      // being added.
+      const __m128i q01 = _mm_mullo_epi16(v01, v01);
+      const __m128i q23 = _mm_mullo_epi16(v23, v23);
+      square = _mm_add_epi32(
+          square, _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(q01, zero),
+                                              _mm_unpackhi_epi16(q01, zero)),
+                                _mm_add_epi32(_mm_unpacklo_epi16(q23, zero),
+                                              _mm_unpackhi_epi16(q23, zero))));
+      const __m128i c01 = _mm_mullo_epi16(v01, t01);
+      const __m128i c23 = _mm_mullo_epi16(v23, t23);
+      cross = _mm_add_epi32(
+          cross, _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(c01, zero),
+                                             _mm_unpackhi_epi16(c01, zero)),
+                               _mm_add_epi32(_mm_unpacklo_epi16(c23, zero),
+                                             _mm_unpackhi_epi16(c23, zero))));
+      for (int k = 0; k < 4; ++k) {
+        ++sums.histogram[voxels[i + k].color];
+        mark(voxels[i + k]);
+      }
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+    for (int axis = 0; axis < 3; ++axis) sums.sum[axis] += lanes[axis];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), square);
+    for (int axis = 0; axis < 3; ++axis) sums.square[axis] += lanes[axis];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), cross);
+    for (int axis = 0; axis < 3; ++axis) sums.cross[axis] += lanes[axis];
+  }
+  sums.count += i;
+  if (i) {
+    uint8_t bytes[16], high_bytes[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), low);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(high_bytes), high);
+    for (int k = 0; k < 16; k += 4) {
+      for (int axis = 0; axis < 3; ++axis) {
+        sums.low[axis] = min<uint32_t>(sums.low[axis], bytes[k + axis]);
+        sums.high[axis] = max<uint32_t>(sums.high[axis], high_bytes[k + axis]);
+      }
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    const Voxel& v = voxels[i];
+    sums.AddVoxel(v.x, v.y, v.z, v.color);
+    mark(v);
+  }
+}
+
+}  // namespace
+
+ModelStats magicavoxel::ComputeStats(const VoxDenseModel& model,
+                                     const StatsOptions& options) {
+  const Size& size = model.size();
+  const uint8_t* voxels = model.data().data();
+  const size_t words = (size.x + 63) / 64;
+  const size_t layer_words = words * size.y;
+  const size_t layer = static_cast<size_t>(size.x) * size.y;
+
+  Sums total;
+  mutex total_mutex;
+  ParallelFor(size.z, kMinLayers, options.threads, [&](size_t z0, size_t z1) {
+    Sums sums;
+    // Occupancy of this layer and the one below, for the pairs along z.
+    vector<uint64_t> below(layer_words), bits(layer_words);
+    if (z0 > 0) {
+      for (uint32_t y = 0; y < size.y; ++y)
+        RowBits(voxels + layer * (z0 - 1) + static_cast<size_t>(size.x) * y,
+                size.x, below.data() + words * y);
+    }
+    for (size_t z = z0; z < z1; ++z) {
+      const uint64_t zz = z;
+      for (uint32_t y = 0; y < size.y; ++y) {
+        const uint8_t* row = voxels + layer * z + static_cast<size_t>(size.x) * y;
+        uint64_t* row_bits = bits.data() + words * y;
+        RowBits(row, size.x, row_bits);
+
+        // Sums along the row; y and z are the same for all of it.
+        uint64_t n = 0, sum_x = 0, square_x = 0;
+        for (size_t w = 0; w < words; ++w) {
+          n += PopCount64(row_bits[w]);
+          for (uint64_t b = row_bits[w]; b; b &= b - 1) {
+            const uint64_t x = w * 64 + CountTrailingZeros64(b);
+            ++sums.histogram[row[x]];
+            sum_x += x;
+            square_x += x * x;
+          }
+        }
+        if (n) {
+          size_t first = 0, last = words - 1;
+          while (!row_bits[first]) ++first;
+          while (!row_bits[last]) --last;
+          sums.low[0] = min(sums.low[0],
+                            static_cast<uint32_t>(first * 64 + CountTrailingZeros64(row_bits[first])));
+          sums.high[0] = max(sums.high[0],
+                             static_cast<uint32_t>(last * 64 + HighestBit64(row_bits[last])));
+          sums.low[1] = min(sums.low[1], y);
+          sums.high[1] = max(sums.high[1], y);
+          sums.low[2] = min(sums.low[2], static_cast<uint32_t>(z));
+          sums.high[2] = max(sums.high[2], static_cast<uint32_t>(z));
+          sums.count += n;
+          sums.sum[0] += sum_x;
+          sums.sum[1] += n * y;
+          sums.sum[2] += n * zz;
+          sums.square[0] += square_x;
+          sums.square[1] += n * y * y;
+          sums.square[2] += n * zz * zz;
+          sums.cross[0] += sum_x * y;
+          sums.cross[1] += n * y * zz;
+          sums.cross[2] += sum_x * zz;
+        }
+
+        sums.pairs += RowPairs(row_bits, words);
+        if (y > 0) sums.pairs += CommonBits(row_bits, row_bits - words, words);
+        if (z > 0) sums.pairs += CommonBits(row_bits, below.data() + words * y, words);
+      }
+      swap(below, bits);
+    }
+    sums.occupied = sums.count;
+    lock_guard<mutex> lock(total_mutex);
+    total.Add(sums);
+  });
+  return Finish(total, options);
+}
+
+ModelStats magicavoxel::ComputeStats(const Size& size, const Voxel* voxels,
+                                     size_t count, const StatsOptions& options) {
+  const size_t words = (size.x + 63) / 64;
+  const size_t layer_words = words * size.y;
+  const size_t all_words = layer_words * size.z;
+  unique_ptr<atomic<uint64_t>[]> bits(new atomic<uint64_t>[all_words]());
+
+  Sums total;
+  mutex total_mutex;
+  ParallelFor(count, kMinVoxels, options.threads, [&](size_t begin, size_t end) {
+    Sums sums;
+    SumVoxels(voxels + begin, end - begin, size, bits.get(),
+              begin == 0 && end == count, sums);
+    lock_guard<mutex> lock(total_mutex);
+    total.Add(sums);
+  });
+  if (total.outside) {
+    // Rare (a hand-built list); start over without the stray voxels rather
+    // than check them in the SIMD sums.
+    vector<Voxel> inside;
+    inside.reserve(count - total.outside);
+    for (size_t i = 0; i < count; ++i) {
+      const Voxel& v = voxels[i];
+      if (v.x < size.x && v.y < size.y && v.z < size.z) inside.push_back(v);
+    }
+    return ComputeStats(size, inside.data(), inside.size(), options);
+  }
+
+  // Distinct voxels and neighbor pairs, from the occupancy a layer at a time.
+  ParallelFor(size.z, kMinLayers, options.threads, [&](size_t z0, size_t z1) {
+    vector<uint64_t> bits_layer(layer_words), above(layer_words);
+    uint64_t occupied = 0, pairs = 0;
+    auto load = [&](size_t z, vector<uint64_t>& out) {
+      for (size_t w = 0; w < layer_words; ++w)
+        out[w] = bits[layer_words * z + w].load(memory_order_relaxed);
+    };
+    load(z0, bits_layer);
+    for (size_t z = z0; z < z1; ++z) {
+      if (z + 1 < size.z) load(z + 1, above);
+      for (uint32_t y = 0; y < size.y; ++y) {
+        const uint64_t* row = bits_layer.data() + words * y;
+        for (size_t w = 0; w < words; ++w) occupied += PopCount64(row[w]);
+        pairs += RowPairs(row, words);
+        if (y + 1 < size.y) pairs += CommonBits(row, row + words, words);
+        if (z + 1 < size.z) pairs += CommonBits(row, above.data() + words * y, words);
+      }
+      swap(bits_layer, above);
+    }
+    lock_guard<mutex> lock(total_mutex);
+    total.occupied += occupied;
+    total.pairs += pairs;
+  });
+  return Finish(total, options);
+}
+
+ModelStats magicavoxel::ComputeStats(const VoxSparseModel& model,
+                                     const StatsOptions& options) {
+  return ComputeStats(model.size(), model.voxels().data(), model.voxels().size(),
+                      options);
+}
+
+void magicavoxel::CollectStats(VoxFile& file, vector<ModelStats>& stats,
+                               const StatsOptions& options) {
+  file.SetModelHandler([&stats, options](const Size& size,
+                                         const vector<Voxel>& voxels) {
+    stats.push_back(ComputeStats(size, voxels.data(), voxels.size(), options));
+  });
+}
@@ -0,0 +1,83 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_STATS_H
+#define VOX_STATS_H
+
+#include "vox_boxes.h"
+#include "vox_file.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+struct StatsOptions {
+  // Edge length of a voxel, in the units the results are wanted in.
+  float voxel_size = 1.0f;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Measures of one model, treating each voxel as a solid cube of density 1.
+struct ModelStats {
+  uint64_t count = 0;
+  // Voxels of each palette index.
+  std::array<uint64_t, 256> histogram{};
+  // Smallest box holding every voxel; all zero for an empty model.
+  VoxelBox bounds{{0, 0, 0}, {0, 0, 0}};
+  // Area of the voxel faces not covered by another voxel, and volume.
+  double surface_area = 0.0;
+  double volume = 0.0;
+  // With the model's (0, 0, 0) corner at the origin.
+  Vec3f center_of_mass{0.0f, 0.0f, 0.0f};
+  // About the center of mass, row-major: diagonal moments, then products of
+  // inertia (negated, as they enter the tensor).
+  std::array<double, 9> inertia{};
+};
+
+// All the measures in one parallel pass over the grid: rows are turned into
+// occupancy bits with SIMD compares, their neighbors counted with popcounts,
+// and moments summed per row.
+ModelStats ComputeStats(const VoxDenseModel& model,
+                        const StatsOptions& options = StatsOptions());
+
+// Same in one parallel pass over a voxel list, with coordinates summed four
+// voxels at a time in SIMD registers. Voxels listed twice count twice,
+// except for the surface area; voxels outside size are skipped. A sparse model loaded with hidden voxels
+// removed lacks its interior; see CollectStats.
+ModelStats ComputeStats(const Size& size, const Voxel* voxels, size_t count,
+                        const StatsOptions& options = StatsOptions());
+ModelStats ComputeStats(const VoxSparseModel& model,
+                        const StatsOptions& options = StatsOptions());
+
+// Makes file append the stats of every model to stats as it loads them,
+// from the XYZI data itself, so nothing is read twice. stats must outlive
+// the loads; SetModelHandler({}) stops collecting.
+void CollectStats(VoxFile& file, std::vector<ModelStats>& stats,
+                  const StatsOptions& options = StatsOptions());
+
+}  // namespace magicavoxel
+#endif
@@ -0,0 +1,202 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_sun.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VOX_SUN_SSE2
+#endif
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+constexpr uint64_t kAllLit = ~uint64_t{0};
+
+// Sets bit x of empty for every empty voxel of a row of width voxels, and
+// every padding bit past the end of the row.
+void EmptyBits(const uint8_t* row, uint32_t width, uint64_t* empty) {
+  const size_t words = (width + 63) / 64;
+  for (size_t w = 0; w < words; ++w) empty[w] = kAllLit;
+  uint32_t x = 0;
+#ifdef VOX_SUN_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  for (; x + 16 <= width; x += 16) {
+    const __m128i voxels =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+    const uint64_t bits = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(voxels, zero)));
+    // x is a multiple of 16, so the 16 bits never straddle two words.
+    empty[x >> 6] &= ~(uint64_t{0xffff} << (x & 63)) | (bits << (x & 63));
+  }
+#endif
+  for (; x < width; ++x) {
+    if (row[x]) empty[x >> 6] &= ~(uint64_t{1} << (x & 63));
+  }
+}
+
+// dst[x] = src[x + shift], reading bits outside the row as lit.
+void ShiftRow(const uint64_t* src, size_t words, int shift, uint64_t* dst) {
+  const long q = shift >= 0 ? shift / 64 : -((63 - shift) / 64);
+  const int r = static_cast<int>(shift - q * 64);
+  auto word = [&](long k) {
+    return (k < 0 || k >= static_cast<long>(words)) ? kAllLit : src[k];
+  };
+  for (size_t w = 0; w < words; ++w) {
+    const long k = static_cast<long>(w) + q;
+    dst[w] = r ? (word(k) >> r) | (word(k + 1) << (64 - r)) : word(k);
+  }
+}
+
+}  // namespace
+
+VoxSunMap::VoxSunMap(const VoxDenseModel& model, const Vec3f& sun_direction)
+    : model_(model), sun_(sun_direction), words_((model.size().x + 63) / 64) {
+  ComputeHeights();
+  ComputeShadows();
+}
+
+void VoxSunMap::SetSunDirection(const Vec3f& sun_direction) {
+  sun_ = sun_direction;
+  ComputeShadows();
+}
+
+void VoxSunMap::ComputeHeights() {
+  const Size& s = size();
+  const uint8_t* voxels = model_.data().data();
+  heights_.assign(static_cast<size_t>(s.x) * s.y, -1);
+
+  // Bottom-up, so the last occupied layer seen in a column wins.
+  for (uint32_t z = 0; z < s.z; ++z) {
+    for (uint32_t y = 0; y < s.y; ++y) {
+      const uint8_t* row = voxels + (static_cast<size_t>(s.y) * z + y) * s.x;
+      int16_t* heights = heights_.data() + static_cast<size_t>(s.x) * y;
+      uint32_t x = 0;
+#ifdef VOX_SUN_SSE2
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i layer = _mm_set1_epi16(static_cast<int16_t>(z));
+      for (; x + 16 <= s.x; x += 16) {
+        const __m128i empty = _mm_cmpeq_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)), zero);
+        for (int half = 0; half < 2; ++half) {
+          __m128i* h = reinterpret_cast<__m128i*>(heights + x + 8 * half);
+          const __m128i keep = half ? _mm_unpackhi_epi8(empty, empty)
+                                    : _mm_unpacklo_epi8(empty, empty);
+          _mm_storeu_si128(h, _mm_or_si128(_mm_and_si128(keep, _mm_loadu_si128(h)),
+                                           _mm_andnot_si128(keep, layer)));
+        }
+      }
+#endif
+      for (; x < s.x; ++x) {
+        if (row[x]) heights[x] = static_cast<int16_t>(z);
+      }
+    }
+  }
+}
+
+void VoxSunMap::ComputeShadows() {
+  const Size& s = size();
+  lit_.assign(words_ * s.y * s.z, 0);
+  shift_x_.assign(s.z, 0);
+  shift_y_.assign(s.z, 0);
+  if (!(sun_.z > 0) || !s.x) return;
+
+  const double kx = sun_.x / sun_.z;
+  const double ky = sun_.y / sun_.z;
+  for (uint32_t z = 0; z < s.z; ++z) {
+    shift_x_[z] = static_cast<int>(lround((z + 1) * kx) - lround(z * kx));
+    shift_y_[z] = static_cast<int>(lround((z + 1) * ky) - lround(z * ky));
+  }
+
+  const uint8_t* voxels = model_.data().data();
+  vector<uint64_t> above(words_);
+  // Bits past the end of a row must stay lit for ShiftRow to read.
+  const uint64_t padding = (s.x & 63) ? kAllLit << (s.x & 63) : 0;
+  for (uint32_t z = s.z; z-- > 0;) {
+    for (uint32_t y = 0; y < s.y; ++y) {
+      uint64_t* lit = lit_.data() + Row(y, z);
+      EmptyBits(voxels + (static_cast<size_t>(s.y) * z + y) * s.x, s.x, lit);
+      if (z + 1 == s.z) continue;
+      const long y_above = static_cast<long>(y) + shift_y_[z];
+      if (y_above < 0 || y_above >= static_cast<long>(s.y)) continue;
+      ShiftRow(lit_.data() + Row(static_cast<uint32_t>(y_above), z + 1),
+               words_, shift_x_[z], above.data());
+      for (size_t w = 0; w < words_; ++w) lit[w] &= above[w];
+      lit[words_ - 1] |= padding;
+    }
+  }
+}
+
+bool VoxSunMap::LitAbove(uint32_t x, uint32_t y, uint32_t z) const {
+  const Size& s = size();
+  if (z + 1 >= s.z) return true;
+  const long xa = static_cast<long>(x) + shift_x_[z];
+  const long ya = static_cast<long>(y) + shift_y_[z];
+  if (xa < 0 || ya < 0 || xa >= static_cast<long>(s.x) ||
+      ya >= static_cast<long>(s.y))
+    return true;
+  return sunlit(static_cast<uint32_t>(xa), static_cast<uint32_t>(ya), z + 1);
+}
+
+void VoxSunMap::Update(uint32_t x, uint32_t y, uint32_t z) {
+  const Size& s = size();
+  int16_t& height = heights_[x + s.x * y];
+  if (model_.voxel(x, y, z)) {
+    if (static_cast<int>(z) > height) height = static_cast<int16_t>(z);
+  } else if (static_cast<int>(z) == height) {
+    height = -1;
+    for (uint32_t below = z; below-- > 0;) {
+      if (model_.voxel(x, y, below)) {
+        height = static_cast<int16_t>(below);
+        break;
+      }
+    }
+  }
+
+  if (!(sun_.z > 0)) return;
+  // Each voxel's shadow bit depends on exactly one voxel in the layer above,
+  // so the change can only travel down the sun's path.
+  long cx = x, cy = y;
+  for (uint32_t cz = z;; --cz) {
+    const uint32_t ux = static_cast<uint32_t>(cx);
+    const uint32_t uy = static_cast<uint32_t>(cy);
+    const bool lit = !model_.voxel(ux, uy, cz) && LitAbove(ux, uy, cz);
+    uint64_t& word = lit_[Row(uy, cz) + (ux >> 6)];
+    const uint64_t bit = uint64_t{1} << (ux & 63);
+    if (((word & bit) != 0) == lit) break;
+    word ^= bit;
+    if (cz == 0) break;
+    cx -= shift_x_[cz - 1];
+    cy -= shift_y_[cz - 1];
+    if (cx < 0 || cy < 0 || cx >= static_cast<long>(s.x) ||
+        cy >= static_cast<long>(s.y))
+      break;
+  }
+}
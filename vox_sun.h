@@ -0,0 +1,96 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_SUN_H
+#define VOX_SUN_H
+
+#include "vox_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// Precomputed sun visibility for a model, so outdoor and sunlit queries are
+// a single lookup instead of a raycast.
+//
+// The height map holds the highest occupied z of every (x, y) column. The
+// shadow map holds one bit per voxel: whether an empty voxel sees the sun
+// along sun_direction (which points towards the sun; its z must be positive,
+// otherwise nothing is sunlit). It is built by sweeping the model's layers
+// from the top down: a voxel is lit if it is empty and the voxel one layer
+// up along the sun's (rounded) path is lit, with everything outside the model
+// lit. Both sweeps work on whole rows of x at a time (16 voxels per SSE2
+// vector, and 64 shadow bits per word).
+//
+// After changing a voxel through VoxDenseModel::voxel(), call Update to fix
+// both maps; it only walks the column and the sun path below the voxel. The
+// model must outlive the map.
+class VoxSunMap {
+ public:
+  VoxSunMap(const VoxDenseModel& model, const Vec3f& sun_direction);
+
+  const Size& size() const noexcept { return model_.size(); }
+  const Vec3f& sunDirection() const noexcept { return sun_; }
+
+  // Highest occupied z in column (x, y), or -1 if the column is empty.
+  int height(uint32_t x, uint32_t y) const { return heights_[x + size().x * y]; }
+
+  // Whether nothing is above (x, y, z) in its column.
+  bool outdoors(uint32_t x, uint32_t y, uint32_t z) const {
+    return static_cast<int>(z) > height(x, y);
+  }
+
+  // Whether the (empty) voxel at (x, y, z) sees the sun. Occupied voxels are
+  // never sunlit; ask about the voxel in front of a face to light the face.
+  bool sunlit(uint32_t x, uint32_t y, uint32_t z) const {
+    return (lit_[Row(y, z) + (x >> 6)] >> (x & 63)) & 1;
+  }
+
+  // Moves the sun, recomputing the shadow map.
+  void SetSunDirection(const Vec3f& sun_direction);
+
+  // Fixes both maps after the voxel at (x, y, z) was changed in the model.
+  void Update(uint32_t x, uint32_t y, uint32_t z);
+
+ private:
+  size_t Row(uint32_t y, uint32_t z) const {
+    return (y + static_cast<size_t>(size().y) * z) * words_;
+  }
+  void ComputeHeights();
+  void ComputeShadows();
+  bool LitAbove(uint32_t x, uint32_t y, uint32_t z) const;
+
+  const VoxDenseModel& model_;
+  Vec3f sun_;
+  size_t words_;                 // 64-bit words per row of shadow bits
+  std::vector<int16_t> heights_;
+  std::vector<uint64_t> lit_;
+  // How far the sun's path moves in x and y from layer z to layer z + 1.
+  std::vector<int> shift_x_, shift_y_;
+};
+
+}  // namespace magicavoxel
+#endif
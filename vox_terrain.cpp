@@ -0,0 +1,480 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_terrain.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VOX_TERRAIN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VOX_TERRAIN_SSE2
+#endif
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+// Rows of columns per task, so small terrains stay on one thread.
+constexpr size_t kMinRows = 8;
+constexpr size_t kMinLayers = 4;
+// Columns evaluated per step of the noise loop.
+constexpr uint32_t kBatch = 8;
+
+// The noise below is written once against lanes of floats (F), unsigned
+// integers (U) and comparison masks; these are plain scalars, or SSE2 or AVX2
+// registers of 4 or 8 lanes.
+inline float Floor(float a) { return floorf(a); }
+inline uint32_t ToInt(float a) {
+  return static_cast<uint32_t>(static_cast<int32_t>(a));
+}
+inline float Unit(uint32_t h) {
+  return static_cast<float>(h >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+inline bool Bit(uint32_t h, uint32_t bit) { return (h & bit) != 0; }
+inline bool Greater(float a, float b) { return a > b; }
+inline float Select(bool mask, float a, float b) { return mask ? a : b; }
+inline float Max(float a, float b) { return a > b ? a : b; }
+inline void Load(const float* p, float& a) { a = *p; }
+inline void Store(float a, float* p) { *p = a; }
+
+#ifdef VOX_TERRAIN_AVX2
+struct F8 {
+  __m256 v;
+  F8() = default;
+  F8(__m256 a) : v(a) {}
+  F8(float a) : v(_mm256_set1_ps(a)) {}
+};
+struct U8 {
+  __m256i v;
+  U8() = default;
+  U8(__m256i a) : v(a) {}
+  U8(uint32_t a) : v(_mm256_set1_epi32(static_cast<int>(a))) {}
+};
+struct M8 {
+  __m256 v;
+};
+
+inline F8 operator+(F8 a, F8 b) { return _mm256_add_ps(a.v, b.v); }
+inline F8 operator-(F8 a, F8 b) { return _mm256_sub_ps(a.v, b.v); }
+inline F8 operator*(F8 a, F8 b) { return _mm256_mul_ps(a.v, b.v); }
+inline F8 operator-(F8 a) { return _mm256_sub_ps(_mm256_setzero_ps(), a.v); }
+inline U8 operator+(U8 a, U8 b) { return _mm256_add_epi32(a.v, b.v); }
+inline U8 operator^(U8 a, U8 b) { return _mm256_xor_si256(a.v, b.v); }
+inline U8 operator*(U8 a, U8 b) { return _mm256_mullo_epi32(a.v, b.v); }
+inline U8 operator>>(U8 a, int n) { return _mm256_srli_epi32(a.v, n); }
+inline F8 Floor(F8 a) { return _mm256_floor_ps(a.v); }
+inline U8 ToInt(F8 a) { return _mm256_cvttps_epi32(a.v); }
+inline F8 Unit(U8 h) {
+  return _mm256_sub_ps(
+      _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(h.v, 8)),
+                    _mm256_set1_ps(2.0f / 16777216.0f)),
+      _mm256_set1_ps(1.0f));
+}
+inline M8 Bit(U8 h, uint32_t bit) {
+  const __m256i b = _mm256_set1_epi32(static_cast<int>(bit));
+  return {_mm256_castsi256_ps(
+      _mm256_cmpeq_epi32(_mm256_and_si256(h.v, b), b))};
+}
+inline M8 Greater(F8 a, F8 b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+inline F8 Select(M8 mask, F8 a, F8 b) {
+  return _mm256_blendv_ps(b.v, a.v, mask.v);
+}
+inline F8 Max(F8 a, F8 b) { return _mm256_max_ps(a.v, b.v); }
+inline void Load(const float* p, F8& a) { a = _mm256_loadu_ps(p); }
+inline void Store(F8 a, float* p) { _mm256_storeu_ps(p, a.v); }
+
+using Lanes = F8;
+using LaneInts = U8;
+#elif defined(VOX_TERRAIN_SSE2)
+struct F4 {
+  __m128 v;
+  F4() = default;
+  F4(__m128 a) : v(a) {}
+  F4(float a) : v(_mm_set1_ps(a)) {}
+};
+struct U4 {
+  __m128i v;
+  U4() = default;
+  U4(__m128i a) : v(a) {}
+  U4(uint32_t a) : v(_mm_set1_epi32(static_cast<int>(a))) {}
+};
+struct M4 {
+  __m128 v;
+};
+
+inline F4 operator+(F4 a, F4 b) { return _mm_add_ps(a.v, b.v); }
+inline F4 operator-(F4 a, F4 b) { return _mm_sub_ps(a.v, b.v); }
+inline F4 operator*(F4 a, F4 b) { return _mm_mul_ps(a.v, b.v); }
+inline F4 operator-(F4 a) { return _mm_sub_ps(_mm_setzero_ps(), a.v); }
+inline U4 operator+(U4 a, U4 b) { return _mm_add_epi32(a.v, b.v); }
+inline U4 operator^(U4 a, U4 b) { return _mm_xor_si128(a.v, b.v); }
+// SSE2 has no 32-bit multiply keeping the low halves: multiply the even and
+// the odd lanes to 64 bits and gather the low words.
+inline U4 operator*(U4 a, U4 b) {
+  const __m128i even = _mm_mul_epu32(a.v, b.v);
+  const __m128i odd =
+      _mm_mul_epu32(_mm_srli_epi64(a.v, 32), _mm_srli_epi64(b.v, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+inline U4 operator>>(U4 a, int n) { return _mm_srli_epi32(a.v, n); }
+// Truncates, then steps down where that rounded up (negative values).
+inline F4 Floor(F4 a) {
+  const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+  return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f)));
+}
+inline U4 ToInt(F4 a) { return _mm_cvttps_epi32(a.v); }
+inline F4 Unit(U4 h) {
+  return _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(h.v, 8)),
+                               _mm_set1_ps(2.0f / 16777216.0f)),
+                    _mm_set1_ps(1.0f));
+}
+inline M4 Bit(U4 h, uint32_t bit) {
+  const __m128i b = _mm_set1_epi32(static_cast<int>(bit));
+  return {_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(h.v, b), b))};
+}
+inline M4 Greater(F4 a, F4 b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+inline F4 Select(M4 mask, F4 a, F4 b) {
+  return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+inline F4 Max(F4 a, F4 b) { return _mm_max_ps(a.v, b.v); }
+inline void Load(const float* p, F4& a) { a = _mm_loadu_ps(p); }
+inline void Store(F4 a, float* p) { _mm_storeu_ps(p, a.v); }
+
+using Lanes = F4;
+using LaneInts = U4;
+#else
+using Lanes = float;
+using LaneInts = uint32_t;
+#endif
+
+constexpr uint32_t kLaneWidth = sizeof(Lanes) / sizeof(float);
+const float kLaneOffsets[kBatch] = {0, 1, 2, 3, 4, 5, 6, 7};
+
+// Scales bringing each noise to about -1 to 1.
+constexpr float kPerlinScale = 1.0f;
+constexpr float kSimplexScale = 70.0f;
+// Skews between the simplex grid and the square one.
+constexpr float kSkew = 0.36602540f;    // (sqrt(3) - 1) / 2
+constexpr float kUnskew = 0.21132487f;  // (3 - sqrt(3)) / 6
+
+template <class U>
+inline U Hash(U x, U y, U seed) {
+  U h = (x * U(0x8da6b343u)) ^ (y * U(0xd8163841u)) ^ seed;
+  h = (h ^ (h >> 16)) * U(0x7feb352du);
+  h = (h ^ (h >> 15)) * U(0x846ca68bu);
+  return h ^ (h >> 16);
+}
+
+template <class F>
+inline F Fade(F t) {
+  return t * t * t * (t * (t * F(6.0f) - F(15.0f)) + F(10.0f));
+}
+
+template <class F>
+inline F Lerp(F a, F b, F t) {
+  return a + (b - a) * t;
+}
+
+// Dot product of (x, y) with one of eight gradients picked by h: the
+// diagonals, or the axes stretched to the same length.
+template <class F, class U>
+inline F Gradient(U h, F x, F y) {
+  const F diagonal = Select(Bit(h, 1), -x, x) + Select(Bit(h, 2), -y, y);
+  const F along = Select(Bit(h, 2), y, x);
+  const F axis = Select(Bit(h, 1), -along, along) * F(1.41421356f);
+  return Select(Bit(h, 4), axis, diagonal);
+}
+
+template <class F, class U>
+F ValueNoise(F x, F y, U seed) {
+  const F fx = Floor(x), fy = Floor(y);
+  const U ix = ToInt(fx), iy = ToInt(fy);
+  const U ix1 = ix + U(1u), iy1 = iy + U(1u);
+  const F u = Fade(x - fx), v = Fade(y - fy);
+  const F a = Lerp(Unit(Hash(ix, iy, seed)), Unit(Hash(ix1, iy, seed)), u);
+  const F b = Lerp(Unit(Hash(ix, iy1, seed)), Unit(Hash(ix1, iy1, seed)), u);
+  return Lerp(a, b, v);
+}
+
+template <class F, class U>
+F PerlinNoise(F x, F y, U seed) {
+  const F fx = Floor(x), fy = Floor(y);
+  const U ix = ToInt(fx), iy = ToInt(fy);
+  const U ix1 = ix + U(1u), iy1 = iy + U(1u);
+  const F tx = x - fx, ty = y - fy;
+  const F tx1 = tx - F(1.0f), ty1 = ty - F(1.0f);
+  const F u = Fade(tx), v = Fade(ty);
+  const F a = Lerp(Gradient(Hash(ix, iy, seed), tx, ty),
+                   Gradient(Hash(ix1, iy, seed), tx1, ty), u);
+  const F b = Lerp(Gradient(Hash(ix, iy1, seed), tx, ty1),
+                   Gradient(Hash(ix1, iy1, seed), tx1, ty1), u);
+  return Lerp(a, b, v) * F(kPerlinScale);
+}
+
+template <class F, class U>
+inline F SimplexCorner(U h, F x, F y) {
+  F t = Max(F(0.5f) - x * x - y * y, F(0.0f));
+  t = t * t;
+  return t * t * Gradient(h, x, y);
+}
+
+template <class F, class U>
+F SimplexNoise(F x, F y, U seed) {
+  // Cell of the skewed grid, and the offset from its first corner.
+  const F s = (x + y) * F(kSkew);
+  const F fi = Floor(x + s), fj = Floor(y + s);
+  const F t = (fi + fj) * F(kUnskew);
+  const F x0 = x - (fi - t), y0 = y - (fj - t);
+  // The middle corner: along x first in the lower triangle, y in the upper.
+  const F i1 = Select(Greater(x0, y0), F(1.0f), F(0.0f));
+  const F j1 = F(1.0f) - i1;
+  const F x1 = x0 - i1 + F(kUnskew), y1 = y0 - j1 + F(kUnskew);
+  const F x2 = x0 - F(1.0f - 2.0f * kUnskew);
+  const F y2 = y0 - F(1.0f - 2.0f * kUnskew);
+  const U i = ToInt(fi), j = ToInt(fj);
+  const F n = SimplexCorner(Hash(i, j, seed), x0, y0) +
+              SimplexCorner(Hash(i + ToInt(i1), j + ToInt(j1), seed), x1, y1) +
+              SimplexCorner(Hash(i + U(1u), j + U(1u), seed), x2, y2);
+  return n * F(kSimplexScale);
+}
+
+template <NoiseType kType, class F, class U>
+inline F Noise(F x, F y, U seed) {
+  if (kType == NoiseType::kValue) return ValueNoise(x, y, seed);
+  if (kType == NoiseType::kPerlin) return PerlinNoise(x, y, seed);
+  return SimplexNoise(x, y, seed);
+}
+
+// fBm of count columns (a multiple of kBatch) of row y, from column x0.
+template <NoiseType kType>
+void NoiseRow(float x0, float y, size_t count, const NoiseOptions& noise,
+              float* out) {
+  float amplitudes = 0.0f, amplitude = 1.0f;
+  for (uint32_t octave = 0; octave < noise.octaves; ++octave) {
+    amplitudes += amplitude;
+    amplitude *= noise.gain;
+  }
+  const Lanes scale(amplitudes > 0.0f ? 1.0f / amplitudes : 0.0f);
+  Lanes offsets;
+  Load(kLaneOffsets, offsets);
+
+  for (size_t x = 0; x < count; x += kBatch) {
+    for (uint32_t lane = 0; lane < kBatch; lane += kLaneWidth) {
+      const Lanes lx = offsets + Lanes(x0 + static_cast<float>(x + lane));
+      Lanes sum(0.0f);
+      float frequency = noise.frequency;
+      amplitude = 1.0f;
+      for (uint32_t octave = 0; octave < noise.octaves; ++octave) {
+        // Each octave hashes with its own seed, so their lattices do not
+        // line up.
+        const LaneInts seed(noise.seed + octave * 0x9e3779b9u);
+        sum = sum + Noise<kType>(lx * Lanes(frequency),
+                                 Lanes(y * frequency), seed) *
+                        Lanes(amplitude);
+        frequency *= noise.lacunarity;
+        amplitude *= noise.gain;
+      }
+      Store(sum * scale, out + x + lane);
+    }
+  }
+}
+
+// Heights in voxels of the width x depth columns from (x0, y0) of the noise,
+// into rows stride floats apart; stride is a multiple of kBatch.
+void HeightGrid(int64_t x0, int64_t y0, uint32_t width, uint32_t depth,
+                uint32_t height, const TerrainOptions& options, size_t stride,
+                float* grid) {
+  const float top = static_cast<float>(height);
+  ParallelFor(depth, kMinRows, options.threads, [&](size_t y_begin, size_t y_end) {
+    for (size_t y = y_begin; y < y_end; ++y) {
+      float* row = grid + stride * y;
+      const float fx = static_cast<float>(x0);
+      const float fy = static_cast<float>(y0 + static_cast<int64_t>(y));
+      switch (options.noise.type) {
+        case NoiseType::kValue:
+          NoiseRow<NoiseType::kValue>(fx, fy, stride, options.noise, row);
+          break;
+        case NoiseType::kPerlin:
+          NoiseRow<NoiseType::kPerlin>(fx, fy, stride, options.noise, row);
+          break;
+        case NoiseType::kSimplex:
+          NoiseRow<NoiseType::kSimplex>(fx, fy, stride, options.noise, row);
+          break;
+      }
+      for (uint32_t x = 0; x < width; ++x) {
+        const float h =
+            (options.base_height + options.amplitude * row[x]) * top;
+        row[x] = min(max(h, 0.0f), top);
+      }
+    }
+  });
+}
+
+size_t GridStride(uint32_t width) {
+  return (static_cast<size_t>(width) + kBatch - 1) / kBatch * kBatch;
+}
+
+uint32_t ColumnTop(float height) {
+  return static_cast<uint32_t>(lroundf(height));
+}
+
+}  // namespace
+
+void magicavoxel::TerrainHeights(uint32_t width, uint32_t depth,
+                                 uint32_t height, const TerrainOptions& options,
+                                 vector<float>& heights) {
+  const size_t stride = GridStride(width);
+  vector<float> grid(stride * depth);
+  HeightGrid(options.offset_x, options.offset_y, width, depth, height, options,
+             stride, grid.data());
+  heights.resize(static_cast<size_t>(width) * depth);
+  for (uint32_t y = 0; y < depth; ++y)
+    memcpy(heights.data() + static_cast<size_t>(width) * y,
+           grid.data() + stride * y, width * sizeof(float));
+}
+
+void magicavoxel::GenerateTerrain(VoxDenseModel& model,
+                                  const TerrainOptions& options) {
+  const Size size = model.size();
+  if (!size.x || !size.y || !size.z) return;
+
+  // Heights with a border of one column, for the slopes at the edges.
+  const uint32_t grid_width = size.x + 2;
+  const size_t stride = GridStride(grid_width);
+  vector<float> grid(stride * (size.y + 2));
+  HeightGrid(int64_t{options.offset_x} - 1, int64_t{options.offset_y} - 1,
+             grid_width, size.y + 2, size.z, options, stride, grid.data());
+
+  // Column tops and surface colors, and the lowest and highest top of each
+  // row.
+  const size_t columns = static_cast<size_t>(size.x) * size.y;
+  vector<uint32_t> tops(columns);
+  vector<uint8_t> surface(columns);
+  vector<uint32_t> row_low(size.y), row_high(size.y);
+  const float top = static_cast<float>(size.z);
+  ParallelFor(size.y, kMinRows, options.threads, [&](size_t y_begin, size_t y_end) {
+    for (size_t y = y_begin; y < y_end; ++y) {
+      const float* above = grid.data() + stride * (y + 2);
+      const float* row = grid.data() + stride * (y + 1);
+      const float* below = grid.data() + stride * y;
+      uint32_t low = ~0u, high = 0;
+      for (uint32_t x = 0; x < size.x; ++x) {
+        const size_t column = x + size.x * y;
+        const float h = row[x + 1];
+        const float slope =
+            0.5f * hypotf(row[x + 2] - row[x], above[x + 1] - below[x + 1]);
+        uint8_t color = options.fill_color;
+        for (const TerrainMaterial& material : options.materials) {
+          if (h <= material.max_height * top && slope <= material.max_slope) {
+            color = material.color;
+            break;
+          }
+        }
+        tops[column] = ColumnTop(h);
+        surface[column] = color;
+        low = min(low, tops[column]);
+        high = max(high, tops[column]);
+      }
+      row_low[y] = low;
+      row_high[y] = high;
+    }
+  });
+
+  uint8_t* voxels = model.data().data();
+  const uint8_t fill = options.fill_color;
+  const uint32_t surface_depth = options.surface_depth;
+  ParallelFor(size.z, kMinLayers, options.threads, [&](size_t z0, size_t z1) {
+    for (size_t z = z0; z < z1; ++z) {
+      uint8_t* layer = voxels + columns * z;
+      for (uint32_t y = 0; y < size.y; ++y) {
+        uint8_t* row = layer + static_cast<size_t>(size.x) * y;
+        if (z >= row_high[y]) {
+          memset(row, 0, size.x);
+        } else if (z + surface_depth < row_low[y]) {
+          memset(row, fill, size.x);
+        } else {
+          const size_t first = static_cast<size_t>(size.x) * y;
+          for (uint32_t x = 0; x < size.x; ++x) {
+            const uint32_t column_top = tops[first + x];
+            row[x] = z >= column_top                  ? 0
+                     : z + surface_depth >= column_top ? surface[first + x]
+                                                       : fill;
+          }
+        }
+      }
+    }
+  });
+}
+
+void magicavoxel::GenerateTerrain(VoxBrickMap& bricks,
+                                  const TerrainOptions& options) {
+  const Size size = bricks.size();
+  if (!size.x || !size.y || !size.z) return;
+
+  const size_t stride = GridStride(size.x);
+  vector<float> grid(stride * size.y);
+  HeightGrid(options.offset_x, options.offset_y, size.x, size.y, size.z,
+             options, stride, grid.data());
+
+  // One brick row along x per task: every layer of a brick is built from the
+  // column tops in one go.
+  const Size& count = bricks.brickCount();
+  BrickOccupancy* data = bricks.data().data();
+  ParallelFor(static_cast<size_t>(count.y) * count.z, 1, options.threads,
+              [&](size_t begin, size_t end) {
+    for (size_t r = begin; r < end; ++r) {
+      const uint32_t by = static_cast<uint32_t>(r % count.y);
+      const uint32_t bz = static_cast<uint32_t>(r / count.y);
+      const uint32_t y_end = min(size.y, (by + 1) * kBrickSize);
+      for (uint32_t bx = 0; bx < count.x; ++bx) {
+        const uint32_t x_end = min(size.x, (bx + 1) * kBrickSize);
+        // Column tops within the brick, in brick-local bit order.
+        uint32_t brick_tops[kBrickSize * kBrickSize] = {};
+        for (uint32_t y = by * kBrickSize; y < y_end; ++y)
+          for (uint32_t x = bx * kBrickSize; x < x_end; ++x)
+            brick_tops[(x % kBrickSize) + kBrickSize * (y % kBrickSize)] =
+                ColumnTop(grid[x + stride * y]);
+
+        BrickOccupancy& brick = data[r * count.x + bx];
+        for (uint32_t lz = 0; lz < kBrickSize; ++lz) {
+          const uint32_t z = bz * kBrickSize + lz;
+          uint64_t bits = 0;
+          for (uint32_t bit = 0; bit < kBrickSize * kBrickSize; ++bit)
+            bits |= uint64_t{brick_tops[bit] > z} << bit;
+          brick.layers[lz] = bits;
+        }
+      }
+    }
+  });
+}
@@ -0,0 +1,101 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_TERRAIN_H
+#define VOX_TERRAIN_H
+
+#include "vox_brick.h"
+#include "vox_file.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+enum class NoiseType {
+  kValue,   // Random values at lattice points, smoothly interpolated
+  kPerlin,  // Gradient noise on a square lattice
+  kSimplex  // Gradient noise on a triangular lattice; fewest artifacts
+};
+
+// Fractal Brownian motion: octaves of noise summed, each at lacunarity times
+// the frequency and gain times the amplitude of the one before, and scaled
+// back to about -1 to 1.
+struct NoiseOptions {
+  NoiseType type = NoiseType::kSimplex;
+  uint32_t seed = 0;
+  // Frequency of the first octave, in cycles per voxel.
+  float frequency = 1.0f / 128.0f;
+  uint32_t octaves = 5;
+  float lacunarity = 2.0f;
+  float gain = 0.5f;
+};
+
+// Surface material of a terrain: applies to columns at most max_height high
+// (a fraction of the model height) whose slope, in voxels of rise per voxel,
+// is at most max_slope.
+struct TerrainMaterial {
+  float max_height;
+  float max_slope;
+  uint8_t color;
+};
+
+struct TerrainOptions {
+  NoiseOptions noise;
+  // Column height: base_height + amplitude * fBm, as fractions of the model
+  // height, cut off at 0 and the model top.
+  float base_height = 0.5f;
+  float amplitude = 0.4f;
+  // Position of the model's (0, 0) column in the noise, in voxels. Models
+  // whose offsets are one model size apart join up seamlessly.
+  int32_t offset_x = 0, offset_y = 0;
+  // Checked in order; the first that applies colors the top surface_depth
+  // voxels of a column.
+  std::vector<TerrainMaterial> materials;
+  uint32_t surface_depth = 1;
+  // Palette index of the voxels below the surface, and of the surface where
+  // no material applies.
+  uint8_t fill_color = 1;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Column heights, in voxels from 0 to height, of a width x depth terrain,
+// x-major. The noise is evaluated eight columns at a time with SIMD
+// instructions where available.
+void TerrainHeights(uint32_t width, uint32_t depth, uint32_t height,
+                    const TerrainOptions& options, std::vector<float>& heights);
+
+// Replaces the voxels of model with a terrain of its size, colored by the
+// materials. Layers are written in parallel.
+void GenerateTerrain(VoxDenseModel& model,
+                     const TerrainOptions& options = TerrainOptions());
+
+// Same for the occupancy of bricks, without building a dense model first;
+// materials do not apply.
+void GenerateTerrain(VoxBrickMap& bricks,
+                     const TerrainOptions& options = TerrainOptions());
+
+}  // namespace magicavoxel
+#endif
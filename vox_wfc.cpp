@@ -0,0 +1,503 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#include "vox_wfc.h"
+
+#include "vox_parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace magicavoxel;
+using namespace std;
+
+namespace {
+
+constexpr size_t kMinLayers = 4;
+// Tiles OR-ed into a support set between checks whether it already covers
+// the neighbor's domain.
+constexpr int kCoverCheck = 8;
+
+int PopCount64(uint64_t value) {
+#ifdef _MSC_VER
+  return static_cast<int>(__popcnt64(value));
+#else
+  return __builtin_popcountll(value);
+#endif
+}
+
+int CountTrailingZeros64(uint64_t value) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, value);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(value);
+#endif
+}
+
+uint32_t Axis(const Vec3i& v, int axis) { return (&v.x)[axis]; }
+
+// Small, fast generator (PCG32) so every attempt can have its own.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(Mix(seed)) {}
+
+  uint32_t Next() {
+    const uint64_t old = state_;
+    state_ = old * 6364136223846793005ull + 1442695040888963407ull;
+    const uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+    const uint32_t rotation = static_cast<uint32_t>(old >> 59);
+    return (xorshifted >> rotation) | (xorshifted << ((32 - rotation) & 31));
+  }
+
+  // Uniform in [0, 1).
+  float Uniform() { return (Next() >> 8) * (1.0f / 16777216.0f); }
+
+ private:
+  // SplitMix64 finalizer, so nearby seeds give unrelated streams.
+  static uint64_t Mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+  uint64_t state_;
+};
+
+// Voxels of a tile turned a quarter counterclockwise about z: (x, y) moves
+// to (size - 1 - y, x).
+vector<uint8_t> Turn(const vector<uint8_t>& voxels, const Size& size) {
+  vector<uint8_t> turned(voxels.size());
+  const size_t area = static_cast<size_t>(size.x) * size.y;
+  for (uint32_t z = 0; z < size.z; ++z)
+    for (uint32_t y = 0; y < size.y; ++y)
+      for (uint32_t x = 0; x < size.x; ++x)
+        turned[(size.x - 1 - y) + size.x * x + area * z] =
+            voxels[x + size.x * y + area * z];
+  return turned;
+}
+
+// Voxels of one face of a tile, in the same order for every tile, so equal
+// slices mean the faces match up.
+string FaceSlice(const uint8_t* voxels, const Size& size, int face,
+                 bool occupancy_only) {
+  const int axis = face / 2;
+  const int u_axis = axis == 0 ? 1 : 0;
+  const int v_axis = axis == 2 ? 1 : 2;
+  const uint32_t fixed = (face & 1) ? Axis(size, axis) - 1 : 0;
+  const size_t stride[3] = {1, size.x, static_cast<size_t>(size.x) * size.y};
+  string slice;
+  slice.reserve(static_cast<size_t>(Axis(size, u_axis)) * Axis(size, v_axis));
+  for (uint32_t v = 0; v < Axis(size, v_axis); ++v) {
+    for (uint32_t u = 0; u < Axis(size, u_axis); ++u) {
+      const uint8_t voxel = voxels[fixed * stride[axis] + u * stride[u_axis] +
+                                   v * stride[v_axis]];
+      slice.push_back(static_cast<char>(occupancy_only ? voxel != 0 : voxel));
+    }
+  }
+  return slice;
+}
+
+// One run of the solver, from all tiles possible everywhere to either every
+// cell decided or a contradiction.
+class Attempt {
+ public:
+  Attempt(uint32_t tiles, size_t words, const uint64_t* allowed,
+          const vector<float>& weights, const Size& grid, uint64_t seed)
+      : tiles_(tiles),
+        words_(words),
+        allowed_(allowed),
+        weights_(weights),
+        grid_(grid),
+        cells_(static_cast<size_t>(grid.x) * grid.y * grid.z),
+        random_(seed) {
+    weight_logs_.resize(tiles);
+    for (uint32_t t = 0; t < tiles; ++t)
+      weight_logs_[t] = weights[t] > 0.0f ? weights[t] * log(weights[t]) : 0.0f;
+    domains_.resize(cells_ * words);
+    counts_.resize(cells_);
+    entropies_.resize(cells_);
+    queued_.assign(cells_, 0);
+    support_.resize(words);
+  }
+
+  // Returns true once every cell is decided, false on a contradiction or
+  // when an attempt numbered below index has already succeeded.
+  bool Run(const atomic<uint32_t>& best, uint32_t index) {
+    if (!Initialize()) return false;
+    while (!heap_.empty()) {
+      if (best.load(memory_order_relaxed) < index) return false;
+      const pair<float, uint32_t> next = heap_.top();
+      heap_.pop();
+      // Skip cells decided since, and entries left over from before a
+      // cell's domain shrank.
+      if (counts_[next.second] <= 1 || next.first != entropies_[next.second])
+        continue;
+      Collapse(next.second);
+      if (!Propagate()) return false;
+    }
+    return true;
+  }
+
+  // The tile of every cell, after Run succeeded.
+  void Cells(vector<uint32_t>& cells) const {
+    cells.resize(cells_);
+    for (size_t cell = 0; cell < cells_; ++cell) {
+      const uint64_t* domain = Domain(cell);
+      size_t w = 0;
+      while (!domain[w]) ++w;
+      cells[cell] = static_cast<uint32_t>(w * 64 + CountTrailingZeros64(domain[w]));
+    }
+  }
+
+ private:
+  uint64_t* Domain(size_t cell) { return domains_.data() + cell * words_; }
+  const uint64_t* Domain(size_t cell) const {
+    return domains_.data() + cell * words_;
+  }
+  const uint64_t* Allowed(int face, uint32_t tile) const {
+    return allowed_ + (face * static_cast<size_t>(tiles_) + tile) * words_;
+  }
+
+  void Coordinates(size_t cell, uint32_t& x, uint32_t& y, uint32_t& z) const {
+    x = static_cast<uint32_t>(cell % grid_.x);
+    y = static_cast<uint32_t>(cell / grid_.x % grid_.y);
+    z = static_cast<uint32_t>(cell / grid_.x / grid_.y);
+  }
+
+  // Neighbor across face of the cell at (x, y, z), or false at the grid
+  // edge.
+  bool Neighbor(size_t cell, uint32_t x, uint32_t y, uint32_t z, int face,
+                size_t& neighbor) const {
+    const size_t layer = static_cast<size_t>(grid_.x) * grid_.y;
+    switch (face) {
+      case kFaceNegX: if (x == 0) return false; neighbor = cell - 1; break;
+      case kFacePosX: if (x + 1 == grid_.x) return false; neighbor = cell + 1; break;
+      case kFaceNegY: if (y == 0) return false; neighbor = cell - grid_.x; break;
+      case kFacePosY: if (y + 1 == grid_.y) return false; neighbor = cell + grid_.x; break;
+      case kFaceNegZ: if (z == 0) return false; neighbor = cell - layer; break;
+      default: if (z + 1 == grid_.z) return false; neighbor = cell + layer; break;
+    }
+    return true;
+  }
+
+  // Starts every cell with the tiles of nonzero weight that have some
+  // possible neighbor on each side that has a cell, and propagates.
+  bool Initialize() {
+    vector<uint64_t> full(words_, 0);
+    for (uint32_t t = 0; t < tiles_; ++t)
+      if (weights_[t] > 0.0f) full[t / 64] |= uint64_t{1} << (t % 64);
+    // Tiles with something allowed on each side.
+    vector<uint64_t> open(6 * words_, 0);
+    for (int face = 0; face < 6; ++face) {
+      for (uint32_t t = 0; t < tiles_; ++t) {
+        const uint64_t* allowed = Allowed(face, t);
+        uint64_t any = 0;
+        for (size_t w = 0; w < words_; ++w) any |= allowed[w] & full[w];
+        if (any) open[face * words_ + t / 64] |= uint64_t{1} << (t % 64);
+      }
+    }
+    for (size_t cell = 0; cell < cells_; ++cell) {
+      uint32_t x, y, z;
+      Coordinates(cell, x, y, z);
+      uint64_t* domain = Domain(cell);
+      memcpy(domain, full.data(), words_ * sizeof(uint64_t));
+      for (int face = 0; face < 6; ++face) {
+        size_t neighbor;
+        if (!Neighbor(cell, x, y, z, face, neighbor)) continue;
+        for (size_t w = 0; w < words_; ++w) domain[w] &= open[face * words_ + w];
+      }
+      int count = 0;
+      for (size_t w = 0; w < words_; ++w) count += PopCount64(domain[w]);
+      if (!count) return false;
+      counts_[cell] = static_cast<uint32_t>(count);
+      if (memcmp(domain, full.data(), words_ * sizeof(uint64_t))) Queue(cell);
+      if (count > 1) UpdateEntropy(cell);
+    }
+    return Propagate();
+  }
+
+  void Queue(size_t cell) {
+    if (queued_[cell]) return;
+    queued_[cell] = 1;
+    stack_.push_back(static_cast<uint32_t>(cell));
+  }
+
+  // Shannon entropy of the weighted tiles left, plus a little noise to
+  // break ties at random; the cell goes (back) on the heap.
+  void UpdateEntropy(size_t cell) {
+    const uint64_t* domain = Domain(cell);
+    float sum = 0.0f, sum_logs = 0.0f;
+    for (size_t w = 0; w < words_; ++w) {
+      for (uint64_t bits = domain[w]; bits; bits &= bits - 1) {
+        const size_t t = w * 64 + CountTrailingZeros64(bits);
+        sum += weights_[t];
+        sum_logs += weight_logs_[t];
+      }
+    }
+    const float entropy =
+        log(sum) - sum_logs / sum + 1e-4f * random_.Uniform();
+    entropies_[cell] = entropy;
+    heap_.emplace(entropy, static_cast<uint32_t>(cell));
+  }
+
+  // Decides a cell: one of its tiles, drawn by weight.
+  void Collapse(size_t cell) {
+    uint64_t* domain = Domain(cell);
+    float sum = 0.0f;
+    for (size_t w = 0; w < words_; ++w)
+      for (uint64_t bits = domain[w]; bits; bits &= bits - 1)
+        sum += weights_[w * 64 + CountTrailingZeros64(bits)];
+    // Rounding can leave pick just above zero at the end: the last tile
+    // seen is kept then.
+    float pick = sum * random_.Uniform();
+    size_t chosen = 0;
+    bool done = false;
+    for (size_t w = 0; w < words_ && !done; ++w) {
+      for (uint64_t bits = domain[w]; bits; bits &= bits - 1) {
+        chosen = w * 64 + CountTrailingZeros64(bits);
+        pick -= weights_[chosen];
+        if (pick < 0.0f) {
+          done = true;
+          break;
+        }
+      }
+    }
+    memset(domain, 0, words_ * sizeof(uint64_t));
+    domain[chosen / 64] = uint64_t{1} << (chosen % 64);
+    counts_[cell] = 1;
+    Queue(cell);
+  }
+
+  // Spreads the domains of queued cells to their neighbors until nothing
+  // changes. Returns false if a cell is left without tiles.
+  bool Propagate() {
+    while (!stack_.empty()) {
+      const size_t cell = stack_.back();
+      stack_.pop_back();
+      queued_[cell] = 0;
+      uint32_t x, y, z;
+      Coordinates(cell, x, y, z);
+      const uint64_t* domain = Domain(cell);
+      for (int face = 0; face < 6; ++face) {
+        size_t neighbor;
+        if (!Neighbor(cell, x, y, z, face, neighbor)) continue;
+        // Tiles some tile of this cell allows on that side, a word at a time.
+        // Stops early once they cover everything the neighbor still holds,
+        // as they soon do while domains are large.
+        uint64_t* other = Domain(neighbor);
+        fill(support_.begin(), support_.end(), 0);
+        bool covered = false;
+        int since_check = 0;
+        for (size_t w = 0; w < words_ && !covered; ++w) {
+          for (uint64_t bits = domain[w]; bits; bits &= bits - 1) {
+            const uint64_t* allowed =
+                Allowed(face, static_cast<uint32_t>(w * 64 + CountTrailingZeros64(bits)));
+            for (size_t i = 0; i < words_; ++i) support_[i] |= allowed[i];
+            if (++since_check == kCoverCheck) {
+              since_check = 0;
+              covered = true;
+              for (size_t i = 0; i < words_ && covered; ++i)
+                covered = !(other[i] & ~support_[i]);
+              if (covered) break;
+            }
+          }
+        }
+        if (covered) continue;
+        bool changed = false;
+        int count = 0;
+        for (size_t w = 0; w < words_; ++w) {
+          const uint64_t kept = other[w] & support_[w];
+          changed |= kept != other[w];
+          other[w] = kept;
+          count += PopCount64(kept);
+        }
+        if (!changed) continue;
+        if (!count) return false;
+        counts_[neighbor] = static_cast<uint32_t>(count);
+        if (count > 1) UpdateEntropy(neighbor);
+        Queue(neighbor);
+      }
+    }
+    return true;
+  }
+
+  const uint32_t tiles_;
+  const size_t words_;
+  const uint64_t* const allowed_;
+  const vector<float>& weights_;
+  vector<float> weight_logs_;
+  const Size grid_;
+  const size_t cells_;
+  Random random_;
+  vector<uint64_t> domains_;
+  vector<uint32_t> counts_;
+  vector<float> entropies_;
+  vector<uint8_t> queued_;
+  vector<uint32_t> stack_;
+  vector<uint64_t> support_;
+  priority_queue<pair<float, uint32_t>, vector<pair<float, uint32_t>>,
+                 greater<pair<float, uint32_t>>>
+      heap_;
+};
+
+}  // namespace
+
+VoxWfcGenerator::VoxWfcGenerator(const VoxFile& file,
+                                 const WfcTileOptions& options)
+    : palette_(file.palette()) {
+  const vector<VoxDenseModel>& models = file.denseModels();
+  if (models.empty()) throw VoxException("No dense models to use as WFC tiles");
+  tile_size_ = models[0].size();
+  for (const VoxDenseModel& model : models) {
+    const Size& size = model.size();
+    if (size.x != tile_size_.x || size.y != tile_size_.y || size.z != tile_size_.z)
+      throw VoxException("WFC tiles must all have the same size");
+  }
+  if (options.rotations && tile_size_.x != tile_size_.y)
+    throw VoxException("Turned WFC tiles must be square in x and y");
+  if (!tile_size_.x || !tile_size_.y || !tile_size_.z)
+    throw VoxException("WFC tiles must not be empty");
+
+  // Tiles: every model, and its distinct turns.
+  const size_t volume = models[0].data().size();
+  for (uint32_t m = 0; m < models.size(); ++m) {
+    const size_t first = tiles_.size();
+    vector<uint8_t> turned = models[m].data();
+    for (uint32_t turns = 0; turns < (options.rotations ? 4u : 1u); ++turns) {
+      if (turns) turned = Turn(turned, tile_size_);
+      bool seen = false;
+      for (size_t t = first; t < tiles_.size() && !seen; ++t)
+        seen = !memcmp(voxels_.data() + t * volume, turned.data(), volume);
+      if (seen) continue;
+      tiles_.push_back(Tile{m, turns});
+      voxels_.insert(voxels_.end(), turned.begin(), turned.end());
+    }
+    const float weight = m < options.weights.size() ? options.weights[m] : 1.0f;
+    weights_.resize(tiles_.size(), max(weight, 0.0f) / (tiles_.size() - first));
+  }
+
+  // Rules: b may sit on the positive side of a along an axis when a's
+  // positive face matches b's negative one.
+  words_ = (tiles_.size() + 63) / 64;
+  allowed_.assign(6 * tiles_.size() * words_, 0);
+  for (int axis = 0; axis < 3; ++axis) {
+    const int negative = 2 * axis, positive = 2 * axis + 1;
+    unordered_map<string, vector<uint32_t>> by_negative;
+    for (uint32_t t = 0; t < tiles_.size(); ++t)
+      by_negative[FaceSlice(voxels_.data() + t * volume, tile_size_, negative,
+                            options.occupancy_only)]
+          .push_back(t);
+    for (uint32_t a = 0; a < tiles_.size(); ++a) {
+      const auto match = by_negative.find(FaceSlice(
+          voxels_.data() + a * volume, tile_size_, positive, options.occupancy_only));
+      if (match == by_negative.end()) continue;
+      for (uint32_t b : match->second) {
+        allowed_[(positive * tiles_.size() + a) * words_ + b / 64] |=
+            uint64_t{1} << (b % 64);
+        allowed_[(negative * tiles_.size() + b) * words_ + a / 64] |=
+            uint64_t{1} << (a % 64);
+      }
+    }
+  }
+}
+
+bool VoxWfcGenerator::Generate(const Size& grid, vector<uint32_t>& cells,
+                               const WfcOptions& options) const {
+  cells.clear();
+  if (!grid.x || !grid.y || !grid.z) return true;
+
+  // Attempts numbered above the best success so far give up early; the
+  // lowest success is kept, whichever thread finished first.
+  atomic<uint32_t> best(options.attempts);
+  mutex result_mutex;
+  ParallelForTiles(options.attempts, options.threads, [&](size_t index, unsigned) {
+    const uint32_t attempt_index = static_cast<uint32_t>(index);
+    if (best.load(memory_order_relaxed) < attempt_index) return;
+    Attempt attempt(static_cast<uint32_t>(tiles_.size()), words_, allowed_.data(),
+                    weights_, grid,
+                    static_cast<uint64_t>(options.seed) << 32 ^ attempt_index);
+    if (!attempt.Run(best, attempt_index)) return;
+    lock_guard<mutex> lock(result_mutex);
+    if (attempt_index < best.load()) {
+      attempt.Cells(cells);
+      best.store(attempt_index);
+    }
+  });
+  return best.load() < options.attempts;
+}
+
+VoxDenseModel VoxWfcGenerator::Compose(const Size& grid,
+                                       const vector<uint32_t>& cells,
+                                       unsigned threads) const {
+  // In 64 bits, as VoxDenseModel computes its volume in 32.
+  const Size& t = tile_size_;
+  const uint64_t world_x = uint64_t{grid.x} * t.x;
+  const uint64_t world_y = uint64_t{grid.y} * t.y;
+  const uint64_t world_z = uint64_t{grid.z} * t.z;
+  if (world_x * world_y > kMaxWfcWorldVoxels ||
+      world_x * world_y * world_z > kMaxWfcWorldVoxels)
+    throw VoxException("WFC world would exceed kMaxWfcWorldVoxels");
+  if (cells.size() != static_cast<size_t>(grid.x) * grid.y * grid.z)
+    throw VoxException("WFC cells do not match the grid size");
+  for (uint32_t tile : cells) {
+    if (tile >= tiles_.size()) throw VoxException("WFC cell holds no tile");
+  }
+
+  const Size size{static_cast<uint32_t>(world_x),
+                  static_cast<uint32_t>(world_y),
+                  static_cast<uint32_t>(world_z)};
+  VoxDenseModel world(size, palette_);
+  uint8_t* voxels = world.data().data();
+  const size_t volume = static_cast<size_t>(t.x) * t.y * t.z;
+  ParallelFor(size.z, kMinLayers, threads, [&](size_t z0, size_t z1) {
+    for (size_t z = z0; z < z1; ++z) {
+      const size_t cz = z / t.z, lz = z % t.z;
+      for (uint32_t y = 0; y < size.y; ++y) {
+        const size_t cy = y / t.y, ly = y % t.y;
+        uint8_t* row = voxels + size.x * (y + static_cast<size_t>(size.y) * z);
+        for (uint32_t cx = 0; cx < grid.x; ++cx) {
+          const uint32_t tile = cells[cx + grid.x * (cy + grid.y * cz)];
+          memcpy(row + cx * t.x,
+                 voxels_.data() + tile * volume + t.x * (ly + t.y * lz), t.x);
+        }
+      }
+    }
+  });
+  return world;
+}
@@ -0,0 +1,126 @@
+/******************************************************************************
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Joel Becker
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef VOX_WFC_H
+#define VOX_WFC_H
+
+#include "vox_file.h"
+#include "vox_mesh.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace magicavoxel {
+
+// Most voxels of a world that VoxWfcGenerator::Compose builds: one byte
+// each, so 1 GiB.
+constexpr uint64_t kMaxWfcWorldVoxels = uint64_t{1} << 30;
+
+struct WfcTileOptions {
+  // Also use each model turned by 90, 180 and 270 degrees about z as tiles of
+  // their own; turns that look the same as an earlier one are dropped.
+  bool rotations = false;
+  // Match only which voxels of touching faces are filled, not their colors.
+  bool occupancy_only = false;
+  // Relative frequency of each model, by index; missing entries count as 1.
+  // A model's weight is shared among its turns.
+  std::vector<float> weights;
+};
+
+struct WfcOptions {
+  uint32_t seed = 0;
+  // Attempts to make before giving up; each starts over from its own seed.
+  // They run in parallel, and the lowest-numbered one that completes wins,
+  // so the result does not depend on the number of threads.
+  uint32_t attempts = 16;
+  // Threads to use; 0 = one per core.
+  unsigned threads = 0;
+};
+
+// Wave Function Collapse over a 3D grid of cells, each holding one tile: a
+// model of a VoxFile, possibly turned. Two tiles may sit next to each other
+// when the voxels of their touching faces are the same, so a tile library
+// drawn with matching edges needs no hand-written rules.
+//
+// The tiles each cell may still take are kept as a bitset, and constraints
+// spread from a cell to its neighbors by OR-ing and AND-ing whole 64-bit
+// words of the precomputed rule bitsets. The undecided cell with the least
+// (weighted) entropy is decided next.
+class VoxWfcGenerator {
+ public:
+  // Tiles from the dense models of file, which must all have the same size
+  // (and be square in x and y for rotations). Throws VoxException otherwise,
+  // or if the file holds no dense models.
+  explicit VoxWfcGenerator(const VoxFile& file,
+                           const WfcTileOptions& options = WfcTileOptions());
+
+  size_t tileCount() const noexcept { return tiles_.size(); }
+  const Size& tileSize() const noexcept { return tile_size_; }
+  // Model index of a tile, and its quarter turns (counterclockwise, seen from
+  // above).
+  uint32_t tileModel(uint32_t tile) const { return tiles_[tile].model; }
+  uint32_t tileTurns(uint32_t tile) const { return tiles_[tile].turns; }
+  // Whether tile b may sit next to tile a on a's side `face`.
+  bool Compatible(uint32_t a, Face face, uint32_t b) const {
+    return (Allowed(face, a)[b / 64] >> (b % 64)) & 1;
+  }
+
+  // Picks a tile for every cell of a grid (x-major), so that all neighbors
+  // are compatible; the grid edges are unconstrained. Returns false if every
+  // attempt ran into a cell left without tiles.
+  bool Generate(const Size& grid, std::vector<uint32_t>& cells,
+                const WfcOptions& options = WfcOptions()) const;
+
+  // World volume of the grid with the tiles of cells placed in it, using
+  // the file's palette, built on `threads` threads (0 = one per core).
+  // Throws VoxException if cells does not match the grid or the world would
+  // hold more than kMaxWfcWorldVoxels.
+  VoxDenseModel Compose(const Size& grid, const std::vector<uint32_t>& cells,
+                        unsigned threads = 0) const;
+
+ private:
+  struct Tile {
+    uint32_t model;
+    uint32_t turns;
+  };
+
+  // Tiles that may sit on side `face` of tile, words_ words.
+  const uint64_t* Allowed(int face, uint32_t tile) const {
+    return allowed_.data() + (face * tiles_.size() + tile) * words_;
+  }
+
+  Size tile_size_;
+  Palette palette_;
+  std::vector<Tile> tiles_;
+  std::vector<float> weights_;
+  // Voxels of each tile, turned, one after another.
+  std::vector<uint8_t> voxels_;
+  // 64-bit words per tile bitset.
+  size_t words_;
+  // Per face, then per tile: the bitset of tiles allowed on that side.
+  std::vector<uint64_t> allowed_;
+};
+
+}  // namespace magicavoxel
+#endif